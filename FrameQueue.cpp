@@ -0,0 +1,82 @@
+// FrameQueue.cpp, bounded blocking queue used to pass frames between threads
+// See MIT_License.txt
+
+#include <stdlib.h>
+#include <mutex>
+#include <condition_variable>
+#include "FrameQueue.h"
+#include "Utils.h"
+
+struct FrameQueue
+{
+	std::mutex lock;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+	void **items;		// Ring buffer of capacity items
+	int capacity;
+	int head;			// Index of oldest item
+	int count;			// Number of items queued
+	bool closed;
+};
+
+FrameQueue *CreateFrameQueue(int capacity)
+{
+	FrameQueue *pQueue = new FrameQueue;
+	pQueue->items = (void **)malloc(capacity * sizeof(void *));
+	if (pQueue->items == NULL)
+	{
+		fprintf(stderr, "ERROR FRAMEQUEUE::CreateFrameQueue(): Could not allocate queue!\n");
+		delete pQueue;
+		return NULL;
+	}
+	pQueue->capacity = capacity;
+	pQueue->head = 0;
+	pQueue->count = 0;
+	pQueue->closed = FALSE;
+	return pQueue;
+}
+
+void DestroyFrameQueue(FrameQueue *pQueue)
+{
+	if (pQueue == NULL)
+		return;
+	free(pQueue->items);
+	delete pQueue;
+}
+
+bool PushFrameQueue(FrameQueue *pQueue, void *item)
+{
+	std::unique_lock<std::mutex> guard(pQueue->lock);
+	while (pQueue->count == pQueue->capacity && !pQueue->closed)
+		pQueue->notFull.wait(guard);
+	if (pQueue->closed)
+		return FALSE;
+
+	pQueue->items[(pQueue->head + pQueue->count) % pQueue->capacity] = item;
+	pQueue->count++;
+	pQueue->notEmpty.notify_one();
+	return TRUE;
+}
+
+bool PopFrameQueue(FrameQueue *pQueue, void **pItem)
+{
+	std::unique_lock<std::mutex> guard(pQueue->lock);
+	while (pQueue->count == 0 && !pQueue->closed)
+		pQueue->notEmpty.wait(guard);
+	if (pQueue->count == 0)
+		return FALSE;
+
+	*pItem = pQueue->items[pQueue->head];
+	pQueue->head = (pQueue->head + 1) % pQueue->capacity;
+	pQueue->count--;
+	pQueue->notFull.notify_one();
+	return TRUE;
+}
+
+void CloseFrameQueue(FrameQueue *pQueue)
+{
+	std::lock_guard<std::mutex> guard(pQueue->lock);
+	pQueue->closed = TRUE;
+	pQueue->notEmpty.notify_all();
+	pQueue->notFull.notify_all();
+}
@@ -0,0 +1,32 @@
+// FrameQueue.h, bounded blocking queue used to pass frames between threads
+// See MIT_License.txt
+
+#ifndef IMAGERESIZE_FRAMEQUEUE_H_
+#define IMAGERESIZE_FRAMEQUEUE_H_
+
+// Opaque queue of pointers, safe for any number of producer and consumer threads
+typedef struct FrameQueue FrameQueue;
+
+/******************************************************************************
+* PUBLIC FUNCTIONS
+*****************************************************************************/
+
+// Allocates queue holding up to capacity items. Returns NULL on failure
+FrameQueue *CreateFrameQueue(int capacity);
+
+// Deallocates queue. No thread may still be using it
+void DestroyFrameQueue(FrameQueue *pQueue);
+
+// Appends item, blocking while the queue is full
+// Returns FALSE, without appending, if the queue is or becomes closed
+bool PushFrameQueue(FrameQueue *pQueue, void *item);
+
+// Removes oldest item, blocking while the queue is empty
+// Returns FALSE once the queue is closed and has been drained
+bool PopFrameQueue(FrameQueue *pQueue, void **pItem);
+
+// Marks queue closed and wakes all waiting threads
+// Items already queued can still be popped
+void CloseFrameQueue(FrameQueue *pQueue);
+
+#endif // #ifndef IMAGERESIZE_FRAMEQUEUE_H_
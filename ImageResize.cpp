@@ -3,50 +3,91 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <math.h>
-#include <float.h>
 #include <ctype.h>
+#include <thread>
+#include <chrono>
 #include "ImageResize.h"
+#include "ResizeDaemon.h"
 #include "Utils.h"
 
-#define M_PI				3.14159265358979323846
-#define EPSILON				.0000125
-#define LANCZOS2_NUMTAPS	2.0
-
 // Private functions
 static void print_usage();
-static bool GetFileInfo(ImageFileInfo *inFileInfo, ImageFileInfo *outFileInfo);
+static bool GetFileInfo(ImageFileInfo *inFileInfo, ImageFileInfo *outFileInfos, int numOutputs);
+static bool ParseScaleRatio(const char *arg, double *pScaleRatio);
 static bool ParseCmdLine(const int argc, char *argv[], CmdLineParms *parms);
-static double sinc(double x);
-static double lanczos2Filter(double in);
-static bool MakeContribTable(ContribTable *contribTable, int inDimSize, 
-	int outDimSize, EdgeMethod edgeMethod);
-static void DestroyContribTable(ContribTable *contribTable);
-static bool ResizeImage(const IMAGE *pImageIn, IMAGE *pImageOut, EdgeMethod edgeMethod);
-static void MainCleanup(IMAGE *pImageIn, IMAGE *pImageOut, IMAGE *pImageInLinear, IMAGE *pImageOutLinear);
+static bool RunResizeJob(const CmdLineParms *pJobParms, ResizeContext *pContext);
+static bool RunBatch(const CmdLineParms *parms);
+static bool ReadManifestJobs(const char *manifestFilename, BatchJob **pJobs, int *pNumJobs, bool *pSuccess);
+static bool MakeSourceJobs(const CmdLineParms *parms, BatchJob **pJobs, int *pNumJobs, bool *pSuccess);
+static bool SplitJobLine(BatchJob *pJob, const char *manifestFilename);
+static void RunBatchJobs(Batch *pBatch);
+static double GetSeconds();
+static bool ProcessFrame(FrameSlot *pSlot, StageWorker *pWorker);
+static bool CreateFramePipeline(FramePipeline *pPipeline, ColorSpaces resizeColorSpace);
+static void ReadFrames(StageWorker *pWorker);
+static void RunStage(StageWorker *pWorker);
+static bool WriteFrame(FramePipeline *pPipeline, FrameSlot *pSlot, int output);
+static void WriteFrames(StageWorker *pWorker);
+static void ReportStageUtilization(const StageWorker *workers, int numThreads, const TilePool *pTilePool,
+	double elapsed);
+static void MainCleanup(FramePipeline *pPipeline, ImageFileInfo *pInFileInfo, GammaLUTs *pLUTs,
+	ResizePlan *pPlans, TilePool *pOwnTilePool, StageWorker *workers, int numThreads);
 
 // Output usage and exit indicating failure
 static void print_usage()
 {
 	printf("ImageResize [options] <source_file> <dest_file>\n");
+	printf("ImageResize [options] -b <manifest>\n");
+	printf("ImageResize [options] -b <source_dir or wildcard> <dest_dir or name with *>\n");
+	printf("ImageResize [options] -d <socket>\n");
+	printf("ImageResize -q <socket>\n");
 	printf("\nRequired parameters (must follow options):\n");
-	printf("source_file: Source image file, in yuv I420 (.yuv) or BMP (.bmp) format.\n");
-	printf("dest_file: Destination image file, in yuv I420 (.yuv) or BMP (.bmp) format.\n");
+	printf("source_file: Source image file, in yuv I420 (.yuv), YUV4MPEG2 (.y4m), BMP (.bmp) or QOI (.qoi) format.\n");
+	printf("dest_file: Destination image file, in yuv I420 (.yuv), YUV4MPEG2 (.y4m), BMP (.bmp) or QOI (.qoi) format.\n");
+	printf("\tAll frames of a sequence are written to a single .yuv or .y4m file.\n");
+	printf("Use - as source_file or dest_file to stream raw YUV through stdin or stdout.\n");
+	printf("\tA source stream is read as YUV4MPEG2 if -w and -h are not given.\n");
 	printf("\nOptions:\n");
+	printf("-f: Full range (0-255) YUV. Default is limited range (16-235 Y, 16-240 UV)\n");
 	printf("-g <gamma>: Gamma value. Set to 1.0 to disable. Default = 2.2\n");
 	printf("-r[1|2]: H/V scaling ratio.\n");
 	printf("\t-r1: Upscale 2x < default > \n");
 	printf("\t-r2: Shrink 1/2x\n");
+	printf("-o <ratio> <file>: Another output, of scaling ratio 0, 1 or 2 as for -r, computed from the same input.\n");
+	printf("\tMay be repeated, up to %d outputs. Outputs of the same size share one resize\n", MAX_OUTPUTS);
 	printf("-h <height in lines>: MUST be specified if input is YUV file\n");
+	printf("-v: Verbose output\n");
 	printf("-w <width in pixels>: MUST be specified if input is YUV file\n");
+	printf("-m <matrix>: YUV<->RGB conversion matrix. 601 (default), 709 or 2020\n");
+	printf("-p <precision>: Linear light precision used for resizing.\n");
+	printf("\t0 = double (default), 1 = 16-bit integer\n");
+	printf("-t <resize> or -t <degamma>,<resize>,<gamma>: Worker threads of each stage.\n");
+	printf("\tFrames are loaded, degamma'ed, resized, gamma corrected and saved on separate threads.\n");
+	printf("\t1 = one per stage (default), 0 = one per CPU core. Output frames stay in order\n");
+	printf("-j <threads>: Resize frames in tiles of %d rows on a work-stealing pool of that many threads.\n", TILE_ROWS);
+	printf("\tTiles of all frames in the resize stage share the pool. 0 = one per CPU core, default: no pool\n");
+	printf("-b <manifest>: Batch of jobs, one per line of manifest: [options] <source_file> <dest_file>\n");
+	printf("\tOptions given before -b apply to every job. Lines starting with # are skipped\n");
+	printf("\tGiven a directory, e.g. in, or wildcard, e.g. \"in/*.bmp\", instead: one job per file, each file read alone.\n");
+	printf("\tOutputs keep the file names in dest_dir, or replace * of the dest name, e.g. \"out/*_half.qoi\"\n");
+	printf("-n <jobs>: Batch jobs run at once. 1 = one at a time (default), 0 = one per CPU core\n");
+	printf("\tWith -d, clients served at once\n");
+	printf("-d <socket>: Run as daemon resizing frames passed in shared memory, over a Unix domain socket (Linux only).\n");
+	printf("\tSee ResizeDaemon.h for the requests. Tables, buffers and the -j pool are kept between requests\n");
+	printf("-q <socket>: Print requests served and latency percentiles of daemon listening on socket\n");
 	printf("-y <color format>: YUV file format.\n");
 	printf("\tYUV file format: \n");
-	printf("\t\t0 = YUV420_I420(default), 1 = YUV420_YV12, 2 = YUV420_NV12, 3 = YUV420_NV21");
+	printf("\t\t0 = YUV420_I420(default), 1 = YUV420_YV12, 2 = YUV420_NV12, 3 = YUV420_NV21\n");
+	printf("\t\t4 = YUV420_I420 10-bit, 5 = YUV420_I420 12-bit, 6 = YUV420_I420 16-bit, 7 = YUV420_P010\n");
+	printf("\t\t8 = YUV422_I422, 9 = YUV444_I444, 10 = YUV422_YUY2, 11 = YUV422_UYVY\n");
+	printf("\tSamples of more than 8 bits are 16-bit little endian words. Y4M output keeps the input bit depth");
 	printf("\n\nExamples of usage:\n");
 	printf("ImageResize -g 1.8 -w 528 -h 488 -r2 a_528x488_avg.yuv a_264x244_avg.yuv\n");
 	printf("\tShrink YUV420 I420 input by half, using Pre-Mac OS X v10.6 Snow Leopard gamma value\n\n");
 	printf("ImageResize -g 1.0 -r1 birds.bmp birds_352x288.yuv\n");
 	printf("\tExpand QCIF-sized bmp by 2x without gamma compensation, output to YUV420 I420\n");
+	printf("\nffmpeg -i in.mp4 -f rawvideo -pix_fmt yuv420p - | ImageResize -w 1920 -h 1080 -r2 - out.yuv\n");
+	printf("\tShrink decoded video by half without an intermediate file\n");
 
 	exit(EXIT_FAILURE);
 }
@@ -56,7 +97,7 @@ static void print_usage()
 //		try to read BMP header to detect BMP
 // Image dimensions (BMP only)
 // Number of frames in sequence
-static bool GetFileInfo(ImageFileInfo *inFileInfo, ImageFileInfo *outFileInfo)
+static bool GetFileInfo(ImageFileInfo *inFileInfo, ImageFileInfo *outFileInfos, int numOutputs)
 {
 	// Check input image exists
 	if (!FileExists(inFileInfo->filename))
@@ -66,7 +107,12 @@ static bool GetFileInfo(ImageFileInfo *inFileInfo, ImageFileInfo *outFileInfo)
 	}
 
 	// Determine image types
-	if (!DetectFileType(inFileInfo->filename, &inFileInfo->fileType))
+	if (IsStdioFileName(inFileInfo->filename))
+	{
+		// Raw YUV stream if dimensions given, otherwise a Y4M stream carrying them in its header
+		inFileInfo->fileType = (inFileInfo->width && inFileInfo->height) ? YUV_FILE : Y4M_FILE;
+	}
+	else if (!DetectFileType(inFileInfo->filename, &inFileInfo->fileType))
 	{
 		if (DetectBmpImageSize(inFileInfo->filename, &inFileInfo->width, &inFileInfo->height))
 			// If no extension, try detecting BMP file using header info.
@@ -76,12 +122,7 @@ static bool GetFileInfo(ImageFileInfo *inFileInfo, ImageFileInfo *outFileInfo)
 			inFileInfo->fileType = YUV_FILE;
 	}
 
-	// If output filename has extension, determine file type from that
-	if (!DetectFileType(outFileInfo->filename, &outFileInfo->fileType))
-		// Otherwise default to output file same as input file to avoid color space conversion
-		outFileInfo->fileType = inFileInfo->fileType;
-
-	// If input is BMP, get dimensions from header
+	// If input is BMP or QOI, get dimensions from header
 	// If it's YUV, dimensions must have already been supplied from command line
 	if (inFileInfo->fileType == BMP_FILE)
 	{
@@ -91,10 +132,29 @@ static bool GetFileInfo(ImageFileInfo *inFileInfo, ImageFileInfo *outFileInfo)
 			return FALSE;
 		}
 	}
+	else if (inFileInfo->fileType == QOI_FILE)
+	{
+		if (!DetectQoiImageSize(inFileInfo->filename, &inFileInfo->width, &inFileInfo->height))
+		{
+			fprintf(stderr, "Cannot determine QOI dimensions!\n");
+			return FALSE;
+		}
+	}
+	else if (inFileInfo->fileType == Y4M_FILE)
+	{
+		// Dimensions and stream parameters come from the Y4M header
+		if (!DetectY4MHeader(inFileInfo->filename, &inFileInfo->y4mHeader))
+		{
+			fprintf(stderr, "Cannot read Y4M stream header!\n");
+			return FALSE;
+		}
+		inFileInfo->width = inFileInfo->y4mHeader.width;
+		inFileInfo->height = inFileInfo->y4mHeader.height;
+	}
 	else if (inFileInfo->width == 0 || inFileInfo->height == 0)
 	{
 		fprintf(stderr, "Height and width must be supplied when input file is YUV!\n");
-		print_usage();
+		return FALSE;
 	}
 
 	// Determine number of frames in sequence
@@ -103,46 +163,149 @@ static bool GetFileInfo(ImageFileInfo *inFileInfo, ImageFileInfo *outFileInfo)
 		fprintf(stderr, "Cannot determine number of frames in file %s!\n", inFileInfo->filename);
 		return FALSE;
 	}
-	if ((inFileInfo->fileType == YUV_FILE) && (outFileInfo->fileType == BMP_FILE))
+
+	// Color space and bits per sample. Y4M output keeps the chroma subsampling of YUV input and its bit depth
+	switch (inFileInfo->fileType)
 	{
-		outFileInfo->numFrames = inFileInfo->numFrames * inFileInfo->numSubFrames;
+	case YUV_FILE:
+		inFileInfo->colorSpace = GetYUVColorSpace(inFileInfo->fileSubtype);
+		inFileInfo->bitDepth = GetYUVBitDepth(inFileInfo->fileSubtype);
+		break;
+	case Y4M_FILE:
+		inFileInfo->colorSpace = inFileInfo->y4mHeader.colorSpace;
+		inFileInfo->bitDepth = inFileInfo->y4mHeader.bitDepth;
+		break;
+	default:
+		inFileInfo->colorSpace = RGB;
+		inFileInfo->bitDepth = 8;
+		break;
 	}
-	else
+
+	for (int i = 0; i < numOutputs; i++)
 	{
-		outFileInfo->numFrames = inFileInfo->numFrames;
-		outFileInfo->numSubFrames = inFileInfo->numSubFrames;
+		ImageFileInfo *outFileInfo = &outFileInfos[i];
+
+		// If output filename has extension, determine file type from that
+		if (!DetectFileType(outFileInfo->filename, &outFileInfo->fileType))
+		{
+			// Otherwise default to output file same as input file to avoid color space conversion
+			outFileInfo->fileType = inFileInfo->fileType;
+			// BMP and QOI can't be streamed
+			if (IsStdioFileName(outFileInfo->filename) &&
+				(outFileInfo->fileType == BMP_FILE || outFileInfo->fileType == QOI_FILE))
+				outFileInfo->fileType = YUV_FILE;
+		}
+
+		// One image per BMP or QOI file
+		bool inImageFiles = (inFileInfo->fileType == BMP_FILE || inFileInfo->fileType == QOI_FILE);
+		bool outImageFiles = (outFileInfo->fileType == BMP_FILE || outFileInfo->fileType == QOI_FILE);
+		if (!inImageFiles && outImageFiles)
+		{
+			outFileInfo->numFrames = inFileInfo->numFrames * inFileInfo->numSubFrames;
+		}
+		else
+		{
+			outFileInfo->numFrames = inFileInfo->numFrames;
+			outFileInfo->numSubFrames = inFileInfo->numSubFrames;
+		}
+		outFileInfo->startFrame = inFileInfo->startFrame;
+
+		switch (outFileInfo->fileType)
+		{
+		case YUV_FILE:
+			outFileInfo->colorSpace = GetYUVColorSpace(outFileInfo->fileSubtype);
+			outFileInfo->bitDepth = GetYUVBitDepth(outFileInfo->fileSubtype);
+			break;
+		case Y4M_FILE:
+			outFileInfo->colorSpace = (inFileInfo->colorSpace == RGB) ? YUV420 : inFileInfo->colorSpace;
+			outFileInfo->bitDepth = inFileInfo->bitDepth;
+			break;
+		default:
+			outFileInfo->colorSpace = RGB;
+			outFileInfo->bitDepth = 8;
+			break;
+		}
+
+		// Parse output filename
+		// Parse filename to get base name
+		const char *pChar = strrchr(outFileInfo->filename, '.');
+		if (pChar == NULL)
+			pChar = outFileInfo->filename + strlen(outFileInfo->filename);
+		// Strip out extension to find base filename
+		strncpy(outFileInfo->baseFileName, outFileInfo->filename, pChar - outFileInfo->filename);
+		outFileInfo->baseFileName[pChar - outFileInfo->filename] = '\0';	// Terminate substring
 	}
-	outFileInfo->startFrame = inFileInfo->startFrame;
 
-	// Parse output filename
-	// Parse filename to get base name
-	const char *pChar = strrchr(outFileInfo->filename, '.');
-	// Strip out extension to find base filename
-	strncpy(outFileInfo->baseFileName, outFileInfo->filename, pChar - outFileInfo->filename);
-	outFileInfo->baseFileName[pChar - outFileInfo->filename] = '\0';	// Terminate substring
+	return TRUE;
+}
 
+// Scaling ratio given by digit of -r or -o: 1 = upscale 2x, 2 = shrink 1/2x, 0 = same size
+static bool ParseScaleRatio(const char *arg, double *pScaleRatio)
+{
+	if (strcmp(arg, "1") == 0)
+		*pScaleRatio = 2.0f;
+	else if (strcmp(arg, "2") == 0)
+		*pScaleRatio = 0.5f;
+	else if (strcmp(arg, "0") == 0)
+		*pScaleRatio = 1.0f;
+	else
+		return FALSE;
 	return TRUE;
 }
 
-// Parse command line
+// Parse command line, or the options and file names of one batch job
+// Returns FALSE on errors, reported to stderr
 static bool ParseCmdLine(const int argc, char *argv[], CmdLineParms *parms)
 {
 	int arg_index = 1;
-	while ((arg_index < argc) && (argv[arg_index][0] == '-'))
+	// A lone '-' is a file name, for stdin/stdout
+	while ((arg_index < argc) && (argv[arg_index][0] == '-') && (argv[arg_index][1] != '\0'))
 	{
+		if (strchr("bdghjmnpqtwy", tolower(argv[arg_index][1])) && arg_index + 1 >= argc)
+		{
+			fprintf(stderr, "Missing value of option %s\n", argv[arg_index]);
+			return FALSE;
+		}
 		switch (tolower(argv[arg_index][1]))
 		{
+		case 'b':
+			parms->manifestFilename = argv[++arg_index];
+			break;
+		case 'd':
+			parms->daemonSocket = argv[++arg_index];
+			break;
+		case 'q':
+			parms->statsSocket = argv[++arg_index];
+			break;
+		case 'n':
+			parms->numJobs = atoi(argv[++arg_index]);
+			if (parms->numJobs == 0)
+				parms->numJobs = CLAMP((int)std::thread::hardware_concurrency(), 1, MAX_BATCH_JOBS);
+			if (parms->numJobs <= 0 || parms->numJobs > MAX_BATCH_JOBS)
+			{
+				fprintf(stderr, "Unrecognized number of batch jobs, or more than %d.\n", MAX_BATCH_JOBS);
+				return FALSE;
+			}
+			break;
+		case 'o':
+			// Additional output: scaling ratio as for -r, then file name
+			if (arg_index + 2 >= argc || parms->numOutputs == MAX_OUTPUTS)
+			{
+				fprintf(stderr, "Missing ratio or file name of -o, or more than %d outputs.\n", MAX_OUTPUTS);
+				return FALSE;
+			}
+			if (!ParseScaleRatio(argv[++arg_index], &parms->scaleRatios[parms->numOutputs]))
+			{
+				fprintf(stderr, "Unrecognized scaling ratio.\n");
+				return FALSE;
+			}
+			parms->outFilenames[parms->numOutputs++] = argv[++arg_index];
+			break;
 		case 'r':
-			if (argv[arg_index][2] == '1')
-				parms->scaleRatio = 2.0f;
-			else if (argv[arg_index][2] == '2')
-				parms->scaleRatio = 0.5f;
-			else if (argv[arg_index][2] == '0')
-				parms->scaleRatio = 1.0f;
-			else
+			if (!ParseScaleRatio(&argv[arg_index][2], &parms->scaleRatios[0]))
 			{
 				fprintf(stderr, "Unrecognized scaling ratio.\n");
-				print_usage();
+				return FALSE;
 			}
 			break;
 		case 'h':
@@ -150,15 +313,18 @@ static bool ParseCmdLine(const int argc, char *argv[], CmdLineParms *parms)
 			if (parms->height == 0)
 			{
 				fprintf(stderr, "Unrecognized height or height specified as 0.\n");
-				print_usage();
+				return FALSE;
 			}
 			break;
+		case 'v':
+			parms->verbose = TRUE;
+			break;
 		case 'w':
 			parms->width = atoi(argv[++arg_index]);
 			if (parms->width == 0)
 			{
 				fprintf(stderr, "Unrecognized width or width specified as 0.\n");
-				print_usage();
+				return FALSE;
 			}
 			break;
 		case 'g':
@@ -166,531 +332,1196 @@ static bool ParseCmdLine(const int argc, char *argv[], CmdLineParms *parms)
 			if (parms->gamma == 0.0)
 			{
 				fprintf(stderr, "Unrecognized gamma or gamma specified as 0.\n");
-				print_usage();
+				return FALSE;
+			}
+			break;
+		case 'f':
+			parms->yuvRange = FULL_RANGE;
+			break;
+		case 'm':
+			switch (atoi(argv[++arg_index]))
+			{
+			case 601:
+				parms->yuvMatrix = BT601;
+				break;
+			case 709:
+				parms->yuvMatrix = BT709;
+				break;
+			case 2020:
+				parms->yuvMatrix = BT2020;
+				break;
+			default:
+				fprintf(stderr, "Unrecognized YUV matrix.\n");
+				return FALSE;
+			}
+			break;
+		case 'p':
+			switch (atoi(argv[++arg_index]))
+			{
+			case 0:
+				parms->linearPrecision = DOUBLE;
+				break;
+			case 1:
+				parms->linearPrecision = BPP16;
+				break;
+			default:
+				fprintf(stderr, "Unrecognized linear light precision.\n");
+				return FALSE;
+			}
+			break;
+		case 't':
+		{
+			// One count sets the resize stage only, three set degamma, resize and gamma stages
+			int counts[3];
+			int numCounts = sscanf(argv[++arg_index], "%d,%d,%d", &counts[0], &counts[1], &counts[2]);
+			if (numCounts != 1 && numCounts != 3)
+			{
+				fprintf(stderr, "Unrecognized number of worker threads.\n");
+				return FALSE;
+			}
+			for (int i = 0; i < numCounts; i++)
+			{
+				PipelineStage stage = (numCounts == 1) ? RESIZE_STAGE : (PipelineStage)(DEGAMMA_STAGE + i);
+				if (counts[i] == 0)
+					counts[i] = CLAMP((int)std::thread::hardware_concurrency(), 1, MAX_STAGE_WORKERS);
+				if (counts[i] <= 0 || counts[i] > MAX_STAGE_WORKERS)
+				{
+					fprintf(stderr, "Unrecognized number of worker threads, or more than %d.\n", MAX_STAGE_WORKERS);
+					return FALSE;
+				}
+				parms->numWorkers[stage] = counts[i];
+			}
+			break;
+		}
+		case 'j':
+			parms->numTileThreads = atoi(argv[++arg_index]);
+			if (parms->numTileThreads == 0)
+				parms->numTileThreads = CLAMP((int)std::thread::hardware_concurrency(), 1, MAX_TILE_THREADS);
+			if (parms->numTileThreads <= 0 || parms->numTileThreads > MAX_TILE_THREADS)
+			{
+				fprintf(stderr, "Unrecognized number of tile threads, or more than %d.\n", MAX_TILE_THREADS);
+				return FALSE;
 			}
 			break;
 		case 'y':
 			parms->fileSubtype = (YUVType)(atoi(argv[++arg_index]) + 1);
-			if ((parms->fileSubtype < YUV420_I420) || (parms->fileSubtype < YUV420_NV21))
+			if ((parms->fileSubtype < YUV420_I420) || (parms->fileSubtype > YUV422_UYVY))
 			{
 				fprintf(stderr, "Unrecognized YUV color format.\n");
-				print_usage();
+				return FALSE;
 			}
 			break;
 		default:
 			fprintf(stderr, "Unrecognized option: %s\n", argv[arg_index]);
-			print_usage();
+			return FALSE;
 		}
 		arg_index++;
 	}
-	if (argc < (arg_index + 2))
+	// A batch takes its file names from the manifest, and a daemon from each request
+	if ((parms->manifestFilename || parms->daemonSocket || parms->statsSocket) && argc == arg_index)
+		return TRUE;
+	// A batch of the files of a directory or wildcard source names its outputs after them
+	if (parms->manifestFilename && argc == arg_index + 1)
 	{
-		fprintf(stderr, "Missing required parameters.\n");
-		print_usage();
+		parms->batchOutput = argv[arg_index];
+		return TRUE;
+	}
+	if (argc != (arg_index + 2))
+	{
+		fprintf(stderr, "Missing required parameters, or parameters after file names.\n");
+		return FALSE;
 	}
 	parms->inFilename = argv[arg_index++];
-	parms->outFilename = argv[arg_index++];
+	parms->outFilenames[0] = argv[arg_index++];
 
 	return TRUE;
 }
 
-// sinc(x) function
-static double sinc(double x) 
+static double GetSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Runs one frame through the worker's stage, in the linear light buffers the frame holds
+// The linear light images' precision selects which forward LUT is used, each output's bit depth which reverse LUT
+static bool ProcessFrame(FrameSlot *pSlot, StageWorker *pWorker)
 {
-	x *= M_PI;
+	const FramePipeline *pPipeline = pWorker->pPipeline;
+	IMAGE *pImageInLinear = &pSlot->pLinear->imageInLinear;
+	bool success = TRUE;
 
-	if ((x < EPSILON) && (x > -EPSILON)) 
+	switch (pWorker->stage)
+	{
+	case DEGAMMA_STAGE:
+		if (!((pImageInLinear->precision == BPP16) ?
+			DegammaImage(&pSlot->image, pImageInLinear, pWorker->pLUTs[0]->fwdGamma16) :
+			DegammaImage(&pSlot->image, pImageInLinear, pWorker->pLUTs[0]->fwdGamma)))
+		{
+			fprintf(stderr, "Unable to degamma input image!\n");
+			return FALSE;
+		}
+		break;
+	case RESIZE_STAGE:
 	{
-		// Handle range near divide by zero
-		return (1.0f + x*x*(-1 / 6.0f + x*x / 120.0f));
+		// Process image once per output size. With a tile pool, the tiles of all sizes are queued at once,
+		// so that pool threads take on the next size while the last tiles of another finish
+		int numStarted = 0;
+		for (int i = 0; i < pPipeline->numSizes && success; i++)
+		{
+			IMAGE *pImageOutLinear = &pSlot->pLinear->imageOutLinear[i];
+			if (pWorker->tiled[i].pJob)
+			{
+				success = StartResizeImageTiled(&pWorker->tiled[i], pImageInLinear, pImageOutLinear,
+					&pWorker->imageTmp[i]);
+				if (success)
+					numStarted++;
+			}
+			else
+			{
+				success = ResizeImage(pImageInLinear, pImageOutLinear, &pWorker->imageTmp[i], pWorker->pPlans[i],
+					pPipeline->parms->edgeMethod);
+			}
+		}
+		for (int i = 0; i < numStarted; i++)
+			WaitTileJob(pWorker->tiled[i].pJob);
+		if (!success)
+		{
+			fprintf(stderr, "Unable to resize image!\n");
+			return FALSE;
+		}
+		break;
+	}
+	case GAMMA_STAGE:
+		for (int i = 0; i < pPipeline->numOutputs; i++)
+		{
+			const GammaLUTs *pLUTs = pWorker->pLUTs[i];
+			IMAGE *pImageOutLinear = &pSlot->pLinear->imageOutLinear[pPipeline->outputSizes[i]];
+			if (!((pSlot->imageOut[i].precision == BPP16) ?
+				GammaImage(pImageOutLinear, &pSlot->imageOut[i], pLUTs->bwdGamma16) :
+				GammaImage(pImageOutLinear, &pSlot->imageOut[i], pLUTs->bwdGamma)))
+			{
+				fprintf(stderr, "Unable to gamma correct output image!\n");
+				return FALSE;
+			}
+		}
+		break;
+	default:
+		return FALSE;
 	}
 
-	return sin(x) / x;
+	return TRUE;
 }
 
-static double fabsThresh(double x, double thresh)
+int main(int argc, char *argv[])
 {
-	if (fabs(x) < thresh)
-		return 0.0;
-	return x;
-}
+	// Command line parser
+	CmdLineParms parms;
 
-// Returns filter weight at position t
-static double lanczos2Filter(double t)
-{
-	const double R = LANCZOS2_NUMTAPS;
+	// Set default parm values
+	parms.scaleRatios[0] = 2.0f;
+	parms.numOutputs = 1;
+	parms.fileSubtype = YUV420_I420;
+	parms.height = 0;
+	parms.width = 0;
+	parms.edgeMethod = REPEAT;
+	parms.gamma = 1.0f;
+	parms.linearPrecision = DOUBLE;
+	parms.yuvMatrix = BT601;
+	parms.yuvRange = LIMITED_RANGE;
+	parms.verbose = FALSE;
+	for (int i = 0; i < NUM_PIPELINE_STAGES; i++)
+		parms.numWorkers[i] = 1;
+	parms.numTileThreads = 0;
+	parms.manifestFilename = parms.batchOutput = NULL;
+	parms.singleInputFile = FALSE;
+	parms.numJobs = 1;
+	parms.daemonSocket = parms.statsSocket = NULL;
+	parms.inFilename = parms.outFilenames[0] = NULL;
 
-	if (t < 0.0f)
-		t = -t;
+	if (!ParseCmdLine(argc, argv, &parms))
+		print_usage();
 
-	// return windowed sinc based on number of lobes
-	// Lanzos2 filter defined by lobes=2
-	if (t < R)
-		return fabsThresh(sinc(t)*sinc(t / R), EPSILON);
+	bool success;
+	if (parms.manifestFilename)
+		success = RunBatch(&parms);
+	else if (parms.daemonSocket)
+	{
+		ResizeContext *pContext = CreateResizeContext(parms.numTileThreads);
+		success = pContext && RunResizeDaemon(parms.daemonSocket, parms.numJobs, pContext);
+		DestroyResizeContext(pContext);
+	}
+	else if (parms.statsSocket)
+		success = PrintResizeDaemonStats(parms.statsSocket);
 	else
-		return (0.0f);
-}
-
-// 1D horizontal filter using contributor table
-static void Filter1DHorz(const IMAGE *pImageIn, IMAGE *pImageOut,
-	int x, int y, int plane, EdgeMethod edgeMethod, ContribTable contribs)
-{
-	double tmpResult = 0.0;
-	for (int k = 0; k < contribs.numContribPixels[x]; k++)
 	{
-		double tmpPixel = pImageIn->dblPixArray[plane][y][contribs.contribPixPos[x][k]];
-		tmpResult += contribs.filterWeights[x][k] * tmpPixel;
+		ResizeContext *pContext = CreateResizeContext(parms.numTileThreads);
+		success = pContext && RunResizeJob(&parms, pContext);
+		DestroyResizeContext(pContext);
 	}
-	tmpResult /= contribs.weightsSum[x];
-	double outPixel = CLAMP(tmpResult, 0, 1.0);
-	pImageOut->dblPixArray[plane][y][x] = outPixel;
+	FCLOSEALL();			// In case of a missed open file stream; shouldn't be necessary
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-// 1D vertical filter using contributor table
-static void Filter1DVert(const IMAGE *pImageIn, IMAGE *pImageOut,
-	int x, int y, int plane, EdgeMethod edgeMethod, ContribTable contribs)
+// Resizes one file or sequence. Command line options in pJobParms apply to it alone
+// Tables, LUTs and the tile pool come from pContext, which may be shared with other jobs
+static bool RunResizeJob(const CmdLineParms *pJobParms, ResizeContext *pContext)
 {
-	double tmpResult = 0.0;
-	for (int k = 0; k < contribs.numContribPixels[y]; k++)
+	CmdLineParms parms = *pJobParms;
+
+	// Copy parameters to file info structure as needed
+	ImageFileInfo inFileInfo;
+	ImageFileInfo outFileInfos[MAX_OUTPUTS];
+
+	inFileInfo.fileSubtype = parms.fileSubtype;
+	inFileInfo.filename = parms.inFilename;
+	inFileInfo.singleFile = parms.singleInputFile;
+	inFileInfo.height = parms.height;
+	inFileInfo.width = parms.width;
+	for (int i = 0; i < parms.numOutputs; i++)
 	{
-		double tmpPixel = pImageIn->dblPixArray[plane][contribs.contribPixPos[y][k]][x];
-		tmpResult += contribs.filterWeights[y][k] * tmpPixel;
+		outFileInfos[i].fileSubtype = parms.fileSubtype;
+		outFileInfos[i].filename = parms.outFilenames[i];
 	}
-	tmpResult /= contribs.weightsSum[y];
-	double outPixel = CLAMP(tmpResult, 0, 1.0);
-	pImageOut->dblPixArray[plane][y][x] = outPixel;
-}
 
+	// Fill in rest of file info structure
+	if (!GetFileInfo(&inFileInfo, outFileInfos, parms.numOutputs))
+		return FALSE;
+
+	// Y4M input may declare full range YUV
+	if (inFileInfo.fileType == Y4M_FILE && inFileInfo.y4mHeader.yuvRange == FULL_RANGE)
+		parms.yuvRange = FULL_RANGE;
 
-// Makes pixel contribution table
-// Slight speed efficiency due to checking image boundaaries in O(n) time instead of every pixel O(n^2)
-// Allows precomputation of arbitrary filter phases for arbitrary scaling ratios
-static bool MakeContribTable(ContribTable *contribTable, int inDimSize, int outDimSize, EdgeMethod edgeMethod)
-{
-	double scaleRatio = (double)outDimSize / inDimSize;	// scale ratio
+	// Set output dimensions here since we could determine input dims from BMP header in GetFileInfo()
+	// TODO: make output H,W parameters to enable arbitrary scaling ratios
+	for (int i = 0; i < parms.numOutputs; i++)
+	{
+		outFileInfos[i].height = (int)(inFileInfo.height * parms.scaleRatios[i] + 0.5f);
+		outFileInfos[i].width = (int)(inFileInfo.width * parms.scaleRatios[i] + 0.5f);
 
-	double scaledHalfTaps;	// Max one-sided number of filter taps, depends on if up or downscaling
-	double filterScale;		// 
+		// If over/under max/min image dimensions, exit
+		if (outFileInfos[i].height < MIN_HEIGHT || outFileInfos[i].height > MAX_HEIGHT ||
+			outFileInfos[i].width < MIN_WIDTH || outFileInfos[i].width > MAX_WIDTH)
+		{
+			fprintf(stderr, "Min/max image dimension exceeded!\n");
+			return FALSE;
+		}
+	}
 
-	if (scaleRatio > 1.0)
+	// Choose color space to resize in
+	// The loaders convert to it on input and the savers convert from it on output
+	for (int i = 0; i <= parms.numOutputs; i++)
+	{
+		const ImageFileInfo *fileInfo = i ? &outFileInfos[i - 1] : &inFileInfo;
+		switch (fileInfo->fileType)
+		{
+		case YUV_FILE:
+		case Y4M_FILE:
+		case BMP_FILE:
+		case QOI_FILE:
+			break;
+		default:
+			fprintf(stderr, "Unsupported file type for %s file %s!\n", i ? "output" : "input", fileInfo->filename);
+			return FALSE;
+		}
+	}
+	int maxOutBitDepth = 8;
+	for (int i = 0; i < parms.numOutputs; i++)
+		maxOutBitDepth = MAX(maxOutBitDepth, outFileInfos[i].bitDepth);
+	ColorSpaces resizeColorSpace;
+	if (inFileInfo.bitDepth > 8 || maxOutBitDepth > 8)
 	{
-		// Horizontal upscaling
-		filterScale = 1.0;
-		scaledHalfTaps = LANCZOS2_NUMTAPS;
+		// RGB<->YUV conversion is 8-bit only: frames of more bits are resized as stored
+		resizeColorSpace = YUV420;
+		if (parms.verbose)
+		{
+			fprintf(stderr, "Resizing in YUV420 color space: %d-bit input, %d-bit output\n",
+				inFileInfo.bitDepth, maxOutBitDepth);
+		}
 	}
 	else
 	{
-		// Horizontal downscaling
-		filterScale = scaleRatio;
-		scaledHalfTaps = LANCZOS2_NUMTAPS / scaleRatio;
+		// All outputs are resized from the one input frame: if they would choose differently, keep the input's
+		resizeColorSpace = ChooseResizeColorSpace(inFileInfo.colorSpace, outFileInfos[0].colorSpace,
+			inFileInfo.width, inFileInfo.height, outFileInfos[0].width, outFileInfos[0].height, parms.verbose);
+		for (int i = 1; i < parms.numOutputs; i++)
+		{
+			if (ChooseResizeColorSpace(inFileInfo.colorSpace, outFileInfos[i].colorSpace, inFileInfo.width,
+				inFileInfo.height, outFileInfos[i].width, outFileInfos[i].height, FALSE) != resizeColorSpace)
+			{
+				resizeColorSpace = inFileInfo.colorSpace;
+				if (parms.verbose)
+					fprintf(stderr, "Outputs differ in color space: resizing in that of the input\n");
+				break;
+			}
+		}
 	}
-	int maxTaps = (int)(2 * scaledHalfTaps + 1);
-
-	contribTable->filterWeights = Create2DArray(double, outDimSize, maxTaps);	// filter weights
-	contribTable->contribPixPos = Create2DArray(int, outDimSize, maxTaps);		// contributing pixels
-	contribTable->numContribPixels = (int *)calloc(outDimSize, sizeof(int));		// number of contributors for target pixel
-	contribTable->weightsSum = (double *)calloc(outDimSize, sizeof(double));		// sum of weights for target pixel
 
-	if (!contribTable->filterWeights || !contribTable->contribPixPos ||
-		!contribTable->numContribPixels || !contribTable->weightsSum)
+	// Load and save stages have one thread each; no more workers of the other stages than frames
+	int numInFrames = inFileInfo.numFrames * MAX(inFileInfo.numSubFrames, 1);
+	if (inFileInfo.numSubFrames >= 0)
 	{
-		fprintf(stderr, "ERROR: MakeContribTable(): Could not allocate memory for ContribTable!\n");
-		DestroyContribTable(contribTable);
-		return FALSE;
+		for (int i = DEGAMMA_STAGE; i <= GAMMA_STAGE; i++)
+			parms.numWorkers[i] = MAX(MIN(parms.numWorkers[i], numInFrames), 1);
 	}
-
-	// Precalculate filter weights for each target pixel in output row
-	// Number of contributing input pixels per output target pixel is variable depending on filter phase
-	for (int i = 0; i < outDimSize; i++)
+	if (parms.verbose)
 	{
-		// Calculate extents of contributor pixels
-		// Supports all scaling ratios, both shrink and expand
-		double center = ((double)i + 0.5f) / scaleRatio - 0.5f;
-		int left = (int)(floor(center - scaledHalfTaps));
-		int right = (int)(ceil(center + scaledHalfTaps));
+		fprintf(stderr, "Worker threads: %d degamma, %d resize, %d gamma\n", parms.numWorkers[DEGAMMA_STAGE],
+			parms.numWorkers[RESIZE_STAGE], parms.numWorkers[GAMMA_STAGE]);
+	}
 
-		for (int j = left; j <= right; j++)
+	// Frame buffers and queues connecting the stages
+	// Outputs of the same dimensions are resized once, and gamma corrected from it each to its own bit depth
+	FramePipeline pipeline;
+	pipeline.parms = &parms;
+	pipeline.inFileInfo = &inFileInfo;
+	pipeline.outFileInfos = outFileInfos;
+	pipeline.numOutputs = parms.numOutputs;
+	pipeline.numSizes = 0;
+	for (int i = 0; i < parms.numOutputs; i++)
+	{
+		int size = 0;
+		while (size < pipeline.numSizes && (pipeline.sizeWidths[size] != outFileInfos[i].width ||
+			pipeline.sizeHeights[size] != outFileInfos[i].height))
+			size++;
+		if (size == pipeline.numSizes)
 		{
-			// If edgeMethod == NOCONTRIB and contributing pixel lies outside iamge area, skip it
-			// i.e. filter weight is 0
-			if (edgeMethod == NOCONTRIB && (j<0 || j>(int)inDimSize))
-				continue;
-
-			double weight;
-			if ((weight = lanczos2Filter((center - j) * filterScale)) == 0)
-				continue;
+			pipeline.sizeWidths[size] = outFileInfos[i].width;
+			pipeline.sizeHeights[size] = outFileInfos[i].height;
+			pipeline.numSizes++;
+		}
+		pipeline.outputSizes[i] = size;
+	}
+	if (parms.verbose && parms.numOutputs > 1)
+		fprintf(stderr, "%d outputs resized to %d sizes\n", parms.numOutputs, pipeline.numSizes);
+
+	// Gamma and inverse gamma LUTs per output and contributor tables per size, shared by all workers
+	// Made for this job only if not taken from the cache
+	GammaLUTs gammaLUTs[MAX_OUTPUTS];
+	ResizePlan plans[MAX_OUTPUTS];
+	memset(gammaLUTs, 0, sizeof(gammaLUTs));
+	memset(plans, 0, sizeof(plans));
+	const GammaLUTs *pLUTs[MAX_OUTPUTS];
+	const ResizePlan *pPlans[MAX_OUTPUTS];
+
+	// Pool resizing the tiles of frames of all resize workers, if any: the context's if of the job's size,
+	// else one of the job's own
+	TilePool *pTilePool = NULL;
+	TilePool *pOwnTilePool = NULL;
+
+	// Workers in stage order; each resize worker has its own horizontally resized buffers
+	StageWorker workers[MAX_PIPELINE_THREADS];
+	memset(workers, 0, sizeof(workers));
+	int numThreads = 0;
+	for (int i = 0; i < NUM_PIPELINE_STAGES; i++)
+	{
+		for (int j = 0; j < parms.numWorkers[i]; j++, numThreads++)
+		{
+			workers[numThreads].pPipeline = &pipeline;
+			workers[numThreads].stage = (PipelineStage)i;
+			for (int k = 0; i == RESIZE_STAGE && k < pipeline.numSizes; k++)
+			{
+				workers[numThreads].imageTmp[k] = CreateImage(resizeColorSpace, pipeline.sizeWidths[k],
+					inFileInfo.height, parms.linearPrecision);
+			}
+		}
+	}
 
-			// Handle image edge cases
-			int x = HandleEdgeCase(j, (int)inDimSize, edgeMethod);
+	bool created = CreateFramePipeline(&pipeline, resizeColorSpace);
+	for (int i = 0; created && i < numThreads; i++)
+	{
+		for (int j = 0; workers[i].stage == RESIZE_STAGE && j < pipeline.numSizes; j++)
+			created = created && IsImageAllocated(&workers[i].imageTmp[j]);
+	}
+	for (int i = 0; created && i < parms.numOutputs; i++)
+	{
+		created = (pLUTs[i] = GetGammaLUTs(pContext, &gammaLUTs[i], parms.gamma, inFileInfo.bitDepth,
+			outFileInfos[i].bitDepth, parms.linearPrecision)) != NULL;
+	}
+	for (int i = 0; created && i < pipeline.numSizes; i++)
+	{
+		created = (pPlans[i] = GetResizePlan(pContext, &plans[i], resizeColorSpace, inFileInfo.width,
+			inFileInfo.height, pipeline.sizeWidths[i], pipeline.sizeHeights[i], parms.edgeMethod)) != NULL;
+	}
+	if (!created)
+	{
+		MainCleanup(&pipeline, &inFileInfo, gammaLUTs, plans, pOwnTilePool, workers, numThreads);
+		return FALSE;
+	}
+	for (int i = 0; i < numThreads; i++)
+	{
+		memcpy(workers[i].pPlans, pPlans, pipeline.numSizes * sizeof(ResizePlan *));
+		memcpy(workers[i].pLUTs, pLUTs, parms.numOutputs * sizeof(GammaLUTs *));
+	}
 
-			contribTable->filterWeights[i][contribTable->numContribPixels[i]] = weight;
-			contribTable->contribPixPos[i][contribTable->numContribPixels[i]] = x;
-			contribTable->weightsSum[i] += weight;
-			contribTable->numContribPixels[i]++;
+	if (parms.numTileThreads > 0)
+	{
+		pTilePool = GetResizeContextTilePool(pContext);
+		if (pTilePool == NULL || GetTilePoolSize(pTilePool) != parms.numTileThreads)
+			pTilePool = pOwnTilePool = CreateTilePool(parms.numTileThreads);
+		for (int i = 0; i < numThreads; i++)
+		{
+			for (int j = 0; workers[i].stage == RESIZE_STAGE && j < pipeline.numSizes; j++)
+			{
+				if (!CreateTiledResize(&workers[i].tiled[j], pTilePool, pPlans[j], inFileInfo.width,
+					inFileInfo.height, pipeline.sizeWidths[j], pipeline.sizeHeights[j], parms.edgeMethod))
+				{
+					MainCleanup(&pipeline, &inFileInfo, gammaLUTs, plans, pOwnTilePool, workers, numThreads);
+					return FALSE;
+				}
+			}
 		}
+		if (parms.verbose)
+			fprintf(stderr, "Resizing in tiles of %d rows on %d pool threads\n", TILE_ROWS, parms.numTileThreads);
 	}
 
-	return TRUE;
-}
-
-// Safely deallocate contributor table storage
-static void DestroyContribTable(ContribTable *contribTable)
-{
-	if (contribTable->filterWeights)
-		Destroy2DArray(contribTable->filterWeights);
-	if (contribTable->contribPixPos)
-		Destroy2DArray(contribTable->contribPixPos);
-	if (contribTable->numContribPixels)
-		free(contribTable->numContribPixels);
-	if (contribTable->weightsSum)
-		free(contribTable->weightsSum);
-}
+	// YUV and Y4M output is written as one multi-frame file through a single handle
+	int numOutFrames = numInFrames;
+	bool writerOpened = TRUE;
+	for (int i = 0; i < parms.numOutputs && writerOpened; i++)
+	{
+		ImageFileInfo *outFileInfo = &outFileInfos[i];
+		switch (outFileInfo->fileType)
+		{
+		case YUV_FILE:
+			writerOpened = OpenYUVSequenceWriter(outFileInfo->filename, outFileInfo->width, outFileInfo->height,
+				outFileInfo->fileSubtype, numOutFrames, &pipeline.outWriters[i]);
+			break;
+		case Y4M_FILE:
+			// Carry stream parameters over from Y4M input
+			if (inFileInfo.fileType == Y4M_FILE)
+				outFileInfo->y4mHeader = inFileInfo.y4mHeader;
+			else
+			{
+				memset(&outFileInfo->y4mHeader, 0, sizeof(Y4MHeader));
+				outFileInfo->y4mHeader.frameRateNum = Y4M_DEFAULT_FRAME_RATE;
+				outFileInfo->y4mHeader.frameRateDen = 1;
+				outFileInfo->y4mHeader.interlace = 'p';
+			}
+			outFileInfo->y4mHeader.width = outFileInfo->width;
+			outFileInfo->y4mHeader.height = outFileInfo->height;
+			outFileInfo->y4mHeader.yuvRange = parms.yuvRange;
+			outFileInfo->y4mHeader.colorSpace = outFileInfo->colorSpace;
+			outFileInfo->y4mHeader.bitDepth = outFileInfo->bitDepth;
+			writerOpened = OpenY4MSequenceWriter(outFileInfo->filename, &outFileInfo->y4mHeader, numOutFrames,
+				&pipeline.outWriters[i]);
+			break;
+		default:
+			break;
+		}
+	}
+	if (!writerOpened)
+	{
+		MainCleanup(&pipeline, &inFileInfo, gammaLUTs, plans, pOwnTilePool, workers, numThreads);
+		return FALSE;
+	}
 
-// Main rescaling function
-// Currently hardcoded to 2D separable Lanczos2 filter
-// Creates separate contributor table for Y, UV planes to facilitate image edge handling for
-// differently sized YUV422/YUV420 chroma planes
-// Note:Image scaling done in *Linear Light domain*, i.e. RGB or YUV,
-//		not in linear perception domain (Y'UV or R'G'B'),
-//		so gamma correction must be applied before & after this function.
-//		Doing it this way makes for much better quality in dark regions, especially in shrink case.
-static bool ResizeImage(const IMAGE *pImageIn, IMAGE *pImageOut, EdgeMethod edgeMethod)
-{
-	// In, out image same size: no rescaling
-	if ((pImageIn->width == pImageOut->width) && (pImageIn->height == pImageOut->height))
+	// Every stage works on its own frame while the others work on earlier and later ones
+	double startTime = GetSeconds();
+	std::thread threads[MAX_PIPELINE_THREADS];
+	for (int i = 0; i < numThreads; i++)
 	{
-		CopyImage(pImageIn, pImageOut);
-		return TRUE;
+		switch (workers[i].stage)
+		{
+		case LOAD_STAGE:
+			threads[i] = std::thread(ReadFrames, &workers[i]);
+			break;
+		case SAVE_STAGE:
+			threads[i] = std::thread(WriteFrames, &workers[i]);
+			break;
+		default:
+			threads[i] = std::thread(RunStage, &workers[i]);
+			break;
+		}
 	}
 
-	// Setup variables to increment chroma planes
-	int xinc = 1, yinc = 1;
-	switch (pImageIn->colorSpace)
+	// Once all workers of a stage have ended, no more frames reach the next one: let it drain its queue and end
+	// After a failure, all queues are already closed
+	bool success = TRUE;
+	for (int i = 0; i < numThreads; i++)
 	{
-	case YUV420:
-		xinc = 2;
-		yinc = 2;
-		break;
-	case YUV422:
-		xinc = 2;
-		break;
-	default:
-		break;
+		threads[i].join();
+		if (workers[i].failed)
+			success = FALSE;
+		if (i == numThreads - 1 || workers[i + 1].stage != workers[i].stage)
+			CloseFrameQueue(pipeline.pendingSlots[(workers[i].stage + 1) % NUM_PIPELINE_STAGES]);
 	}
 
-	// Create temp image buffer for initial h acaling
-	IMAGE imageTmp = CreateImage(pImageIn->colorSpace, pImageOut->width, pImageIn->height, DOUBLE);  // Temp image buffer
+	if (parms.verbose)
+		ReportStageUtilization(workers, numThreads, pTilePool, GetSeconds() - startTime);
+	if (pipeline.readFailed)
+		success = FALSE;
+	MainCleanup(&pipeline, &inFileInfo, gammaLUTs, plans, pOwnTilePool, workers, numThreads);
+	return success;
+}
 
-	// Horizontal scaling
-	// Create storage for precomputed pixel contribution tables
-	ContribTable contribs, contribsUV;
-	if (!MakeContribTable(&contribs, pImageIn->width, pImageOut->width, edgeMethod))
+// Runs every job of the manifest, or one per file of a directory or wildcard source, parms->numJobs at a time,
+// with LUTs and tables cached across jobs
+// Options of the command line apply to every job, unless its line overrides them
+// A job that fails is reported and does not stop the others. Returns FALSE if any failed
+static bool RunBatch(const CmdLineParms *parms)
+{
+	// Read all jobs before splitting any: jobs move as the array grows
+	bool success = TRUE;
+	int numJobs = 0;
+	BatchJob *jobs = NULL;
+	if (!(parms->batchOutput ? MakeSourceJobs(parms, &jobs, &numJobs, &success) :
+		ReadManifestJobs(parms->manifestFilename, &jobs, &numJobs, &success)))
 		return FALSE;
-	if (pImageIn->colorSpace == YUV420 || pImageIn->colorSpace == YUV422)
-	{
-		if (!MakeContribTable(&contribsUV, pImageIn->width / 2, pImageOut->width / 2, edgeMethod))
-			return FALSE;
-	}
-	else
+
+	Batch batch;
+	batch.parms = parms;
+	batch.jobKind = parms->batchOutput ? "file" : "line";
+	batch.pendingJobs = CreateFrameQueue(MAX(numJobs, 1));
+	batch.pContext = CreateResizeContext(parms->numTileThreads);
+	if (batch.pendingJobs == NULL || batch.pContext == NULL)
 	{
-		contribsUV.contribPixPos = contribs.contribPixPos;
-		contribsUV.filterWeights = contribs.filterWeights;
-		contribsUV.numContribPixels = contribs.numContribPixels;
-		contribsUV.weightsSum = contribs.weightsSum;
+		DestroyFrameQueue(batch.pendingJobs);
+		DestroyResizeContext(batch.pContext);
+		free(jobs);
+		return FALSE;
 	}
 
-	// Filter image
-	// Y/R plane
-	for (int y = 0; y < pImageIn->height; y++)
+	// Blank and comment lines hold no job
+	int numValidJobs = 0;
+	for (int i = 0; i < numJobs; i++)
 	{
-		for (int x = 0; x < pImageOut->width; x++)
+		if (!SplitJobLine(&jobs[i], parms->manifestFilename))
 		{
-			Filter1DHorz(pImageIn, &imageTmp, x, y, Y_PLANE, edgeMethod, contribs);
+			fprintf(stderr, "%s line %d: More than %d arguments!\n", parms->manifestFilename, jobs[i].lineNumber,
+				MAX_JOB_ARGS - 1);
+			success = FALSE;
+			continue;
 		}
-	}
-	// UV/GB planes
-	int UVwidth = pImageOut->width / xinc;
-	int UVheight = pImageIn->height / yinc;
-	for (int plane = U_PLANE; plane <= V_PLANE; plane++)
-	{
-		for (int y = 0; y < UVheight; y++)
+		if (jobs[i].argc > 1)
 		{
-			for (int x = 0; x < UVwidth; x++)
-			{
-				Filter1DHorz(pImageIn, &imageTmp, x, y, plane, edgeMethod, contribsUV);
-			}
+			PushFrameQueue(batch.pendingJobs, &jobs[i]);
+			numValidJobs++;
 		}
 	}
-	DestroyContribTable(&contribs);
-	if (pImageIn->colorSpace == YUV420 || pImageIn->colorSpace == YUV422)
-		DestroyContribTable(&contribsUV);
+	CloseFrameQueue(batch.pendingJobs);
 
-	// Vertical scaling
-	// In, out image same size: no rescaling
-	if (pImageIn->height == pImageOut->height)
+	std::thread threads[MAX_BATCH_JOBS];
+	int numThreads = MAX(MIN(parms->numJobs, numValidJobs), 1);
+	for (int i = 0; i < numThreads; i++)
+		threads[i] = std::thread(RunBatchJobs, &batch);
+	for (int i = 0; i < numThreads; i++)
+		threads[i].join();
+
+	int numSucceeded = 0;
+	for (int i = 0; i < numJobs; i++)
 	{
-		CopyImage(&imageTmp, pImageOut);
+		if (jobs[i].succeeded)
+			numSucceeded++;
+	}
+	fprintf(stderr, "%s: %d of %d jobs succeeded\n", parms->manifestFilename, numSucceeded, numValidJobs);
+
+	DestroyFrameQueue(batch.pendingJobs);
+	DestroyResizeContext(batch.pContext);
+	free(jobs);
+	return success && numSucceeded == numValidJobs;
+}
+
+// Adds room for one more job to *pJobs if it is full. Returns FALSE, freeing the jobs, if it cannot be allocated
+static bool GrowBatchJobs(BatchJob **pJobs, int numJobs, int *pMaxJobs)
+{
+	if (numJobs < *pMaxJobs)
 		return TRUE;
+	*pMaxJobs = MAX(2 * *pMaxJobs, 16);
+	BatchJob *newJobs = (BatchJob *)realloc(*pJobs, *pMaxJobs * sizeof(BatchJob));
+	if (newJobs == NULL)
+	{
+		fprintf(stderr, "Could not allocate batch jobs!\n");
+		free(*pJobs);
+		*pJobs = NULL;
+		return FALSE;
 	}
-	// Create storage for precomputed pixel contribution tables
-	if (!MakeContribTable(&contribs, pImageIn->height, pImageOut->height, edgeMethod))
+	*pJobs = newJobs;
+	return TRUE;
+}
+
+// Reads every line of the manifest into a job. Lines too long to be read are reported, clearing *pSuccess
+// Returns FALSE if the manifest cannot be read
+static bool ReadManifestJobs(const char *manifestFilename, BatchJob **pJobs, int *pNumJobs, bool *pSuccess)
+{
+	FILE *manifest = fopen(manifestFilename, "r");
+	if (manifest == NULL)
+	{
+		fprintf(stderr, "Could not open manifest %s!\n", manifestFilename);
 		return FALSE;
-	if (pImageIn->colorSpace == YUV420)
+	}
+
+	int numJobs = 0, maxJobs = 0, lineNumber = 0;
+	BatchJob *jobs = NULL;
+	char line[MAX_MANIFEST_LINE];
+	while (fgets(line, MAX_MANIFEST_LINE, manifest))
 	{
-		if (!MakeContribTable(&contribsUV, pImageIn->height / 2, pImageOut->height / 2, edgeMethod))
+		lineNumber++;
+		if (strchr(line, '\n') == NULL && !feof(manifest))
+		{
+			fprintf(stderr, "%s line %d: Longer than %d characters!\n", manifestFilename, lineNumber,
+				MAX_MANIFEST_LINE - 2);
+			*pSuccess = FALSE;
+			int c;
+			while ((c = fgetc(manifest)) != EOF && c != '\n')
+				;
+			continue;
+		}
+		if (!GrowBatchJobs(&jobs, numJobs, &maxJobs))
+		{
+			fclose(manifest);
 			return FALSE;
+		}
+		jobs[numJobs].lineNumber = lineNumber;
+		jobs[numJobs].succeeded = FALSE;
+		strcpy(jobs[numJobs].line, line);
+		numJobs++;
 	}
-	else
+	fclose(manifest);
+
+	*pJobs = jobs;
+	*pNumJobs = numJobs;
+	return TRUE;
+}
+
+// Makes a job of each image file of the directory or wildcard source, writing to an output of the same name in
+// the parms->batchOutput directory, or named by parms->batchOutput with * replaced by the input name without
+// its extension. Files whose output cannot be named are reported, clearing *pSuccess
+// Returns FALSE if the source cannot be read
+static bool MakeSourceJobs(const CmdLineParms *parms, BatchJob **pJobs, int *pNumJobs, bool *pSuccess)
+{
+	char **fileNames;
+	int numFiles = ListMatchingFiles(parms->manifestFilename, &fileNames);
+	if (numFiles < 0)
 	{
-		contribsUV.contribPixPos = contribs.contribPixPos;
-		contribsUV.filterWeights = contribs.filterWeights;
-		contribsUV.numContribPixels = contribs.numContribPixels;
-		contribsUV.weightsSum = contribs.weightsSum;
+		fprintf(stderr, "Could not read batch source %s!\n", parms->manifestFilename);
+		return FALSE;
 	}
 
-	// Filter image
-	// Y/R plane
-	for (int y = 0; y < pImageOut->height; y++)
+	const char *pStar = strchr(parms->batchOutput, '*');
+	size_t outLength = strlen(parms->batchOutput);
+	bool hasSeparator = outLength > 0 &&
+		(parms->batchOutput[outLength - 1] == PATH_SEPARATOR || parms->batchOutput[outLength - 1] == '/');
+	const char separator[2] = { hasSeparator ? '\0' : PATH_SEPARATOR, '\0' };
+
+	int numJobs = 0, maxJobs = 0;
+	BatchJob *jobs = NULL;
+	for (int i = 0; i < numFiles; i++)
 	{
-		for (int x = 0; x < pImageOut->width; x++)
+		// Other files of a directory, e.g. notes, are not jobs
+		FileType fileType;
+		if (!DetectFileType(fileNames[i], &fileType) || fileType == UNSUPPORTED_FILE)
+			continue;
+
+		const char *pCharName = strrchr(fileNames[i], PATH_SEPARATOR);
+#ifdef _WIN32
+		if (strrchr(fileNames[i], '/') > pCharName)
+			pCharName = strrchr(fileNames[i], '/');
+#endif
+		pCharName = (pCharName != NULL) ? pCharName + 1 : fileNames[i];
+		const char *pChar = strrchr(pCharName, '.');
+		int stemLength = (int)((pChar != NULL) ? pChar - pCharName : strlen(pCharName));
+
+		char outFilename[MAX_STRING_LENGTH];
+		int length = pStar ?
+			snprintf(outFilename, MAX_STRING_LENGTH, "%.*s%.*s%s", (int)(pStar - parms->batchOutput), parms->batchOutput,
+				stemLength, pCharName, pStar + 1) :
+			snprintf(outFilename, MAX_STRING_LENGTH, "%s%s%s", parms->batchOutput, separator, pCharName);
+		if (length < 0 || length >= MAX_STRING_LENGTH || strchr(fileNames[i], '"') || strchr(outFilename, '"'))
 		{
-			Filter1DVert(&imageTmp, pImageOut, x, y, Y_PLANE, edgeMethod, contribs);
+			fprintf(stderr, "%s file %d: Output name of %s is too long or holds a quote!\n", parms->manifestFilename,
+				i + 1, fileNames[i]);
+			*pSuccess = FALSE;
+			continue;
 		}
-	}
-	// UV/GB planes
-	UVwidth = pImageOut->width / xinc;
-	UVheight = pImageOut->height / yinc;
-	for (int plane = U_PLANE; plane <= V_PLANE; plane++)
-	{
-		for (int y = 0; y < UVheight; y++)
+
+		if (!GrowBatchJobs(&jobs, numJobs, &maxJobs))
 		{
-			for (int x = 0; x < UVwidth; x++)
-			{
-				Filter1DVert(&imageTmp, pImageOut, x, y, plane, edgeMethod, contribsUV);
-			}
+			FreeFileList(fileNames, numFiles);
+			return FALSE;
 		}
+		// Quoted, as on a manifest line, so that names may hold spaces
+		jobs[numJobs].lineNumber = i + 1;
+		jobs[numJobs].succeeded = FALSE;
+		snprintf(jobs[numJobs].line, MAX_MANIFEST_LINE, "\"%s\" \"%s\"", fileNames[i], outFilename);
+		numJobs++;
 	}
-	DestroyContribTable(&contribs);
-	if (pImageIn->colorSpace == YUV420)
-		DestroyContribTable(&contribsUV);
+	FreeFileList(fileNames, numFiles);
 
-	DestroyImage(&imageTmp);
+	*pJobs = jobs;
+	*pNumJobs = numJobs;
 	return TRUE;
 }
 
-int main(int argc, char *argv[])
+// Splits manifest line in place into arguments, separated by white space; double quotes keep spaces in one
+// A line starting with # is a comment. Returns FALSE if there are too many arguments
+static bool SplitJobLine(BatchJob *pJob, const char *manifestFilename)
 {
-	// Command line parser
-	CmdLineParms parms;
+	pJob->argv[0] = (char *)manifestFilename;
+	pJob->argc = 1;
 
-	// Set default parm values
-	parms.scaleRatio = 2.0f;
-	parms.fileSubtype = YUV420_I420;
-	parms.height = 0;
-	parms.width = 0;
-	parms.edgeMethod = REPEAT;
-	parms.gamma = 1.0f;
+	char *pChar = pJob->line;
+	while (TRUE)
+	{
+		while (isspace((unsigned char)*pChar))
+			pChar++;
+		if (*pChar == '\0' || (*pChar == '#' && pJob->argc == 1))
+			return TRUE;
+		if (pJob->argc == MAX_JOB_ARGS)
+			return FALSE;
 
-	if (!ParseCmdLine(argc, argv, &parms))
-		exit(EXIT_FAILURE);
+		char endChar = ' ';
+		if (*pChar == '"')
+		{
+			endChar = '"';
+			pChar++;
+		}
+		pJob->argv[pJob->argc++] = pChar;
+		while (*pChar != '\0' && (endChar == '"' ? *pChar != '"' : !isspace((unsigned char)*pChar)))
+			pChar++;
+		if (*pChar == '\0')
+			return TRUE;
+		*pChar++ = '\0';
+	}
+}
 
-	// Copy parameters to file info structure as needed
-	ImageFileInfo inFileInfo;
-	ImageFileInfo outFileInfo;
+// Batch thread: runs jobs until none are left, reporting the outcome of each
+static void RunBatchJobs(Batch *pBatch)
+{
+	const char *manifestFilename = pBatch->parms->manifestFilename;
+	BatchJob *pJob;
+	while (PopFrameQueue(pBatch->pendingJobs, (void **)&pJob))
+	{
+		double startTime = GetSeconds();
+		CmdLineParms parms = *pBatch->parms;
+		parms.manifestFilename = parms.batchOutput = parms.daemonSocket = parms.statsSocket = NULL;
+		// Numbered files of a source are jobs of their own, not the start of a sequence
+		parms.singleInputFile = (pBatch->parms->batchOutput != NULL);
+		parms.inFilename = parms.outFilenames[0] = NULL;
+		parms.numOutputs = 1;
+		if (!ParseCmdLine(pJob->argc, pJob->argv, &parms))
+			pJob->succeeded = FALSE;
+		else if (parms.manifestFilename || parms.daemonSocket || parms.statsSocket)
+			fprintf(stderr, "%s %s %d: Jobs cannot run manifests or daemons!\n", manifestFilename, pBatch->jobKind,
+				pJob->lineNumber);
+		else
+			pJob->succeeded = RunResizeJob(&parms, pBatch->pContext);
 
-	inFileInfo.fileSubtype = outFileInfo.fileSubtype = parms.fileSubtype;
-	inFileInfo.filename = parms.inFilename;
-	outFileInfo.filename = parms.outFilename;
-	inFileInfo.height = parms.height;
-	inFileInfo.width = parms.width;
+		fprintf(stderr, "%s %s %d: %s %s -> %s, %.3f s\n", manifestFilename, pBatch->jobKind, pJob->lineNumber,
+			pJob->succeeded ? "OK" : "FAILED", parms.inFilename ? parms.inFilename : "?",
+			parms.outFilenames[0] ? parms.outFilenames[0] : "?", GetSeconds() - startTime);
+	}
+}
 
-	// Fill in rest of file info structure
-	if (!GetFileInfo(&inFileInfo, &outFileInfo))
-		return EXIT_FAILURE;
+// Allocates frame slots, linear light buffers and the queues passing them between threads
+// All slots start out free, on the load stage's queue
+static bool CreateFramePipeline(FramePipeline *pPipeline, ColorSpaces resizeColorSpace)
+{
+	const CmdLineParms *parms = pPipeline->parms;
 
-	// Set output dimensions here since we could determine input dims from BMP header in GetFileInfo()
-	// TODO: make output H,W parameters to enable arbitrary scaling ratios
-	outFileInfo.height = (int)(inFileInfo.height * parms.scaleRatio + 0.5f);
-	outFileInfo.width = (int)(inFileInfo.width * parms.scaleRatio + 0.5f);
+	memset(pPipeline->outWriters, 0, sizeof(pPipeline->outWriters));
+	pPipeline->readFailed = FALSE;
 
-	// If over/under max/min image dimensions, exit
-	if (outFileInfo.height < MIN_HEIGHT || outFileInfo.height > MAX_HEIGHT ||
-		outFileInfo.width < MIN_WIDTH || outFileInfo.width > MAX_WIDTH)
+	// One slot per thread, plus those queued so the reader can load ahead
+	// Only frames between degamma and gamma stages hold linear light buffers: one per thread of those stages
+	pPipeline->numSlots = FRAME_SLOTS_QUEUED;
+	pPipeline->numLinearBuffers = 0;
+	for (int i = 0; i < NUM_PIPELINE_STAGES; i++)
 	{
-		fprintf(stderr, "Min/max image dimension exceeded!\n");
-		return EXIT_FAILURE;
+		pPipeline->numSlots += parms->numWorkers[i];
+		if (i >= DEGAMMA_STAGE && i <= GAMMA_STAGE)
+			pPipeline->numLinearBuffers += parms->numWorkers[i];
 	}
-
-	// Allocate input/output image storage
-	IMAGE imageIn;
-	switch (inFileInfo.fileType)
+	pPipeline->slots = (FrameSlot *)calloc(pPipeline->numSlots, sizeof(FrameSlot));
+	pPipeline->linearBuffers = (LinearBuffers *)calloc(pPipeline->numLinearBuffers, sizeof(LinearBuffers));
+	for (int i = 0; i < NUM_PIPELINE_STAGES; i++)
+		pPipeline->pendingSlots[i] = CreateFrameQueue(pPipeline->numSlots);
+	pPipeline->freeLinearBuffers = CreateFrameQueue(pPipeline->numLinearBuffers);
+	if (!pPipeline->slots || !pPipeline->linearBuffers)
 	{
-	case YUV_FILE:
-		// Only YUV420 inputs currently supported
-		// TODO: Add YUV422 support
-		imageIn = CreateImage(YUV420, inFileInfo.width, inFileInfo.height);
-		break;
-	case BMP_FILE:
-		// Allocate image storage
-		imageIn = CreateImage(RGB, inFileInfo.width, inFileInfo.height);
-		break;
-	default:
-		fprintf(stderr, "Unsupported file type for input file %s!\n", inFileInfo.filename);
-		return EXIT_FAILURE;
+		fprintf(stderr, "Could not allocate frame slots!\n");
+		return FALSE;
 	}
-	IMAGE imageOut = CreateImage(imageIn.colorSpace, outFileInfo.width, outFileInfo.height);
 
-	// Allocate storage for light linearized (degamma'ed) image
-	IMAGE imageInLinear = CreateImage(imageIn.colorSpace, inFileInfo.width, inFileInfo.height, DOUBLE);
+	for (int i = 0; i < pPipeline->numSlots; i++)
+	{
+		FrameSlot *pSlot = &pPipeline->slots[i];
+		pSlot->image = CreateImage(resizeColorSpace, pPipeline->inFileInfo->width, pPipeline->inFileInfo->height,
+			(pPipeline->inFileInfo->bitDepth > 8) ? BPP16 : BPP8);
+		pSlot->image.bitDepth = pPipeline->inFileInfo->bitDepth;
+		pSlot->image.yuvMatrix = parms->yuvMatrix;
+		pSlot->image.yuvRange = parms->yuvRange;
+		for (int j = 0; j < pPipeline->numOutputs; j++)
+		{
+			const ImageFileInfo *outFileInfo = &pPipeline->outFileInfos[j];
+			pSlot->imageOut[j] = CreateImage(resizeColorSpace, outFileInfo->width, outFileInfo->height,
+				(outFileInfo->bitDepth > 8) ? BPP16 : BPP8);
+			pSlot->imageOut[j].bitDepth = outFileInfo->bitDepth;
+			pSlot->imageOut[j].yuvMatrix = parms->yuvMatrix;
+			pSlot->imageOut[j].yuvRange = parms->yuvRange;
+			if (!IsImageAllocated(&pSlot->imageOut[j]))
+				return FALSE;
+		}
+		if (!IsImageAllocated(&pSlot->image))
+			return FALSE;
+	}
+	for (int i = 0; i < pPipeline->numLinearBuffers; i++)
+	{
+		LinearBuffers *pLinear = &pPipeline->linearBuffers[i];
+		pLinear->imageInLinear = CreateImage(resizeColorSpace, pPipeline->inFileInfo->width,
+			pPipeline->inFileInfo->height, parms->linearPrecision);
+		for (int j = 0; j < pPipeline->numSizes; j++)
+		{
+			pLinear->imageOutLinear[j] = CreateImage(resizeColorSpace, pPipeline->sizeWidths[j],
+				pPipeline->sizeHeights[j], parms->linearPrecision);
+			if (!IsImageAllocated(&pLinear->imageOutLinear[j]))
+				return FALSE;
+		}
+		if (!IsImageAllocated(&pLinear->imageInLinear))
+			return FALSE;
+	}
 
-	// Allocate storage for light linearized (degamma'ed) image out
-	IMAGE imageOutLinear = CreateImage(imageIn.colorSpace, outFileInfo.width, outFileInfo.height, DOUBLE);
+	for (int i = 0; i < NUM_PIPELINE_STAGES; i++)
+	{
+		if (!pPipeline->pendingSlots[i])
+			return FALSE;
+	}
+	if (!pPipeline->freeLinearBuffers)
+		return FALSE;
 
-	// Create gamma and inverse gamma LUTs
-	// Create 8-bit forward LUT
-	double fwdGamma[FWD_GAMMA_LUTSIZE];
-	for (int i = 0; i < FWD_GAMMA_LUTSIZE; ++i)
-		fwdGamma[i] = (double)pow((double)i / (double)PIXMAX, parms.gamma);
+	for (int i = 0; i < pPipeline->numSlots; i++)
+		PushFrameQueue(pPipeline->pendingSlots[LOAD_STAGE], &pPipeline->slots[i]);
+	for (int i = 0; i < pPipeline->numLinearBuffers; i++)
+		PushFrameQueue(pPipeline->freeLinearBuffers, &pPipeline->linearBuffers[i]);
+	return TRUE;
+}
 
-	// Create 12-bit reverse LUT to account for higher resolution needed for linear light/nonlinear perception
-	PIXEL bwdGamma[BWD_GAMMA_LUTSIZE];
-	const double invGamma = 1.0 / parms.gamma;
-	for (int i = 0; i < BWD_GAMMA_LUTSIZE; ++i)
-		bwdGamma[i] = (PIXEL)(CLAMP((double)PIXMAX * pow((double)i / BWD_GAMMA_LUTSIZE, invGamma) + 0.5f, 0, PIXMAX));
+// Load stage thread: loads every input frame into a free slot, in resize color space
+// Frames that cannot be read are skipped
+static void ReadFrames(StageWorker *pWorker)
+{
+	FramePipeline *pPipeline = pWorker->pPipeline;
+	const ImageFileInfo *inFileInfo = pPipeline->inFileInfo;
+	const CmdLineParms *parms = pPipeline->parms;
+
+	// View of input frame read from a YUV file, copied or converted into an input slot
+	// Copying here also moves the page faults of a memory-mapped file off the resize thread
+	IMAGE imageInView = CreateImageView(inFileInfo->colorSpace, inFileInfo->width, inFileInfo->height,
+		(inFileInfo->bitDepth > 8) ? BPP16 : BPP8);
+	imageInView.bitDepth = inFileInfo->bitDepth;
+	imageInView.yuvMatrix = parms->yuvMatrix;
+	imageInView.yuvRange = parms->yuvRange;
+	if (!IsImageAllocated(&imageInView))
+	{
+		pPipeline->readFailed = TRUE;
+		return;
+	}
 
 	char fullInFileName[MAX_STRING_LENGTH];
-	char fullOutFileName[MAX_STRING_LENGTH];
-	for (int i = 0, outFrame = inFileInfo.startFrame; i < inFileInfo.numFrames; i++)
+	FrameSlot *pSlot;
+	bool running = TRUE;
+	double startTime;
+	for (int i = 0, outFrame = inFileInfo->startFrame; running && i < inFileInfo->numFrames; i++)
 	{
-		switch (inFileInfo.fileType)
+		switch (inFileInfo->fileType)
 		{
 		case YUV_FILE:
-			if (inFileInfo.numFrames > 1)
-				sprintf(fullInFileName, "%s%05d.yuv", inFileInfo.baseFileName, inFileInfo.startFrame + i);
-			else
-				strncpy(fullInFileName, inFileInfo.filename, MAX_STRING_LENGTH - 1);
-			for (int j = 0; j < inFileInfo.numSubFrames; j++, outFrame++)
+		case Y4M_FILE:
+			if (!GetSequenceFileName(inFileInfo, i, fullInFileName))
 			{
-				// Load input image
-				if (LoadRawYUVImage(fullInFileName, &imageIn, j, inFileInfo.fileSubtype))
+				pPipeline->readFailed = TRUE;
+				running = FALSE;
+				break;
+			}
+			YUVSequenceReader inReader;
+			if (inFileInfo->fileType == Y4M_FILE)
+			{
+				Y4MHeader header;
+				if (!OpenY4MSequenceReader(fullInFileName, &header, &inReader))
+					break;
+				if (header.width != inFileInfo->width || header.height != inFileInfo->height ||
+					header.colorSpace != inFileInfo->colorSpace || header.bitDepth != inFileInfo->bitDepth)
 				{
-					if (!DegammaImage(&imageIn, &imageInLinear, fwdGamma))
-					{
-						fprintf(stderr, "Unable to degamma input image!\n");
-						MainCleanup(&imageIn, &imageOut, &imageInLinear, &imageOutLinear);
-						return EXIT_FAILURE;
-					}
-
-					// Process image
-					if (!ResizeImage(&imageInLinear, &imageOutLinear, parms.edgeMethod))
-					{
-						fprintf(stderr, "Unable to resize image!\n");
-						MainCleanup(&imageIn, &imageOut, &imageInLinear, &imageOutLinear);
-						return EXIT_FAILURE;
-					}
-
-					if (!GammaImage(&imageOutLinear, &imageOut, bwdGamma))
-					{
-						fprintf(stderr, "Unable to gamma correct output image!\n");
-						MainCleanup(&imageIn, &imageOut, &imageInLinear, &imageOutLinear);
-						return EXIT_FAILURE;
-					}
-
-					// Write output image
-					switch (outFileInfo.fileType)
-					{
-					case YUV_FILE:
-						if ((inFileInfo.numFrames > 1) || (inFileInfo.numSubFrames > 1))
-							sprintf(fullOutFileName, "%s%05d.yuv", outFileInfo.baseFileName, outFrame);
-						else
-							strncpy(fullOutFileName, outFileInfo.filename, MAX_STRING_LENGTH - 1);
-						SaveRawYUVImage(fullOutFileName, &imageOut, outFileInfo.fileSubtype);
-						break;
-					case BMP_FILE:
-						if ((inFileInfo.numFrames > 1) || (inFileInfo.numSubFrames > 1))
-							sprintf(fullOutFileName, "%s%05d.bmp", outFileInfo.baseFileName, outFrame);
-						else
-							strncpy(fullOutFileName, outFileInfo.filename, MAX_STRING_LENGTH - 1);
-						SaveBmpImage(fullOutFileName, &imageOut);
-						break;
-					default:
-						fprintf(stderr, "Unsupported file type for output file %s!\n", outFileInfo.filename);
-						MainCleanup(&imageIn, &imageOut, &imageInLinear, &imageOutLinear);
-						return EXIT_FAILURE;
-					}
+					fprintf(stderr, "Dimensions or format of %s differ from rest of sequence!\n", fullInFileName);
+					CloseYUVSequenceReader(&inReader);
+					break;
 				}
 			}
-			break;
-		case BMP_FILE:
-			// Load input image
-			if (inFileInfo.numFrames > 1)
-				sprintf(fullInFileName, "%s%05d.bmp", inFileInfo.baseFileName, inFileInfo.startFrame + i);
-			else
-				strncpy(fullInFileName, inFileInfo.filename, MAX_STRING_LENGTH - 1);
-			if (LoadBmpImage(fullInFileName, &imageIn))
+			else if (!OpenYUVSequenceReader(fullInFileName, inFileInfo->width, inFileInfo->height,
+				inFileInfo->fileSubtype, &inReader))
+				break;
+			// numSubFrames < 0 for a stream: read until end of file
+			for (int j = 0; running && (inFileInfo->numSubFrames < 0 || j < inFileInfo->numSubFrames); j++, outFrame++)
 			{
-				if (!DegammaImage(&imageIn, &imageInLinear, fwdGamma))
+				// Length of a mapped file is known up front; a stream's once its end is reached
+				if (inReader.numFrames >= 0 && j >= inReader.numFrames)
+					break;
+				if (!PopFrameQueue(pPipeline->pendingSlots[LOAD_STAGE], (void **)&pSlot))
 				{
-					fprintf(stderr, "Unable to degamma input image!\n");
-					MainCleanup(&imageIn, &imageOut, &imageInLinear, &imageOutLinear);
-					return EXIT_FAILURE;
+					running = FALSE;
+					break;
 				}
 
-				// Process image
-				if (!ResizeImage(&imageInLinear, &imageOutLinear, parms.edgeMethod))
+				// Read input image
+				startTime = GetSeconds();
+				bool loaded = ReadYUVSequenceFrame(&inReader, j, &imageInView);
+				if (!loaded && inReader.numFrames >= 0 && j >= inReader.numFrames)
 				{
-					fprintf(stderr, "Unable to resize image!\n");
-					MainCleanup(&imageIn, &imageOut, &imageInLinear, &imageOutLinear);
-					return EXIT_FAILURE;
+					// End of file
+					PushFrameQueue(pPipeline->pendingSlots[LOAD_STAGE], pSlot);
+					break;
 				}
-
-				if (!GammaImage(&imageOutLinear, &imageOut, bwdGamma))
+				if (loaded)
 				{
-					fprintf(stderr, "Unable to gamma correct output image!\n");
-					MainCleanup(&imageIn, &imageOut, &imageInLinear, &imageOutLinear);
-					return EXIT_FAILURE;
+					if (!((pSlot->image.colorSpace == imageInView.colorSpace) ?
+						CopyImage(&imageInView, &pSlot->image) :
+						ConvertImage(&imageInView, &pSlot->image)))
+					{
+						fprintf(stderr, "Unable to convert input image color space!\n");
+						pPipeline->readFailed = TRUE;
+						running = FALSE;
+						break;
+					}
 				}
+				pSlot->frameNumber = outFrame;
+				pSlot->sequence = loaded ? pWorker->numFrames++ : -1;
+				pWorker->busyTime += GetSeconds() - startTime;
+				running = loaded ? PushFrameQueue(pPipeline->pendingSlots[DEGAMMA_STAGE], pSlot) :
+					PushFrameQueue(pPipeline->pendingSlots[LOAD_STAGE], pSlot);
+			}
+			CloseYUVSequenceReader(&inReader);
+			break;
+		case BMP_FILE:
+		case QOI_FILE:
+			if (!PopFrameQueue(pPipeline->pendingSlots[LOAD_STAGE], (void **)&pSlot))
+			{
+				running = FALSE;
+				break;
+			}
 
-				// Write output image
-				switch (outFileInfo.fileType)
-				{
-				case YUV_FILE:
-					if (inFileInfo.numFrames > 1)
-						sprintf(fullOutFileName, "%s%05d.bmp", outFileInfo.baseFileName, i);
-					else
-						strncpy(fullOutFileName, outFileInfo.filename, MAX_STRING_LENGTH - 1);
-					SaveRawYUVImage(outFileInfo.filename, &imageOut, outFileInfo.fileSubtype);
-					break;
-				case BMP_FILE:
-					if (inFileInfo.numFrames > 1)
-						sprintf(fullOutFileName, "%s%05d.bmp", outFileInfo.baseFileName, i);
-					else
-						strncpy(fullOutFileName, outFileInfo.filename, MAX_STRING_LENGTH - 1);
-					SaveBmpImage(outFileInfo.filename, &imageOut);
-					break;
-				default:
-					fprintf(stderr, "Unsupported file type for output file %s!\n", outFileInfo.filename);
-					MainCleanup(&imageIn, &imageOut, &imageInLinear, &imageOutLinear);
-					return EXIT_FAILURE;
-				}
+			// Load input image
+			startTime = GetSeconds();
+			if (!GetSequenceFileName(inFileInfo, i, fullInFileName))
+			{
+				PushFrameQueue(pPipeline->pendingSlots[LOAD_STAGE], pSlot);
+				pPipeline->readFailed = TRUE;
+				running = FALSE;
+				break;
+			}
+			// Output files take the numbers of input files, so that gaps in the sequence are kept
+			pSlot->frameNumber = (inFileInfo->frameNumbers != NULL) ? inFileInfo->frameNumbers[i] : outFrame;
+			outFrame++;
+			if ((inFileInfo->fileType == QOI_FILE) ? LoadQoiImage(fullInFileName, &pSlot->image) :
+				LoadBmpImage(fullInFileName, &pSlot->image))
+			{
+				pSlot->sequence = pWorker->numFrames++;
+				pWorker->busyTime += GetSeconds() - startTime;
+				running = PushFrameQueue(pPipeline->pendingSlots[DEGAMMA_STAGE], pSlot);
 			}
+			else
+				running = PushFrameQueue(pPipeline->pendingSlots[LOAD_STAGE], pSlot);
 			break;
 		default:
-			fprintf(stderr, "Unsupported file type for input file %s!\n", inFileInfo.filename);
-			MainCleanup(&imageIn, &imageOut, &imageInLinear, &imageOutLinear);
-			return EXIT_FAILURE;
+			fprintf(stderr, "Unsupported file type for input file %s!\n", inFileInfo->filename);
+			pPipeline->readFailed = TRUE;
+			running = FALSE;
+			break;
 		}
 	}
 
-	MainCleanup(&imageIn, &imageOut, &imageInLinear, &imageOutLinear);
-	return EXIT_SUCCESS;
+	DestroyImage(&imageInView);
 }
 
-static void MainCleanup(IMAGE *pImageIn, IMAGE *pImageOut, IMAGE *pImageInLinear, IMAGE *pImageOutLinear)
+// Degamma, resize or gamma stage worker thread: runs frames through its stage until its queue is closed and drained
+// A frame takes linear light buffers in the degamma stage, before it is popped, so that every frame
+// past that stage has them; the gamma stage gives them back. On error, closes every queue to stop the other threads
+static void RunStage(StageWorker *pWorker)
 {
-	FCLOSEALL();			// In case of a missed open file stream; shouldn't be necessary
-	DestroyImage(pImageIn);
-	DestroyImage(pImageOut);
-	DestroyImage(pImageInLinear);
-	DestroyImage(pImageOutLinear);
-}
\ No newline at end of file
+	FramePipeline *pPipeline = pWorker->pPipeline;
+	PipelineStage stage = pWorker->stage;
+	LinearBuffers *pLinear = NULL;
+	FrameSlot *pSlot;
+	while (TRUE)
+	{
+		if (stage == DEGAMMA_STAGE && !PopFrameQueue(pPipeline->freeLinearBuffers, (void **)&pLinear))
+			break;
+		if (!PopFrameQueue(pPipeline->pendingSlots[stage], (void **)&pSlot))
+		{
+			if (stage == DEGAMMA_STAGE)
+				PushFrameQueue(pPipeline->freeLinearBuffers, pLinear);
+			break;
+		}
+		if (stage == DEGAMMA_STAGE)
+			pSlot->pLinear = pLinear;
+
+		double startTime = GetSeconds();
+		bool success = ProcessFrame(pSlot, pWorker);
+		pWorker->busyTime += GetSeconds() - startTime;
+		if (stage == GAMMA_STAGE)
+		{
+			PushFrameQueue(pPipeline->freeLinearBuffers, pSlot->pLinear);
+			pSlot->pLinear = NULL;
+		}
+		if (!success)
+		{
+			pWorker->failed = TRUE;
+			for (int i = 0; i < NUM_PIPELINE_STAGES; i++)
+				CloseFrameQueue(pPipeline->pendingSlots[i]);
+			CloseFrameQueue(pPipeline->freeLinearBuffers);
+			break;
+		}
+		pWorker->numFrames++;
+		PushFrameQueue(pPipeline->pendingSlots[stage + 1], pSlot);
+	}
+}
+
+// Saves one resized frame of an output, to its sequence file or to a file of its own
+static bool WriteFrame(FramePipeline *pPipeline, FrameSlot *pSlot, int output)
+{
+	const ImageFileInfo *inFileInfo = pPipeline->inFileInfo;
+	const ImageFileInfo *outFileInfo = &pPipeline->outFileInfos[output];
+	IMAGE *pImageOut = &pSlot->imageOut[output];
+
+	char fullOutFileName[MAX_STRING_LENGTH];
+	switch (outFileInfo->fileType)
+	{
+	case YUV_FILE:
+	case Y4M_FILE:
+		return WriteYUVSequenceFrame(&pPipeline->outWriters[output], pImageOut);
+	case BMP_FILE:
+	case QOI_FILE:
+		if ((inFileInfo->numFrames > 1) || (inFileInfo->numSubFrames > 1) || (inFileInfo->numSubFrames < 0))
+		{
+			// Frame numbers are padded as those of input names are, so that output names follow input names
+			int frameDigits = (inFileInfo->frameDigits > 0) ? inFileInfo->frameDigits : DEFAULT_FRAME_DIGITS;
+			int length = snprintf(fullOutFileName, MAX_STRING_LENGTH, "%s%0*d.%s", outFileInfo->baseFileName, frameDigits,
+				pSlot->frameNumber, (outFileInfo->fileType == QOI_FILE) ? "qoi" : "bmp");
+			if (length < 0 || length >= MAX_STRING_LENGTH)
+			{
+				fprintf(stderr, "Name of frame %d of output file %s is too long!\n", pSlot->frameNumber, outFileInfo->filename);
+				return FALSE;
+			}
+		}
+		else
+		{
+			strncpy(fullOutFileName, outFileInfo->filename, MAX_STRING_LENGTH - 1);
+			fullOutFileName[MAX_STRING_LENGTH - 1] = '\0';
+		}
+		if (outFileInfo->fileType == QOI_FILE)
+			return SaveQoiImage(fullOutFileName, pImageOut);
+		return SaveBmpImage(fullOutFileName, pImageOut);
+	default:
+		fprintf(stderr, "Unsupported file type for output file %s!\n", outFileInfo->filename);
+		return FALSE;
+	}
+}
+
+// Save stage thread: saves every resized frame, in read order, and returns its slot to the load stage
+// Frames finished ahead of an earlier one are held back until it has been written
+// Returns once its queue is closed and drained
+static void WriteFrames(StageWorker *pWorker)
+{
+	FramePipeline *pPipeline = pWorker->pPipeline;
+	FrameSlot *heldSlots[MAX_FRAME_SLOTS];
+	memset(heldSlots, 0, sizeof(heldSlots));
+
+	FrameSlot *pSlot;
+	while (PopFrameQueue(pPipeline->pendingSlots[SAVE_STAGE], (void **)&pSlot))
+	{
+		// Slots in flight have distinct sequence numbers less than numSlots past the next one due
+		heldSlots[pSlot->sequence % pPipeline->numSlots] = pSlot;
+		while ((pSlot = heldSlots[pWorker->numFrames % pPipeline->numSlots]) != NULL &&
+			pSlot->sequence == pWorker->numFrames)
+		{
+			heldSlots[pWorker->numFrames % pPipeline->numSlots] = NULL;
+			double startTime = GetSeconds();
+			bool success = TRUE;
+			for (int i = 0; i < pPipeline->numOutputs && success; i++)
+				success = WriteFrame(pPipeline, pSlot, i);
+			pWorker->busyTime += GetSeconds() - startTime;
+			if (!success)
+			{
+				// A full disk or closed pipe fails every later frame too: stop the pipeline
+				pWorker->failed = TRUE;
+				for (int i = 0; i < NUM_PIPELINE_STAGES; i++)
+					CloseFrameQueue(pPipeline->pendingSlots[i]);
+				CloseFrameQueue(pPipeline->freeLinearBuffers);
+				return;
+			}
+			pWorker->numFrames++;
+			PushFrameQueue(pPipeline->pendingSlots[LOAD_STAGE], pSlot);
+		}
+	}
+}
+
+// Reports per stage the frames passed on and the share of its threads' time spent working on them
+// A stage near 100% while the others idle limits the throughput of the whole pipeline
+// Resize workers wait for tile pool threads, if any: those are reported as well
+static void ReportStageUtilization(const StageWorker *workers, int numThreads, const TilePool *pTilePool,
+	double elapsed)
+{
+	static const char *stageNames[NUM_PIPELINE_STAGES] = { "load", "degamma", "resize", "gamma", "save" };
+
+	fprintf(stderr, "Stage    Threads  Frames  Busy (s)  Utilization\n");
+	for (int i = 0; i < NUM_PIPELINE_STAGES; i++)
+	{
+		int stageThreads = 0, stageFrames = 0;
+		double busyTime = 0.0;
+		for (int j = 0; j < numThreads; j++)
+		{
+			if (workers[j].stage != i)
+				continue;
+			stageThreads++;
+			stageFrames += workers[j].numFrames;
+			busyTime += workers[j].busyTime;
+		}
+		fprintf(stderr, "%-8s %7d %7d %9.3f %11.1f%%\n", stageNames[i], stageThreads, stageFrames, busyTime,
+			(elapsed > 0.0 && stageThreads > 0) ? 100.0 * busyTime / (elapsed * stageThreads) : 0.0);
+	}
+	if (pTilePool)
+	{
+		int poolThreads = GetTilePoolSize(pTilePool);
+		double busyTime = GetTilePoolBusyTime(pTilePool);
+		fprintf(stderr, "%-8s %7d %7s %9.3f %11.1f%%\n", "tiles", poolThreads, "-", busyTime,
+			(elapsed > 0.0) ? 100.0 * busyTime / (elapsed * poolThreads) : 0.0);
+	}
+	fprintf(stderr, "Elapsed: %.3f s\n", elapsed);
+}
+
+// pLUTs holds one entry per output, and pPlans one per output size, made for this job unless from its context
+static void MainCleanup(FramePipeline *pPipeline, ImageFileInfo *pInFileInfo, GammaLUTs *pLUTs,
+	ResizePlan *pPlans, TilePool *pOwnTilePool, StageWorker *workers, int numThreads)
+{
+	for (int i = 0; i < pPipeline->numOutputs; i++)
+		CloseYUVSequenceWriter(&pPipeline->outWriters[i]);
+	for (int i = 0; pPipeline->slots && i < pPipeline->numSlots; i++)
+	{
+		DestroyImage(&pPipeline->slots[i].image);
+		for (int j = 0; j < pPipeline->numOutputs; j++)
+			DestroyImage(&pPipeline->slots[i].imageOut[j]);
+	}
+	for (int i = 0; pPipeline->linearBuffers && i < pPipeline->numLinearBuffers; i++)
+	{
+		DestroyImage(&pPipeline->linearBuffers[i].imageInLinear);
+		for (int j = 0; j < pPipeline->numSizes; j++)
+			DestroyImage(&pPipeline->linearBuffers[i].imageOutLinear[j]);
+	}
+	free(pPipeline->slots);
+	free(pPipeline->linearBuffers);
+	for (int i = 0; i < NUM_PIPELINE_STAGES; i++)
+		DestroyFrameQueue(pPipeline->pendingSlots[i]);
+	DestroyFrameQueue(pPipeline->freeLinearBuffers);
+	FreeImageFileInfo(pInFileInfo);
+	for (int i = 0; i < pPipeline->numOutputs; i++)
+		DestroyGammaLUTs(&pLUTs[i]);
+	for (int i = 0; i < numThreads; i++)
+	{
+		for (int j = 0; j < pPipeline->numSizes; j++)
+		{
+			DestroyImage(&workers[i].imageTmp[j]);
+			DestroyTiledResize(&workers[i].tiled[j]);
+		}
+	}
+	DestroyTilePool(pOwnTilePool);
+	for (int i = 0; i < pPipeline->numSizes; i++)
+		DestroyResizePlan(&pPlans[i]);
+}
@@ -5,31 +5,133 @@
 #define IMAGERESIZE_H_
 
 #include "Utils.h"
+#include "FrameQueue.h"
+#include "ImageResizeLib.h"
 
-#define MIN_WIDTH	1
-#define MAX_WIDTH	4096
-#define MIN_HEIGHT	1
-#define MAX_HEIGHT	4096
+#define Y4M_DEFAULT_FRAME_RATE	25	// Frame rate written to Y4M output when input has none
+#define DEFAULT_FRAME_DIGITS	5	// Digits of output BMP/QOI frame numbers when input names have none
+
+#define MAX_STAGE_WORKERS	64	// Upper limit on worker threads of each of the degamma, resize and gamma stages
+#define FRAME_SLOTS_QUEUED	1	// Frame slots beyond one per thread, so that the reader can load ahead
+#define MAX_PIPELINE_THREADS	(2 + 3 * MAX_STAGE_WORKERS)	// Load and save threads plus the other stages' workers
+#define MAX_FRAME_SLOTS		(MAX_PIPELINE_THREADS + FRAME_SLOTS_QUEUED)
+#define MAX_TILE_THREADS	64	// Upper limit on threads of the tile pool
+#define MAX_OUTPUTS			8	// Output files computed from one decoded input
+
+#define MAX_BATCH_JOBS		64	// Upper limit on batch jobs run at once
+#define MAX_MANIFEST_LINE	1024
+#define MAX_JOB_ARGS		32	// Arguments on one manifest line, plus one for the manifest name
+
+// Stages every frame passes through, each run by its own worker threads
+// Load and save have one thread each, the others as many as configured
+enum PipelineStage
+{
+	LOAD_STAGE,
+	DEGAMMA_STAGE,
+	RESIZE_STAGE,
+	GAMMA_STAGE,
+	SAVE_STAGE,
+	NUM_PIPELINE_STAGES
+};
 
 typedef struct
 {
-	double scaleRatio;			// Scaling ratio output:input
+	int numOutputs;				// Outputs computed from the one input, the first given by -r and dest_file
+	double scaleRatios[MAX_OUTPUTS];	// Scaling ratio output:input, per output
 	YUVType fileSubtype;		// FOURCC type of YUV file
 	int height;		// Input file height. Supplied on command line for YUV files only
 	int width;			// Input file width. Supplied on command line for YUV files only
 	const char *inFilename;		// Input file name
-	const char *outFilename;	// Output file name
+	const char *outFilenames[MAX_OUTPUTS];	// Output file names
 	EdgeMethod edgeMethod;		// Edge handling method
 	double gamma;				// Gamma value used to linearize pixel data
+	PixelPrecision linearPrecision;	// Precision of linear light images, DOUBLE or BPP16
+	YUVMatrix yuvMatrix;		// Matrix used for YUV<->RGB conversion
+	YUVRange yuvRange;			// Limited or full range YUV
+	bool verbose;				// Report processing choices to stderr
+	int numWorkers[NUM_PIPELINE_STAGES];	// Worker threads of each stage
+	int numTileThreads;			// Threads of the tile pool resizing frames in row bands, 0 for none
+	const char *manifestFilename;	// Batch manifest, one job per line, or directory or wildcard source of a batch
+	const char *batchOutput;	// Output directory, or name with * standing for input names, of a batch source
+	bool singleInputFile;		// Read input file alone, even if its name is numbered like a sequence
+	int numJobs;				// Batch jobs run at once, or daemon clients served at once
+	const char *daemonSocket;	// Socket the daemon serves requests on, NULL unless running as daemon
+	const char *statsSocket;	// Socket of the daemon to print stats of, NULL unless asking for them
 } CmdLineParms;
 
-// TODO: convert c-style struct to C++ class
+// Light linearized images of a frame, held from its degamma stage until its gamma stage
+typedef struct
+{
+	IMAGE imageInLinear;		// Degamma'ed input frame
+	IMAGE imageOutLinear[MAX_OUTPUTS];	// Resized frame per output size, still in linear light
+} LinearBuffers;
+
+// Frame passed along the stages of the pipeline, from loading it to saving it
+typedef struct
+{
+	IMAGE image;				// Input frame in resize color space, BPP16 if the file has more than 8 bits
+	IMAGE imageOut[MAX_OUTPUTS];	// Output frames in resize color space, BPP16 if the file has more than 8 bits
+	LinearBuffers *pLinear;		// Taken by the degamma stage and given back by the gamma stage
+	int frameNumber;			// Output frame number, used to name output BMP files
+	int sequence;				// Position in read order, used by the writer to restore it
+} FrameSlot;
+
+// State shared by the worker threads of all stages
+// Stage i takes frames from pendingSlots[i] and passes them on to pendingSlots[i + 1];
+// the save stage returns them to pendingSlots[LOAD_STAGE], which holds the free slots
+// Outputs of equal dimensions share one size: the frame is resized once for all of them
+typedef struct
+{
+	const CmdLineParms *parms;
+	const ImageFileInfo *inFileInfo;
+	const ImageFileInfo *outFileInfos;
+	int numOutputs;
+	int numSizes;
+	int sizeWidths[MAX_OUTPUTS];
+	int sizeHeights[MAX_OUTPUTS];
+	int outputSizes[MAX_OUTPUTS];				// Size each output is gamma corrected from
+	int numSlots;
+	FrameSlot *slots;
+	int numLinearBuffers;
+	LinearBuffers *linearBuffers;
+	FrameQueue *pendingSlots[NUM_PIPELINE_STAGES];
+	FrameQueue *freeLinearBuffers;
+	YUVSequenceWriter outWriters[MAX_OUTPUTS];	// Used by save stage for YUV output
+	bool readFailed;							// Set by load stage on unrecoverable error
+} FramePipeline;
+
+// Worker thread of one stage, with the plans and LUTs shared by all workers
+typedef struct
+{
+	FramePipeline *pPipeline;
+	PipelineStage stage;
+	const ResizePlan *pPlans[MAX_OUTPUTS];	// Per output size
+	const GammaLUTs *pLUTs[MAX_OUTPUTS];	// Per output; degamma uses the forward LUT of the first
+	IMAGE imageTmp[MAX_OUTPUTS];	// Resize stage: horizontally resized frame per output size, at input height
+	TiledResize tiled[MAX_OUTPUTS];	// Resize stage with a tile pool: its frames' tiles per output size
+	double busyTime;			// Seconds spent on frames, not waiting for them
+	int numFrames;				// Frames passed on to the next stage
+	bool failed;				// Set on unrecoverable error
+} StageWorker;
+
+// One job of a batch: a manifest line, or the input and output names of one source file, split into arguments
+// as on the command line
+typedef struct
+{
+	int lineNumber;				// Line of the manifest, or number of the source file
+	char line[MAX_MANIFEST_LINE];
+	int argc;
+	char *argv[MAX_JOB_ARGS];	// argv[0] is the manifest name, the others point into line
+	bool succeeded;
+} BatchJob;
+
+// Batch of jobs run by several threads, each taking the next job from pendingJobs
 typedef struct
 {
-	double **filterWeights;		// Filter weights
-	int **contribPixPos;		// Position of contributing pixels
-	int *numContribPixels;		// Number of contributors for target pixel
-	double *weightsSum;			// Sum of weights for target pixel
-} ContribTable;
+	const CmdLineParms *parms;	// Options of the command line, defaults of every job
+	const char *jobKind;		// "line" of a manifest or "file" of a source, reporting jobs
+	FrameQueue *pendingJobs;
+	ResizeContext *pContext;	// Tables, LUTs and tile pool shared by all jobs
+} Batch;
 
 #endif //#ifndef LANCZOS_RESIZE_H_
@@ -0,0 +1,871 @@
+// ImageResizeLib.cpp, lanczos resizer library: contributor tables, gamma LUTs and resizing of in-memory images
+// See MIT_License.txt
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <mutex>
+#include "ImageResizeLib.h"
+#include "Utils.h"
+
+#define M_PI				3.14159265358979323846
+#define EPSILON				.0000125
+#define LANCZOS2_NUMTAPS	2.0
+#define CONVERT_COST		3.0		// Estimated cost of RGB<->YUV conversion per pixel, in filter taps
+
+// Private functions
+static double sinc(double x);
+static double lanczos2Filter(double in);
+static bool MakeContribTable(ContribTable *contribTable, int inDimSize, 
+	int outDimSize, EdgeMethod edgeMethod);
+static void DestroyContribTable(ContribTable *contribTable);
+static bool CreateResizePlan(ResizePlan *pPlan, ColorSpaces colorSpace, int inWidth, int inHeight,
+	int outWidth, int outHeight, EdgeMethod edgeMethod);
+static void ResizeRows(const IMAGE *pImageIn, IMAGE *pImageOut, int plane, bool vertical, int firstRow, int numRows,
+	int width, EdgeMethod edgeMethod, const ContribTable *pContribs);
+static void GetChromaSteps(ColorSpaces colorSpace, int *pXInc, int *pYInc);
+static void RunResizeTile(void *context, int task);
+static double ResizeCost(ColorSpaces colorSpace, int inWidth, int inHeight, int outWidth, int outHeight);
+static bool CreateGammaLUTs(GammaLUTs *pLUTs, double gamma, int inBitDepth, int outBitDepth,
+	PixelPrecision linearPrecision);
+static ResizeBuffers *TakeResizeBuffers(ResizeContext *pContext, ColorSpaces colorSpace, int inWidth, int inHeight,
+	int outWidth, int outHeight, PixelPrecision linearPrecision);
+static void GiveBackResizeBuffers(ResizeContext *pContext, ResizeBuffers *pBuffers);
+static void DestroyResizeBuffers(ResizeBuffers *pBuffers);
+
+// sinc(x) function
+static double sinc(double x) 
+{
+	x *= M_PI;
+
+	if ((x < EPSILON) && (x > -EPSILON)) 
+	{
+		// Handle range near divide by zero
+		return (1.0f + x*x*(-1 / 6.0f + x*x / 120.0f));
+	}
+
+	return sin(x) / x;
+}
+
+static double fabsThresh(double x, double thresh)
+{
+	if (fabs(x) < thresh)
+		return 0.0;
+	return x;
+}
+
+// Returns filter weight at position t
+static double lanczos2Filter(double t)
+{
+	const double R = LANCZOS2_NUMTAPS;
+
+	if (t < 0.0f)
+		t = -t;
+
+	// return windowed sinc based on number of lobes
+	// Lanzos2 filter defined by lobes=2
+	if (t < R)
+		return fabsThresh(sinc(t)*sinc(t / R), EPSILON);
+	else
+		return (0.0f);
+}
+
+// 1D horizontal filter using contributor table
+static void Filter1DHorz(const IMAGE *pImageIn, IMAGE *pImageOut,
+	int x, int y, int plane, EdgeMethod edgeMethod, ContribTable contribs)
+{
+	double tmpResult = 0.0;
+	if (pImageIn->precision == BPP16)
+	{
+		for (int k = 0; k < contribs.numContribPixels[x]; k++)
+		{
+			double tmpPixel = pImageIn->pix16Array[plane][y][contribs.contribPixPos[x][k]];
+			tmpResult += contribs.filterWeights[x][k] * tmpPixel;
+		}
+		tmpResult /= contribs.weightsSum[x];
+		pImageOut->pix16Array[plane][y][x] = (PIXEL16)CLAMP(tmpResult + 0.5, 0, PIX16MAX);
+		return;
+	}
+	for (int k = 0; k < contribs.numContribPixels[x]; k++)
+	{
+		double tmpPixel = pImageIn->dblPixArray[plane][y][contribs.contribPixPos[x][k]];
+		tmpResult += contribs.filterWeights[x][k] * tmpPixel;
+	}
+	tmpResult /= contribs.weightsSum[x];
+	double outPixel = CLAMP(tmpResult, 0, 1.0);
+	pImageOut->dblPixArray[plane][y][x] = outPixel;
+}
+
+// 1D vertical filter using contributor table
+static void Filter1DVert(const IMAGE *pImageIn, IMAGE *pImageOut,
+	int x, int y, int plane, EdgeMethod edgeMethod, ContribTable contribs)
+{
+	double tmpResult = 0.0;
+	if (pImageIn->precision == BPP16)
+	{
+		for (int k = 0; k < contribs.numContribPixels[y]; k++)
+		{
+			double tmpPixel = pImageIn->pix16Array[plane][contribs.contribPixPos[y][k]][x];
+			tmpResult += contribs.filterWeights[y][k] * tmpPixel;
+		}
+		tmpResult /= contribs.weightsSum[y];
+		pImageOut->pix16Array[plane][y][x] = (PIXEL16)CLAMP(tmpResult + 0.5, 0, PIX16MAX);
+		return;
+	}
+	for (int k = 0; k < contribs.numContribPixels[y]; k++)
+	{
+		double tmpPixel = pImageIn->dblPixArray[plane][contribs.contribPixPos[y][k]][x];
+		tmpResult += contribs.filterWeights[y][k] * tmpPixel;
+	}
+	tmpResult /= contribs.weightsSum[y];
+	double outPixel = CLAMP(tmpResult, 0, 1.0);
+	pImageOut->dblPixArray[plane][y][x] = outPixel;
+}
+
+// Resizes rows firstRow..firstRow + numRows - 1 of one plane, width pixels each: horizontally, into the same rows
+// of pImageOut, or vertically, using the contributor table of that direction
+static void ResizeRows(const IMAGE *pImageIn, IMAGE *pImageOut, int plane, bool vertical, int firstRow, int numRows,
+	int width, EdgeMethod edgeMethod, const ContribTable *pContribs)
+{
+	for (int y = firstRow; y < firstRow + numRows; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			if (vertical)
+				Filter1DVert(pImageIn, pImageOut, x, y, plane, edgeMethod, *pContribs);
+			else
+				Filter1DHorz(pImageIn, pImageOut, x, y, plane, edgeMethod, *pContribs);
+		}
+	}
+}
+
+// Steps in pixels between chroma samples of color space, horizontally and vertically
+static void GetChromaSteps(ColorSpaces colorSpace, int *pXInc, int *pYInc)
+{
+	*pXInc = (colorSpace == YUV420 || colorSpace == YUV422) ? 2 : 1;
+	*pYInc = (colorSpace == YUV420) ? 2 : 1;
+}
+
+// Makes pixel contribution table
+// Slight speed efficiency due to checking image boundaaries in O(n) time instead of every pixel O(n^2)
+// Allows precomputation of arbitrary filter phases for arbitrary scaling ratios
+static bool MakeContribTable(ContribTable *contribTable, int inDimSize, int outDimSize, EdgeMethod edgeMethod)
+{
+	double scaleRatio = (double)outDimSize / inDimSize;	// scale ratio
+
+	double scaledHalfTaps;	// Max one-sided number of filter taps, depends on if up or downscaling
+	double filterScale;		// 
+
+	if (scaleRatio > 1.0)
+	{
+		// Horizontal upscaling
+		filterScale = 1.0;
+		scaledHalfTaps = LANCZOS2_NUMTAPS;
+	}
+	else
+	{
+		// Horizontal downscaling
+		filterScale = scaleRatio;
+		scaledHalfTaps = LANCZOS2_NUMTAPS / scaleRatio;
+	}
+	int maxTaps = (int)(2 * scaledHalfTaps + 1);
+
+	contribTable->filterWeights = Create2DArray(double, outDimSize, maxTaps);	// filter weights
+	contribTable->contribPixPos = Create2DArray(int, outDimSize, maxTaps);		// contributing pixels
+	contribTable->numContribPixels = (int *)calloc(outDimSize, sizeof(int));		// number of contributors for target pixel
+	contribTable->weightsSum = (double *)calloc(outDimSize, sizeof(double));		// sum of weights for target pixel
+
+	if (!contribTable->filterWeights || !contribTable->contribPixPos ||
+		!contribTable->numContribPixels || !contribTable->weightsSum)
+	{
+		fprintf(stderr, "ERROR: MakeContribTable(): Could not allocate memory for ContribTable!\n");
+		DestroyContribTable(contribTable);
+		return FALSE;
+	}
+
+	// Precalculate filter weights for each target pixel in output row
+	// Number of contributing input pixels per output target pixel is variable depending on filter phase
+	for (int i = 0; i < outDimSize; i++)
+	{
+		// Calculate extents of contributor pixels
+		// Supports all scaling ratios, both shrink and expand
+		double center = ((double)i + 0.5f) / scaleRatio - 0.5f;
+		int left = (int)(floor(center - scaledHalfTaps));
+		int right = (int)(ceil(center + scaledHalfTaps));
+
+		for (int j = left; j <= right; j++)
+		{
+			// If edgeMethod == NOCONTRIB and contributing pixel lies outside iamge area, skip it
+			// i.e. filter weight is 0
+			if (edgeMethod == NOCONTRIB && (j<0 || j>(int)inDimSize))
+				continue;
+
+			double weight;
+			if ((weight = lanczos2Filter((center - j) * filterScale)) == 0)
+				continue;
+
+			// Handle image edge cases
+			int x = HandleEdgeCase(j, (int)inDimSize, edgeMethod);
+
+			contribTable->filterWeights[i][contribTable->numContribPixels[i]] = weight;
+			contribTable->contribPixPos[i][contribTable->numContribPixels[i]] = x;
+			contribTable->weightsSum[i] += weight;
+			contribTable->numContribPixels[i]++;
+		}
+	}
+
+	return TRUE;
+}
+
+// Safely deallocate contributor table storage
+static void DestroyContribTable(ContribTable *contribTable)
+{
+	if (contribTable->filterWeights)
+		Destroy2DArray(contribTable->filterWeights);
+	if (contribTable->contribPixPos)
+		Destroy2DArray(contribTable->contribPixPos);
+	if (contribTable->numContribPixels)
+		free(contribTable->numContribPixels);
+	if (contribTable->weightsSum)
+		free(contribTable->weightsSum);
+	memset(contribTable, 0, sizeof(ContribTable));
+}
+
+// Makes contributor tables for resizing frames of given color space and dimensions
+// Separate tables for Y, UV planes facilitate image edge handling for differently sized YUV422/YUV420 chroma planes
+static bool CreateResizePlan(ResizePlan *pPlan, ColorSpaces colorSpace, int inWidth, int inHeight,
+	int outWidth, int outHeight, EdgeMethod edgeMethod)
+{
+	memset(pPlan, 0, sizeof(ResizePlan));
+	pPlan->colorSpace = colorSpace;
+
+	if (!MakeContribTable(&pPlan->horz, inWidth, outWidth, edgeMethod) ||
+		!MakeContribTable(&pPlan->vert, inHeight, outHeight, edgeMethod))
+	{
+		DestroyResizePlan(pPlan);
+		return FALSE;
+	}
+	pPlan->horzUV = pPlan->horz;
+	pPlan->vertUV = pPlan->vert;
+	if (colorSpace == YUV420 || colorSpace == YUV422)
+	{
+		if (!MakeContribTable(&pPlan->horzUV, inWidth / 2, outWidth / 2, edgeMethod))
+		{
+			DestroyResizePlan(pPlan);
+			return FALSE;
+		}
+	}
+	if (colorSpace == YUV420)
+	{
+		if (!MakeContribTable(&pPlan->vertUV, inHeight / 2, outHeight / 2, edgeMethod))
+		{
+			DestroyResizePlan(pPlan);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// Safely deallocate contributor tables of plan, including any not yet made
+void DestroyResizePlan(ResizePlan *pPlan)
+{
+	if (pPlan->horzUV.filterWeights != pPlan->horz.filterWeights)
+		DestroyContribTable(&pPlan->horzUV);
+	if (pPlan->vertUV.filterWeights != pPlan->vert.filterWeights)
+		DestroyContribTable(&pPlan->vertUV);
+	DestroyContribTable(&pPlan->horz);
+	DestroyContribTable(&pPlan->vert);
+	memset(pPlan, 0, sizeof(ResizePlan));
+}
+
+// Main rescaling function
+// Currently hardcoded to 2D separable Lanczos2 filter, using the contributor tables of pPlan
+// pImageTmp holds the horizontally resized image: output width, input height
+// Note:Image scaling done in *Linear Light domain*, i.e. RGB or YUV,
+//		not in linear perception domain (Y'UV or R'G'B'),
+//		so gamma correction must be applied before & after this function.
+//		Doing it this way makes for much better quality in dark regions, especially in shrink case.
+bool ResizeImage(const IMAGE *pImageIn, IMAGE *pImageOut, IMAGE *pImageTmp, const ResizePlan *pPlan,
+	EdgeMethod edgeMethod)
+{
+	// In, out image same size: no rescaling
+	if ((pImageIn->width == pImageOut->width) && (pImageIn->height == pImageOut->height))
+	{
+		CopyImage(pImageIn, pImageOut);
+		return TRUE;
+	}
+
+	if (pImageIn->colorSpace != pPlan->colorSpace || pImageTmp->width != pImageOut->width ||
+		pImageTmp->height != pImageIn->height)
+	{
+		fprintf(stderr, "ERROR: ResizeImage(): Images do not match resize plan!\n");
+		return FALSE;
+	}
+
+	// Horizontal scaling
+	if (!ResizeImagePass(pImageIn, pImageTmp, pPlan, edgeMethod, FALSE))
+		return FALSE;
+
+	// Vertical scaling
+	// In, out image same size: no rescaling
+	if (pImageIn->height == pImageOut->height)
+	{
+		CopyImage(pImageTmp, pImageOut);
+		return TRUE;
+	}
+
+	return ResizeImagePass(pImageTmp, pImageOut, pPlan, edgeMethod, TRUE);
+}
+
+// One pass of ResizeImage(): horizontal, pImageIn to an image of output width and input height,
+// or vertical, from that image to pImageOut
+bool ResizeImagePass(const IMAGE *pImageIn, IMAGE *pImageOut, const ResizePlan *pPlan, EdgeMethod edgeMethod,
+	bool vertical)
+{
+	if (pImageIn->colorSpace != pPlan->colorSpace || pImageOut->colorSpace != pPlan->colorSpace ||
+		(vertical ? (pImageIn->width != pImageOut->width) : (pImageIn->height != pImageOut->height)))
+	{
+		fprintf(stderr, "ERROR: ResizeImagePass(): Images do not match resize plan!\n");
+		return FALSE;
+	}
+
+	int xinc, yinc;
+	GetChromaSteps(pImageIn->colorSpace, &xinc, &yinc);
+
+	// Y/R plane, then UV/GB planes
+	for (int plane = Y_PLANE; plane <= V_PLANE; plane++)
+	{
+		int numRows = vertical ? pImageOut->height : pImageIn->height;
+		const ContribTable *pContribs = vertical ? &pPlan->vert : &pPlan->horz;
+		if (plane != Y_PLANE)
+		{
+			numRows /= yinc;
+			pContribs = vertical ? &pPlan->vertUV : &pPlan->horzUV;
+		}
+		ResizeRows(pImageIn, pImageOut, plane, vertical, 0, numRows,
+			(plane == Y_PLANE) ? pImageOut->width : pImageOut->width / xinc, edgeMethod, pContribs);
+	}
+
+	return TRUE;
+}
+
+// Cuts the resize of frames of given dimensions into tiles of TILE_ROWS rows per plane and pass, run as a job
+// on pPool. Only frames resized in both directions are tiled: pTiled->pJob stays NULL for others
+bool CreateTiledResize(TiledResize *pTiled, TilePool *pPool, const ResizePlan *pPlan, int inWidth, int inHeight,
+	int outWidth, int outHeight, EdgeMethod edgeMethod)
+{
+	memset(pTiled, 0, sizeof(TiledResize));
+	pTiled->pPlan = pPlan;
+	pTiled->edgeMethod = edgeMethod;
+	if (inWidth == outWidth || inHeight == outHeight)
+		return TRUE;
+
+	int xinc, yinc;
+	GetChromaSteps(pPlan->colorSpace, &xinc, &yinc);
+	int horzRows[3], vertRows[3], widths[3];
+	for (int plane = Y_PLANE; plane <= V_PLANE; plane++)
+	{
+		horzRows[plane] = (plane == Y_PLANE) ? inHeight : inHeight / yinc;
+		vertRows[plane] = (plane == Y_PLANE) ? outHeight : outHeight / yinc;
+		widths[plane] = (plane == Y_PLANE) ? outWidth : outWidth / xinc;
+		pTiled->numTiles += (horzRows[plane] + TILE_ROWS - 1) / TILE_ROWS + (vertRows[plane] + TILE_ROWS - 1) / TILE_ROWS;
+	}
+
+	pTiled->tiles = (ResizeTile *)calloc(pTiled->numTiles, sizeof(ResizeTile));
+	int *firstDependent = (int *)malloc(pTiled->numTiles * sizeof(int));
+	int *lastDependent = (int *)malloc(pTiled->numTiles * sizeof(int));
+	if (!pTiled->tiles || !firstDependent || !lastDependent)
+	{
+		fprintf(stderr, "ERROR: CreateTiledResize(): Could not allocate tiles!\n");
+		free(firstDependent);
+		free(lastDependent);
+		DestroyTiledResize(pTiled);
+		return FALSE;
+	}
+
+	// Horizontal tiles of all planes first, so that they are queued ahead of the vertical tiles waiting for them
+	int firstHorzTile[3];
+	int numTiles = 0;
+	for (int vertical = FALSE; vertical <= TRUE; vertical++)
+	{
+		for (int plane = Y_PLANE; plane <= V_PLANE; plane++)
+		{
+			int numRows = vertical ? vertRows[plane] : horzRows[plane];
+			if (!vertical)
+				firstHorzTile[plane] = numTiles;
+			for (int y = 0; y < numRows; y += TILE_ROWS, numTiles++)
+			{
+				ResizeTile *pTile = &pTiled->tiles[numTiles];
+				pTile->plane = plane;
+				pTile->vertical = vertical ? TRUE : FALSE;
+				pTile->firstRow = y;
+				pTile->numRows = MIN(TILE_ROWS, numRows - y);
+				pTile->width = widths[plane];
+				firstDependent[numTiles] = pTiled->numTiles;
+				lastDependent[numTiles] = -1;
+			}
+		}
+	}
+
+	// A vertical tile depends on the horizontal tiles holding the rows its contributor table reads
+	for (int i = 0; i < pTiled->numTiles; i++)
+	{
+		const ResizeTile *pTile = &pTiled->tiles[i];
+		if (!pTile->vertical)
+			continue;
+		const ContribTable *pContribs = (pTile->plane == Y_PLANE) ? &pPlan->vert : &pPlan->vertUV;
+		int minRow = horzRows[pTile->plane] - 1, maxRow = 0;
+		for (int y = pTile->firstRow; y < pTile->firstRow + pTile->numRows; y++)
+		{
+			for (int k = 0; k < pContribs->numContribPixels[y]; k++)
+			{
+				int row = CLAMP(pContribs->contribPixPos[y][k], 0, horzRows[pTile->plane] - 1);
+				minRow = MIN(minRow, row);
+				maxRow = MAX(maxRow, row);
+			}
+		}
+		for (int j = minRow / TILE_ROWS; j <= maxRow / TILE_ROWS; j++)
+		{
+			int horzTile = firstHorzTile[pTile->plane] + j;
+			firstDependent[horzTile] = MIN(firstDependent[horzTile], i);
+			lastDependent[horzTile] = MAX(lastDependent[horzTile], i);
+		}
+	}
+
+	pTiled->pJob = CreateTileJob(pPool, pTiled->numTiles, RunResizeTile, pTiled);
+	for (int i = 0; pTiled->pJob && i < pTiled->numTiles; i++)
+		SetTileDependents(pTiled->pJob, i, firstDependent[i], lastDependent[i]);
+	free(firstDependent);
+	free(lastDependent);
+	if (!pTiled->pJob)
+	{
+		DestroyTiledResize(pTiled);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void DestroyTiledResize(TiledResize *pTiled)
+{
+	DestroyTileJob(pTiled->pJob);
+	free(pTiled->tiles);
+	memset(pTiled, 0, sizeof(TiledResize));
+}
+
+// Tile task: resizes the rows of one tile, run on a tile pool thread
+static void RunResizeTile(void *context, int task)
+{
+	const TiledResize *pTiled = (const TiledResize *)context;
+	const ResizeTile *pTile = &pTiled->tiles[task];
+	const ResizePlan *pPlan = pTiled->pPlan;
+
+	if (pTile->vertical)
+	{
+		ResizeRows(pTiled->pImageTmp, pTiled->pImageOut, pTile->plane, TRUE, pTile->firstRow, pTile->numRows,
+			pTile->width, pTiled->edgeMethod, (pTile->plane == Y_PLANE) ? &pPlan->vert : &pPlan->vertUV);
+	}
+	else
+	{
+		ResizeRows(pTiled->pImageIn, pTiled->pImageTmp, pTile->plane, FALSE, pTile->firstRow, pTile->numRows,
+			pTile->width, pTiled->edgeMethod, (pTile->plane == Y_PLANE) ? &pPlan->horz : &pPlan->horzUV);
+	}
+}
+
+// Same as ResizeImage(), with the tiles of pTiled run on its tile pool
+// Returns once they are queued: the image is resized once WaitTileJob(pTiled->pJob) returns
+bool StartResizeImageTiled(TiledResize *pTiled, const IMAGE *pImageIn, IMAGE *pImageOut, IMAGE *pImageTmp)
+{
+	if (pImageIn->colorSpace != pTiled->pPlan->colorSpace || pImageTmp->width != pImageOut->width ||
+		pImageTmp->height != pImageIn->height)
+	{
+		fprintf(stderr, "ERROR: StartResizeImageTiled(): Images do not match resize plan!\n");
+		return FALSE;
+	}
+
+	pTiled->pImageIn = pImageIn;
+	pTiled->pImageTmp = pImageTmp;
+	pTiled->pImageOut = pImageOut;
+	StartTileJob(pTiled->pJob);
+	return TRUE;
+}
+
+// Estimated cost of degamma, resize and gamma of one image in the given color space,
+// in filter taps (multiply-accumulates) summed over all planes
+static double ResizeCost(ColorSpaces colorSpace, int inWidth, int inHeight, int outWidth, int outHeight)
+{
+	// Samples per pixel, summed over all planes
+	double planeFactor;
+	switch (colorSpace)
+	{
+	case YUV420:
+		planeFactor = 1.5;
+		break;
+	case YUV422:
+		planeFactor = 2.0;
+		break;
+	default:
+		planeFactor = 3.0;
+		break;
+	}
+
+	// Lanczos2 filter spans 2*LANCZOS2_NUMTAPS input pixels, widened by the shrink factor when downscaling
+	double hTaps = 2 * LANCZOS2_NUMTAPS * MAX(1.0, (double)inWidth / outWidth);
+	double vTaps = 2 * LANCZOS2_NUMTAPS * MAX(1.0, (double)inHeight / outHeight);
+
+	double degammaCost = (double)inWidth * inHeight;
+	double hCost = (double)outWidth * inHeight * hTaps;
+	double vCost = (double)outWidth * outHeight * vTaps;
+	double gammaCost = (double)outWidth * outHeight;
+
+	return planeFactor * (degammaCost + hCost + vCost + gammaCost);
+}
+
+// Chooses color space to resize in when input and output file color spaces differ:
+// either convert at input size then resize, or resize then convert at output size
+ColorSpaces ChooseResizeColorSpace(ColorSpaces inColorSpace, ColorSpaces outColorSpace,
+	int inWidth, int inHeight, int outWidth, int outHeight, bool verbose)
+{
+	static const char *colorSpaceNames[] = { "RGB", "YUV444", "YUV422", "YUV420" };
+
+	if (inColorSpace == outColorSpace)
+	{
+		if (verbose)
+			fprintf(stderr, "Resizing in %s color space\n", colorSpaceNames[inColorSpace]);
+		return inColorSpace;
+	}
+
+	double resizeThenConvert = ResizeCost(inColorSpace, inWidth, inHeight, outWidth, outHeight) +
+		CONVERT_COST * outWidth * outHeight;
+	double convertThenResize = CONVERT_COST * inWidth * inHeight +
+		ResizeCost(outColorSpace, inWidth, inHeight, outWidth, outHeight);
+
+	ColorSpaces resizeColorSpace = (convertThenResize < resizeThenConvert) ? outColorSpace : inColorSpace;
+	if (verbose)
+	{
+		fprintf(stderr, "Resizing in %s color space: %s (estimated cost %.3g vs %.3g for %s)\n",
+			colorSpaceNames[resizeColorSpace],
+			(resizeColorSpace == outColorSpace) ? "convert->resize" : "resize->convert",
+			MIN(convertThenResize, resizeThenConvert), MAX(convertThenResize, resizeThenConvert),
+			(resizeColorSpace == outColorSpace) ? "resize->convert" : "convert->resize");
+	}
+	return resizeColorSpace;
+}
+
+// Creates forward LUT with one entry per input code and reverse LUT for output display pixels
+// Codes of different bit depths for the same level map to the same linear light value, see DISPLAY_WHITE()
+static bool CreateGammaLUTs(GammaLUTs *pLUTs, double gamma, int inBitDepth, int outBitDepth,
+	PixelPrecision linearPrecision)
+{
+	memset(pLUTs, 0, sizeof(GammaLUTs));
+	const int fwdGammaLutSize = 1 << inBitDepth;
+	const int bwdGammaLutSize = GetBwdGammaLutSize(linearPrecision, outBitDepth);
+	pLUTs->fwdGamma = (double *)malloc(fwdGammaLutSize * sizeof(double));
+	pLUTs->fwdGamma16 = (PIXEL16 *)malloc(fwdGammaLutSize * sizeof(PIXEL16));
+	if (outBitDepth > 8)
+		pLUTs->bwdGamma16 = (PIXEL16 *)malloc(bwdGammaLutSize * sizeof(PIXEL16));
+	else
+		pLUTs->bwdGamma = (PIXEL *)malloc(bwdGammaLutSize * sizeof(PIXEL));
+	if (!pLUTs->fwdGamma || !pLUTs->fwdGamma16 || (!pLUTs->bwdGamma && !pLUTs->bwdGamma16))
+	{
+		fprintf(stderr, "Could not allocate gamma LUTs!\n");
+		return FALSE;
+	}
+
+	// Forward LUT. Codes above white, from 1 << inBitDepth of more than 8 bits, go past 1.0
+	for (int i = 0; i < fwdGammaLutSize; ++i)
+		pLUTs->fwdGamma[i] = (double)pow((double)i / (double)DISPLAY_WHITE(inBitDepth), gamma);
+
+	// 16-bit linear light version of the forward LUT
+	for (int i = 0; i < fwdGammaLutSize; ++i)
+		pLUTs->fwdGamma16[i] = (PIXEL16)MIN(pLUTs->fwdGamma[i] * PIX16MAX + 0.5, PIX16MAX);
+
+	// Create reverse LUT to account for higher resolution needed for linear light/nonlinear perception
+	// 4 bits more than output for double precision linear light, 16-bit so it can be indexed directly by 16-bit pixels
+	const double invGamma = 1.0 / gamma;
+	const int outWhite = DISPLAY_WHITE(outBitDepth);
+	const int outMax = (1 << outBitDepth) - 1;
+	for (int i = 0; i < bwdGammaLutSize; ++i)
+	{
+		double pixval = CLAMP((double)outWhite * pow((double)i / bwdGammaLutSize, invGamma) + 0.5f, 0, outMax);
+		if (outBitDepth > 8)
+			pLUTs->bwdGamma16[i] = (PIXEL16)pixval;
+		else
+			pLUTs->bwdGamma[i] = (PIXEL)pixval;
+	}
+
+	return TRUE;
+}
+
+void DestroyGammaLUTs(GammaLUTs *pLUTs)
+{
+	free(pLUTs->fwdGamma);
+	free(pLUTs->fwdGamma16);
+	free(pLUTs->bwdGamma);
+	free(pLUTs->bwdGamma16);
+	memset(pLUTs, 0, sizeof(GammaLUTs));
+}
+
+struct ResizeContext
+{
+	std::mutex lock;			// Guards the cached tables and pooled buffers
+	int numLUTs;
+	CachedGammaLUTs luts[MAX_CACHED_TABLES];
+	int numPlans;
+	CachedResizePlan plans[MAX_CACHED_TABLES];
+	int numBuffers;
+	ResizeBuffers *buffers[MAX_POOLED_BUFFERS];
+	TilePool *pTilePool;
+};
+
+ResizeContext *CreateResizeContext(int numTileThreads)
+{
+	ResizeContext *pContext = new ResizeContext;
+	pContext->numLUTs = 0;
+	pContext->numPlans = 0;
+	pContext->numBuffers = 0;
+	pContext->pTilePool = NULL;
+	if (numTileThreads > 0 && (pContext->pTilePool = CreateTilePool(numTileThreads)) == NULL)
+	{
+		delete pContext;
+		return NULL;
+	}
+	return pContext;
+}
+
+void DestroyResizeContext(ResizeContext *pContext)
+{
+	if (pContext == NULL)
+		return;
+	for (int i = 0; i < pContext->numLUTs; i++)
+		DestroyGammaLUTs(&pContext->luts[i].luts);
+	for (int i = 0; i < pContext->numPlans; i++)
+		DestroyResizePlan(&pContext->plans[i].plan);
+	for (int i = 0; i < pContext->numBuffers; i++)
+		DestroyResizeBuffers(pContext->buffers[i]);
+	DestroyTilePool(pContext->pTilePool);
+	delete pContext;
+}
+
+TilePool *GetResizeContextTilePool(ResizeContext *pContext)
+{
+	return pContext->pTilePool;
+}
+
+// Gamma LUTs for the given parameters: from pContext, made there on first use, else made in pOwnLUTs,
+// without a context or once its cache is full. Returns NULL on failure
+const GammaLUTs *GetGammaLUTs(ResizeContext *pContext, GammaLUTs *pOwnLUTs, double gamma, int inBitDepth,
+	int outBitDepth, PixelPrecision linearPrecision)
+{
+	if (pContext)
+	{
+		std::lock_guard<std::mutex> guard(pContext->lock);
+		for (int i = 0; i < pContext->numLUTs; i++)
+		{
+			CachedGammaLUTs *pCached = &pContext->luts[i];
+			if (pCached->gamma == gamma && pCached->inBitDepth == inBitDepth &&
+				pCached->outBitDepth == outBitDepth && pCached->linearPrecision == linearPrecision)
+				return &pCached->luts;
+		}
+		if (pContext->numLUTs < MAX_CACHED_TABLES)
+		{
+			CachedGammaLUTs *pCached = &pContext->luts[pContext->numLUTs];
+			if (!CreateGammaLUTs(&pCached->luts, gamma, inBitDepth, outBitDepth, linearPrecision))
+			{
+				DestroyGammaLUTs(&pCached->luts);
+				return NULL;
+			}
+			pCached->gamma = gamma;
+			pCached->inBitDepth = inBitDepth;
+			pCached->outBitDepth = outBitDepth;
+			pCached->linearPrecision = linearPrecision;
+			pContext->numLUTs++;
+			return &pCached->luts;
+		}
+	}
+	return CreateGammaLUTs(pOwnLUTs, gamma, inBitDepth, outBitDepth, linearPrecision) ? pOwnLUTs : NULL;
+}
+
+// Resize plan for the given parameters: from pContext, made there on first use, else made in pOwnPlan,
+// without a context or once its cache is full. Returns NULL on failure
+const ResizePlan *GetResizePlan(ResizeContext *pContext, ResizePlan *pOwnPlan, ColorSpaces colorSpace,
+	int inWidth, int inHeight, int outWidth, int outHeight, EdgeMethod edgeMethod)
+{
+	if (pContext)
+	{
+		std::lock_guard<std::mutex> guard(pContext->lock);
+		for (int i = 0; i < pContext->numPlans; i++)
+		{
+			CachedResizePlan *pCached = &pContext->plans[i];
+			if (pCached->colorSpace == colorSpace && pCached->inWidth == inWidth && pCached->inHeight == inHeight &&
+				pCached->outWidth == outWidth && pCached->outHeight == outHeight && pCached->edgeMethod == edgeMethod)
+				return &pCached->plan;
+		}
+		if (pContext->numPlans < MAX_CACHED_TABLES)
+		{
+			CachedResizePlan *pCached = &pContext->plans[pContext->numPlans];
+			if (!CreateResizePlan(&pCached->plan, colorSpace, inWidth, inHeight, outWidth, outHeight, edgeMethod))
+				return NULL;
+			pCached->colorSpace = colorSpace;
+			pCached->inWidth = inWidth;
+			pCached->inHeight = inHeight;
+			pCached->outWidth = outWidth;
+			pCached->outHeight = outHeight;
+			pCached->edgeMethod = edgeMethod;
+			pContext->numPlans++;
+			return &pCached->plan;
+		}
+	}
+	return CreateResizePlan(pOwnPlan, colorSpace, inWidth, inHeight, outWidth, outHeight, edgeMethod) ?
+		pOwnPlan : NULL;
+}
+
+// Linear light buffers of the given dimensions: pooled ones of an earlier call if any, else new ones
+// Returns NULL on failure
+static ResizeBuffers *TakeResizeBuffers(ResizeContext *pContext, ColorSpaces colorSpace, int inWidth, int inHeight,
+	int outWidth, int outHeight, PixelPrecision linearPrecision)
+{
+	{
+		std::lock_guard<std::mutex> guard(pContext->lock);
+		for (int i = 0; i < pContext->numBuffers; i++)
+		{
+			ResizeBuffers *pBuffers = pContext->buffers[i];
+			if (pBuffers->colorSpace == colorSpace && pBuffers->inWidth == inWidth &&
+				pBuffers->inHeight == inHeight && pBuffers->outWidth == outWidth &&
+				pBuffers->outHeight == outHeight && pBuffers->linearPrecision == linearPrecision)
+			{
+				pContext->buffers[i] = pContext->buffers[--pContext->numBuffers];
+				return pBuffers;
+			}
+		}
+	}
+
+	ResizeBuffers *pBuffers = (ResizeBuffers *)calloc(1, sizeof(ResizeBuffers));
+	if (pBuffers == NULL)
+		return NULL;
+	pBuffers->colorSpace = colorSpace;
+	pBuffers->inWidth = inWidth;
+	pBuffers->inHeight = inHeight;
+	pBuffers->outWidth = outWidth;
+	pBuffers->outHeight = outHeight;
+	pBuffers->linearPrecision = linearPrecision;
+	pBuffers->imageInLinear = CreateImage(colorSpace, inWidth, inHeight, linearPrecision);
+	pBuffers->imageTmp = CreateImage(colorSpace, outWidth, inHeight, linearPrecision);
+	pBuffers->imageOutLinear = CreateImage(colorSpace, outWidth, outHeight, linearPrecision);
+	if (!IsImageAllocated(&pBuffers->imageInLinear) || !IsImageAllocated(&pBuffers->imageTmp) ||
+		!IsImageAllocated(&pBuffers->imageOutLinear))
+	{
+		DestroyResizeBuffers(pBuffers);
+		return NULL;
+	}
+	return pBuffers;
+}
+
+// Pools buffers for later calls, or deallocates them once the pool is full
+static void GiveBackResizeBuffers(ResizeContext *pContext, ResizeBuffers *pBuffers)
+{
+	{
+		std::lock_guard<std::mutex> guard(pContext->lock);
+		if (pContext->numBuffers < MAX_POOLED_BUFFERS)
+		{
+			pContext->buffers[pContext->numBuffers++] = pBuffers;
+			return;
+		}
+	}
+	DestroyResizeBuffers(pBuffers);
+}
+
+static void DestroyResizeBuffers(ResizeBuffers *pBuffers)
+{
+	if (pBuffers == NULL)
+		return;
+	DestroyImage(&pBuffers->imageInLinear);
+	DestroyImage(&pBuffers->imageTmp);
+	DestroyImage(&pBuffers->imageOutLinear);
+	free(pBuffers);
+}
+
+// Degamma, resize and gamma of one image, with the tables, LUTs, buffers and tile pool of pContext
+// The linear light precision selects which forward LUT is used, the output's bit depth which reverse LUT
+ResizeStatus ResizeFrame(ResizeContext *pContext, const IMAGE *pImageIn, IMAGE *pImageOut,
+	const ResizeOptions *pOptions)
+{
+	if (!IsImageAllocated(pImageIn) || !IsImageAllocated(pImageOut) ||
+		pImageIn->colorSpace != pImageOut->colorSpace ||
+		pImageIn->precision == DOUBLE || pImageOut->precision == DOUBLE ||
+		pOptions->linearPrecision == BPP8 ||
+		pImageIn->width < MIN_WIDTH || pImageIn->width > MAX_WIDTH ||
+		pImageIn->height < MIN_HEIGHT || pImageIn->height > MAX_HEIGHT ||
+		pImageOut->width < MIN_WIDTH || pImageOut->width > MAX_WIDTH ||
+		pImageOut->height < MIN_HEIGHT || pImageOut->height > MAX_HEIGHT)
+	{
+		fprintf(stderr, "ERROR: ResizeFrame(): Unsupported images or options!\n");
+		return RESIZE_INVALID_ARGUMENT;
+	}
+
+	// Tables and LUTs are made for this call only once the context's cache is full
+	GammaLUTs ownLUTs;
+	ResizePlan ownPlan;
+	TiledResize tiled;
+	memset(&ownLUTs, 0, sizeof(GammaLUTs));
+	memset(&ownPlan, 0, sizeof(ResizePlan));
+	memset(&tiled, 0, sizeof(TiledResize));
+	const GammaLUTs *pLUTs = GetGammaLUTs(pContext, &ownLUTs, pOptions->gamma, pImageIn->bitDepth,
+		pImageOut->bitDepth, pOptions->linearPrecision);
+	const ResizePlan *pPlan = pLUTs ? GetResizePlan(pContext, &ownPlan, pImageIn->colorSpace, pImageIn->width,
+		pImageIn->height, pImageOut->width, pImageOut->height, pOptions->edgeMethod) : NULL;
+	ResizeBuffers *pBuffers = pPlan ? TakeResizeBuffers(pContext, pImageIn->colorSpace, pImageIn->width,
+		pImageIn->height, pImageOut->width, pImageOut->height, pOptions->linearPrecision) : NULL;
+	ResizeStatus status = RESIZE_OUT_OF_MEMORY;
+	if (pBuffers && (!pContext->pTilePool || CreateTiledResize(&tiled, pContext->pTilePool, pPlan,
+		pImageIn->width, pImageIn->height, pImageOut->width, pImageOut->height, pOptions->edgeMethod)))
+	{
+		IMAGE *pImageInLinear = &pBuffers->imageInLinear;
+		IMAGE *pImageOutLinear = &pBuffers->imageOutLinear;
+		bool success = (pImageInLinear->precision == BPP16) ?
+			DegammaImage(pImageIn, pImageInLinear, pLUTs->fwdGamma16) :
+			DegammaImage(pImageIn, pImageInLinear, pLUTs->fwdGamma);
+		if (success && tiled.pJob)
+		{
+			success = StartResizeImageTiled(&tiled, pImageInLinear, pImageOutLinear, &pBuffers->imageTmp);
+			if (success)
+				WaitTileJob(tiled.pJob);
+		}
+		else if (success)
+		{
+			success = ResizeImage(pImageInLinear, pImageOutLinear, &pBuffers->imageTmp, pPlan,
+				pOptions->edgeMethod);
+		}
+		if (success)
+		{
+			success = (pImageOut->precision == BPP16) ?
+				GammaImage(pImageOutLinear, pImageOut, pLUTs->bwdGamma16) :
+				GammaImage(pImageOutLinear, pImageOut, pLUTs->bwdGamma);
+		}
+		status = success ? RESIZE_OK : RESIZE_FAILED;
+	}
+
+	if (pBuffers)
+		GiveBackResizeBuffers(pContext, pBuffers);
+	DestroyTiledResize(&tiled);
+	DestroyResizePlan(&ownPlan);
+	DestroyGammaLUTs(&ownLUTs);
+	return status;
+}
+
+const char *GetResizeStatusString(ResizeStatus status)
+{
+	switch (status)
+	{
+	case RESIZE_OK:
+		return "OK";
+	case RESIZE_INVALID_ARGUMENT:
+		return "Unsupported images or options";
+	case RESIZE_OUT_OF_MEMORY:
+		return "Out of memory";
+	case RESIZE_FAILED:
+		return "Resize failed";
+	default:
+		return "Unknown status";
+	}
+}
@@ -0,0 +1,184 @@
+// ImageResizeLib.h, lanczos resizer library: contributor tables, gamma LUTs and resizing of in-memory images
+// See MIT_License.txt
+
+#ifndef IMAGERESIZE_LIB_H_
+#define IMAGERESIZE_LIB_H_
+
+#include "Utils.h"
+#include "TilePool.h"
+
+#define MIN_WIDTH	1
+#define MAX_WIDTH	4096
+#define MIN_HEIGHT	1
+#define MAX_HEIGHT	4096
+
+#define TILE_ROWS			16	// Rows of a plane resized by one tile task
+#define MAX_CACHED_TABLES	16	// Distinct gamma LUTs, and distinct resize plans, kept by a context
+#define MAX_POOLED_BUFFERS	16	// Idle sets of linear light buffers kept by a context
+
+// Result of ResizeFrame()
+typedef enum
+{
+	RESIZE_OK,
+	RESIZE_INVALID_ARGUMENT,	// Images of different color spaces, DOUBLE precision or unsupported dimensions
+	RESIZE_OUT_OF_MEMORY,
+	RESIZE_FAILED				// Images do not match the LUTs or tables made for them
+} ResizeStatus;
+
+// Parameters of ResizeFrame() besides the images' own
+typedef struct
+{
+	double gamma;				// Gamma value used to linearize pixel data, 1.0 for none
+	EdgeMethod edgeMethod;		// Edge handling method
+	PixelPrecision linearPrecision;	// Precision of linear light images, DOUBLE or BPP16
+} ResizeOptions;
+
+// TODO: convert c-style struct to C++ class
+typedef struct
+{
+	double **filterWeights;		// Filter weights
+	int **contribPixPos;		// Position of contributing pixels
+	int *numContribPixels;		// Number of contributors for target pixel
+	double *weightsSum;			// Sum of weights for target pixel
+} ContribTable;
+
+// Contributor tables for resizing every frame of a sequence, computed once and shared read-only by all workers
+// Chroma tables alias the luma ones unless chroma planes are subsampled in that direction
+typedef struct
+{
+	ColorSpaces colorSpace;		// Color space the tables were made for
+	ContribTable horz;			// Y/R plane, horizontal
+	ContribTable horzUV;		// UV/GB planes, horizontal
+	ContribTable vert;			// Y/R plane, vertical
+	ContribTable vertUV;		// UV/GB planes, vertical
+} ResizePlan;
+
+// Rows of one plane resized by one tile task, in one pass
+typedef struct
+{
+	int plane;
+	bool vertical;				// Vertical pass, pImageTmp to pImageOut, else horizontal, pImageIn to pImageTmp
+	int firstRow;
+	int numRows;
+	int width;
+} ResizeTile;
+
+// Resize of frames cut into tiles of TILE_ROWS rows per plane and pass, run as a job on the tile pool
+// Vertical tiles wait only for the horizontal tiles of the rows they filter
+typedef struct
+{
+	const IMAGE *pImageIn;		// Images of the frame being resized
+	IMAGE *pImageTmp;
+	IMAGE *pImageOut;
+	const ResizePlan *pPlan;
+	EdgeMethod edgeMethod;
+	int numTiles;
+	ResizeTile *tiles;			// Horizontal tiles of all planes, then vertical ones
+	TileJob *pJob;
+} TiledResize;
+
+// Gamma LUTs, sized by the bit depths of input and output frames
+typedef struct
+{
+	double *fwdGamma;			// Display to linear light, one entry per input code
+	PIXEL16 *fwdGamma16;		// As fwdGamma, scaled to 0..PIX16MAX for 16-bit linear light
+	PIXEL *bwdGamma;			// Linear light to 8-bit display, NULL for output of more bits
+	PIXEL16 *bwdGamma16;		// Linear light to display of more than 8 bits, NULL for 8-bit output
+} GammaLUTs;
+
+// Gamma LUTs kept by a context, with the parameters they were made for
+typedef struct
+{
+	double gamma;
+	int inBitDepth;
+	int outBitDepth;
+	PixelPrecision linearPrecision;
+	GammaLUTs luts;
+} CachedGammaLUTs;
+
+// Resize plan kept by a context, with the parameters it was made for
+typedef struct
+{
+	ColorSpaces colorSpace;
+	int inWidth;
+	int inHeight;
+	int outWidth;
+	int outHeight;
+	EdgeMethod edgeMethod;
+	ResizePlan plan;
+} CachedResizePlan;
+
+// Linear light images of one ResizeFrame() call, pooled by the context for later calls of the same dimensions
+typedef struct
+{
+	ColorSpaces colorSpace;
+	int inWidth;
+	int inHeight;
+	int outWidth;
+	int outHeight;
+	PixelPrecision linearPrecision;
+	IMAGE imageInLinear;
+	IMAGE imageTmp;				// Horizontally resized image, at input height
+	IMAGE imageOutLinear;
+} ResizeBuffers;
+
+// Opaque resizer state: cached tables and LUTs, pooled buffers and an optional tile pool
+// Safe to use from any number of threads at once; what it hands out stays valid until it is destroyed
+typedef struct ResizeContext ResizeContext;
+
+/******************************************************************************
+* PUBLIC FUNCTIONS
+*****************************************************************************/
+
+// Creates context, with a tile pool of numTileThreads threads unless 0. Returns NULL on failure
+ResizeContext *CreateResizeContext(int numTileThreads);
+
+// Deallocates context and all it holds. No call may still be using it
+void DestroyResizeContext(ResizeContext *pContext);
+
+// Tile pool of context, NULL if it has none
+TilePool *GetResizeContextTilePool(ResizeContext *pContext);
+
+// Resizes pImageIn into pImageOut, both created by the caller in the same color space, BPP8 or BPP16,
+// with the bit depths and dimensions wanted. Light is linearized by pOptions->gamma for resizing
+// Frames are tiled on the context's tile pool, if any
+ResizeStatus ResizeFrame(ResizeContext *pContext, const IMAGE *pImageIn, IMAGE *pImageOut,
+	const ResizeOptions *pOptions);
+
+// Text describing status, for error messages
+const char *GetResizeStatusString(ResizeStatus status);
+
+// Steps of ResizeFrame(), for callers running them on threads of their own
+
+// Gamma LUTs and resize plan for the given parameters, cached in pContext, or made in pOwnLUTs and pOwnPlan
+// without a context or once its cache is full. Those must be zeroed beforehand and destroyed after use
+// Return NULL on failure
+const GammaLUTs *GetGammaLUTs(ResizeContext *pContext, GammaLUTs *pOwnLUTs, double gamma, int inBitDepth,
+	int outBitDepth, PixelPrecision linearPrecision);
+const ResizePlan *GetResizePlan(ResizeContext *pContext, ResizePlan *pOwnPlan, ColorSpaces colorSpace,
+	int inWidth, int inHeight, int outWidth, int outHeight, EdgeMethod edgeMethod);
+void DestroyGammaLUTs(GammaLUTs *pLUTs);
+void DestroyResizePlan(ResizePlan *pPlan);
+
+// Color space to resize in when converting between the given ones, the cheaper of resizing before or after
+ColorSpaces ChooseResizeColorSpace(ColorSpaces inColorSpace, ColorSpaces outColorSpace,
+	int inWidth, int inHeight, int outWidth, int outHeight, bool verbose);
+
+// Resizes linear light pImageIn into pImageOut with the tables of pPlan, through pImageTmp of output width
+// and input height
+bool ResizeImage(const IMAGE *pImageIn, IMAGE *pImageOut, IMAGE *pImageTmp, const ResizePlan *pPlan,
+	EdgeMethod edgeMethod);
+
+// One pass of ResizeImage(), horizontal, from pImageIn to pImageTmp, or vertical, from pImageTmp to pImageOut
+bool ResizeImagePass(const IMAGE *pImageIn, IMAGE *pImageOut, const ResizePlan *pPlan, EdgeMethod edgeMethod,
+	bool vertical);
+
+// Tiles the resize of frames of given dimensions as a job on pPool, see ResizeTile
+bool CreateTiledResize(TiledResize *pTiled, TilePool *pPool, const ResizePlan *pPlan, int inWidth, int inHeight,
+	int outWidth, int outHeight, EdgeMethod edgeMethod);
+void DestroyTiledResize(TiledResize *pTiled);
+
+// As ResizeImage(), on the tile pool. The image is resized once WaitTileJob(pTiled->pJob) returns
+bool StartResizeImageTiled(TiledResize *pTiled, const IMAGE *pImageIn, IMAGE *pImageOut, IMAGE *pImageTmp);
+
+#endif // #ifndef IMAGERESIZE_LIB_H_
@@ -0,0 +1,876 @@
+// ResizeBench.cpp, microbenchmarks of the resizer's hot paths on synthetic frames
+// See MIT_License.txt
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <thread>
+#include "ImageResizeLib.h"
+#include "Utils.h"
+
+#define DEFAULT_MIN_SECONDS	0.2		// Time each case is run for, at least
+#define MIN_ITERATIONS		3		// Calls each case is timed over, at least
+#define MAX_ITERATIONS		1000	// Calls each case is timed over, at most
+#define BENCH_GAMMA			2.2
+#define MAX_SCALING_THREADS	64		// Largest tile pool of the thread scaling sweep
+
+// One call of the code being measured. Returns FALSE on failure
+typedef bool (*BenchFunc)(void *context);
+
+typedef struct
+{
+	const char *name;
+	int width;
+	int height;
+} BenchSize;
+
+// Output dimensions are input dimensions * num / den
+typedef struct
+{
+	const char *name;
+	int num;
+	int den;
+} BenchRatio;
+
+typedef struct
+{
+	double minSeconds;
+	const char *filter;			// Only cases whose name contains it are run, NULL for all
+	const char *label;			// Recorded in the JSON report, e.g. the commit measured
+	const char *jsonFilename;	// JSON report file, NULL for stdout
+	int maxThreads;				// Largest tile pool of the thread scaling sweep
+	const char *chartFilename;	// SVG chart of thread scaling efficiency, NULL for none
+} BenchParms;
+
+// Timing of one case
+typedef struct
+{
+	char name[128];
+	int width;					// Frame dimensions: input, and output of resize cases
+	int height;
+	int outWidth;
+	int outHeight;
+	double pixels;				// Pixels of the frame processed per call, output pixels for resize cases
+	int threads;				// Tile pool threads of scaling cases, 0 for the others
+	int iterations;
+	double medianSeconds;
+	double minSeconds;
+} BenchResult;
+
+// State of the cases of each kind
+typedef struct
+{
+	ColorSpaces colorSpace;
+	int inWidth;
+	int inHeight;
+	int outWidth;
+	int outHeight;
+} PlanBench;
+
+typedef struct
+{
+	const IMAGE *pImageIn;
+	IMAGE *pImageOut;
+	const ResizePlan *pPlan;
+	bool vertical;
+} PassBench;
+
+typedef struct
+{
+	const IMAGE *pImageIn;
+	IMAGE *pImageOut;
+	const GammaLUTs *pLUTs;
+} GammaBench;
+
+typedef struct
+{
+	const IMAGE *pImageIn;
+	IMAGE *pImageOut;
+} ConvertBench;
+
+typedef struct
+{
+	const char *fileName;
+	IMAGE *pImage;
+	YUVType fileSubtype;		// Raw YUV files only
+} LoadBench;
+
+typedef struct
+{
+	ResizeContext *pContext;
+	const IMAGE *pImageIn;
+	IMAGE *pImageOut;
+	const ResizeOptions *pOptions;
+} FrameBench;
+
+static const BenchSize sizes[] = { { "qcif", 176, 144 }, { "720p", 1280, 720 }, { "1080p", 1920, 1080 },
+	{ "4k", 3840, 2160 } };
+static const BenchRatio ratios[] = { { "2x", 2, 1 }, { "0.5x", 1, 2 }, { "0.75x", 3, 4 } };
+static const ColorSpaces resizeColorSpaces[] = { YUV420, RGB };
+static const PixelPrecision linearPrecisions[] = { DOUBLE, BPP16 };
+static const BenchSize scalingSizes[] = { { "720p", 1280, 720 }, { "1080p", 1920, 1080 } };
+
+// Private functions
+static void print_usage();
+static bool ParseCmdLine(const int argc, char *argv[], BenchParms *parms);
+static double GetSeconds();
+static const char *ColorSpaceName(ColorSpaces colorSpace);
+static const char *PrecisionName(PixelPrecision precision);
+static void FillSyntheticImage(IMAGE *pImage, unsigned seed);
+static int CompareSeconds(const void *a, const void *b);
+static bool RunBench(const BenchParms *parms, BenchResult *pResult, BenchFunc run, void *context);
+static bool AddResult(BenchResult **pResults, int *pNumResults, const BenchResult *pResult);
+static bool WantBench(const BenchParms *parms, const char *name);
+static bool RunPlan(void *context);
+static bool RunPass(void *context);
+static bool RunDegamma(void *context);
+static bool RunGamma(void *context);
+static bool RunConvert(void *context);
+static bool RunLoadBmp(void *context);
+static bool RunLoadQoi(void *context);
+static bool RunLoadRawYUV(void *context);
+static bool RunFrame(void *context);
+static bool BenchPlans(const BenchParms *parms, BenchResult **pResults, int *pNumResults);
+static bool BenchResizePasses(const BenchParms *parms, BenchResult **pResults, int *pNumResults);
+static bool BenchGamma(const BenchParms *parms, BenchResult **pResults, int *pNumResults);
+static bool BenchConvert(const BenchParms *parms, BenchResult **pResults, int *pNumResults);
+static bool BenchLoaders(const BenchParms *parms, BenchResult **pResults, int *pNumResults);
+static bool BenchThreadScaling(const BenchParms *parms, BenchResult **pResults, int *pNumResults);
+static void WriteJsonString(FILE *file, const char *string);
+static bool WriteJsonReport(const BenchParms *parms, const BenchResult *results, int numResults);
+static bool WriteScalingChart(const BenchParms *parms, const BenchResult *results, int numResults);
+
+static void print_usage()
+{
+	printf("ResizeBench [options]\n");
+	printf("\nTimes contributor table setup, horizontal and vertical resize passes, degamma and gamma,\n");
+	printf("RGB<->YUV conversion and the BMP, QOI and raw YUV loaders on synthetic frames, one at a time\n");
+	printf("at QCIF, 720p, 1080p and 4K, reporting ns/pixel and MP/s to stderr and as JSON.\n");
+	printf("Then times tiled ResizeFrame() calls at 720p and 1080p on tile pools of 1, 2, 4 ... threads.\n");
+	printf("\nOptions:\n");
+	printf("-t <seconds>: Time each case is run for, at least. Default = %.1f\n", DEFAULT_MIN_SECONDS);
+	printf("-s <text>: Only run cases whose name contains text, e.g. resize_v/1080p\n");
+	printf("-l <label>: Label recorded in the JSON report, e.g. the commit measured\n");
+	printf("-o <file>: Write JSON report to file. Default: stdout\n");
+	printf("-j <threads>: Largest tile pool of the thread scaling sweep, 1 to %d. Default = %d\n",
+		MAX_SCALING_THREADS, MAX_SCALING_THREADS);
+	printf("-c <file>: Write SVG chart of thread scaling efficiency to file\n");
+	printf("\nExample of usage:\n");
+	printf("ResizeBench -l $(git rev-parse --short HEAD) -o bench.json\n");
+	printf("\tMeasure all cases; compare reports of different commits run on the same machine\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static bool ParseCmdLine(const int argc, char *argv[], BenchParms *parms)
+{
+	for (int arg_index = 1; arg_index < argc; arg_index++)
+	{
+		if (argv[arg_index][0] != '-' || !strchr("tslojc", argv[arg_index][1]) || argv[arg_index][2] != '\0' ||
+			arg_index + 1 >= argc)
+		{
+			fprintf(stderr, "Unrecognized option, or missing value: %s\n", argv[arg_index]);
+			return FALSE;
+		}
+		switch (argv[arg_index][1])
+		{
+		case 't':
+			parms->minSeconds = atof(argv[++arg_index]);
+			if (parms->minSeconds <= 0.0)
+			{
+				fprintf(stderr, "Unrecognized time per case.\n");
+				return FALSE;
+			}
+			break;
+		case 's':
+			parms->filter = argv[++arg_index];
+			break;
+		case 'l':
+			parms->label = argv[++arg_index];
+			break;
+		case 'o':
+			parms->jsonFilename = argv[++arg_index];
+			break;
+		case 'j':
+			parms->maxThreads = atoi(argv[++arg_index]);
+			if (parms->maxThreads < 1 || parms->maxThreads > MAX_SCALING_THREADS)
+			{
+				fprintf(stderr, "Unrecognized number of threads, or more than %d.\n", MAX_SCALING_THREADS);
+				return FALSE;
+			}
+			break;
+		case 'c':
+			parms->chartFilename = argv[++arg_index];
+			break;
+		}
+	}
+	return TRUE;
+}
+
+static double GetSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const char *ColorSpaceName(ColorSpaces colorSpace)
+{
+	switch (colorSpace)
+	{
+	case RGB:
+		return "rgb";
+	case YUV420:
+		return "yuv420";
+	case YUV422:
+		return "yuv422";
+	case YUV444:
+		return "yuv444";
+	default:
+		return "unknown";
+	}
+}
+
+static const char *PrecisionName(PixelPrecision precision)
+{
+	switch (precision)
+	{
+	case BPP8:
+		return "bpp8";
+	case BPP16:
+		return "bpp16";
+	case DOUBLE:
+		return "double";
+	default:
+		return "unknown";
+	}
+}
+
+// Smooth gradients with noise on top, so that neither resizing nor QOI coding gets an easy ride
+static void FillSyntheticImage(IMAGE *pImage, unsigned seed)
+{
+	unsigned random = seed * 2654435761u + 1;
+	for (int plane = Y_PLANE; plane <= V_PLANE; plane++)
+	{
+		int planeWidth, planeHeight;
+		GetPlaneDimensions(pImage->colorSpace, pImage->width, pImage->height, plane, &planeWidth, &planeHeight);
+		for (int y = 0; y < planeHeight; y++)
+		{
+			for (int x = 0; x < planeWidth; x++)
+			{
+				random = random * 1664525u + 1013904223u;
+				int value = (x * 255 / planeWidth + y * 255 / planeHeight + plane * 85) / 2 + (int)(random >> 28) - 8;
+				pImage->pixArray[plane][y][x] = (PIXEL)CLAMP(value, 16, 235);
+			}
+		}
+	}
+}
+
+static int CompareSeconds(const void *a, const void *b)
+{
+	double secondsA = *(const double *)a, secondsB = *(const double *)b;
+	return (secondsA > secondsB) - (secondsA < secondsB);
+}
+
+// Calls run once to warm up, then times it until minSeconds have passed, MIN_ITERATIONS..MAX_ITERATIONS times
+// Reports the median call: the least disturbed by other work on the machine, short of the minimum
+static bool RunBench(const BenchParms *parms, BenchResult *pResult, BenchFunc run, void *context)
+{
+	static double seconds[MAX_ITERATIONS];
+	if (!run(context))
+	{
+		fprintf(stderr, "%s: Failed!\n", pResult->name);
+		return FALSE;
+	}
+
+	int iterations = 0;
+	double startTime = GetSeconds();
+	double now = startTime;
+	while (iterations < MAX_ITERATIONS && (iterations < MIN_ITERATIONS || now - startTime < parms->minSeconds))
+	{
+		double callStart = now;
+		if (!run(context))
+		{
+			fprintf(stderr, "%s: Failed!\n", pResult->name);
+			return FALSE;
+		}
+		now = GetSeconds();
+		seconds[iterations++] = now - callStart;
+	}
+
+	qsort(seconds, iterations, sizeof(double), CompareSeconds);
+	pResult->iterations = iterations;
+	pResult->medianSeconds = seconds[iterations / 2];
+	pResult->minSeconds = seconds[0];
+	fprintf(stderr, "%-40s %9.3f ns/pixel %9.2f MP/s %6d calls\n", pResult->name,
+		pResult->medianSeconds * 1e9 / pResult->pixels, pResult->pixels / pResult->medianSeconds / 1e6, iterations);
+	return TRUE;
+}
+
+static bool AddResult(BenchResult **pResults, int *pNumResults, const BenchResult *pResult)
+{
+	BenchResult *results = (BenchResult *)realloc(*pResults, (*pNumResults + 1) * sizeof(BenchResult));
+	if (results == NULL)
+	{
+		fprintf(stderr, "Could not allocate benchmark results!\n");
+		return FALSE;
+	}
+	results[(*pNumResults)++] = *pResult;
+	*pResults = results;
+	return TRUE;
+}
+
+static bool WantBench(const BenchParms *parms, const char *name)
+{
+	return parms->filter == NULL || strstr(name, parms->filter) != NULL;
+}
+
+// Contributor tables of a resize plan, made from scratch
+static bool RunPlan(void *context)
+{
+	const PlanBench *pBench = (const PlanBench *)context;
+	ResizePlan plan;
+	memset(&plan, 0, sizeof(ResizePlan));
+	bool success = GetResizePlan(NULL, &plan, pBench->colorSpace, pBench->inWidth, pBench->inHeight,
+		pBench->outWidth, pBench->outHeight, REPEAT) != NULL;
+	DestroyResizePlan(&plan);
+	return success;
+}
+
+static bool RunPass(void *context)
+{
+	const PassBench *pBench = (const PassBench *)context;
+	return ResizeImagePass(pBench->pImageIn, pBench->pImageOut, pBench->pPlan, REPEAT, pBench->vertical);
+}
+
+static bool RunDegamma(void *context)
+{
+	const GammaBench *pBench = (const GammaBench *)context;
+	return (pBench->pImageOut->precision == BPP16) ?
+		DegammaImage(pBench->pImageIn, pBench->pImageOut, pBench->pLUTs->fwdGamma16) :
+		DegammaImage(pBench->pImageIn, pBench->pImageOut, pBench->pLUTs->fwdGamma);
+}
+
+static bool RunGamma(void *context)
+{
+	const GammaBench *pBench = (const GammaBench *)context;
+	return GammaImage(pBench->pImageIn, pBench->pImageOut, pBench->pLUTs->bwdGamma);
+}
+
+static bool RunConvert(void *context)
+{
+	const ConvertBench *pBench = (const ConvertBench *)context;
+	return ConvertImage(pBench->pImageIn, pBench->pImageOut);
+}
+
+static bool RunLoadBmp(void *context)
+{
+	const LoadBench *pBench = (const LoadBench *)context;
+	return LoadBmpImage(pBench->fileName, pBench->pImage);
+}
+
+static bool RunLoadQoi(void *context)
+{
+	const LoadBench *pBench = (const LoadBench *)context;
+	return LoadQoiImage(pBench->fileName, pBench->pImage);
+}
+
+static bool RunLoadRawYUV(void *context)
+{
+	const LoadBench *pBench = (const LoadBench *)context;
+	return LoadRawYUVImage(pBench->fileName, pBench->pImage, 0, pBench->fileSubtype);
+}
+
+// Whole frame through the context: degamma, resize tiled on its pool, gamma
+static bool RunFrame(void *context)
+{
+	const FrameBench *pBench = (const FrameBench *)context;
+	return ResizeFrame(pBench->pContext, pBench->pImageIn, pBench->pImageOut, pBench->pOptions) == RESIZE_OK;
+}
+
+// plan/<size>/<ratio>: MakeContribTable() for every table of a YUV420 plan
+static bool BenchPlans(const BenchParms *parms, BenchResult **pResults, int *pNumResults)
+{
+	for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+	{
+		for (int r = 0; r < (int)(sizeof(ratios) / sizeof(ratios[0])); r++)
+		{
+			BenchResult result;
+			memset(&result, 0, sizeof(BenchResult));
+			sprintf(result.name, "plan/%s/%s", sizes[s].name, ratios[r].name);
+			result.width = sizes[s].width;
+			result.height = sizes[s].height;
+			result.outWidth = result.width * ratios[r].num / ratios[r].den;
+			result.outHeight = result.height * ratios[r].num / ratios[r].den;
+			if (!WantBench(parms, result.name) || result.outWidth > MAX_WIDTH || result.outHeight > MAX_HEIGHT)
+				continue;
+
+			PlanBench bench = { YUV420, result.width, result.height, result.outWidth, result.outHeight };
+			result.pixels = (double)result.outWidth * result.outHeight;
+			if (!RunBench(parms, &result, RunPlan, &bench) || !AddResult(pResults, pNumResults, &result))
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// resize_h/<size>/<ratio>/<color space>/<precision>: Filter1DHorz() over a frame, input to output width
+// resize_v/<size>/<ratio>/<color space>/<precision>: Filter1DVert() over a frame, input to output height
+// Sizes whose output is beyond MAX_WIDTH x MAX_HEIGHT are skipped
+static bool BenchResizePasses(const BenchParms *parms, BenchResult **pResults, int *pNumResults)
+{
+	for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+	{
+		for (int r = 0; r < (int)(sizeof(ratios) / sizeof(ratios[0])); r++)
+		{
+			for (int c = 0; c < (int)(sizeof(resizeColorSpaces) / sizeof(resizeColorSpaces[0])); c++)
+			{
+				for (int p = 0; p < (int)(sizeof(linearPrecisions) / sizeof(linearPrecisions[0])); p++)
+				{
+					ColorSpaces colorSpace = resizeColorSpaces[c];
+					PixelPrecision precision = linearPrecisions[p];
+					int inWidth = sizes[s].width, inHeight = sizes[s].height;
+					int outWidth = inWidth * ratios[r].num / ratios[r].den;
+					int outHeight = inHeight * ratios[r].num / ratios[r].den;
+					char nameH[128], nameV[128];
+					sprintf(nameH, "resize_h/%s/%s/%s/%s", sizes[s].name, ratios[r].name, ColorSpaceName(colorSpace),
+						PrecisionName(precision));
+					sprintf(nameV, "resize_v/%s/%s/%s/%s", sizes[s].name, ratios[r].name, ColorSpaceName(colorSpace),
+						PrecisionName(precision));
+					if ((!WantBench(parms, nameH) && !WantBench(parms, nameV)) ||
+						outWidth > MAX_WIDTH || outHeight > MAX_HEIGHT)
+						continue;
+
+					// Linear light frames made from a synthetic one, as the resize stage gets them
+					ResizePlan plan;
+					GammaLUTs luts;
+					memset(&plan, 0, sizeof(ResizePlan));
+					memset(&luts, 0, sizeof(GammaLUTs));
+					IMAGE image = CreateImage(colorSpace, inWidth, inHeight);
+					IMAGE imageIn = CreateImage(colorSpace, inWidth, inHeight, precision);
+					IMAGE imageTmp = CreateImage(colorSpace, outWidth, inHeight, precision);
+					IMAGE imageOut = CreateImage(colorSpace, outWidth, outHeight, precision);
+					bool success = IsImageAllocated(&image) && IsImageAllocated(&imageIn) &&
+						IsImageAllocated(&imageTmp) && IsImageAllocated(&imageOut) &&
+						GetResizePlan(NULL, &plan, colorSpace, inWidth, inHeight, outWidth, outHeight, REPEAT) &&
+						GetGammaLUTs(NULL, &luts, BENCH_GAMMA, 8, 8, precision);
+					if (success)
+					{
+						FillSyntheticImage(&image, s);
+						success = ((precision == BPP16) ? DegammaImage(&image, &imageIn, luts.fwdGamma16) :
+							DegammaImage(&image, &imageIn, luts.fwdGamma)) &&
+							ResizeImagePass(&imageIn, &imageTmp, &plan, REPEAT, FALSE);
+					}
+					if (success)
+					{
+						PassBench benchH = { &imageIn, &imageTmp, &plan, FALSE };
+						PassBench benchV = { &imageTmp, &imageOut, &plan, TRUE };
+						BenchResult result;
+						memset(&result, 0, sizeof(BenchResult));
+						result.width = inWidth;
+						result.height = inHeight;
+						result.outWidth = outWidth;
+						result.outHeight = outHeight;
+						if (WantBench(parms, nameH))
+						{
+							strcpy(result.name, nameH);
+							result.pixels = (double)outWidth * inHeight;
+							success = RunBench(parms, &result, RunPass, &benchH) &&
+								AddResult(pResults, pNumResults, &result);
+						}
+						if (success && WantBench(parms, nameV))
+						{
+							strcpy(result.name, nameV);
+							result.pixels = (double)outWidth * outHeight;
+							success = RunBench(parms, &result, RunPass, &benchV) &&
+								AddResult(pResults, pNumResults, &result);
+						}
+					}
+					if (!success)
+						fprintf(stderr, "Could not run %s!\n", nameH);
+
+					DestroyImage(&image);
+					DestroyImage(&imageIn);
+					DestroyImage(&imageTmp);
+					DestroyImage(&imageOut);
+					DestroyResizePlan(&plan);
+					DestroyGammaLUTs(&luts);
+					if (!success)
+						return FALSE;
+				}
+			}
+		}
+	}
+	return TRUE;
+}
+
+// degamma/<size>/<color space>/<precision> and gamma/<size>/<color space>/<precision>: 8-bit display
+// frames to linear light ones of precision, and back
+static bool BenchGamma(const BenchParms *parms, BenchResult **pResults, int *pNumResults)
+{
+	for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+	{
+		for (int c = 0; c < (int)(sizeof(resizeColorSpaces) / sizeof(resizeColorSpaces[0])); c++)
+		{
+			for (int p = 0; p < (int)(sizeof(linearPrecisions) / sizeof(linearPrecisions[0])); p++)
+			{
+				ColorSpaces colorSpace = resizeColorSpaces[c];
+				PixelPrecision precision = linearPrecisions[p];
+				char nameDegamma[128], nameGamma[128];
+				sprintf(nameDegamma, "degamma/%s/%s/%s", sizes[s].name, ColorSpaceName(colorSpace),
+					PrecisionName(precision));
+				sprintf(nameGamma, "gamma/%s/%s/%s", sizes[s].name, ColorSpaceName(colorSpace),
+					PrecisionName(precision));
+				if (!WantBench(parms, nameDegamma) && !WantBench(parms, nameGamma))
+					continue;
+
+				GammaLUTs luts;
+				memset(&luts, 0, sizeof(GammaLUTs));
+				IMAGE image = CreateImage(colorSpace, sizes[s].width, sizes[s].height);
+				IMAGE imageLinear = CreateImage(colorSpace, sizes[s].width, sizes[s].height, precision);
+				bool success = IsImageAllocated(&image) && IsImageAllocated(&imageLinear) &&
+					GetGammaLUTs(NULL, &luts, BENCH_GAMMA, 8, 8, precision);
+				if (success)
+				{
+					FillSyntheticImage(&image, s);
+					GammaBench benchDegamma = { &image, &imageLinear, &luts };
+					GammaBench benchGamma = { &imageLinear, &image, &luts };
+					BenchResult result;
+					memset(&result, 0, sizeof(BenchResult));
+					result.width = result.outWidth = sizes[s].width;
+					result.height = result.outHeight = sizes[s].height;
+					result.pixels = (double)sizes[s].width * sizes[s].height;
+					strcpy(result.name, nameDegamma);
+					// Degamma is run regardless, as gamma takes its output
+					success = RunBench(parms, &result, RunDegamma, &benchDegamma) &&
+						(!WantBench(parms, nameDegamma) || AddResult(pResults, pNumResults, &result));
+					if (success && WantBench(parms, nameGamma))
+					{
+						strcpy(result.name, nameGamma);
+						success = RunBench(parms, &result, RunGamma, &benchGamma) &&
+							AddResult(pResults, pNumResults, &result);
+					}
+				}
+				if (!success)
+					fprintf(stderr, "Could not run %s!\n", nameDegamma);
+
+				DestroyImage(&image);
+				DestroyImage(&imageLinear);
+				DestroyGammaLUTs(&luts);
+				if (!success)
+					return FALSE;
+			}
+		}
+	}
+	return TRUE;
+}
+
+// rgb2yuv/<size>/<color space> and yuv2rgb/<size>/<color space>: RGBImage2YUV() and YUVImage2RGB()
+static bool BenchConvert(const BenchParms *parms, BenchResult **pResults, int *pNumResults)
+{
+	static const ColorSpaces yuvColorSpaces[] = { YUV420, YUV422, YUV444 };
+	for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+	{
+		for (int c = 0; c < (int)(sizeof(yuvColorSpaces) / sizeof(yuvColorSpaces[0])); c++)
+		{
+			char nameToYUV[128], nameToRGB[128];
+			sprintf(nameToYUV, "rgb2yuv/%s/%s", sizes[s].name, ColorSpaceName(yuvColorSpaces[c]));
+			sprintf(nameToRGB, "yuv2rgb/%s/%s", sizes[s].name, ColorSpaceName(yuvColorSpaces[c]));
+			if (!WantBench(parms, nameToYUV) && !WantBench(parms, nameToRGB))
+				continue;
+
+			IMAGE imageRGB = CreateImage(RGB, sizes[s].width, sizes[s].height);
+			IMAGE imageYUV = CreateImage(yuvColorSpaces[c], sizes[s].width, sizes[s].height);
+			bool success = IsImageAllocated(&imageRGB) && IsImageAllocated(&imageYUV);
+			if (success)
+			{
+				FillSyntheticImage(&imageRGB, s);
+				FillSyntheticImage(&imageYUV, s);
+				ConvertBench benchToYUV = { &imageRGB, &imageYUV };
+				ConvertBench benchToRGB = { &imageYUV, &imageRGB };
+				BenchResult result;
+				memset(&result, 0, sizeof(BenchResult));
+				result.width = result.outWidth = sizes[s].width;
+				result.height = result.outHeight = sizes[s].height;
+				result.pixels = (double)sizes[s].width * sizes[s].height;
+				if (WantBench(parms, nameToYUV))
+				{
+					strcpy(result.name, nameToYUV);
+					success = RunBench(parms, &result, RunConvert, &benchToYUV) &&
+						AddResult(pResults, pNumResults, &result);
+				}
+				if (success && WantBench(parms, nameToRGB))
+				{
+					strcpy(result.name, nameToRGB);
+					success = RunBench(parms, &result, RunConvert, &benchToRGB) &&
+						AddResult(pResults, pNumResults, &result);
+				}
+			}
+			if (!success)
+				fprintf(stderr, "Could not run %s!\n", nameToYUV);
+
+			DestroyImage(&imageRGB);
+			DestroyImage(&imageYUV);
+			if (!success)
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// load_bmp/<size>, load_qoi/<size> and load_yuv/<size>: synthetic frames saved to files in the working
+// directory, then loaded as the load stage does, BMP and QOI to RGB and I420 to YUV420
+// Files are removed afterwards. Timings include reading from the file cache
+static bool BenchLoaders(const BenchParms *parms, BenchResult **pResults, int *pNumResults)
+{
+	for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+	{
+		for (int f = 0; f < 3; f++)
+		{
+			static const char *formats[] = { "bmp", "qoi", "yuv" };
+			static const BenchFunc loaders[] = { RunLoadBmp, RunLoadQoi, RunLoadRawYUV };
+			BenchResult result;
+			memset(&result, 0, sizeof(BenchResult));
+			sprintf(result.name, "load_%s/%s", formats[f], sizes[s].name);
+			if (!WantBench(parms, result.name))
+				continue;
+
+			char fileName[64];
+			sprintf(fileName, "ResizeBench_%s.%s", sizes[s].name, formats[f]);
+			IMAGE image = CreateImage((f == 2) ? YUV420 : RGB, sizes[s].width, sizes[s].height);
+			bool success = IsImageAllocated(&image);
+			if (success)
+			{
+				FillSyntheticImage(&image, s);
+				success = (f == 0) ? SaveBmpImage(fileName, &image) :
+					(f == 1) ? SaveQoiImage(fileName, &image) : SaveRawYUVImage(fileName, &image, YUV420_I420);
+			}
+			if (success)
+			{
+				LoadBench bench = { fileName, &image, YUV420_I420 };
+				result.width = result.outWidth = sizes[s].width;
+				result.height = result.outHeight = sizes[s].height;
+				result.pixels = (double)sizes[s].width * sizes[s].height;
+				success = RunBench(parms, &result, loaders[f], &bench) && AddResult(pResults, pNumResults, &result);
+			}
+			if (!success)
+				fprintf(stderr, "Could not run %s!\n", result.name);
+
+			remove(fileName);
+			DestroyImage(&image);
+			if (!success)
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// scaling/<size>/<threads>t: ResizeFrame() of a YUV420 frame to 0.5x on a context with a tile pool of 1, 2, 4 ...
+// parms->maxThreads threads. Degamma and gamma stay on the calling thread, as in the resize stage
+static bool BenchThreadScaling(const BenchParms *parms, BenchResult **pResults, int *pNumResults)
+{
+	// Powers of 2 below maxThreads, then maxThreads
+	int threadCounts[8];
+	int numThreadCounts = 0;
+	for (int threads = 1; threads < parms->maxThreads; threads *= 2)
+		threadCounts[numThreadCounts++] = threads;
+	threadCounts[numThreadCounts++] = parms->maxThreads;
+
+	for (int s = 0; s < (int)(sizeof(scalingSizes) / sizeof(scalingSizes[0])); s++)
+	{
+		for (int t = 0; t < numThreadCounts; t++)
+		{
+			int threads = threadCounts[t];
+			BenchResult result;
+			memset(&result, 0, sizeof(BenchResult));
+			sprintf(result.name, "scaling/%s/%dt", scalingSizes[s].name, threads);
+			if (!WantBench(parms, result.name))
+				continue;
+			result.width = scalingSizes[s].width;
+			result.height = scalingSizes[s].height;
+			result.outWidth = result.width / 2;
+			result.outHeight = result.height / 2;
+			result.pixels = (double)result.outWidth * result.outHeight;
+			result.threads = threads;
+
+			ResizeOptions options = { BENCH_GAMMA, REPEAT, DOUBLE };
+			ResizeContext *pContext = CreateResizeContext(threads);
+			IMAGE imageIn = CreateImage(YUV420, result.width, result.height);
+			IMAGE imageOut = CreateImage(YUV420, result.outWidth, result.outHeight);
+			bool success = pContext && IsImageAllocated(&imageIn) && IsImageAllocated(&imageOut);
+			if (success)
+			{
+				FillSyntheticImage(&imageIn, s);
+				FrameBench bench = { pContext, &imageIn, &imageOut, &options };
+				success = RunBench(parms, &result, RunFrame, &bench) && AddResult(pResults, pNumResults, &result);
+			}
+			if (!success)
+				fprintf(stderr, "Could not run %s!\n", result.name);
+
+			DestroyImage(&imageIn);
+			DestroyImage(&imageOut);
+			DestroyResizeContext(pContext);
+			if (!success)
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static void WriteJsonString(FILE *file, const char *string)
+{
+	fputc('"', file);
+	for (; *string; string++)
+	{
+		if (*string == '"' || *string == '\\')
+			fputc('\\', file);
+		if ((unsigned char)*string >= ' ')
+			fputc(*string, file);
+	}
+	fputc('"', file);
+}
+
+// One object per case, with the label and machine facts needed to tell comparable reports apart
+static bool WriteJsonReport(const BenchParms *parms, const BenchResult *results, int numResults)
+{
+	FILE *file = parms->jsonFilename ? fopen(parms->jsonFilename, "w") : stdout;
+	if (file == NULL)
+	{
+		fprintf(stderr, "Could not open %s!\n", parms->jsonFilename);
+		return FALSE;
+	}
+
+	fprintf(file, "{\n  \"benchmark\": \"ResizeBench\",\n  \"label\": ");
+	WriteJsonString(file, parms->label ? parms->label : "");
+	fprintf(file, ",\n  \"hardwareThreads\": %u,\n  \"minSeconds\": %g,\n  \"results\": [",
+		std::thread::hardware_concurrency(), parms->minSeconds);
+	for (int i = 0; i < numResults; i++)
+	{
+		const BenchResult *pResult = &results[i];
+		fprintf(file, "%s\n    { \"name\": ", (i == 0) ? "" : ",");
+		WriteJsonString(file, pResult->name);
+		fprintf(file, ", \"width\": %d, \"height\": %d, \"outWidth\": %d, \"outHeight\": %d, \"pixels\": %.0f, "
+			"\"threads\": %d, \"iterations\": %d, \"medianNs\": %.0f, \"minNs\": %.0f, \"nsPerPixel\": %.4f, "
+			"\"mpPerSecond\": %.3f }",
+			pResult->width, pResult->height, pResult->outWidth, pResult->outHeight, pResult->pixels, pResult->threads,
+			pResult->iterations, pResult->medianSeconds * 1e9, pResult->minSeconds * 1e9,
+			pResult->medianSeconds * 1e9 / pResult->pixels, pResult->pixels / pResult->medianSeconds / 1e6);
+	}
+	fprintf(file, "\n  ]\n}\n");
+
+	bool success = !ferror(file);
+	if (file != stdout)
+		success = (fclose(file) == 0) && success;
+	if (!success)
+		fprintf(stderr, "Could not write JSON report!\n");
+	return success;
+}
+
+// Efficiency of each scaling case, its speedup over the 1 thread case of its size divided by its threads,
+// plotted against threads on a log2 axis, one line per size. 100% is perfect scaling
+static bool WriteScalingChart(const BenchParms *parms, const BenchResult *results, int numResults)
+{
+	const int chartWidth = 640, chartHeight = 400, left = 60, right = 130, top = 40, bottom = 50;
+	const int plotWidth = chartWidth - left - right, plotHeight = chartHeight - top - bottom;
+	static const char *colors[] = { "#1f77b4", "#d62728", "#2ca02c", "#9467bd" };
+	FILE *file = fopen(parms->chartFilename, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Could not open %s!\n", parms->chartFilename);
+		return FALSE;
+	}
+
+	int logMaxThreads = 0;
+	while ((1 << logMaxThreads) < parms->maxThreads)
+		logMaxThreads++;
+	logMaxThreads = MAX(logMaxThreads, 1);
+
+	fprintf(file, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" font-family=\"sans-serif\" "
+		"font-size=\"12\">\n", chartWidth, chartHeight);
+	fprintf(file, "<rect width=\"%d\" height=\"%d\" fill=\"white\"/>\n", chartWidth, chartHeight);
+	fprintf(file, "<text x=\"%d\" y=\"20\" text-anchor=\"middle\" font-size=\"14\">Tiled ResizeFrame() scaling "
+		"efficiency, 0.5x YUV420, %s, %u hardware threads</text>\n", chartWidth / 2,
+		parms->label ? parms->label : "unlabelled", std::thread::hardware_concurrency());
+
+	// Grid every 25% and every power of 2 threads
+	for (int percent = 0; percent <= 100; percent += 25)
+	{
+		int y = top + plotHeight - plotHeight * percent / 100;
+		fprintf(file, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" stroke=\"#ddd\"/>\n", left, y,
+			left + plotWidth, y);
+		fprintf(file, "<text x=\"%d\" y=\"%d\" text-anchor=\"end\">%d%%</text>\n", left - 6, y + 4, percent);
+	}
+	for (int i = 0; i <= logMaxThreads; i++)
+	{
+		int x = left + plotWidth * i / logMaxThreads;
+		fprintf(file, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" stroke=\"#ddd\"/>\n", x, top, x,
+			top + plotHeight);
+		fprintf(file, "<text x=\"%d\" y=\"%d\" text-anchor=\"middle\">%d</text>\n", x, top + plotHeight + 18, 1 << i);
+	}
+	fprintf(file, "<text x=\"%d\" y=\"%d\" text-anchor=\"middle\">Tile pool threads</text>\n",
+		left + plotWidth / 2, chartHeight - 10);
+	fprintf(file, "<text x=\"15\" y=\"%d\" text-anchor=\"middle\" transform=\"rotate(-90 15 %d)\">"
+		"Speedup / threads</text>\n", top + plotHeight / 2, top + plotHeight / 2);
+
+	// Efficiency above 100% is clipped to the top of the plot
+	for (int s = 0; s < (int)(sizeof(scalingSizes) / sizeof(scalingSizes[0])); s++)
+	{
+		char prefix[64];
+		sprintf(prefix, "scaling/%s/", scalingSizes[s].name);
+		double oneThreadSeconds = 0.0;
+		for (int i = 0; i < numResults; i++)
+		{
+			if (strncmp(results[i].name, prefix, strlen(prefix)) == 0 && results[i].threads == 1)
+				oneThreadSeconds = results[i].medianSeconds;
+		}
+		if (oneThreadSeconds == 0.0)
+			continue;
+
+		const char *color = colors[s % (sizeof(colors) / sizeof(colors[0]))];
+		fprintf(file, "<polyline fill=\"none\" stroke=\"%s\" stroke-width=\"2\" points=\"", color);
+		for (int i = 0; i < numResults; i++)
+		{
+			if (strncmp(results[i].name, prefix, strlen(prefix)) != 0)
+				continue;
+			double efficiency = oneThreadSeconds / (results[i].medianSeconds * results[i].threads);
+			fprintf(file, "%.1f,%.1f ", left + plotWidth * log2((double)results[i].threads) / logMaxThreads,
+				top + plotHeight - plotHeight * MIN(efficiency, 1.0));
+		}
+		fprintf(file, "\"/>\n");
+		fprintf(file, "<text x=\"%d\" y=\"%d\" fill=\"%s\">%s</text>\n", left + plotWidth + 10, top + 20 + 18 * s,
+			color, scalingSizes[s].name);
+	}
+	fprintf(file, "</svg>\n");
+
+	bool success = !ferror(file);
+	success = (fclose(file) == 0) && success;
+	if (!success)
+		fprintf(stderr, "Could not write chart!\n");
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	BenchParms parms;
+	parms.minSeconds = DEFAULT_MIN_SECONDS;
+	parms.filter = NULL;
+	parms.label = NULL;
+	parms.jsonFilename = NULL;
+	parms.maxThreads = MAX_SCALING_THREADS;
+	parms.chartFilename = NULL;
+	if (!ParseCmdLine(argc, argv, &parms))
+		print_usage();
+
+	BenchResult *results = NULL;
+	int numResults = 0;
+	bool success = BenchPlans(&parms, &results, &numResults) &&
+		BenchResizePasses(&parms, &results, &numResults) &&
+		BenchGamma(&parms, &results, &numResults) &&
+		BenchConvert(&parms, &results, &numResults) &&
+		BenchLoaders(&parms, &results, &numResults) &&
+		BenchThreadScaling(&parms, &results, &numResults) &&
+		WriteJsonReport(&parms, results, numResults) &&
+		(parms.chartFilename == NULL || WriteScalingChart(&parms, results, numResults));
+	free(results);
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,375 @@
+// ResizeDaemon.cpp, resize daemon serving requests over a Unix domain socket, with frames in shared memory
+// See MIT_License.txt
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "ResizeDaemon.h"
+#include "FrameQueue.h"
+#include "Utils.h"
+
+#ifdef __linux__
+
+// Latencies of the latest resize requests, shared by all connections
+typedef struct
+{
+	std::mutex lock;
+	uint64_t numRequests;
+	double latencies[DAEMON_LATENCY_SAMPLES];	// Ring of the latest MIN(numRequests, DAEMON_LATENCY_SAMPLES)
+} DaemonStats;
+
+typedef struct
+{
+	ResizeContext *pContext;
+	FrameQueue *pendingConnections;	// Accepted sockets, as intptr_t, taken by the connection threads
+	DaemonStats stats;
+} ResizeDaemon;
+
+// Private functions
+static double GetSeconds();
+static bool IsPlanarYUV(YUVType fileSubtype);
+static bool ReceiveRequest(int connection, DaemonRequest *pRequest, int *pFd);
+static ResizeStatus ServeResize(ResizeDaemon *pDaemon, const DaemonRequest *pRequest, int fd);
+static void RecordLatency(DaemonStats *pStats, double latency);
+static int CompareLatencies(const void *a, const void *b);
+static void GetStats(DaemonStats *pStats, DaemonReply *pReply);
+static void ServeConnections(ResizeDaemon *pDaemon);
+
+static double GetSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Formats whose planes lie one after another in the frame, so that they are viewed and written in place
+static bool IsPlanarYUV(YUVType fileSubtype)
+{
+	switch (fileSubtype)
+	{
+	case YUV420_I420:
+	case YUV420_YV12:
+	case YUV420_I420_10:
+	case YUV420_I420_12:
+	case YUV420_I420_16:
+	case YUV422_I422:
+	case YUV444_I444:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+// Receives one request and the descriptor passed with it, -1 if none
+// Returns FALSE once the client has disconnected, or on error
+static bool ReceiveRequest(int connection, DaemonRequest *pRequest, int *pFd)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = { pRequest, sizeof(DaemonRequest) };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	*pFd = -1;
+	ssize_t received;
+	while ((received = recvmsg(connection, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+		;
+	if (received <= 0)
+		return FALSE;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(pFd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	// A short request is answered as malformed
+	if (received != sizeof(DaemonRequest) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+		pRequest->command = 0;
+	return TRUE;
+}
+
+// Maps the shared memory and resizes the input frame there into the output frame, through views of both
+static ResizeStatus ServeResize(ResizeDaemon *pDaemon, const DaemonRequest *pRequest, int fd)
+{
+	YUVType fileSubtype = (YUVType)pRequest->fileSubtype;
+	if (fd < 0 || !IsPlanarYUV(fileSubtype) ||
+		pRequest->inWidth < MIN_WIDTH || pRequest->inWidth > MAX_WIDTH ||
+		pRequest->inHeight < MIN_HEIGHT || pRequest->inHeight > MAX_HEIGHT ||
+		pRequest->outWidth < MIN_WIDTH || pRequest->outWidth > MAX_WIDTH ||
+		pRequest->outHeight < MIN_HEIGHT || pRequest->outHeight > MAX_HEIGHT ||
+		pRequest->edgeMethod < REPEAT || pRequest->edgeMethod > NOCONTRIB ||
+		(pRequest->linearPrecision != DOUBLE && pRequest->linearPrecision != BPP16) ||
+		!(pRequest->gamma > 0.0))
+		return RESIZE_INVALID_ARGUMENT;
+
+	// The memory must be sealed against shrinking: otherwise the client could truncate it while it is mapped,
+	// and the daemon would die of SIGBUS on reading or writing past its new end
+	int seals = fcntl(fd, F_GET_SEALS);
+	if (seals < 0 || !(seals & F_SEAL_SHRINK))
+		return RESIZE_INVALID_ARGUMENT;
+
+	// Both frames must lie within the shared memory without overlapping, 16-bit samples aligned
+	int bitDepth = GetYUVBitDepth(fileSubtype);
+	uint64_t inSize = GetYUVFrameSize(pRequest->inWidth, pRequest->inHeight, fileSubtype);
+	uint64_t outSize = GetYUVFrameSize(pRequest->outWidth, pRequest->outHeight, fileSubtype);
+	struct stat memStat;
+	if (fstat(fd, &memStat) != 0)
+		return RESIZE_INVALID_ARGUMENT;
+	uint64_t size = (uint64_t)memStat.st_size;
+	if (pRequest->inOffset > size || inSize > size - pRequest->inOffset ||
+		pRequest->outOffset > size || outSize > size - pRequest->outOffset ||
+		(pRequest->inOffset < pRequest->outOffset + outSize && pRequest->outOffset < pRequest->inOffset + inSize) ||
+		(bitDepth > 8 && ((pRequest->inOffset | pRequest->outOffset) & 1)))
+		return RESIZE_INVALID_ARGUMENT;
+
+	void *mapped = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapped == MAP_FAILED)
+		return RESIZE_INVALID_ARGUMENT;
+	PIXEL *data = (PIXEL *)mapped;
+
+	ColorSpaces colorSpace = GetYUVColorSpace(fileSubtype);
+	PixelPrecision precision = (bitDepth > 8) ? BPP16 : BPP8;
+	IMAGE imageIn = CreateImageView(colorSpace, pRequest->inWidth, pRequest->inHeight, precision);
+	IMAGE imageOut = CreateImageView(colorSpace, pRequest->outWidth, pRequest->outHeight, precision);
+	imageIn.bitDepth = imageOut.bitDepth = bitDepth;
+	ResizeStatus status = RESIZE_OUT_OF_MEMORY;
+	if (IsImageAllocated(&imageIn) && IsImageAllocated(&imageOut))
+	{
+		if (ViewRawYUVFrame(data + pRequest->inOffset, pRequest->inWidth, pRequest->inHeight, fileSubtype, NULL,
+			&imageIn) && ViewRawYUVFrame(data + pRequest->outOffset, pRequest->outWidth, pRequest->outHeight,
+			fileSubtype, NULL, &imageOut))
+		{
+			ResizeOptions options;
+			options.gamma = pRequest->gamma;
+			options.edgeMethod = (EdgeMethod)pRequest->edgeMethod;
+			options.linearPrecision = (PixelPrecision)pRequest->linearPrecision;
+			status = ResizeFrame(pDaemon->pContext, &imageIn, &imageOut, &options);
+		}
+		else
+			status = RESIZE_INVALID_ARGUMENT;
+	}
+
+	DestroyImage(&imageIn);
+	DestroyImage(&imageOut);
+	munmap(mapped, (size_t)size);
+	return status;
+}
+
+static void RecordLatency(DaemonStats *pStats, double latency)
+{
+	std::lock_guard<std::mutex> guard(pStats->lock);
+	pStats->latencies[pStats->numRequests % DAEMON_LATENCY_SAMPLES] = latency;
+	pStats->numRequests++;
+}
+
+static int CompareLatencies(const void *a, const void *b)
+{
+	double latencyA = *(const double *)a, latencyB = *(const double *)b;
+	return (latencyA > latencyB) - (latencyA < latencyB);
+}
+
+// Percentiles of the latest latencies, sorted outside the lock
+static void GetStats(DaemonStats *pStats, DaemonReply *pReply)
+{
+	double latencies[DAEMON_LATENCY_SAMPLES];
+	int numSamples;
+	{
+		std::lock_guard<std::mutex> guard(pStats->lock);
+		pReply->numRequests = pStats->numRequests;
+		numSamples = (int)MIN(pStats->numRequests, (uint64_t)DAEMON_LATENCY_SAMPLES);
+		memcpy(latencies, pStats->latencies, numSamples * sizeof(double));
+	}
+	if (numSamples == 0)
+		return;
+
+	qsort(latencies, numSamples, sizeof(double), CompareLatencies);
+	pReply->latencyP50 = latencies[(numSamples - 1) * 50 / 100];
+	pReply->latencyP90 = latencies[(numSamples - 1) * 90 / 100];
+	pReply->latencyP99 = latencies[(numSamples - 1) * 99 / 100];
+	pReply->latencyMax = latencies[numSamples - 1];
+}
+
+// Connection thread: serves the requests of one client at a time until the listening socket is closed
+static void ServeConnections(ResizeDaemon *pDaemon)
+{
+	void *item;
+	while (PopFrameQueue(pDaemon->pendingConnections, &item))
+	{
+		int connection = (int)(intptr_t)item;
+		DaemonRequest request;
+		int fd;
+		while (ReceiveRequest(connection, &request, &fd))
+		{
+			double startTime = GetSeconds();
+			DaemonReply reply;
+			memset(&reply, 0, sizeof(DaemonReply));
+			switch (request.command)
+			{
+			case DAEMON_RESIZE:
+				reply.status = ServeResize(pDaemon, &request, fd);
+				break;
+			case DAEMON_STATS:
+				reply.status = RESIZE_OK;
+				GetStats(&pDaemon->stats, &reply);
+				break;
+			default:
+				reply.status = RESIZE_INVALID_ARGUMENT;
+				break;
+			}
+			if (fd >= 0)
+				close(fd);
+			if (send(connection, &reply, sizeof(DaemonReply), MSG_NOSIGNAL) != sizeof(DaemonReply))
+				break;
+			if (request.command == DAEMON_RESIZE)
+				RecordLatency(&pDaemon->stats, GetSeconds() - startTime);
+		}
+		close(connection);
+	}
+}
+
+bool RunResizeDaemon(const char *socketPath, int numConnections, ResizeContext *pContext)
+{
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(socketPath) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "Socket path %s is too long!\n", socketPath);
+		return FALSE;
+	}
+	strcpy(address.sun_path, socketPath);
+	if (numConnections <= 0 || numConnections > MAX_DAEMON_CONNECTIONS)
+	{
+		fprintf(stderr, "Unrecognized number of daemon connections, or more than %d.\n", MAX_DAEMON_CONNECTIONS);
+		return FALSE;
+	}
+
+	// A socket file left by an earlier daemon is replaced, but nothing else at that path is removed
+	struct stat fileStat;
+	if (lstat(socketPath, &fileStat) == 0)
+	{
+		if (!S_ISSOCK(fileStat.st_mode))
+		{
+			fprintf(stderr, "Could not listen on %s: it exists and is not a socket!\n", socketPath);
+			return FALSE;
+		}
+		unlink(socketPath);
+	}
+	int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+		listen(listener, SOMAXCONN) != 0)
+	{
+		fprintf(stderr, "Could not listen on socket %s: %s\n", socketPath, strerror(errno));
+		if (listener >= 0)
+			close(listener);
+		return FALSE;
+	}
+
+	ResizeDaemon *pDaemon = new ResizeDaemon;
+	pDaemon->pContext = pContext;
+	pDaemon->pendingConnections = CreateFrameQueue(numConnections);
+	pDaemon->stats.numRequests = 0;
+	if (pDaemon->pendingConnections == NULL)
+	{
+		close(listener);
+		delete pDaemon;
+		return FALSE;
+	}
+
+	std::thread threads[MAX_DAEMON_CONNECTIONS];
+	for (int i = 0; i < numConnections; i++)
+		threads[i] = std::thread(ServeConnections, pDaemon);
+	fprintf(stderr, "Serving resize requests on %s, %d connections at once\n", socketPath, numConnections);
+
+	// Clients beyond numConnections wait in the queue, then in the listen backlog
+	while (TRUE)
+	{
+		int connection = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+		if (connection < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			fprintf(stderr, "Could not accept connection on socket %s: %s\n", socketPath, strerror(errno));
+			break;
+		}
+		if (!PushFrameQueue(pDaemon->pendingConnections, (void *)(intptr_t)connection))
+		{
+			close(connection);
+			break;
+		}
+	}
+
+	CloseFrameQueue(pDaemon->pendingConnections);
+	for (int i = 0; i < numConnections; i++)
+		threads[i].join();
+	close(listener);
+	unlink(socketPath);
+	DestroyFrameQueue(pDaemon->pendingConnections);
+	delete pDaemon;
+	return FALSE;
+}
+
+bool PrintResizeDaemonStats(const char *socketPath)
+{
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+
+	int connection = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (connection < 0 || connect(connection, (struct sockaddr *)&address, sizeof(address)) != 0)
+	{
+		fprintf(stderr, "Could not connect to daemon on %s: %s\n", socketPath, strerror(errno));
+		if (connection >= 0)
+			close(connection);
+		return FALSE;
+	}
+
+	DaemonRequest request;
+	DaemonReply reply;
+	memset(&request, 0, sizeof(DaemonRequest));
+	request.command = DAEMON_STATS;
+	bool success = send(connection, &request, sizeof(DaemonRequest), MSG_NOSIGNAL) == sizeof(DaemonRequest) &&
+		recv(connection, &reply, sizeof(DaemonReply), 0) == sizeof(DaemonReply) && reply.status == RESIZE_OK;
+	close(connection);
+	if (!success)
+	{
+		fprintf(stderr, "No stats from daemon on %s!\n", socketPath);
+		return FALSE;
+	}
+
+	printf("Requests: %llu\n", (unsigned long long)reply.numRequests);
+	printf("Latency (ms) of latest %d: p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+		(int)MIN(reply.numRequests, (uint64_t)DAEMON_LATENCY_SAMPLES), reply.latencyP50 * 1000.0,
+		reply.latencyP90 * 1000.0, reply.latencyP99 * 1000.0, reply.latencyMax * 1000.0);
+	return TRUE;
+}
+
+#else	// Windows, MACOS: no memfd, and no SOCK_SEQPACKET on MACOS
+
+bool RunResizeDaemon(const char *socketPath, int numConnections, ResizeContext *pContext)
+{
+	fprintf(stderr, "Daemon mode is only supported on Linux!\n");
+	return FALSE;
+}
+
+bool PrintResizeDaemonStats(const char *socketPath)
+{
+	fprintf(stderr, "Daemon mode is only supported on Linux!\n");
+	return FALSE;
+}
+
+#endif
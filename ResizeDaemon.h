@@ -0,0 +1,62 @@
+// ResizeDaemon.h, resize daemon serving requests over a Unix domain socket, with frames in shared memory
+// See MIT_License.txt
+
+#ifndef IMAGERESIZE_RESIZEDAEMON_H_
+#define IMAGERESIZE_RESIZEDAEMON_H_
+
+#include <stdint.h>
+#include "ImageResizeLib.h"
+
+#define MAX_DAEMON_CONNECTIONS	64		// Clients served at once
+#define DAEMON_LATENCY_SAMPLES	4096	// Latest resize requests kept for latency percentiles
+
+// Requests and replies are single SOCK_SEQPACKET messages of the fixed layouts below, in host byte order
+// A client may send any number of requests over one connection, waiting for each reply
+typedef enum
+{
+	DAEMON_RESIZE = 1,			// Resize frame in shared memory into another frame there
+	DAEMON_STATS = 2			// Report number of requests served and their latency percentiles
+} DaemonCommand;
+
+// The shared memory of a resize request, e.g. a memfd, is passed with it as SCM_RIGHTS ancillary data
+// It holds both frames, in raw YUV file format, and is mapped only while the request is served
+// It must be sealed with F_SEAL_SHRINK, e.g. a memfd created with MFD_ALLOW_SEALING; requests are rejected otherwise
+typedef struct
+{
+	int32_t command;			// DaemonCommand
+	int32_t fileSubtype;		// YUVType of both frames: planar only, I420, YV12, I420 of more bits, I422 or I444
+	int32_t inWidth;
+	int32_t inHeight;
+	int32_t outWidth;
+	int32_t outHeight;
+	int32_t edgeMethod;
+	int32_t linearPrecision;	// DOUBLE or BPP16
+	double gamma;
+	uint64_t inOffset;			// Byte offsets of the input and output frames in the shared memory
+	uint64_t outOffset;
+} DaemonRequest;
+
+typedef struct
+{
+	int32_t status;				// ResizeStatus; RESIZE_INVALID_ARGUMENT also for malformed requests
+	int32_t reserved;
+	uint64_t numRequests;		// Stats: resize requests served since the daemon started
+	double latencyP50;			// Stats: seconds from receiving a resize request to replying,
+	double latencyP90;			// over the latest DAEMON_LATENCY_SAMPLES requests
+	double latencyP99;
+	double latencyMax;
+} DaemonReply;
+
+/******************************************************************************
+* PUBLIC FUNCTIONS
+*****************************************************************************/
+
+// Serves requests on a socket bound to socketPath, numConnections clients at once, until the process is stopped
+// Frames are resized through pContext, so that tables, LUTs, buffers and tile pool stay warm between requests
+// Returns FALSE if the socket cannot be set up, or on platforms without Unix domain sockets and fd passing
+bool RunResizeDaemon(const char *socketPath, int numConnections, ResizeContext *pContext);
+
+// Asks daemon listening on socketPath for its stats and prints them to stdout
+bool PrintResizeDaemonStats(const char *socketPath);
+
+#endif // #ifndef IMAGERESIZE_RESIZEDAEMON_H_
@@ -0,0 +1,263 @@
+// TilePool.cpp, work-stealing thread pool running the tile tasks of resize jobs
+// See MIT_License.txt
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "TilePool.h"
+#include "Utils.h"
+
+// Task queued on a pool thread
+typedef struct
+{
+	TileJob *pJob;
+	int task;
+} TileRef;
+
+// Pool thread and its deque: the owner takes its newest task, thieves the oldest
+typedef struct
+{
+	std::thread thread;
+	std::mutex lock;
+	std::deque<TileRef> tasks;
+	double busyTime;			// Seconds spent running tasks, written by owner only
+} TileWorker;
+
+struct TilePool
+{
+	int numThreads;
+	TileWorker *workers;
+	std::mutex lock;			// Guards sleeping on wake
+	std::condition_variable wake;
+	std::atomic<int> numQueued;	// Tasks on all deques, changed under lock when increased
+	std::atomic<unsigned> nextWorker;	// Deque receiving the next task queued from outside the pool
+	bool closing;
+};
+
+struct TileJob
+{
+	TilePool *pPool;
+	int numTasks;
+	TileFunc run;
+	void *context;
+	int *firstDependent;		// Tasks started once each task has finished
+	int *lastDependent;
+	int *numDeps;				// Per task, tasks it depends on
+	std::atomic<int> *numPending;	// Per task, tasks it depends on not yet finished
+	std::atomic<int> numUnfinished;
+	std::mutex lock;			// Guards done
+	std::condition_variable finished;
+	bool done;
+};
+
+// Queues task on deque of worker, or spread over all deques if queued from outside the pool
+static void PushTileTask(TilePool *pPool, int worker, TileJob *pJob, int task)
+{
+	if (worker < 0)
+		worker = (int)(pPool->nextWorker++ % (unsigned)pPool->numThreads);
+
+	TileRef ref = { pJob, task };
+	{
+		std::lock_guard<std::mutex> guard(pPool->workers[worker].lock);
+		pPool->workers[worker].tasks.push_back(ref);
+	}
+	{
+		std::lock_guard<std::mutex> guard(pPool->lock);
+		pPool->numQueued++;
+	}
+	pPool->wake.notify_one();
+}
+
+// Takes newest task of worker's own deque, else steals oldest of another's
+// Sleeps while no deque has any. Returns FALSE once pool is closing
+static bool TakeTileTask(TilePool *pPool, int worker, TileRef *pRef)
+{
+	while (TRUE)
+	{
+		for (int i = 0; i < pPool->numThreads; i++)
+		{
+			TileWorker *pVictim = &pPool->workers[(worker + i) % pPool->numThreads];
+			std::lock_guard<std::mutex> guard(pVictim->lock);
+			if (pVictim->tasks.empty())
+				continue;
+			if (i == 0)
+			{
+				*pRef = pVictim->tasks.back();
+				pVictim->tasks.pop_back();
+			}
+			else
+			{
+				*pRef = pVictim->tasks.front();
+				pVictim->tasks.pop_front();
+			}
+			pPool->numQueued--;
+			return TRUE;
+		}
+
+		std::unique_lock<std::mutex> guard(pPool->lock);
+		while (pPool->numQueued == 0 && !pPool->closing)
+			pPool->wake.wait(guard);
+		if (pPool->closing)
+			return FALSE;
+	}
+}
+
+// Queues the tasks waiting only on finished task, and wakes the job's runner after its last
+static void FinishTileTask(TilePool *pPool, int worker, TileJob *pJob, int task)
+{
+	for (int i = pJob->firstDependent[task]; i <= pJob->lastDependent[task]; i++)
+	{
+		if (--pJob->numPending[i] == 0)
+			PushTileTask(pPool, worker, pJob, i);
+	}
+	if (--pJob->numUnfinished == 0)
+	{
+		std::lock_guard<std::mutex> guard(pJob->lock);
+		pJob->done = TRUE;
+		pJob->finished.notify_all();
+	}
+}
+
+static void RunTileWorker(TilePool *pPool, int worker)
+{
+	TileWorker *pWorker = &pPool->workers[worker];
+	TileRef ref;
+	while (TakeTileTask(pPool, worker, &ref))
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		ref.pJob->run(ref.pJob->context, ref.task);
+		pWorker->busyTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		FinishTileTask(pPool, worker, ref.pJob, ref.task);
+	}
+}
+
+TilePool *CreateTilePool(int numThreads)
+{
+	TilePool *pPool = new TilePool;
+	pPool->numThreads = numThreads;
+	pPool->workers = new TileWorker[numThreads];
+	pPool->numQueued = 0;
+	pPool->nextWorker = 0;
+	pPool->closing = FALSE;
+	for (int i = 0; i < numThreads; i++)
+	{
+		pPool->workers[i].busyTime = 0.0;
+		pPool->workers[i].thread = std::thread(RunTileWorker, pPool, i);
+	}
+	return pPool;
+}
+
+void DestroyTilePool(TilePool *pPool)
+{
+	if (pPool == NULL)
+		return;
+	{
+		std::lock_guard<std::mutex> guard(pPool->lock);
+		pPool->closing = TRUE;
+	}
+	pPool->wake.notify_all();
+	for (int i = 0; i < pPool->numThreads; i++)
+		pPool->workers[i].thread.join();
+	delete[] pPool->workers;
+	delete pPool;
+}
+
+int GetTilePoolSize(const TilePool *pPool)
+{
+	return pPool->numThreads;
+}
+
+// Only exact while no job is running
+double GetTilePoolBusyTime(const TilePool *pPool)
+{
+	double busyTime = 0.0;
+	for (int i = 0; i < pPool->numThreads; i++)
+		busyTime += pPool->workers[i].busyTime;
+	return busyTime;
+}
+
+TileJob *CreateTileJob(TilePool *pPool, int numTasks, TileFunc run, void *context)
+{
+	TileJob *pJob = new TileJob;
+	pJob->pPool = pPool;
+	pJob->numTasks = numTasks;
+	pJob->run = run;
+	pJob->context = context;
+	pJob->firstDependent = (int *)calloc(numTasks, sizeof(int));
+	pJob->lastDependent = (int *)malloc(numTasks * sizeof(int));
+	pJob->numDeps = (int *)malloc(numTasks * sizeof(int));
+	pJob->numPending = new std::atomic<int>[numTasks];
+	pJob->done = FALSE;
+	if (pJob->firstDependent == NULL || pJob->lastDependent == NULL || pJob->numDeps == NULL)
+	{
+		fprintf(stderr, "ERROR TILEPOOL::CreateTileJob(): Could not allocate job!\n");
+		DestroyTileJob(pJob);
+		return NULL;
+	}
+	for (int i = 0; i < numTasks; i++)
+		pJob->lastDependent[i] = -1;
+	return pJob;
+}
+
+void DestroyTileJob(TileJob *pJob)
+{
+	if (pJob == NULL)
+		return;
+	free(pJob->firstDependent);
+	free(pJob->lastDependent);
+	free(pJob->numDeps);
+	delete[] pJob->numPending;
+	delete pJob;
+}
+
+void SetTileDependents(TileJob *pJob, int task, int firstDependent, int lastDependent)
+{
+	pJob->firstDependent[task] = firstDependent;
+	pJob->lastDependent[task] = lastDependent;
+}
+
+void StartTileJob(TileJob *pJob)
+{
+	if (pJob->numTasks == 0)
+	{
+		pJob->done = TRUE;
+		return;
+	}
+
+	// Count dependencies before queuing any task: once one is queued, counts may be changed by pool threads
+	memset(pJob->numDeps, 0, pJob->numTasks * sizeof(int));
+	for (int i = 0; i < pJob->numTasks; i++)
+	{
+		for (int j = pJob->firstDependent[i]; j <= pJob->lastDependent[i]; j++)
+			pJob->numDeps[j]++;
+	}
+	for (int i = 0; i < pJob->numTasks; i++)
+		pJob->numPending[i] = pJob->numDeps[i];
+	pJob->numUnfinished = pJob->numTasks;
+	pJob->done = FALSE;
+
+	for (int i = 0; i < pJob->numTasks; i++)
+	{
+		if (pJob->numDeps[i] == 0)
+			PushTileTask(pJob->pPool, -1, pJob, i);
+	}
+}
+
+void WaitTileJob(TileJob *pJob)
+{
+	std::unique_lock<std::mutex> guard(pJob->lock);
+	while (!pJob->done)
+		pJob->finished.wait(guard);
+}
+
+void RunTileJob(TileJob *pJob)
+{
+	StartTileJob(pJob);
+	WaitTileJob(pJob);
+}
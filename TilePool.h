@@ -0,0 +1,50 @@
+// TilePool.h, work-stealing thread pool running the tile tasks of resize jobs
+// See MIT_License.txt
+
+#ifndef IMAGERESIZE_TILEPOOL_H_
+#define IMAGERESIZE_TILEPOOL_H_
+
+// Opaque pool of threads, each with its own deque of tasks; idle threads steal from the others
+typedef struct TilePool TilePool;
+
+// Opaque set of tasks run on a pool, with dependencies between them, that can be run repeatedly
+typedef struct TileJob TileJob;
+
+// Runs one task of a job on a pool thread
+typedef void (*TileFunc)(void *context, int task);
+
+/******************************************************************************
+* PUBLIC FUNCTIONS
+*****************************************************************************/
+
+// Starts pool of numThreads threads. Returns NULL on failure
+TilePool *CreateTilePool(int numThreads);
+
+// Stops pool threads and deallocates pool. No job may still be running on it
+void DestroyTilePool(TilePool *pPool);
+
+// Number of pool threads, and the seconds they have spent running tasks so far
+int GetTilePoolSize(const TilePool *pPool);
+double GetTilePoolBusyTime(const TilePool *pPool);
+
+// Allocates job of numTasks tasks, each run by calling run(context, task). Returns NULL on failure
+// Tasks have no dependencies until they are set
+TileJob *CreateTileJob(TilePool *pPool, int numTasks, TileFunc run, void *context);
+
+// Deallocates job. It may not be running
+void DestroyTileJob(TileJob *pJob);
+
+// Tasks firstDependent..lastDependent are not started before task has finished
+// An empty range, lastDependent < firstDependent, clears them
+void SetTileDependents(TileJob *pJob, int task, int firstDependent, int lastDependent);
+
+// Queues every task of job as soon as the tasks it depends on have finished
+// Returns once all have finished. Any number of threads outside the pool may run jobs at once
+void RunTileJob(TileJob *pJob);
+
+// RunTileJob in two halves, so that one thread can have several jobs running at once
+// StartTileJob returns after queuing, WaitTileJob once all tasks of a started job have finished
+void StartTileJob(TileJob *pJob);
+void WaitTileJob(TileJob *pJob);
+
+#endif // #ifndef IMAGERESIZE_TILEPOOL_H_
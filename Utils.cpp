@@ -2,6 +2,20 @@
 // See MIT_License.txt
 
 #include <ctype.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#else	// Unix, linux, MACOS
+#include <sys/mman.h>
+#include <unistd.h>
+#include <dirent.h>
+#endif
 #include "Utils.h"
 
 //TODO: Refactor into C++ classes
@@ -49,6 +63,10 @@ static const int YUV_YMIN = 16;
 static const int YUV_YMAX = 235;
 static const int YUV_UVMIN = 16;
 static const int YUV_UVMAX = 240;
+static const int YUV_UVZERO = 128;	// Chroma level of a gray pixel, both ranges
+
+// Stream buffer size used when a YUV file cannot be memory-mapped
+static const int YUV_READ_BUFFER_SIZE = 1 << 20;
 
 // Bitmap header. Uses common BITMAPINFOHEADER header
 //#ifdef _WIN32
@@ -95,6 +113,94 @@ typedef struct __attribute__((__packed__))
 } BitmapFileHeader;
 #endif //UNIX
 
+// Fixed-point color conversion matrices
+// out[i] = (sum_j(Cij * (in[j] + INj)) + OUTi) >> SHIFT, clamped to 0..PIXMAX
+// SHIFT is chosen so that every coefficient fits in a signed 16-bit SIMD lane.
+// Coefficients are derived at compile time from the matrix's Kr, Kb luma weights and the
+// YUV_YMIN..YUV_YMAX, YUV_UVMIN..YUV_UVMAX limits (limited range) or 0..PIXMAX (full range),
+// so that each specialization of ConvertRow() uses them as immediates.
+// For Rec.601/709 limited range they reproduce the tables above.
+#define RGB2YUV_SHIFT		14	// Largest RGB->YUV coefficient is ~0.7*2^14
+#define YUV2RGB_SHIFT		13	// Largest YUV->RGB coefficient is ~2.2*2^13
+
+// Kr, Kb luma weights, scaled by 10000 so they can be template arguments
+#define KR_601		2990
+#define KB_601		1140
+#define KR_709		2126
+#define KB_709		722
+#define KR_2020		2627
+#define KB_2020		593
+
+#define FP_ROUND(x)		((int)((x) < 0 ? (x) - 0.5 : (x) + 0.5))
+#define FP_ONE(shift)	((double)(1 << (shift)))
+#define FP_KR			(KR / 10000.0)
+#define FP_KB			(KB / 10000.0)
+#define FP_KG			(1.0 - FP_KR - FP_KB)
+#define FP_YSCALE		(FULL ? 1.0 : (double)(YUV_YMAX - YUV_YMIN) / PIXMAX)
+#define FP_CSCALE		(FULL ? 1.0 : (double)(YUV_UVMAX - YUV_UVMIN) / PIXMAX)
+
+// R'G'B' to Y'CbCr
+template <int KR, int KB, bool FULL>
+struct RGB2YUVMatrix
+{
+	enum
+	{
+		SHIFT = RGB2YUV_SHIFT,
+		C00 = FP_ROUND(FP_ONE(SHIFT) * FP_YSCALE * FP_KR),
+		C01 = FP_ROUND(FP_ONE(SHIFT) * FP_YSCALE * FP_KG),
+		C02 = FP_ROUND(FP_ONE(SHIFT) * FP_YSCALE * FP_KB),
+		C10 = FP_ROUND(FP_ONE(SHIFT) * FP_CSCALE * -FP_KR / (2.0 * (1.0 - FP_KB))),
+		C11 = FP_ROUND(FP_ONE(SHIFT) * FP_CSCALE * -FP_KG / (2.0 * (1.0 - FP_KB))),
+		C12 = FP_ROUND(FP_ONE(SHIFT) * FP_CSCALE * 0.5),
+		C20 = FP_ROUND(FP_ONE(SHIFT) * FP_CSCALE * 0.5),
+		C21 = FP_ROUND(FP_ONE(SHIFT) * FP_CSCALE * -FP_KG / (2.0 * (1.0 - FP_KR))),
+		C22 = FP_ROUND(FP_ONE(SHIFT) * FP_CSCALE * -FP_KB / (2.0 * (1.0 - FP_KR))),
+		IN0 = 0,
+		IN1 = 0,
+		IN2 = 0,
+		OUT0 = ((FULL ? 0 : YUV_YMIN) << SHIFT) + (1 << (SHIFT - 1)),
+		OUT1 = (YUV_UVZERO << SHIFT) + (1 << (SHIFT - 1)),
+		OUT2 = (YUV_UVZERO << SHIFT) + (1 << (SHIFT - 1))
+	};
+};
+
+// Y'CbCr to R'G'B'
+template <int KR, int KB, bool FULL>
+struct YUV2RGBMatrix
+{
+	enum
+	{
+		SHIFT = YUV2RGB_SHIFT,
+		C00 = FP_ROUND(FP_ONE(SHIFT) / FP_YSCALE),
+		C01 = 0,
+		C02 = FP_ROUND(FP_ONE(SHIFT) / FP_CSCALE * 2.0 * (1.0 - FP_KR)),
+		C10 = C00,
+		C11 = FP_ROUND(FP_ONE(SHIFT) / FP_CSCALE * -2.0 * (1.0 - FP_KB) * FP_KB / FP_KG),
+		C12 = FP_ROUND(FP_ONE(SHIFT) / FP_CSCALE * -2.0 * (1.0 - FP_KR) * FP_KR / FP_KG),
+		C20 = C00,
+		C21 = FP_ROUND(FP_ONE(SHIFT) / FP_CSCALE * 2.0 * (1.0 - FP_KB)),
+		C22 = 0,
+		IN0 = FULL ? 0 : -YUV_YMIN,
+		IN1 = -YUV_UVZERO,
+		IN2 = -YUV_UVZERO,
+		OUT0 = 1 << (SHIFT - 1),
+		OUT1 = 1 << (SHIFT - 1),
+		OUT2 = 1 << (SHIFT - 1)
+	};
+};
+
+#undef FP_ROUND
+#undef FP_ONE
+#undef FP_KR
+#undef FP_KB
+#undef FP_KG
+#undef FP_YSCALE
+#undef FP_CSCALE
+
+// Converts one row of 3 planes of 8BPP pixels
+typedef void (*ConvertRowFunc)(const PIXEL *in0, const PIXEL *in1, const PIXEL *in2,
+	PIXEL *out0, PIXEL *out1, PIXEL *out2, int width);
+
 /******************************************************************************
 * PRIVATE FUNCTIONS forward declarations
 *****************************************************************************/
@@ -104,13 +210,73 @@ static bool RGBImage2YUV(const IMAGE *pImageIn, IMAGE *pImageOut);
 // Converts 8BPP YUV444/422/420 image to 8BPP RGB
 static bool YUVImage2RGB(const IMAGE *pImageIn, IMAGE *pImageOut);
 
-// Converts 8BPP YUV pixel to 8BPP RGB
-static void YUVPixel2RGB(PIXEL yuvPixel[], PIXEL rgbPixel[]);
-
-// Converts 8BPP RGB pixel to 8BPP YUV Rec.601
+// Returns RGB->YUV row conversion specialized for given matrix and range
 // Note: Clamps only to 0..PIXMAX boundary, not 16..235/16..240 range 
 // to preserve excursions for indermediate processing stages
-static void RGBPixel2YUV(PIXEL rgbPixel[], PIXEL yuvPixel[]);
+static ConvertRowFunc GetRGB2YUVRowFunc(YUVMatrix matrix, YUVRange range);
+
+// Returns YUV->RGB row conversion specialized for given matrix and range
+static ConvertRowFunc GetYUV2RGBRowFunc(YUVMatrix matrix, YUVRange range);
+
+// Applies fixed-point color matrix M to one row of 3 planes of 8BPP pixels
+template <class M>
+static void ConvertRow(const PIXEL *in0, const PIXEL *in1, const PIXEL *in2,
+	PIXEL *out0, PIXEL *out1, PIXEL *out2, int width);
+
+// Converts a row of RGB to Y and [1 2 1] filtered, 2:1 subsampled U, V
+static void RGBRow2YUV422(const PIXEL *rgbRow[3], PIXEL *yRow, PIXEL *uRow, PIXEL *vRow,
+	int width, ConvertRowFunc convertRow, PIXEL *chromaRows);
+
+// Converts row y of 8BPP YUV444/422/420 image to RGB, replicating subsampled chroma
+// chromaRows is scratch space for 2 rows of full resolution U, V
+static void YUVRow2RGB(const IMAGE *pImage, int y, PIXEL *rgbRow[3], ConvertRowFunc convertRow, PIXEL *chromaRows);
+
+// Converts a pair of RGB rows to Y and 2x2 averaged U, V without an intermediate YUV444 image
+static void RGBRowPair2YUV420(const PIXEL *rgbRow0[3], const PIXEL *rgbRow1[3], PIXEL *yRow0, PIXEL *yRow1,
+	PIXEL *uRow, PIXEL *vRow, int width, ConvertRowFunc convertRow, PIXEL *chromaRows);
+
+// Splits count interleaved (a, b) byte pairs into two rows
+static void DeinterleaveRow(const PIXEL *in, PIXEL *out0, PIXEL *out1, int count);
+
+// Merges two rows into count interleaved (a, b) byte pairs
+static void InterleaveRow(const PIXEL *in0, const PIXEL *in1, PIXEL *out, int count);
+
+// Splits count interleaved (a, b, c) byte triplets into three rows
+static void DeinterleaveTripletRow(const PIXEL *in, PIXEL *out0, PIXEL *out1, PIXEL *out2, int count);
+
+// Merges three rows into count interleaved (a, b, c) byte triplets
+static void InterleaveTripletRow(const PIXEL *in0, const PIXEL *in1, const PIXEL *in2, PIXEL *out, int count);
+
+// Shifts count 16-bit samples right (shift > 0) or left (shift < 0)
+static void ShiftRow16(const PIXEL16 *in, PIXEL16 *out, int count, int shift);
+
+// Splits count interleaved (a, b) 16-bit pairs into two rows, shifting each sample right by shift > 0
+static void DeinterleaveRow16(const PIXEL16 *in, PIXEL16 *out0, PIXEL16 *out1, int count, int shift);
+
+// Merges two rows into count interleaved (a, b) 16-bit pairs, shifting each sample left by shift
+static void InterleaveRow16(const PIXEL16 *in0, const PIXEL16 *in1, PIXEL16 *out, int count, int shift);
+
+// Splits row of packed YUY2 or UYVY pixel pairs into Y, U and V rows
+static void UnpackYUV422Row(const PIXEL *in, PIXEL *yRow, PIXEL *uRow, PIXEL *vRow, int width, bool isUYVY);
+
+// Merges Y, U and V rows into row of packed YUY2 or UYVY pixel pairs
+static void PackYUV422Row(const PIXEL *yRow, const PIXEL *uRow, const PIXEL *vRow, PIXEL *out, int width, bool isUYVY);
+
+// Converts YUV444/422/420 image to another of these subsamplings: luma copied, chroma resampled
+static bool ResampleYUVImage(const IMAGE *pImageIn, IMAGE *pImageOut);
+
+// Returns sequence number if fileName is prefix, frameDigits zero-padded digits and extension, else -1
+static int MatchSequenceFileName(const char *fileName, const char *prefix, int frameDigits, const char *extension);
+
+// Scans directory once for files of sequence numbered from startFrame on, returned sorted in *pFrameNumbers
+static int ScanSequenceFrames(const char *dirName, const char *prefix, int frameDigits, const char *extension,
+	int startFrame, int **pFrameNumbers);
+
+// Returns TRUE if name matches pattern, in which * stands for any characters and ? for any one character
+static bool MatchWildcards(const char *name, const char *pattern);
+
+// Points rows of image view at given frame of Y4M stream
+static bool ReadY4MSequenceFrame(YUVSequenceReader *pReader, int frame, IMAGE *pImage);
 
 /******************************************************************************
 * PRIVATE FUNCTIONS
@@ -185,52 +351,415 @@ void Free3DArray(void ***array3D)
 	return;
 }
 
-// Converts 8BPP YUV Rec.601 pixel to 8BPP RGB
-static void YUVPixel2RGB(PIXEL yuvPixel[], PIXEL rgbPixel[])
+#ifdef USE_SSE2
+// One output component for 8 pixels: in01 holds interleaved (in0, in1) pairs, in2z holds (in2, 0) pairs,
+// so that each _mm_madd_epi16 yields c0*in0 + c1*in1 and c2*in2 in 32 bits
+static inline __m128i MatrixRow8(__m128i in01Lo, __m128i in01Hi, __m128i in2zLo, __m128i in2zHi,
+	const int c0, const int c1, const int c2, const int outOffset, const int shift)
+{
+	const __m128i coef01 = _mm_set1_epi32((int)(((unsigned)c0 & 0xFFFF) | ((unsigned)c1 << 16)));
+	const __m128i coef2 = _mm_set1_epi32(c2 & 0xFFFF);
+	const __m128i offset = _mm_set1_epi32(outOffset);
+
+	__m128i lo = _mm_add_epi32(_mm_madd_epi16(in01Lo, coef01), _mm_madd_epi16(in2zLo, coef2));
+	__m128i hi = _mm_add_epi32(_mm_madd_epi16(in01Hi, coef01), _mm_madd_epi16(in2zHi, coef2));
+	lo = _mm_srai_epi32(_mm_add_epi32(lo, offset), shift);
+	hi = _mm_srai_epi32(_mm_add_epi32(hi, offset), shift);
+
+	// Saturating packs clamp to 0..PIXMAX
+	__m128i result = _mm_packs_epi32(lo, hi);
+	return _mm_packus_epi16(result, result);
+}
+#endif
+
+// Applies fixed-point color matrix M to one row of 3 planes of 8BPP pixels
+template <class M>
+static void ConvertRow(const PIXEL *in0, const PIXEL *in1, const PIXEL *in2,
+	PIXEL *out0, PIXEL *out1, PIXEL *out2, int width)
 {
-	// Account for YUV offsets before matrix multiply
-	double tempPixel[3] = {
-		(double)yuvPixel[Y_PLANE] + YUV601toRGB[Y_PLANE][3],
-		(double)yuvPixel[U_PLANE] + YUV601toRGB[U_PLANE][3],
-		(double)yuvPixel[V_PLANE] + YUV601toRGB[V_PLANE][3] };
+	int x = 0;
 
-	rgbPixel[R_PLANE] = (PIXEL)(CLAMP((YUV601toRGB[0][0] * tempPixel[Y_PLANE] +
-		YUV601toRGB[0][1] * tempPixel[U_PLANE] +
-		YUV601toRGB[0][2] * tempPixel[V_PLANE]) / 256.0 + 0.5, 0, PIXMAX));
+#ifdef USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i inOffset0 = _mm_set1_epi16((short)M::IN0);
+	const __m128i inOffset1 = _mm_set1_epi16((short)M::IN1);
+	const __m128i inOffset2 = _mm_set1_epi16((short)M::IN2);
 
-	rgbPixel[G_PLANE] = (PIXEL)(CLAMP((YUV601toRGB[1][0] * tempPixel[Y_PLANE] +
-		YUV601toRGB[1][1] * tempPixel[U_PLANE] +
-		YUV601toRGB[1][2] * tempPixel[V_PLANE]) / 256.0 + 0.5, 0, PIXMAX));
+	for (; x + 8 <= width; x += 8)
+	{
+		// Widen 8 pixels of each input to 16 bits and apply input offsets
+		__m128i a = _mm_add_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(in0 + x)), zero), inOffset0);
+		__m128i b = _mm_add_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(in1 + x)), zero), inOffset1);
+		__m128i c = _mm_add_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(in2 + x)), zero), inOffset2);
+
+		__m128i abLo = _mm_unpacklo_epi16(a, b);
+		__m128i abHi = _mm_unpackhi_epi16(a, b);
+		__m128i czLo = _mm_unpacklo_epi16(c, zero);
+		__m128i czHi = _mm_unpackhi_epi16(c, zero);
+
+		_mm_storel_epi64((__m128i *)(out0 + x), MatrixRow8(abLo, abHi, czLo, czHi, M::C00, M::C01, M::C02, M::OUT0, M::SHIFT));
+		_mm_storel_epi64((__m128i *)(out1 + x), MatrixRow8(abLo, abHi, czLo, czHi, M::C10, M::C11, M::C12, M::OUT1, M::SHIFT));
+		_mm_storel_epi64((__m128i *)(out2 + x), MatrixRow8(abLo, abHi, czLo, czHi, M::C20, M::C21, M::C22, M::OUT2, M::SHIFT));
+	}
+#endif
 
-	rgbPixel[B_PLANE] = (PIXEL)(CLAMP((YUV601toRGB[2][0] * tempPixel[Y_PLANE] +
-		YUV601toRGB[2][1] * tempPixel[U_PLANE] +
-		YUV601toRGB[2][2] * tempPixel[V_PLANE]) / 256.0 + 0.5, 0, PIXMAX));
+	// Remaining pixels
+	for (; x < width; x++)
+	{
+		int a = in0[x] + M::IN0;
+		int b = in1[x] + M::IN1;
+		int c = in2[x] + M::IN2;
+
+		out0[x] = (PIXEL)CLAMP((M::C00 * a + M::C01 * b + M::C02 * c + M::OUT0) >> M::SHIFT, 0, PIXMAX);
+		out1[x] = (PIXEL)CLAMP((M::C10 * a + M::C11 * b + M::C12 * c + M::OUT1) >> M::SHIFT, 0, PIXMAX);
+		out2[x] = (PIXEL)CLAMP((M::C20 * a + M::C21 * b + M::C22 * c + M::OUT2) >> M::SHIFT, 0, PIXMAX);
+	}
 }
 
-// Converts 8BPP RGB pixel to 8BPP YUV Rec.601
-// Note: Clamps only to 0..PIXMAX boundary, not 16..235/16..240 range 
-// to preserve excursions for indermediate processing stages
-static void RGBPixel2YUV(PIXEL rgbPixel[], PIXEL yuvPixel[])
+// Returns RGB->YUV row conversion specialized for given matrix and range
+static ConvertRowFunc GetRGB2YUVRowFunc(YUVMatrix matrix, YUVRange range)
+{
+	bool full = (range == FULL_RANGE);
+	switch (matrix)
+	{
+	case BT709:
+		return full ? ConvertRow< RGB2YUVMatrix<KR_709, KB_709, true> > :
+			ConvertRow< RGB2YUVMatrix<KR_709, KB_709, false> >;
+	case BT2020:
+		return full ? ConvertRow< RGB2YUVMatrix<KR_2020, KB_2020, true> > :
+			ConvertRow< RGB2YUVMatrix<KR_2020, KB_2020, false> >;
+	case BT601:
+	default:
+		return full ? ConvertRow< RGB2YUVMatrix<KR_601, KB_601, true> > :
+			ConvertRow< RGB2YUVMatrix<KR_601, KB_601, false> >;
+	}
+}
+
+// Returns YUV->RGB row conversion specialized for given matrix and range
+static ConvertRowFunc GetYUV2RGBRowFunc(YUVMatrix matrix, YUVRange range)
+{
+	bool full = (range == FULL_RANGE);
+	switch (matrix)
+	{
+	case BT709:
+		return full ? ConvertRow< YUV2RGBMatrix<KR_709, KB_709, true> > :
+			ConvertRow< YUV2RGBMatrix<KR_709, KB_709, false> >;
+	case BT2020:
+		return full ? ConvertRow< YUV2RGBMatrix<KR_2020, KB_2020, true> > :
+			ConvertRow< YUV2RGBMatrix<KR_2020, KB_2020, false> >;
+	case BT601:
+	default:
+		return full ? ConvertRow< YUV2RGBMatrix<KR_601, KB_601, true> > :
+			ConvertRow< YUV2RGBMatrix<KR_601, KB_601, false> >;
+	}
+}
+
+// Converts a row of RGB to a row of Y and a row of horizontally [1 2 1] filtered, 2:1 subsampled U, V
+// chromaRows is scratch space for 2 rows of full resolution U, V
+static void RGBRow2YUV422(const PIXEL *rgbRow[3], PIXEL *yRow, PIXEL *uRow, PIXEL *vRow,
+	int width, ConvertRowFunc convertRow, PIXEL *chromaRows)
+{
+	PIXEL *uFull = chromaRows;
+	PIXEL *vFull = chromaRows + width;
+
+	convertRow(rgbRow[R_PLANE], rgbRow[G_PLANE], rgbRow[B_PLANE], yRow, uFull, vFull, width);
+
+	for (int x = 0; x < width; x += 2)
+	{
+		// Repeat edge pixels
+		int xLeft = MAX(x - 1, 0);
+		int xRight = MIN(x + 1, width - 1);
+		uRow[x / 2] = (PIXEL)((uFull[xLeft] + 2 * uFull[x] + uFull[xRight] + 2) >> 2);
+		vRow[x / 2] = (PIXEL)((vFull[xLeft] + 2 * vFull[x] + vFull[xRight] + 2) >> 2);
+	}
+}
+
+// Converts a pair of RGB rows to 2 rows of Y and a row of 2x2 averaged U, V
+// Y is written directly; chromaRows is scratch space for 4 rows of full resolution U, V
+static void RGBRowPair2YUV420(const PIXEL *rgbRow0[3], const PIXEL *rgbRow1[3], PIXEL *yRow0, PIXEL *yRow1,
+	PIXEL *uRow, PIXEL *vRow, int width, ConvertRowFunc convertRow, PIXEL *chromaRows)
+{
+	PIXEL *uFull0 = chromaRows;
+	PIXEL *vFull0 = chromaRows + width;
+	PIXEL *uFull1 = chromaRows + 2 * width;
+	PIXEL *vFull1 = chromaRows + 3 * width;
+
+	convertRow(rgbRow0[R_PLANE], rgbRow0[G_PLANE], rgbRow0[B_PLANE], yRow0, uFull0, vFull0, width);
+	if (rgbRow1[R_PLANE] != rgbRow0[R_PLANE])
+		convertRow(rgbRow1[R_PLANE], rgbRow1[G_PLANE], rgbRow1[B_PLANE], yRow1, uFull1, vFull1, width);
+	else
+	{
+		// Odd height: last row repeated
+		uFull1 = uFull0;
+		vFull1 = vFull0;
+	}
+
+	const PIXEL *full0[2] = { uFull0, vFull0 };
+	const PIXEL *full1[2] = { uFull1, vFull1 };
+	PIXEL *out[2] = { uRow, vRow };
+	for (int c = 0; c < 2; c++)
+	{
+		int x = 0;
+#ifdef USE_SSE2
+		const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+		const __m128i two = _mm_set1_epi16(2);
+		for (; x + 16 <= width; x += 16)
+		{
+			// Sum horizontal pairs of each row in 16 bits, then add rows
+			__m128i row0 = _mm_loadu_si128((const __m128i *)(full0[c] + x));
+			__m128i row1 = _mm_loadu_si128((const __m128i *)(full1[c] + x));
+			__m128i sum = _mm_add_epi16(_mm_and_si128(row0, lowBytes), _mm_srli_epi16(row0, 8));
+			sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_and_si128(row1, lowBytes), _mm_srli_epi16(row1, 8)));
+			sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+			_mm_storel_epi64((__m128i *)(out[c] + x / 2), _mm_packus_epi16(sum, sum));
+		}
+#endif
+		for (; x < width; x += 2)
+		{
+			// Repeat last pixel if width is odd
+			int x1 = MIN(x + 1, width - 1);
+			out[c][x / 2] = (PIXEL)((full0[c][x] + full0[c][x1] + full1[c][x] + full1[c][x1] + 2) >> 2);
+		}
+	}
+}
+
+// Splits count interleaved (a, b) byte pairs into two rows
+static void DeinterleaveRow(const PIXEL *in, PIXEL *out0, PIXEL *out1, int count)
+{
+	int x = 0;
+#ifdef USE_SSE2
+	const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+	for (; x + 16 <= count; x += 16)
+	{
+		__m128i pairs0 = _mm_loadu_si128((const __m128i *)(in + 2 * x));
+		__m128i pairs1 = _mm_loadu_si128((const __m128i *)(in + 2 * x + 16));
+		__m128i a = _mm_packus_epi16(_mm_and_si128(pairs0, lowBytes), _mm_and_si128(pairs1, lowBytes));
+		__m128i b = _mm_packus_epi16(_mm_srli_epi16(pairs0, 8), _mm_srli_epi16(pairs1, 8));
+		_mm_storeu_si128((__m128i *)(out0 + x), a);
+		_mm_storeu_si128((__m128i *)(out1 + x), b);
+	}
+#endif
+	for (; x < count; x++)
+	{
+		out0[x] = in[2 * x];
+		out1[x] = in[2 * x + 1];
+	}
+}
+
+// Splits count interleaved (a, b, c) byte triplets into three rows
+static void DeinterleaveTripletRow(const PIXEL *in, PIXEL *out0, PIXEL *out1, PIXEL *out2, int count)
+{
+	int x = 0;
+#ifdef USE_SSE2
+	// SSE2 has no byte shuffle: four rounds of unpacking 48 bytes against their upper halves
+	// sort them into 16 of each of a, b, c
+	for (; x + 16 <= count; x += 16)
+	{
+		__m128i v0 = _mm_loadu_si128((const __m128i *)(in + 3 * x));
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(in + 3 * x + 16));
+		__m128i v2 = _mm_loadu_si128((const __m128i *)(in + 3 * x + 32));
+		for (int round = 0; round < 4; round++)
+		{
+			__m128i t0 = _mm_unpacklo_epi8(v0, _mm_unpackhi_epi64(v1, v1));
+			__m128i t1 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(v0, v0), v2);
+			__m128i t2 = _mm_unpacklo_epi8(v1, _mm_unpackhi_epi64(v2, v2));
+			v0 = t0;
+			v1 = t1;
+			v2 = t2;
+		}
+		_mm_storeu_si128((__m128i *)(out0 + x), v0);
+		_mm_storeu_si128((__m128i *)(out1 + x), v1);
+		_mm_storeu_si128((__m128i *)(out2 + x), v2);
+	}
+#endif
+	for (; x < count; x++)
+	{
+		out0[x] = in[3 * x];
+		out1[x] = in[3 * x + 1];
+		out2[x] = in[3 * x + 2];
+	}
+}
+
+// Merges two rows into count interleaved (a, b) byte pairs
+static void InterleaveRow(const PIXEL *in0, const PIXEL *in1, PIXEL *out, int count)
+{
+	int x = 0;
+#ifdef USE_SSE2
+	for (; x + 16 <= count; x += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)(in0 + x));
+		__m128i b = _mm_loadu_si128((const __m128i *)(in1 + x));
+		_mm_storeu_si128((__m128i *)(out + 2 * x), _mm_unpacklo_epi8(a, b));
+		_mm_storeu_si128((__m128i *)(out + 2 * x + 16), _mm_unpackhi_epi8(a, b));
+	}
+#endif
+	for (; x < count; x++)
+	{
+		out[2 * x] = in0[x];
+		out[2 * x + 1] = in1[x];
+	}
+}
+
+// Merges three rows into count interleaved (a, b, c) byte triplets
+static void InterleaveTripletRow(const PIXEL *in0, const PIXEL *in1, const PIXEL *in2, PIXEL *out, int count)
+{
+	int x = 0;
+#ifdef USE_SSE2
+	// Inverse of DeinterleaveTripletRow: each round splits the even and odd bytes of its inputs
+	const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+	for (; x + 16 <= count; x += 16)
+	{
+		__m128i v0 = _mm_loadu_si128((const __m128i *)(in0 + x));
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(in1 + x));
+		__m128i v2 = _mm_loadu_si128((const __m128i *)(in2 + x));
+		for (int round = 0; round < 4; round++)
+		{
+			__m128i t0 = _mm_packus_epi16(_mm_and_si128(v0, lowBytes), _mm_and_si128(v1, lowBytes));
+			__m128i t1 = _mm_packus_epi16(_mm_and_si128(v2, lowBytes), _mm_srli_epi16(v0, 8));
+			__m128i t2 = _mm_packus_epi16(_mm_srli_epi16(v1, 8), _mm_srli_epi16(v2, 8));
+			v0 = t0;
+			v1 = t1;
+			v2 = t2;
+		}
+		_mm_storeu_si128((__m128i *)(out + 3 * x), v0);
+		_mm_storeu_si128((__m128i *)(out + 3 * x + 16), v1);
+		_mm_storeu_si128((__m128i *)(out + 3 * x + 32), v2);
+	}
+#endif
+	for (; x < count; x++)
+	{
+		out[3 * x] = in0[x];
+		out[3 * x + 1] = in1[x];
+		out[3 * x + 2] = in2[x];
+	}
+}
+
+// Shifts count 16-bit samples right (shift > 0) or left (shift < 0)
+static void ShiftRow16(const PIXEL16 *in, PIXEL16 *out, int count, int shift)
+{
+	int x = 0;
+#ifdef USE_SSE2
+	const __m128i rightShift = _mm_cvtsi32_si128(MAX(shift, 0));
+	const __m128i leftShift = _mm_cvtsi32_si128(MAX(-shift, 0));
+	for (; x + 8 <= count; x += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + x));
+		_mm_storeu_si128((__m128i *)(out + x), _mm_sll_epi16(_mm_srl_epi16(v, rightShift), leftShift));
+	}
+#endif
+	for (; x < count; x++)
+		out[x] = (PIXEL16)((shift > 0) ? in[x] >> shift : in[x] << -shift);
+}
+
+// Splits count interleaved (a, b) 16-bit pairs into two rows, shifting each sample right by shift > 0
+static void DeinterleaveRow16(const PIXEL16 *in, PIXEL16 *out0, PIXEL16 *out1, int count, int shift)
 {
-	yuvPixel[Y_PLANE] = (PIXEL)(CLAMP((RGBtoYUV601[0][0] * rgbPixel[R_PLANE] +
-		RGBtoYUV601[0][1] * rgbPixel[G_PLANE] +
-		RGBtoYUV601[0][2] * rgbPixel[B_PLANE]) / 256.0 + RGBtoYUV601[0][3] + 0.5, 0, PIXMAX));
+	int x = 0;
+#ifdef USE_SSE2
+	// Shifted samples fit in 15 bits, so the signed 32->16 bit pack does not saturate
+	const __m128i rightShift = _mm_cvtsi32_si128(shift);
+	for (; x + 8 <= count; x += 8)
+	{
+		__m128i pairs0 = _mm_srl_epi16(_mm_loadu_si128((const __m128i *)(in + 2 * x)), rightShift);
+		__m128i pairs1 = _mm_srl_epi16(_mm_loadu_si128((const __m128i *)(in + 2 * x + 8)), rightShift);
+		__m128i a = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(pairs0, 16), 16),
+			_mm_srai_epi32(_mm_slli_epi32(pairs1, 16), 16));
+		__m128i b = _mm_packs_epi32(_mm_srli_epi32(pairs0, 16), _mm_srli_epi32(pairs1, 16));
+		_mm_storeu_si128((__m128i *)(out0 + x), a);
+		_mm_storeu_si128((__m128i *)(out1 + x), b);
+	}
+#endif
+	for (; x < count; x++)
+	{
+		out0[x] = (PIXEL16)(in[2 * x] >> shift);
+		out1[x] = (PIXEL16)(in[2 * x + 1] >> shift);
+	}
+}
+
+// Merges two rows into count interleaved (a, b) 16-bit pairs, shifting each sample left by shift
+static void InterleaveRow16(const PIXEL16 *in0, const PIXEL16 *in1, PIXEL16 *out, int count, int shift)
+{
+	int x = 0;
+#ifdef USE_SSE2
+	const __m128i leftShift = _mm_cvtsi32_si128(shift);
+	for (; x + 8 <= count; x += 8)
+	{
+		__m128i a = _mm_sll_epi16(_mm_loadu_si128((const __m128i *)(in0 + x)), leftShift);
+		__m128i b = _mm_sll_epi16(_mm_loadu_si128((const __m128i *)(in1 + x)), leftShift);
+		_mm_storeu_si128((__m128i *)(out + 2 * x), _mm_unpacklo_epi16(a, b));
+		_mm_storeu_si128((__m128i *)(out + 2 * x + 8), _mm_unpackhi_epi16(a, b));
+	}
+#endif
+	for (; x < count; x++)
+	{
+		out[2 * x] = (PIXEL16)(in0[x] << shift);
+		out[2 * x + 1] = (PIXEL16)(in1[x] << shift);
+	}
+}
 
-	yuvPixel[U_PLANE] = (PIXEL)(CLAMP((RGBtoYUV601[1][0] * rgbPixel[R_PLANE] +
-		RGBtoYUV601[1][1] * rgbPixel[G_PLANE] +
-		RGBtoYUV601[1][2] * rgbPixel[B_PLANE]) / 256.0 + RGBtoYUV601[1][3] + 0.5, 0, PIXMAX));
+// Splits row of packed YUY2 (Y0 U Y1 V) or UYVY (U Y0 V Y1) pixel pairs into Y, U and V rows
+// The second Y of the last pair of an odd width row is dropped
+static void UnpackYUV422Row(const PIXEL *in, PIXEL *yRow, PIXEL *uRow, PIXEL *vRow, int width, bool isUYVY)
+{
+	int x = 0;
+#ifdef USE_SSE2
+	const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 8 <= width / 2; x += 8)
+	{
+		__m128i pairs0 = _mm_loadu_si128((const __m128i *)(in + 4 * x));
+		__m128i pairs1 = _mm_loadu_si128((const __m128i *)(in + 4 * x + 16));
+		__m128i even = _mm_packus_epi16(_mm_and_si128(pairs0, lowBytes), _mm_and_si128(pairs1, lowBytes));
+		__m128i odd = _mm_packus_epi16(_mm_srli_epi16(pairs0, 8), _mm_srli_epi16(pairs1, 8));
+		__m128i chroma = isUYVY ? even : odd;
+		_mm_storeu_si128((__m128i *)(yRow + 2 * x), isUYVY ? odd : even);
+		_mm_storel_epi64((__m128i *)(uRow + x), _mm_packus_epi16(_mm_and_si128(chroma, lowBytes), zero));
+		_mm_storel_epi64((__m128i *)(vRow + x), _mm_packus_epi16(_mm_srli_epi16(chroma, 8), zero));
+	}
+#endif
+	const int lumaOffset = isUYVY ? 1 : 0;
+	const int chromaOffset = isUYVY ? 0 : 1;
+	for (; x < (width + 1) / 2; x++)
+	{
+		yRow[2 * x] = in[4 * x + lumaOffset];
+		if (2 * x + 1 < width)
+			yRow[2 * x + 1] = in[4 * x + 2 + lumaOffset];
+		uRow[x] = in[4 * x + chromaOffset];
+		vRow[x] = in[4 * x + 2 + chromaOffset];
+	}
+}
 
-	yuvPixel[V_PLANE] = (PIXEL)(CLAMP((RGBtoYUV601[2][0] * rgbPixel[R_PLANE] +
-		RGBtoYUV601[2][1] * rgbPixel[G_PLANE] +
-		RGBtoYUV601[2][2] * rgbPixel[B_PLANE]) / 256.0 + RGBtoYUV601[2][3] + 0.5, 0, PIXMAX));
+// Merges Y, U and V rows into row of packed YUY2 (Y0 U Y1 V) or UYVY (U Y0 V Y1) pixel pairs
+// The last Y of an odd width row is repeated to complete its pair
+static void PackYUV422Row(const PIXEL *yRow, const PIXEL *uRow, const PIXEL *vRow, PIXEL *out, int width, bool isUYVY)
+{
+	int x = 0;
+#ifdef USE_SSE2
+	for (; x + 8 <= width / 2; x += 8)
+	{
+		__m128i luma = _mm_loadu_si128((const __m128i *)(yRow + 2 * x));
+		__m128i chroma = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(uRow + x)),
+			_mm_loadl_epi64((const __m128i *)(vRow + x)));
+		_mm_storeu_si128((__m128i *)(out + 4 * x),
+			isUYVY ? _mm_unpacklo_epi8(chroma, luma) : _mm_unpacklo_epi8(luma, chroma));
+		_mm_storeu_si128((__m128i *)(out + 4 * x + 16),
+			isUYVY ? _mm_unpackhi_epi8(chroma, luma) : _mm_unpackhi_epi8(luma, chroma));
+	}
+#endif
+	const int lumaOffset = isUYVY ? 1 : 0;
+	const int chromaOffset = isUYVY ? 0 : 1;
+	for (; x < (width + 1) / 2; x++)
+	{
+		out[4 * x + lumaOffset] = yRow[2 * x];
+		out[4 * x + 2 + lumaOffset] = yRow[MIN(2 * x + 1, width - 1)];
+		out[4 * x + chromaOffset] = uRow[x];
+		out[4 * x + 2 + chromaOffset] = vRow[x];
+	}
 }
 
 // Converts 8BPP YUV444/422/420 image to 8BPP RGB
 static bool YUVImage2RGB(const IMAGE *pImageIn, IMAGE *pImageOut)
 {
-	PIXEL yuvPixel[3];
-	PIXEL rgbPixel[3];
-
 	// Output parameters should already have been set
 	//pImageOut->colorSpace = RGB;
 	//pImageOut->height = pImageIn->height;
@@ -247,70 +776,62 @@ static bool YUVImage2RGB(const IMAGE *pImageIn, IMAGE *pImageOut)
 	// Verify 8BPP
 	if (pImageIn->precision != BPP8 || pImageOut->precision != BPP8)
 	{
-		fprintf(stderr, "ERROR UTILS::RGBImage2YUV(): Only 8BPP precision supported!\n");
+		fprintf(stderr, "ERROR UTILS::YUVImage2RGB(): Only 8BPP precision supported!\n");
 		return FALSE;
 	}
 
-	switch (pImageIn->colorSpace)
+	// Input image determines the YUV matrix and range
+	ConvertRowFunc convertRow = GetYUV2RGBRowFunc(pImageIn->yuvMatrix, pImageIn->yuvRange);
+
+	// YUV422/420 need full resolution chroma rows
+	PIXEL *chromaRows = NULL;
+	if (pImageIn->colorSpace != YUV444)
 	{
-	case YUV444:
-		for (int y = 0; y < pImageOut->height; y++){
-			for (int x = 0; x < pImageOut->width; x++) {
-				GetPixel(pImageIn, y, x, REPEAT, yuvPixel);
-				YUVPixel2RGB(yuvPixel, rgbPixel);
-				SetPixel(pImageOut, y, x, rgbPixel);
-			}
-		}
-		break;
-	case YUV422:
-		for (int y = 0; y < pImageOut->height; y++){
-			for (int x = 0; x < pImageOut->width; x += 2) {
-
-				// Convert cosited pixel
-				GetPixel(pImageIn, y, x, REPEAT, yuvPixel);
-				YUVPixel2RGB(yuvPixel, rgbPixel);
-				SetPixel(pImageOut, y, x, rgbPixel);
-
-				// Convert non-cosited pixel
-				GetPixel(pImageIn, y, x + 1, REPEAT, yuvPixel);
-				YUVPixel2RGB(yuvPixel, rgbPixel);
-				SetPixel(pImageOut, y, x + 1, rgbPixel);
-			}
-		}
-		break;
-	case YUV420:
-		for (int y = 0; y < pImageOut->height; y += 2){
-			for (int x = 0; x < pImageOut->width; x += 2) {
-
-				// Convert cosited pixel
-				GetPixel(pImageIn, y, x, REPEAT, yuvPixel);
-				YUVPixel2RGB(yuvPixel, rgbPixel);
-				SetPixel(pImageOut, y, x, rgbPixel);
-
-				// Convert non-cosited pixel upper right
-				GetPixel(pImageIn, y, x + 1, REPEAT, yuvPixel);
-				YUVPixel2RGB(yuvPixel, rgbPixel);
-				SetPixel(pImageOut, y, x + 1, rgbPixel);
-
-				// Convert non-cosited pixel lower left
-				GetPixel(pImageIn, y + 1, x, REPEAT, yuvPixel);
-				YUVPixel2RGB(yuvPixel, rgbPixel);
-				SetPixel(pImageOut, y + 1, x, rgbPixel);
-
-				// Convert non-cosited pixel lower right
-				GetPixel(pImageIn, y + 1, x + 1, REPEAT, yuvPixel);
-				YUVPixel2RGB(yuvPixel, rgbPixel);
-				SetPixel(pImageOut, y + 1, x + 1, rgbPixel);
-			}
+		chromaRows = (PIXEL *)malloc(2 * pImageOut->width);
+		if (chromaRows == NULL)
+		{
+			fprintf(stderr, "ERROR UTILS::YUVImage2RGB(): Could not allocate chroma row buffer!\n");
+			return FALSE;
 		}
-		break;
-	default:
-		fprintf(stderr, "ERROR UTILS::YUVImage2RGB(): Input image must be in YUV 444/422/420!\n");
-		return FALSE;
 	}
+
+	for (int y = 0; y < pImageOut->height; y++)
+	{
+		PIXEL *rgbRow[3] = { pImageOut->pixArray[R_PLANE][y], pImageOut->pixArray[G_PLANE][y],
+			pImageOut->pixArray[B_PLANE][y] };
+		YUVRow2RGB(pImageIn, y, rgbRow, convertRow, chromaRows);
+	}
+	free(chromaRows);
+
 	return TRUE;
 }
 
+// Converts row y of 8BPP YUV444/422/420 image to RGB, replicating subsampled chroma
+static void YUVRow2RGB(const IMAGE *pImage, int y, PIXEL *rgbRow[3], ConvertRowFunc convertRow, PIXEL *chromaRows)
+{
+	if (pImage->colorSpace == YUV444)
+	{
+		convertRow(pImage->pixArray[Y_PLANE][y], pImage->pixArray[U_PLANE][y], pImage->pixArray[V_PLANE][y],
+			rgbRow[R_PLANE], rgbRow[G_PLANE], rgbRow[B_PLANE], pImage->width);
+		return;
+	}
+
+	// YUV422/420: replicate each chroma sample across its cosited and non-cosited pixels
+	PIXEL *uRow = chromaRows;
+	PIXEL *vRow = chromaRows + pImage->width;
+	int yUV = (pImage->colorSpace == YUV420) ? y / 2 : y;
+	const PIXEL *uIn = pImage->pixArray[U_PLANE][yUV];
+	const PIXEL *vIn = pImage->pixArray[V_PLANE][yUV];
+	for (int x = 0; x < pImage->width; x++)
+	{
+		uRow[x] = uIn[x / 2];
+		vRow[x] = vIn[x / 2];
+	}
+
+	convertRow(pImage->pixArray[Y_PLANE][y], uRow, vRow, rgbRow[R_PLANE], rgbRow[G_PLANE], rgbRow[B_PLANE],
+		pImage->width);
+}
+
 // Converts 8BPP RGB image to 8BPP YUV444/422/420
 static bool RGBImage2YUV(const IMAGE *pImageIn, IMAGE *pImageOut)
 {
@@ -333,100 +854,141 @@ static bool RGBImage2YUV(const IMAGE *pImageIn, IMAGE *pImageOut)
 		return FALSE;
 	}
 
-	PIXEL yuvPixel[3];
-	PIXEL rgbPixel[3];
+	// Output image determines the YUV matrix and range
+	ConvertRowFunc convertRow = GetRGB2YUVRowFunc(pImageOut->yuvMatrix, pImageOut->yuvRange);
 
 	if (pImageOut->colorSpace == YUV444)
 	{
-		for (int y = 0; y < pImageOut->height; y++) {
-			for (int x = 0; x < pImageOut->width; x++) {
-				GetPixel(pImageIn, y, x, REPEAT, rgbPixel);
-				RGBPixel2YUV(rgbPixel, yuvPixel);
-				SetPixel(pImageOut, y, x, yuvPixel);
-			}
+		for (int y = 0; y < pImageOut->height; y++)
+		{
+			convertRow(pImageIn->pixArray[R_PLANE][y], pImageIn->pixArray[G_PLANE][y], pImageIn->pixArray[B_PLANE][y],
+				pImageOut->pixArray[Y_PLANE][y], pImageOut->pixArray[U_PLANE][y], pImageOut->pixArray[V_PLANE][y],
+				pImageOut->width);
 		}
 	}
 	else
 	{
-		// Convert RGB to YUV444
-		IMAGE tempImage = CreateImage(YUV444, pImageOut->width, pImageOut->height);
-
-		for (int y = 0; y < pImageOut->height; y++) {
-			for (int x = 0; x < pImageOut->width; x++) {
-				GetPixel(pImageIn, y, x, REPEAT, rgbPixel);
-				RGBPixel2YUV(rgbPixel, yuvPixel);
-				SetPixel(&tempImage, y, x, yuvPixel);
-			}
+		// Convert and downsample in one pass, using full resolution U, V rows as scratch
+		PIXEL *chromaRows = (PIXEL *)malloc(4 * pImageOut->width);
+		if (chromaRows == NULL)
+		{
+			fprintf(stderr, "ERROR UTILS::RGBImage2YUV(): Could not allocate chroma row buffer!\n");
+			return FALSE;
 		}
 
-		// Downsample for YUV 422/420
 		switch (pImageOut->colorSpace)
 		{
 		case YUV422:
-			for (int y = 0; y < pImageOut->height; y++) {
-				for (int x = 0; x < pImageOut->width; x += 2) {
-
-					yuvPixel[U_PLANE] = (GetSubPixel(&tempImage, y, x - 1, REPEAT, U_PLANE) +
-						2 * GetSubPixel(&tempImage, y, x, REPEAT, U_PLANE) +
-						GetSubPixel(&tempImage, y, x + 1, REPEAT, U_PLANE) + 2) / 4;
-					yuvPixel[V_PLANE] = (GetSubPixel(&tempImage, y, x - 1, REPEAT, V_PLANE) +
-						2 * GetSubPixel(&tempImage, y, x, REPEAT, V_PLANE) +
-						GetSubPixel(&tempImage, y, x + 1, REPEAT, V_PLANE) + 2) / 4;
-
-					// get Y pixel
-					yuvPixel[Y_PLANE] = GetSubPixel(&tempImage, y, x, REPEAT, Y_PLANE);
-
-					// Set cosited pixel
-					SetPixel(pImageOut, y, x, yuvPixel);
-
-					// Get and set non-cosited Y subpixel
-					yuvPixel[Y_PLANE] = GetSubPixel(&tempImage, y, x + 1, REPEAT, Y_PLANE);
-					SetSubPixel(pImageOut, y, x + 1, Y_PLANE, yuvPixel[Y_PLANE]);
-				}
+			for (int y = 0; y < pImageOut->height; y++)
+			{
+				const PIXEL *rgbRow[3] = { pImageIn->pixArray[R_PLANE][y], pImageIn->pixArray[G_PLANE][y],
+					pImageIn->pixArray[B_PLANE][y] };
+				RGBRow2YUV422(rgbRow, pImageOut->pixArray[Y_PLANE][y],
+					pImageOut->pixArray[U_PLANE][y], pImageOut->pixArray[V_PLANE][y],
+					pImageOut->width, convertRow, chromaRows);
 			}
 			break;
 		case YUV420:
-			for (int y = 0; y < pImageOut->height; y += 2) {
-				for (int x = 0; x < pImageOut->width; x += 2) {
-
-					yuvPixel[U_PLANE] = (GetSubPixel(&tempImage, y, x, REPEAT, U_PLANE) +
-						GetSubPixel(&tempImage, y, x + 1, REPEAT, U_PLANE) +
-						GetSubPixel(&tempImage, y + 1, x, REPEAT, U_PLANE) +
-						GetSubPixel(&tempImage, y + 1, x + 1, REPEAT, U_PLANE) + 2) / 4;
-					yuvPixel[V_PLANE] = (GetSubPixel(&tempImage, y, x, REPEAT, V_PLANE) +
-						GetSubPixel(&tempImage, y, x + 1, REPEAT, V_PLANE) +
-						GetSubPixel(&tempImage, y + 1, x, REPEAT, V_PLANE) +
-						GetSubPixel(&tempImage, y + 1, x + 1, REPEAT, V_PLANE) + 2) / 4;
-
-					// get Y pixel
-					yuvPixel[Y_PLANE] = GetSubPixel(&tempImage, y, x, REPEAT, Y_PLANE);
-
-					// Set cosited pixel
-					SetPixel(pImageOut, y, x, yuvPixel);
-
-					// Get and set non-cosited Y subpixels
-					yuvPixel[Y_PLANE] = GetSubPixel(&tempImage, y, x + 1, REPEAT, Y_PLANE);
-					SetSubPixel(pImageOut, y, x + 1, Y_PLANE, yuvPixel[Y_PLANE]);
-
-					yuvPixel[Y_PLANE] = GetSubPixel(&tempImage, y + 1, x, REPEAT, Y_PLANE);
-					SetSubPixel(pImageOut, y + 1, x, Y_PLANE, yuvPixel[Y_PLANE]);
-
-					yuvPixel[Y_PLANE] = GetSubPixel(&tempImage, y + 1, x + 1, REPEAT, Y_PLANE);
-					SetSubPixel(pImageOut, y + 1, x + 1, Y_PLANE, yuvPixel[Y_PLANE]);
-				}
+			for (int y = 0; y < pImageOut->height; y += 2)
+			{
+				// Repeat last line if height is odd
+				int y1 = MIN(y + 1, pImageOut->height - 1);
+				const PIXEL *rgbRow0[3] = { pImageIn->pixArray[R_PLANE][y], pImageIn->pixArray[G_PLANE][y],
+					pImageIn->pixArray[B_PLANE][y] };
+				const PIXEL *rgbRow1[3] = { pImageIn->pixArray[R_PLANE][y1], pImageIn->pixArray[G_PLANE][y1],
+					pImageIn->pixArray[B_PLANE][y1] };
+				RGBRowPair2YUV420(rgbRow0, rgbRow1, pImageOut->pixArray[Y_PLANE][y], pImageOut->pixArray[Y_PLANE][y1],
+					pImageOut->pixArray[U_PLANE][y / 2], pImageOut->pixArray[V_PLANE][y / 2],
+					pImageOut->width, convertRow, chromaRows);
 			}
 			break;
 		default:
 			break;
 		}
 
-		// Deallocate memory
-		DestroyImage(&tempImage);
+		free(chromaRows);
 	}
 	return TRUE;
 }
 
 
+// Resamples one chroma plane between subsamplings: in each direction, averages pairs of input samples
+// if the output has half as many, replicates them if it has twice as many, else copies them
+template <typename T>
+static void ResampleChromaPlane(T **inPlane, int inWidth, int inHeight, T **outPlane, int outWidth, int outHeight)
+{
+	for (int y = 0; y < outHeight; y++)
+	{
+		// Rows averaged, the same one twice unless vertically downsampling
+		int y0, y1;
+		if (inHeight > outHeight)
+		{
+			y0 = 2 * y;
+			y1 = MIN(2 * y + 1, inHeight - 1);
+		}
+		else
+			y0 = y1 = (inHeight < outHeight) ? y / 2 : y;
+		const T *inRow0 = inPlane[y0];
+		const T *inRow1 = inPlane[y1];
+		T *outRow = outPlane[y];
+
+		if (inWidth > outWidth)
+		{
+			for (int x = 0; x < outWidth; x++)
+			{
+				int x1 = MIN(2 * x + 1, inWidth - 1);
+				outRow[x] = (T)((inRow0[2 * x] + inRow0[x1] + inRow1[2 * x] + inRow1[x1] + 2) >> 2);
+			}
+		}
+		else
+		{
+			for (int x = 0; x < outWidth; x++)
+			{
+				int xIn = (inWidth < outWidth) ? x / 2 : x;
+				outRow[x] = (T)((inRow0[xIn] + inRow1[xIn] + 1) >> 1);
+			}
+		}
+	}
+}
+
+// Converts YUV444/422/420 image to another of these subsamplings, of the same precision, BPP8 or BPP16
+// Luma is copied unchanged; chroma is averaged down or replicated up at its own resolution,
+// never going through RGB, which would clip and requantize luma
+static bool ResampleYUVImage(const IMAGE *pImageIn, IMAGE *pImageOut)
+{
+	if (pImageIn->precision != pImageOut->precision || pImageIn->precision == DOUBLE)
+	{
+		fprintf(stderr, "ERROR UTILS::ResampleYUVImage(): Images must both be BPP8 or BPP16!\n");
+		return FALSE;
+	}
+
+	for (int y = 0; y < pImageOut->height; y++)
+	{
+		if (pImageIn->precision == BPP16)
+			memcpy(pImageOut->pix16Array[Y_PLANE][y], pImageIn->pix16Array[Y_PLANE][y], pImageOut->width * sizeof(PIXEL16));
+		else
+			memcpy(pImageOut->pixArray[Y_PLANE][y], pImageIn->pixArray[Y_PLANE][y], pImageOut->width * sizeof(PIXEL));
+	}
+
+	for (int plane = U_PLANE; plane <= V_PLANE; plane++)
+	{
+		int inWidth, inHeight, outWidth, outHeight;
+		GetPlaneDimensions(pImageIn->colorSpace, pImageIn->width, pImageIn->height, plane, &inWidth, &inHeight);
+		GetPlaneDimensions(pImageOut->colorSpace, pImageOut->width, pImageOut->height, plane, &outWidth, &outHeight);
+		if (pImageIn->precision == BPP16)
+		{
+			ResampleChromaPlane(pImageIn->pix16Array[plane], inWidth, inHeight, pImageOut->pix16Array[plane],
+				outWidth, outHeight);
+		}
+		else
+		{
+			ResampleChromaPlane(pImageIn->pixArray[plane], inWidth, inHeight, pImageOut->pixArray[plane],
+				outWidth, outHeight);
+		}
+	}
+	return TRUE;
+}
+
 
 /******************************************************************************
 * PUBLIC FUNCTIONS
@@ -444,53 +1006,118 @@ IMAGE CreateImage(ColorSpaces colorSpace, int width, int height)
 // Creates 3D array. This is space inefficient for YUV422/YUV420 types, but allows
 // support for YUV444/RGB using uniform 3D array addressing, instead of treating
 // first plane differently than second and third plane
-// The pixel array's type is determined by the precision parameter to allow support for both
-// fixed precision (8BPP) and float(double) precision pixels.
+// The pixel array's type is determined by the precision parameter to allow support for
+// fixed precision (8BPP, 16BPP) and float(double) precision pixels.
+// On failure the image has no pixel array, see IsImageAllocated()
 IMAGE CreateImage(ColorSpaces colorSpace, int width, int height, PixelPrecision precision)
 {
 	IMAGE newImage;
+	memset(&newImage, 0, sizeof(IMAGE));
 
 	if (precision == BPP8)
-	{
 		newImage.pixArray = Create3DArray(PIXEL, 3, height, width);
-		if (newImage.pixArray == NULL)
-		{
-			fprintf(stderr, "ERROR UTILS::CreateImage(): Could not allocate image memory\n");
-			exit(FALSE);
-		}
-		newImage.dblPixArray = NULL;
-	}
 	else if (precision == DOUBLE)
-	{
 		newImage.dblPixArray = Create3DArray(double, 3, height, width);
-		if (newImage.dblPixArray == NULL)
-		{
-			fprintf(stderr, "ERROR UTILS::CreateImage(): Could not allocate image memory\n");
-			exit(FALSE);
-		}
-		newImage.pixArray = NULL;
-	}
+	else if (precision == BPP16)
+		newImage.pix16Array = Create3DArray(PIXEL16, 3, height, width);
 	else
 	{
 		fprintf(stderr, "ERROR UTILS::CreateImage(): Unsupported pixel precision!\n");
-		exit(FALSE);
+		return(newImage);
+	}
+	if (!IsImageAllocated(&newImage))
+	{
+		fprintf(stderr, "ERROR UTILS::CreateImage(): Could not allocate image memory\n");
+		return(newImage);
+	}
+
+	newImage.isView = FALSE;
+	newImage.colorSpace = colorSpace;
+	newImage.yuvMatrix = BT601;
+	newImage.yuvRange = LIMITED_RANGE;
+	newImage.height = height;
+	newImage.width = width;
+	newImage.precision = precision;
+	newImage.bitDepth = (precision == BPP16) ? 16 : 8;
+
+	return(newImage);
+}
+
+// Creates 8BPP image with row pointers only. The caller points the rows at pixel storage
+// it owns, e.g. a memory-mapped file, so that image data need not be copied
+IMAGE CreateImageView(ColorSpaces colorSpace, int width, int height)
+{
+	return CreateImageView(colorSpace, width, height, BPP8);
+}
+
+// Creates 8BPP or BPP16 image with row pointers only
+IMAGE CreateImageView(ColorSpaces colorSpace, int width, int height, PixelPrecision precision)
+{
+	IMAGE newImage;
+	memset(&newImage, 0, sizeof(IMAGE));
+
+	if (precision != BPP8 && precision != BPP16)
+	{
+		fprintf(stderr, "ERROR UTILS::CreateImageView(): Unsupported pixel precision!\n");
+		return(newImage);
+	}
+
+	// Row pointers of either precision are the same size
+	void ***planes = (void ***)malloc(3 * sizeof(void **));
+	void **rows = (void **)calloc(3 * height, sizeof(void *));
+	if (planes == NULL || rows == NULL)
+	{
+		fprintf(stderr, "ERROR UTILS::CreateImageView(): Could not allocate row pointers\n");
+		free(planes);
+		free(rows);
+		return(newImage);
 	}
+	for (int plane = 0; plane < 3; plane++)
+		planes[plane] = rows + plane * height;
+	newImage.pixArray = (precision == BPP8) ? (PIXEL ***)planes : NULL;
+	newImage.pix16Array = (precision == BPP16) ? (PIXEL16 ***)planes : NULL;
+	newImage.dblPixArray = NULL;
 
+	newImage.isView = TRUE;
 	newImage.colorSpace = colorSpace;
+	newImage.yuvMatrix = BT601;
+	newImage.yuvRange = LIMITED_RANGE;
 	newImage.height = height;
 	newImage.width = width;
 	newImage.precision = precision;
+	newImage.bitDepth = (precision == BPP16) ? 16 : 8;
 
 	return(newImage);
 }
 
-// Destroys image previously created using CreateImage();
+// FALSE for an image whose creation failed, or that has been destroyed
+bool IsImageAllocated(const IMAGE *pImage)
+{
+	return pImage->pixArray != NULL || pImage->dblPixArray != NULL || pImage->pix16Array != NULL;
+}
+
+// Destroys image previously created using CreateImage() or CreateImageView();
 void DestroyImage(IMAGE *pImage)
 {
+	if (pImage->isView)
+	{
+		// Only the row pointers belong to the image
+		void ***planes = pImage->pixArray ? (void ***)pImage->pixArray : (void ***)pImage->pix16Array;
+		free(planes[0]);
+		free(planes);
+		pImage->pixArray = NULL;
+		pImage->pix16Array = NULL;
+		return;
+	}
 	if (pImage->pixArray)
 		Destroy3DArray(pImage->pixArray);
 	if (pImage->dblPixArray)
 		Destroy3DArray(pImage->dblPixArray);
+	if (pImage->pix16Array)
+		Destroy3DArray(pImage->pix16Array);
+	pImage->pixArray = NULL;
+	pImage->dblPixArray = NULL;
+	pImage->pix16Array = NULL;
 }
 
 // Copies a given image
@@ -501,7 +1128,8 @@ bool CopyImage(const IMAGE *pImageIn, IMAGE *pImageOut)
 		fprintf(stderr, "ERROR: UTILS::CopyImage(): Images have different dimensions!\n");
 		return FALSE;
 	}
-	if (!((pImageIn->pixArray && pImageOut->pixArray) || (pImageIn->dblPixArray && pImageOut->dblPixArray)))
+	if (!((pImageIn->pixArray && pImageOut->pixArray) || (pImageIn->dblPixArray && pImageOut->dblPixArray) ||
+		(pImageIn->pix16Array && pImageOut->pix16Array)))
 	{
 		fprintf(stderr, "ERROR: UTILS::CopyImage(): Image precisions not the same or image memory unallocated!\n");
 		return FALSE;
@@ -509,7 +1137,23 @@ bool CopyImage(const IMAGE *pImageIn, IMAGE *pImageOut)
 
 	// Copy pixels
 	unsigned int size;
-	if (pImageIn->pixArray)
+	if (pImageIn->isView || pImageOut->isView)
+	{
+		// View rows are not contiguous: copy plane by plane, row by row
+		for (int plane = 0; plane < 3; plane++)
+		{
+			int planeWidth, planeHeight;
+			GetPlaneDimensions(pImageIn->colorSpace, pImageIn->width, pImageIn->height, plane, &planeWidth, &planeHeight);
+			for (int y = 0; y < planeHeight; y++)
+			{
+				if (pImageIn->pix16Array)
+					memcpy(pImageOut->pix16Array[plane][y], pImageIn->pix16Array[plane][y], planeWidth * sizeof(PIXEL16));
+				else
+					memcpy(pImageOut->pixArray[plane][y], pImageIn->pixArray[plane][y], planeWidth * sizeof(PIXEL));
+			}
+		}
+	}
+	else if (pImageIn->pixArray)
 	{
 		size = pImageIn->width * pImageIn->height * sizeof(PIXEL)* 3;
 		memcpy(&(pImageOut->pixArray[0][0][0]), &(pImageIn->pixArray[0][0][0]), size);
@@ -519,6 +1163,11 @@ bool CopyImage(const IMAGE *pImageIn, IMAGE *pImageOut)
 		size = pImageIn->width * pImageIn->height * sizeof(double)* 3;
 		memcpy(&(pImageOut->dblPixArray[0][0][0]), &(pImageIn->dblPixArray[0][0][0]), size);
 	}
+	else if (pImageIn->pix16Array)
+	{
+		size = pImageIn->width * pImageIn->height * sizeof(PIXEL16)* 3;
+		memcpy(&(pImageOut->pix16Array[0][0][0]), &(pImageIn->pix16Array[0][0][0]), size);
+	}
 	else
 	{
 		fprintf(stderr, "ERROR: UTILS::CopyImage(): Unsupported pixel precision!\n");
@@ -527,28 +1176,180 @@ bool CopyImage(const IMAGE *pImageIn, IMAGE *pImageOut)
 
 	// Copy colorspace info
 	pImageOut->colorSpace = pImageIn->colorSpace;
+	pImageOut->yuvMatrix = pImageIn->yuvMatrix;
+	pImageOut->yuvRange = pImageIn->yuvRange;
 	pImageOut->precision = pImageIn->precision;
+	pImageOut->bitDepth = pImageIn->bitDepth;
 
 	return TRUE;
 }
 
-// Takes gamma-corrected pImageIn, applies supplied fwdGamma table to convert to linear light pImageOut
-// Y'UV in YUV out, or R'G'B' in RGB out
-bool DegammaImage(const IMAGE *pImageIn, IMAGE *pImageOut, double fwdGamma[])
+#ifdef USE_SSE2
+// Returns (v * mul + add) / div for four 32-bit codes v, identical to the unsigned integer expression: products
+// of 16-bit values are exact as doubles, and their quotient is never close enough to an integer to round up to it
+static __m128i ScaleCodes4(__m128i v, __m128d mul, __m128d add, __m128d div)
 {
-	if ((pImageIn->width != pImageOut->width) || (pImageIn->height != pImageOut->height))
-	{
-		fprintf(stderr, "ERROR UTILS::DegammaImage(): Images have different dimensions!\n");
-		return FALSE;
-	}
-	if (!pImageIn->pixArray)
-	{
-		fprintf(stderr, "ERROR UTILS::DegammaImage(): Input image array must be 8 bit precision!\n");
+	__m128d lo = _mm_div_pd(_mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(v), mul), add), div);
+	__m128d hi = _mm_div_pd(_mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(v, 8)), mul), add), div);
+	return _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi));
+}
+#endif
+
+// Scales count 16-bit codes, first clamped to maxIn, to (in * mul + add) / div, which must fit 16 bits
+static void ScaleRow16(const PIXEL16 *in, PIXEL16 *out, int count, unsigned int maxIn, unsigned int mul,
+	unsigned int add, unsigned int div)
+{
+	int x = 0;
+#ifdef USE_SSE2
+	// MIN(a, b) == a - saturated(a - b) for unsigned 16-bit values; results are offset by 0x8000 to pack signed
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i maxCode = _mm_set1_epi16((short)maxIn);
+	const __m128i bias32 = _mm_set1_epi32(0x8000);
+	const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+	const __m128d mulVec = _mm_set1_pd(mul), addVec = _mm_set1_pd(add), divVec = _mm_set1_pd(div);
+	for (; x + 8 <= count; x += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + x));
+		v = _mm_sub_epi16(v, _mm_subs_epu16(v, maxCode));
+		__m128i lo = _mm_sub_epi32(ScaleCodes4(_mm_unpacklo_epi16(v, zero), mulVec, addVec, divVec), bias32);
+		__m128i hi = _mm_sub_epi32(ScaleCodes4(_mm_unpackhi_epi16(v, zero), mulVec, addVec, divVec), bias32);
+		_mm_storeu_si128((__m128i *)(out + x), _mm_xor_si128(_mm_packs_epi32(lo, hi), bias16));
+	}
+#endif
+	for (; x < count; x++)
+		out[x] = (PIXEL16)((MIN((unsigned int)in[x], maxIn) * mul + add) / div);
+}
+
+// As above, for results which fit 8 bits
+static void ScaleRow16(const PIXEL16 *in, PIXEL *out, int count, unsigned int maxIn, unsigned int mul,
+	unsigned int add, unsigned int div)
+{
+	int x = 0;
+#ifdef USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i maxCode = _mm_set1_epi16((short)maxIn);
+	const __m128d mulVec = _mm_set1_pd(mul), addVec = _mm_set1_pd(add), divVec = _mm_set1_pd(div);
+	for (; x + 8 <= count; x += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + x));
+		v = _mm_sub_epi16(v, _mm_subs_epu16(v, maxCode));
+		__m128i lo = ScaleCodes4(_mm_unpacklo_epi16(v, zero), mulVec, addVec, divVec);
+		__m128i hi = ScaleCodes4(_mm_unpackhi_epi16(v, zero), mulVec, addVec, divVec);
+		_mm_storel_epi64((__m128i *)(out + x), _mm_packus_epi16(_mm_packs_epi32(lo, hi), zero));
+	}
+#endif
+	for (; x < count; x++)
+		out[x] = (PIXEL)((MIN((unsigned int)in[x], maxIn) * mul + add) / div);
+}
+
+// Scales row of UV display codes to linear light range: UV are not gamma corrected
+// 8-bit codes are always 8 bits deep, so those overloads take bitDepth only to share the DegammaPlanes() call
+static void DegammaChromaRow(const PIXEL *inRow, double *outRow, int count, int /*bitDepth*/)
+{
+	int x = 0;
+#ifdef USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128d white = _mm_set1_pd(PIXMAX);
+	for (; x + 8 <= count; x += 8)
+	{
+		__m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(inRow + x)), zero);
+		__m128i lo = _mm_unpacklo_epi16(v, zero), hi = _mm_unpackhi_epi16(v, zero);
+		_mm_storeu_pd(outRow + x, _mm_div_pd(_mm_cvtepi32_pd(lo), white));
+		_mm_storeu_pd(outRow + x + 2, _mm_div_pd(_mm_cvtepi32_pd(_mm_srli_si128(lo, 8)), white));
+		_mm_storeu_pd(outRow + x + 4, _mm_div_pd(_mm_cvtepi32_pd(hi), white));
+		_mm_storeu_pd(outRow + x + 6, _mm_div_pd(_mm_cvtepi32_pd(_mm_srli_si128(hi, 8)), white));
+	}
+#endif
+	for (; x < count; x++)
+		outRow[x] = (double)inRow[x] / PIXMAX;
+}
+
+static void DegammaChromaRow(const PIXEL16 *inRow, double *outRow, int count, int bitDepth)
+{
+	const int maxCode = (1 << bitDepth) - 1;
+	const double white = DISPLAY_WHITE(bitDepth);
+	int x = 0;
+#ifdef USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i maxCodeVec = _mm_set1_epi16((short)maxCode);
+	const __m128d whiteVec = _mm_set1_pd(white);
+	for (; x + 8 <= count; x += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(inRow + x));
+		v = _mm_sub_epi16(v, _mm_subs_epu16(v, maxCodeVec));
+		__m128i lo = _mm_unpacklo_epi16(v, zero), hi = _mm_unpackhi_epi16(v, zero);
+		_mm_storeu_pd(outRow + x, _mm_div_pd(_mm_cvtepi32_pd(lo), whiteVec));
+		_mm_storeu_pd(outRow + x + 2, _mm_div_pd(_mm_cvtepi32_pd(_mm_srli_si128(lo, 8)), whiteVec));
+		_mm_storeu_pd(outRow + x + 4, _mm_div_pd(_mm_cvtepi32_pd(hi), whiteVec));
+		_mm_storeu_pd(outRow + x + 6, _mm_div_pd(_mm_cvtepi32_pd(_mm_srli_si128(hi, 8)), whiteVec));
+	}
+#endif
+	for (; x < count; x++)
+		outRow[x] = (double)MIN(inRow[x], maxCode) / white;
+}
+
+static void DegammaChromaRow(const PIXEL *inRow, PIXEL16 *outRow, int count, int /*bitDepth*/)
+{
+	// PIX16MAX / PIXMAX == 257 exactly, so each code is simply repeated in both bytes
+	int x = 0;
+#ifdef USE_SSE2
+	for (; x + 16 <= count; x += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(inRow + x));
+		_mm_storeu_si128((__m128i *)(outRow + x), _mm_unpacklo_epi8(v, v));
+		_mm_storeu_si128((__m128i *)(outRow + x + 8), _mm_unpackhi_epi8(v, v));
+	}
+#endif
+	for (; x < count; x++)
+		outRow[x] = (PIXEL16)(inRow[x] * (PIX16MAX / PIXMAX));
+}
+
+static void DegammaChromaRow(const PIXEL16 *inRow, PIXEL16 *outRow, int count, int bitDepth)
+{
+	// Codes above white, up to 1 << bitDepth, would overshoot PIX16MAX, so are clamped to white
+	const unsigned int white = DISPLAY_WHITE(bitDepth);
+	ScaleRow16(inRow, outRow, count, white, PIX16MAX, white / 2, white);
+}
+
+// Degammas 8-bit or higher bit depth display pixels of type TIn to linear light pixels of type TOut
+// Codes past the end of the 1 << bitDepth entry fwdGamma table, which only a corrupt file holds, are clamped
+template <typename TIn, typename TOut>
+static void DegammaPlanes(TIn ***inArray, const IMAGE *pImageIn, TOut ***outArray, const TOut fwdGamma[])
+{
+	const int maxCode = (1 << pImageIn->bitDepth) - 1;
+
+	// Gamma convert all planes if they are RGB, otherwise gamma convert Y and simply scale UV
+	int firstUnmappedPlane = (pImageIn->colorSpace == RGB) ? B_PLANE + 1 : U_PLANE;
+	for (int plane = R_PLANE; plane < firstUnmappedPlane; plane++)
+	{
+		for (int y = 0; y < pImageIn->height; y++)
+		{
+			const TIn *inRow = inArray[plane][y];
+			TOut *outRow = outArray[plane][y];
+			for (int x = 0; x < pImageIn->width; x++)
+				outRow[x] = fwdGamma[MIN((int)inRow[x], maxCode)];
+		}
+	}
+	for (int plane = firstUnmappedPlane; plane <= V_PLANE; plane++)
+	{
+		int planeWidth, planeHeight;
+		GetPlaneDimensions(pImageIn->colorSpace, pImageIn->width, pImageIn->height, plane, &planeWidth, &planeHeight);
+		for (int y = 0; y < planeHeight; y++)
+			DegammaChromaRow(inArray[plane][y], outArray[plane][y], planeWidth, pImageIn->bitDepth);
+	}
+}
+
+// Checks images passed to DegammaImage()
+static bool CheckDegammaImages(const IMAGE *pImageIn, const IMAGE *pImageOut)
+{
+	if ((pImageIn->width != pImageOut->width) || (pImageIn->height != pImageOut->height))
+	{
+		fprintf(stderr, "ERROR UTILS::DegammaImage(): Images have different dimensions!\n");
 		return FALSE;
 	}
-	if (!pImageOut->dblPixArray)
+	if (!(pImageIn->pixArray || (pImageIn->pix16Array && pImageIn->bitDepth > 8 && pImageIn->bitDepth <= 16)))
 	{
-		fprintf(stderr, "ERROR UTILS::DegammaImage(): Output image array must be double precision!\n");
+		fprintf(stderr, "ERROR UTILS::DegammaImage(): Input image array must be 8 bit, or 16 bit with 9 to 16 bit pixels!\n");
 		return FALSE;
 	}
 	if (pImageIn->colorSpace != pImageOut->colorSpace)
@@ -556,65 +1357,120 @@ bool DegammaImage(const IMAGE *pImageIn, IMAGE *pImageOut, double fwdGamma[])
 		fprintf(stderr, "ERROR UTILS::DegammaImage(): Images have different colorspaces!\n");
 		return FALSE;
 	}
+	return TRUE;
+}
 
-	// Gamma convert all planes if they are RGB, otherwise gamma convert Y and simply divide down UV
-	if (pImageIn->colorSpace == RGB)
+// Takes gamma-corrected pImageIn, applies supplied fwdGamma table to convert to linear light pImageOut
+// Y'UV in YUV out, or R'G'B' in RGB out
+bool DegammaImage(const IMAGE *pImageIn, IMAGE *pImageOut, double fwdGamma[])
+{
+	if (!CheckDegammaImages(pImageIn, pImageOut))
+		return FALSE;
+	if (!pImageOut->dblPixArray)
 	{
-		for (int plane = R_PLANE; plane <= B_PLANE; plane++)
-		{
+		fprintf(stderr, "ERROR UTILS::DegammaImage(): Output image array must be double precision!\n");
+		return FALSE;
+	}
+
+	if (pImageIn->pixArray)
+		DegammaPlanes(pImageIn->pixArray, pImageIn, pImageOut->dblPixArray, fwdGamma);
+	else
+		DegammaPlanes(pImageIn->pix16Array, pImageIn, pImageOut->dblPixArray, fwdGamma);
+	return TRUE;
+}
+
+// Takes gamma-corrected pImageIn, applies supplied fwdGamma table to convert to 16-bit linear light pImageOut
+// Y'UV in YUV out, or R'G'B' in RGB out
+bool DegammaImage(const IMAGE *pImageIn, IMAGE *pImageOut, PIXEL16 fwdGamma[])
+{
+	if (!CheckDegammaImages(pImageIn, pImageOut))
+		return FALSE;
+	if (!pImageOut->pix16Array)
+	{
+		fprintf(stderr, "ERROR UTILS::DegammaImage(): Output image array must be 16 bit precision!\n");
+		return FALSE;
+	}
+
+	if (pImageIn->pixArray)
+		DegammaPlanes(pImageIn->pixArray, pImageIn, pImageOut->pix16Array, fwdGamma);
+	else
+		DegammaPlanes(pImageIn->pix16Array, pImageIn, pImageOut->pix16Array, fwdGamma);
+	return TRUE;
+}
+
+// Gamma corrects linear light pImageIn to display pixels of type TOut, of bitDepth bits
+template <typename TOut>
+static void GammaPlanes(const IMAGE *pImageIn, TOut ***outArray, int bitDepth, const TOut bwdGamma[])
+{
+	const int white = DISPLAY_WHITE(bitDepth);
+	const int maxCode = (1 << bitDepth) - 1;
+	int firstUnmappedPlane = (pImageIn->colorSpace == RGB) ? B_PLANE + 1 : U_PLANE;
+	int chromaWidth, chromaHeight;
+	GetPlaneDimensions(pImageIn->colorSpace, pImageIn->width, pImageIn->height, U_PLANE, &chromaWidth, &chromaHeight);
 
+	// 16-bit linear light pixels index the BWD_GAMMA16_LUTSIZE table directly
+	if (pImageIn->precision == BPP16)
+	{
+		for (int plane = R_PLANE; plane < firstUnmappedPlane; plane++)
+		{
 			for (int y = 0; y < pImageIn->height; y++)
 			{
+				const PIXEL16 *inRow = pImageIn->pix16Array[plane][y];
+				TOut *outRow = outArray[plane][y];
 				for (int x = 0; x < pImageIn->width; x++)
-				{
-					int pixval = (int)(CLAMP(pImageIn->pixArray[plane][y][x], 0, FWD_GAMMA_LUTSIZE - 1));
-					pImageOut->dblPixArray[plane][y][x] = fwdGamma[pixval];
-				}
+					outRow[x] = bwdGamma[inRow[x]];
+			}
+		}
+		for (int plane = firstUnmappedPlane; plane <= V_PLANE; plane++)
+		{
+			for (int y = 0; y < chromaHeight; y++)
+			{
+				const PIXEL16 *inRow = pImageIn->pix16Array[plane][y];
+				TOut *outRow = outArray[plane][y];
+				ScaleRow16(inRow, outRow, chromaWidth, PIX16MAX, white, PIX16MAX / 2, PIX16MAX);
 			}
 		}
+		return;
 	}
-	else
+
+	// Gamma convert all planes if they are RGB, otherwise gamma convert Y and simply multiply up UV
+	const int lutSize = GetBwdGammaLutSize(DOUBLE, bitDepth);
+	for (int plane = R_PLANE; plane < firstUnmappedPlane; plane++)
 	{
 		for (int y = 0; y < pImageIn->height; y++)
 		{
+			const double *inRow = pImageIn->dblPixArray[plane][y];
+			TOut *outRow = outArray[plane][y];
 			for (int x = 0; x < pImageIn->width; x++)
 			{
-				int pixval = (int)(CLAMP(pImageIn->pixArray[Y_PLANE][y][x], 0, FWD_GAMMA_LUTSIZE - 1));
-				pImageOut->dblPixArray[Y_PLANE][y][x] = fwdGamma[pixval];
+				int pixval = (int)(CLAMP(inRow[x] * (lutSize - 1) + 0.5f, 0, lutSize - 1));
+				outRow[x] = bwdGamma[pixval];
 			}
 		}
-		for (int plane = U_PLANE; plane <= V_PLANE; plane++)
+	}
+	for (int plane = firstUnmappedPlane; plane <= V_PLANE; plane++)
+	{
+		for (int y = 0; y < chromaHeight; y++)
 		{
-			for (int y = 0; y < pImageIn->height; y++)
-			{
-				for (int x = 0; x < pImageIn->width; x++)
-				{
-					int pixval = (int)(CLAMP(pImageIn->pixArray[plane][y][x], 0, FWD_GAMMA_LUTSIZE - 1));
-					pImageOut->dblPixArray[plane][y][x] = (double)pixval / (FWD_GAMMA_LUTSIZE - 1);
-				}
-			}
+			const double *inRow = pImageIn->dblPixArray[plane][y];
+			TOut *outRow = outArray[plane][y];
+			for (int x = 0; x < chromaWidth; x++)
+				outRow[x] = (TOut)(CLAMP(inRow[x] * white + 0.5f, 0, maxCode));
 		}
 	}
-	return TRUE;
 }
 
-// Takes gamma-corrected pImageIn, applies supplied fwdGamma table to convert to linear light pImageOut
-// YUV in Y'UV out, or RGB in R'G'B' out
-bool GammaImage(const IMAGE *pImageIn, IMAGE *pImageOut, PIXEL bwdGamma[])
+// Checks images passed to GammaImage()
+static bool CheckGammaImages(const IMAGE *pImageIn, const IMAGE *pImageOut)
 {
 	if ((pImageIn->width != pImageOut->width) || (pImageIn->height != pImageOut->height))
 	{
 		fprintf(stderr, "ERROR UTILS::GammaImage(): Images have different dimensions!\n");
 		return FALSE;
 	}
-	if (!pImageIn->dblPixArray)
-	{
-		fprintf(stderr, "ERROR UTILS::GammaImage(): Input image array must be 8 bit precision!\n");
-		return FALSE;
-	}
-	if (!pImageOut->pixArray)
+	if (!pImageIn->dblPixArray && !pImageIn->pix16Array)
 	{
-		fprintf(stderr, "ERROR UTILS::GammaImage(): Output image array must be double precision!\n");
+		fprintf(stderr, "ERROR UTILS::GammaImage(): Input image array must be double or 16 bit precision!\n");
 		return FALSE;
 	}
 	if (pImageIn->colorSpace != pImageOut->colorSpace)
@@ -622,51 +1478,50 @@ bool GammaImage(const IMAGE *pImageIn, IMAGE *pImageOut, PIXEL bwdGamma[])
 		fprintf(stderr, "ERROR UTILS::GammaImage(): Images have different colorspaces!\n");
 		return FALSE;
 	}
+	return TRUE;
+}
 
-	// Gamma convert all planes if they are RGB, otherwise gamma convert Y and simply multiply up UV
-	if (pImageIn->colorSpace == RGB)
+// Takes gamma-corrected pImageIn, applies supplied fwdGamma table to convert to linear light pImageOut
+// YUV in Y'UV out, or RGB in R'G'B' out
+bool GammaImage(const IMAGE *pImageIn, IMAGE *pImageOut, PIXEL bwdGamma[])
+{
+	if (!CheckGammaImages(pImageIn, pImageOut))
+		return FALSE;
+	if (!pImageOut->pixArray)
 	{
-		for (int plane = R_PLANE; plane <= B_PLANE; plane++)
-		{
-
-			for (int y = 0; y < pImageIn->height; y++)
-			{
-				for (int x = 0; x < pImageIn->width; x++)
-				{
-					int pixval = (int)
-						(CLAMP(pImageIn->dblPixArray[plane][y][x] * (BWD_GAMMA_LUTSIZE - 1) + 0.5f, 0, BWD_GAMMA_LUTSIZE - 1));
-					pImageOut->pixArray[plane][y][x] = bwdGamma[pixval];
-				}
-			}
-		}
+		fprintf(stderr, "ERROR UTILS::GammaImage(): Output image array must be 8 bit precision!\n");
+		return FALSE;
 	}
-	else
+
+	GammaPlanes(pImageIn, pImageOut->pixArray, 8, bwdGamma);
+	return TRUE;
+}
+
+// Takes linear light pImageIn to display pixels of pImageOut->bitDepth bits
+bool GammaImage(const IMAGE *pImageIn, IMAGE *pImageOut, PIXEL16 bwdGamma[])
+{
+	if (!CheckGammaImages(pImageIn, pImageOut))
+		return FALSE;
+	if (!pImageOut->pix16Array || pImageOut->bitDepth <= 8 || pImageOut->bitDepth > 16)
 	{
-		for (int y = 0; y < pImageIn->height; y++)
-		{
-			for (int x = 0; x < pImageIn->width; x++)
-			{
-				int pixval = (int)
-					(CLAMP(pImageIn->dblPixArray[Y_PLANE][y][x] * (BWD_GAMMA_LUTSIZE - 1) + 0.5f, 0, BWD_GAMMA_LUTSIZE - 1));
-				pImageOut->pixArray[Y_PLANE][y][x] = bwdGamma[pixval];
-			}
-		}
-		for (int plane = U_PLANE; plane <= V_PLANE; plane++)
-		{
-			for (int y = 0; y < pImageIn->height; y++)
-			{
-				for (int x = 0; x < pImageIn->width; x++)
-				{
-					PIXEL pixval = (PIXEL)(CLAMP(pImageIn->dblPixArray[plane][y][x] * 
-						(FWD_GAMMA_LUTSIZE - 1) + 0.5f, 0, (FWD_GAMMA_LUTSIZE - 1)));
-					pImageOut->pixArray[plane][y][x] = pixval;
-				}
-			}
-		}
+		fprintf(stderr, "ERROR UTILS::GammaImage(): Output image array must be 16 bit precision with 9 to 16 bit pixels!\n");
+		return FALSE;
 	}
+
+	GammaPlanes(pImageIn, pImageOut->pix16Array, pImageOut->bitDepth, bwdGamma);
 	return TRUE;
 }
 
+// Linear light pixels of more than 8 bits index the table directly
+// Double precision ones are quantized to 4 bits more than the display pixels,
+// since dark linear levels are far apart once gamma corrected
+int GetBwdGammaLutSize(PixelPrecision linearPrecision, int displayBitDepth)
+{
+	if (linearPrecision == BPP16)
+		return BWD_GAMMA16_LUTSIZE;
+	return (displayBitDepth <= 8) ? BWD_GAMMA_LUTSIZE : 1 << MIN(displayBitDepth + 4, 20);
+}
+
 
 // Color space conversion
 bool ConvertImage(const IMAGE *pImageIn, IMAGE *pImageOut)
@@ -698,6 +1553,12 @@ bool ConvertImage(const IMAGE *pImageIn, IMAGE *pImageOut)
 		if (!CopyImage(pImageIn, pImageOut))
 			return FALSE;
 	}
+	else if (pImageIn->colorSpace != RGB && pImageOut->colorSpace != RGB)
+	{
+		// Between YUV subsamplings, resampling chroma alone
+		if (!ResampleYUVImage(pImageIn, pImageOut))
+			return FALSE;
+	}
 	else
 	{
 		fprintf(stderr, "ERROR UTILS::ConvertImage(): Unsupported input/output format combination!\n");
@@ -752,6 +1613,31 @@ void HandleColorspaceAddress(int *x, int *y, ColorSpaces colorSpace)
 	}
 }
 
+// Get dimensions of given plane for image of given color space and dimensions
+// Subsampled chroma planes round up so that odd-sized images keep their last column/row
+void GetPlaneDimensions(ColorSpaces colorSpace, int width, int height, int plane, int *planeWidth, int *planeHeight)
+{
+	*planeWidth = width;
+	*planeHeight = height;
+	if (plane == U_PLANE || plane == V_PLANE)
+	{
+		switch (colorSpace)
+		{
+		case YUV422:
+			*planeWidth = (width + 1) / 2;
+			break;
+		case YUV420:
+			*planeWidth = (width + 1) / 2;
+			*planeHeight = (height + 1) / 2;
+			break;
+		case RGB:
+		case YUV444:
+		default:
+			break;
+		}
+	}
+}
+
 // Gets subpixel (R, G, B, Y, U, or V)
 // x, y co-ordinates are internally divided down for YUV422/YUV420 UV planes
 PIXEL GetSubPixel(const IMAGE *pImage, int y, int x, const EdgeMethod edgeMethod, const int plane)
@@ -859,17 +1745,22 @@ void SetPixel(const IMAGE *pImage, int y, int x, PIXEL pixel[])
 // General image file I/O
 // ---------------------------
 
+// Detects if file name refers to stdin/stdout rather than a file
+bool IsStdioFileName(const char *fileName)
+{
+	return strcmp(fileName, STDIO_FILENAME) == 0;
+}
+
 // Detects if file exists
+// stdin/stdout always exist
 bool FileExists(const char *fileName)
 {
-	FILE *file;
+	struct stat fileStat;
 
-	if ((file = fopen(fileName, "rb")) != NULL)
-	{
-		fclose(file);
+	if (IsStdioFileName(fileName))
 		return TRUE;
-	}
-	return FALSE;
+
+	return (stat(fileName, &fileStat) == 0);
 }
 
 // Determine file type by file extension.
@@ -880,6 +1771,10 @@ bool DetectFileType(const char *fileName, FileType* fileType)
 
 	*fileType = UNSUPPORTED_FILE;
 
+	// Type of a stream can't be told from its name
+	if (IsStdioFileName(fileName))
+		return FALSE;
+
 	pChar = strrchr(fileName, '.'); // find last '.' in string; letters afterwards should be extension
 	if (pChar == NULL)
 	{
@@ -892,86 +1787,341 @@ bool DetectFileType(const char *fileName, FileType* fileType)
 			*fileType = YUV_FILE;
 		else if (!strncmp(extension, "bmp", 3))
 			*fileType = BMP_FILE;
+		else if (!strncmp(extension, "y4m", 3))
+			*fileType = Y4M_FILE;
+		else if (!strncmp(extension, "qoi", 3))
+			*fileType = QOI_FILE;
 	}
 	return TRUE;
 }
 
+// Returns sequence number if fileName is prefix, frameDigits zero-padded digits and extension, else -1
+static int MatchSequenceFileName(const char *fileName, const char *prefix, int frameDigits, const char *extension)
+{
+	size_t prefixLength = strlen(prefix);
+	if (strncmp(fileName, prefix, prefixLength) != 0)
+		return -1;
+
+	const char *pDigits = fileName + prefixLength;
+	const char *pChar = pDigits;
+	while (isdigit(*pChar))
+		pChar++;
+	if (pChar == pDigits || pChar - pDigits > 9 || strcmp(pChar, extension) != 0)
+		return -1;
+
+	// Reject other paddings of the same number, e.g. frame7.bmp in a sequence of frame007.bmp
+	int frameNumber = atoi(pDigits);
+	char digits[16];
+	sprintf(digits, "%0*d", frameDigits, frameNumber);
+	if ((size_t)(pChar - pDigits) != strlen(digits) || strncmp(pDigits, digits, pChar - pDigits) != 0)
+		return -1;
+
+	return frameNumber;
+}
+
+static int CompareFrameNumbers(const void *a, const void *b)
+{
+	int frameA = *(const int *)a;
+	int frameB = *(const int *)b;
+	return (frameA > frameB) - (frameA < frameB);
+}
+
+// Scans directory once for files of sequence numbered from startFrame on, returned sorted in *pFrameNumbers
+// Returns number of files found, or -1 if directory cannot be read
+static int ScanSequenceFrames(const char *dirName, const char *prefix, int frameDigits, const char *extension,
+	int startFrame, int **pFrameNumbers)
+{
+	int numFrames = 0;
+	int maxFrames = 0;
+	int *frameNumbers = NULL;
+	*pFrameNumbers = NULL;
+
+#ifdef _WIN32
+	char searchPath[MAX_STRING_LENGTH + 2];
+	WIN32_FIND_DATAA findData;
+	sprintf(searchPath, "%s\\*", dirName);
+	HANDLE findHandle = FindFirstFileA(searchPath, &findData);
+	if (findHandle == INVALID_HANDLE_VALUE)
+		return -1;
+	do
+	{
+		const char *entryName = findData.cFileName;
+#else
+	DIR *dir = opendir(dirName);
+	if (dir == NULL)
+		return -1;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		const char *entryName = entry->d_name;
+#endif
+		int frameNumber = MatchSequenceFileName(entryName, prefix, frameDigits, extension);
+		if (frameNumber < startFrame)
+			continue;
+
+		if (numFrames == maxFrames)
+		{
+			maxFrames = MAX(2 * maxFrames, 1024);
+			int *newFrameNumbers = (int *)realloc(frameNumbers, maxFrames * sizeof(int));
+			if (newFrameNumbers == NULL)
+			{
+				fprintf(stderr, "ERROR Utils::ScanSequenceFrames(). Could not allocate frame list!\n");
+				numFrames = -1;
+				break;
+			}
+			frameNumbers = newFrameNumbers;
+		}
+		frameNumbers[numFrames++] = frameNumber;
+#ifdef _WIN32
+	} while (FindNextFileA(findHandle, &findData));
+	FindClose(findHandle);
+#else
+	}
+	closedir(dir);
+#endif
+
+	if (numFrames <= 0)
+	{
+		free(frameNumbers);
+		return numFrames;
+	}
+
+	// Directory order is arbitrary
+	qsort(frameNumbers, numFrames, sizeof(int), CompareFrameNumbers);
+	*pFrameNumbers = frameNumbers;
+	return numFrames;
+}
+
+// Returns TRUE if name matches pattern, in which * stands for any characters and ? for any one character
+static bool MatchWildcards(const char *name, const char *pattern)
+{
+	if (*pattern == '\0')
+		return *name == '\0';
+	if (*pattern == '*')
+		return MatchWildcards(name, pattern + 1) || (*name != '\0' && MatchWildcards(name + 1, pattern));
+	return *name != '\0' && (*pattern == '?' || *pattern == *name) && MatchWildcards(name + 1, pattern + 1);
+}
+
+static int CompareFileNames(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+int ListMatchingFiles(const char *pattern, char ***pFileNames)
+{
+	*pFileNames = NULL;
+
+	// A directory stands for all of its files, otherwise wildcards may only be in the last component of pattern
+	char dirName[MAX_STRING_LENGTH];
+	const char *namePattern;
+	struct stat fileStat;
+	if (stat(pattern, &fileStat) == 0 && (fileStat.st_mode & S_IFMT) == S_IFDIR)
+	{
+		strncpy(dirName, pattern, MAX_STRING_LENGTH - 1);
+		dirName[MAX_STRING_LENGTH - 1] = '\0';
+		namePattern = "*";
+	}
+	else
+	{
+		const char *pCharName = strrchr(pattern, PATH_SEPARATOR);
+#ifdef _WIN32
+		if (strrchr(pattern, '/') > pCharName)
+			pCharName = strrchr(pattern, '/');
+#endif
+		if (pCharName != NULL)
+		{
+			strncpy(dirName, pattern, pCharName - pattern + 1);
+			dirName[pCharName - pattern + 1] = '\0';
+			namePattern = pCharName + 1;
+		}
+		else
+		{
+			strcpy(dirName, ".");
+			namePattern = pattern;
+		}
+	}
+	size_t dirLength = strlen(dirName);
+	bool hasSeparator = dirLength > 0 && (dirName[dirLength - 1] == PATH_SEPARATOR || dirName[dirLength - 1] == '/');
+	const char separator[2] = { hasSeparator ? '\0' : PATH_SEPARATOR, '\0' };
+	bool inCurrentDir = (namePattern == pattern);
+
+	bool failed = FALSE;
+	int numFiles = 0;
+	int maxFiles = 0;
+	char **fileNames = NULL;
+
+#ifdef _WIN32
+	char searchPath[MAX_STRING_LENGTH + 2];
+	WIN32_FIND_DATAA findData;
+	sprintf(searchPath, "%s%s*", dirName, separator);
+	HANDLE findHandle = FindFirstFileA(searchPath, &findData);
+	if (findHandle == INVALID_HANDLE_VALUE)
+		return -1;
+	do
+	{
+		const char *entryName = findData.cFileName;
+#else
+	DIR *dir = opendir(dirName);
+	if (dir == NULL)
+		return -1;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		const char *entryName = entry->d_name;
+#endif
+		// As in a shell, hidden files only match a pattern starting with '.'
+		if ((entryName[0] == '.' && namePattern[0] != '.') || !MatchWildcards(entryName, namePattern))
+			continue;
+
+		char fileName[MAX_STRING_LENGTH];
+		int length = inCurrentDir ? snprintf(fileName, MAX_STRING_LENGTH, "%s", entryName) :
+			snprintf(fileName, MAX_STRING_LENGTH, "%s%s%s", dirName, separator, entryName);
+		if (length < 0 || length >= MAX_STRING_LENGTH)
+		{
+			fprintf(stderr, "ERROR Utils::ListMatchingFiles(). Name of %s in %s is too long!\n", entryName, dirName);
+			continue;
+		}
+		if (stat(fileName, &fileStat) != 0 || (fileStat.st_mode & S_IFMT) != S_IFREG)
+			continue;
+
+		if (numFiles == maxFiles)
+		{
+			maxFiles = MAX(2 * maxFiles, 64);
+			char **newFileNames = (char **)realloc(fileNames, maxFiles * sizeof(char *));
+			if (newFileNames == NULL)
+			{
+				failed = TRUE;
+				break;
+			}
+			fileNames = newFileNames;
+		}
+		if ((fileNames[numFiles] = (char *)malloc(length + 1)) == NULL)
+		{
+			failed = TRUE;
+			break;
+		}
+		strcpy(fileNames[numFiles++], fileName);
+#ifdef _WIN32
+	} while (FindNextFileA(findHandle, &findData));
+	FindClose(findHandle);
+#else
+	}
+	closedir(dir);
+#endif
+
+	if (failed || numFiles == 0)
+	{
+		if (failed)
+			fprintf(stderr, "ERROR Utils::ListMatchingFiles(). Could not allocate file list!\n");
+		FreeFileList(fileNames, numFiles);
+		return failed ? -1 : 0;
+	}
+
+	// Directory order is arbitrary
+	qsort(fileNames, numFiles, sizeof(char *), CompareFileNames);
+	*pFileNames = fileNames;
+	return numFiles;
+}
+
+void FreeFileList(char **fileNames, int numFiles)
+{
+	if (fileNames == NULL)
+		return;
+	for (int i = 0; i < numFiles; i++)
+		free(fileNames[i]);
+	free(fileNames);
+}
+
 // Determine how many frames in YUV file or BMP sequence
 //
-// TODO: Add support for multiframe BMP inputs via file numbers:
-//    <path>/<basename>XXXXX.bmp where XXXXX are digits
-//    numFrames is highest number that can be reached via incrementing from 00000
-// If supplied filename is of form <path>/<basename>.bmp where <basename> does not 
-// end in a digit, only a single frame is implied
-//
-// Supports only single frame BMP inputs
-// Supports multiframe for raw YUV files by numSubFrames = filesize / (width*height)
-// Height, width must be provided for YUV files, unused for BMP input (detected from header)
-// YUV multiframes must be contained in single YUV file
-//bool DetectNumberOfFrames(const char *fileName, FileType fileType,
-//	unsigned int height, unsigned int width, int *numFrames, int *numSubFrames, char *baseFileName)
+// A file name ending in 1 to 9 digits before its extension, <path>/<basename>XXX.<ext>, starts a sequence,
+// unless singleFile is set. Its directory is scanned once for the other files of <basename> and <ext>
+// numbered from that of the file on. Numbers are zero-padded to as many digits as that of the file, or have
+// more digits once they outgrow it; other paddings of a number are not part of the sequence.
+// Gaps in the numbering are skipped: the numbers found are kept sorted in frameNumbers
+// Any other name is a single file, as is stdin
+// numSubFrames of a single raw YUV file is its size / frame size, so height and width must be given
+// Y4M files, YUV sequences and streams are read until end of file, numSubFrames -1
 bool DetectNumberOfFrames(ImageFileInfo *imageFileInfo)
 {
 	imageFileInfo->numFrames = imageFileInfo->numSubFrames = 0;
+	imageFileInfo->frameDigits = 0;
+	imageFileInfo->frameNumbers = NULL;
 
-	char fileExtension[5];
-	switch (imageFileInfo->fileType)
+	// A stream has no size: frames are read until end of file
+	if (IsStdioFileName(imageFileInfo->filename))
 	{
-	case BMP_FILE:
-		strcpy(fileExtension, "bmp");
-		break;
-	case YUV_FILE:
-	default:
-		strcpy(fileExtension, "yuv");
+		if (((imageFileInfo->height == 0) || (imageFileInfo->width == 0)) && imageFileInfo->fileType != Y4M_FILE)
+		{
+			fprintf(stderr, "ERROR Utils::DetectNumberOfFrames(). Height and width must be specified for YUV input!\n");
+			return FALSE;
+		}
+		imageFileInfo->numFrames = 1;
+		imageFileInfo->numSubFrames = -1;
+		imageFileInfo->startFrame = 0;
+		strcpy(imageFileInfo->baseFileName, STDIO_FILENAME);
+		return TRUE;
 	}
 
-	//TODO: Debug multiple frame detection
-	//TODO: Add start frame detection
-	//TODO: Allow variable number of digits in filenames
-
 	// Parse filename to get base name
 	const char *pChar = strrchr(imageFileInfo->filename, '.'); // find last '.' in string; letters afterwards should be extension
+	if (pChar == NULL)
+		pChar = imageFileInfo->filename + strlen(imageFileInfo->filename);
+	const char *pCharName = strrchr(imageFileInfo->filename, PATH_SEPARATOR);
+#ifdef _WIN32
+	if (strrchr(imageFileInfo->filename, '/') > pCharName)
+		pCharName = strrchr(imageFileInfo->filename, '/');
+#endif
+	pCharName = (pCharName != NULL) ? pCharName + 1 : imageFileInfo->filename;
+	if (pChar < pCharName)
+		pChar = imageFileInfo->filename + strlen(imageFileInfo->filename);	// '.' is in directory name
+
 	// Find location of last digits in filename, if any
 	const char *pCharDigitStart = pChar;
-	do
-	{
+	while ((pCharDigitStart > imageFileInfo->filename) && isdigit(*(pCharDigitStart - 1)))
 		pCharDigitStart--;
-	} while ((pCharDigitStart >= imageFileInfo->filename) && isdigit(*pCharDigitStart));
-	pCharDigitStart++;
-	if (pChar - pCharDigitStart > 0)
+
+	// Sequence numbers up to 9 digits fit an int
+	long filenameDigits = pChar - pCharDigitStart;
+	if (filenameDigits > 0 && filenameDigits <= 9 && !imageFileInfo->singleFile)
 	{
-		long filenameDigits = pChar - pCharDigitStart;
 		// Strip out trailing digits to find base filename
 		strncpy(imageFileInfo->baseFileName, imageFileInfo->filename, pCharDigitStart - imageFileInfo->filename);
 		imageFileInfo->baseFileName[pCharDigitStart - imageFileInfo->filename] = '\0';	// Terminate substring
+		imageFileInfo->startFrame = atoi(pCharDigitStart);
+
+		// Later numbers have at least as many digits, so padding every name to this width reproduces it
+		imageFileInfo->frameDigits = (int)filenameDigits;
 
-		char fileDigits[MAX_STRING_LENGTH];
-		strncpy(fileDigits, pCharDigitStart, filenameDigits);
-		imageFileInfo->startFrame = atoi(fileDigits);
-
-		// Find number of frames by checking existance of each filename in sequence
-		int flagFileExists = 0;
-		char fullFileName[MAX_STRING_LENGTH];
-		do
-		{
-			sprintf(fullFileName, "%s%05d.%s", imageFileInfo->baseFileName, 
-				imageFileInfo->startFrame + imageFileInfo->numFrames, fileExtension);
-			flagFileExists = FileExists(fullFileName);
-			if (flagFileExists)
-				(imageFileInfo->numFrames)++;
-		} while (flagFileExists);
+		// Find frames with one scan of the directory rather than probing each possible name
+		char dirName[MAX_STRING_LENGTH];
+		if (pCharName > imageFileInfo->filename)
+		{
+			strncpy(dirName, imageFileInfo->filename, pCharName - imageFileInfo->filename);
+			dirName[pCharName - imageFileInfo->filename] = '\0';
+		}
+		else
+			strcpy(dirName, ".");
+		imageFileInfo->numFrames = ScanSequenceFrames(dirName, imageFileInfo->baseFileName + (pCharName - imageFileInfo->filename),
+			imageFileInfo->frameDigits, pChar, imageFileInfo->startFrame, &imageFileInfo->frameNumbers);
+		if (imageFileInfo->numFrames < 0)
+		{
+			fprintf(stderr, "ERROR Utils::DetectNumberOfFrames(). Directory %s cannot be read!\n", dirName);
+			return FALSE;
+		}
 		if (imageFileInfo->numFrames == 0)
 		{
-			fprintf(stderr, "ERROR Utils::DetectNumberOfFrames(). File %s cannot be found!\n", fullFileName);
+			fprintf(stderr, "ERROR Utils::DetectNumberOfFrames(). File %s cannot be found!\n", imageFileInfo->filename);
 			return FALSE;
 		}
-		//(imageFileInfo->numFrames)--;
 	}
 	else
 		imageFileInfo->numFrames = 1; // Single file only
 
 	if (imageFileInfo->numFrames == 1)
 	{
+		free(imageFileInfo->frameNumbers);
+		imageFileInfo->frameNumbers = NULL;
 		imageFileInfo->startFrame = 0;
 
 		// Strip out extension to find base filename
@@ -982,7 +2132,7 @@ bool DetectNumberOfFrames(ImageFileInfo *imageFileInfo)
 		{
 			// Single file only. Check if there are multiple frames contained.
 			// NOTE: This assumes file has no header
-			// NOTE: This assumes file is YUV420, and that the height and width are correctly specified on the command line
+			// NOTE: This assumes the height, width and format are correctly specified on the command line
 
 			// Check that height, width specified
 			if ((imageFileInfo->height == 0) || (imageFileInfo->width == 0))
@@ -992,21 +2142,15 @@ bool DetectNumberOfFrames(ImageFileInfo *imageFileInfo)
 			}
 
 			// Get file size in bytes.
-			FILE *file;
-			long sizeInBytes = 0;
-			if ((file = fopen(imageFileInfo->filename, "rb")) != NULL)
-			{
-				fseek(file, 0L, SEEK_END);
-				sizeInBytes = ftell(file);
-				fclose(file);
-			}
-			else
+			struct stat fileStat;
+			if (stat(imageFileInfo->filename, &fileStat) != 0)
 			{
 				fprintf(stderr, "ERROR Utils::DetectNumberOfFrames(). File %s cannot be found!\n", imageFileInfo->filename);
 				return FALSE;
 			}
-			// NumFrames = sizeInBytes*8/(BPP_YUV420*Width*Height);
-			long divisor = BPP_YUV420*imageFileInfo->width*imageFileInfo->height / 8;
+			long long sizeInBytes = (long long)fileStat.st_size;
+			long long divisor = (long long)GetYUVFrameSize(imageFileInfo->width, imageFileInfo->height,
+				imageFileInfo->fileSubtype);
 			if (sizeInBytes % divisor != 0)
 			{
 				fprintf(stderr, "ERROR Utils::DetectNumberOfFrames(). YUV File %s header size is nonzero!\n", imageFileInfo->filename);
@@ -1016,12 +2160,45 @@ bool DetectNumberOfFrames(ImageFileInfo *imageFileInfo)
 		}
 	}
 
+	// Y4M frames are delimited in-band, and files of a YUV sequence may differ in length:
+	// read each file until end of file
+	if (imageFileInfo->fileType == Y4M_FILE || (imageFileInfo->fileType == YUV_FILE && imageFileInfo->numFrames > 1))
+		imageFileInfo->numSubFrames = -1;
+
 	return TRUE;
 }
 
-// ---------------------------------------
-// Image format-specific file i/o routines
-// ---------------------------------------
+bool GetSequenceFileName(const ImageFileInfo *imageFileInfo, int i, char *fileName)
+{
+	if (imageFileInfo->frameNumbers == NULL)
+	{
+		strncpy(fileName, imageFileInfo->filename, MAX_STRING_LENGTH - 1);
+		fileName[MAX_STRING_LENGTH - 1] = '\0';
+		return TRUE;
+	}
+
+	// A number with more digits than the first one's lengthens the name
+	const char *extension = strrchr(imageFileInfo->filename, '.');
+	int length = snprintf(fileName, MAX_STRING_LENGTH, "%s%0*d%s", imageFileInfo->baseFileName, imageFileInfo->frameDigits,
+		imageFileInfo->frameNumbers[i], (extension != NULL) ? extension : "");
+	if (length < 0 || length >= MAX_STRING_LENGTH)
+	{
+		fprintf(stderr, "ERROR Utils::GetSequenceFileName(). Name of frame %d of %s is too long!\n",
+			imageFileInfo->frameNumbers[i], imageFileInfo->filename);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void FreeImageFileInfo(ImageFileInfo *imageFileInfo)
+{
+	free(imageFileInfo->frameNumbers);
+	imageFileInfo->frameNumbers = NULL;
+}
+
+// ---------------------------------------
+// Image format-specific file i/o routines
+// ---------------------------------------
 
 // Detect bitmap image size
 bool DetectBmpImageSize(const char *fileName, int *width, int *height)
@@ -1050,8 +2227,105 @@ bool DetectBmpImageSize(const char *fileName, int *width, int *height)
 	return TRUE;
 }
 
+// Receives an image row by row as RGB and stores it in pImage's color space
+// RGB rows go straight into the image planes; YUV rows are converted as soon as they are complete,
+// YUV420 in pairs once both rows of a pair have arrived
+typedef struct
+{
+	IMAGE *pImage;
+	bool bottomUp;				// Rows arrive from last to first
+	ConvertRowFunc convertRow;
+	PIXEL *rgbRows;				// 2 rows of RGB for YUV images, [y & 1][plane][x]
+	PIXEL *chromaRows;			// 4 rows of full resolution U, V scratch
+} RGBRowSink;
+
+static bool OpenRGBRowSink(IMAGE *pImage, bool bottomUp, RGBRowSink *pSink)
+{
+	memset(pSink, 0, sizeof(RGBRowSink));
+	if (pImage->colorSpace != RGB && pImage->colorSpace != YUV444 &&
+		pImage->colorSpace != YUV422 && pImage->colorSpace != YUV420)
+	{
+		fprintf(stderr, "ERROR UTILS::OpenRGBRowSink(): Unsupported color space!\n");
+		return FALSE;
+	}
+	pSink->pImage = pImage;
+	pSink->bottomUp = bottomUp;
+	if (pImage->colorSpace == RGB)
+		return TRUE;
+
+	pSink->rgbRows = (PIXEL *)malloc(10 * pImage->width);
+	if (pSink->rgbRows == NULL)
+	{
+		fprintf(stderr, "ERROR UTILS::OpenRGBRowSink(): Could not allocate row buffers!\n");
+		return FALSE;
+	}
+	pSink->chromaRows = pSink->rgbRows + 6 * pImage->width;
+	pSink->convertRow = GetRGB2YUVRowFunc(pImage->yuvMatrix, pImage->yuvRange);
+	return TRUE;
+}
+
+static void CloseRGBRowSink(RGBRowSink *pSink)
+{
+	free(pSink->rgbRows);
+	pSink->rgbRows = NULL;
+}
+
+// Returns where to put R, G, B of row y
+static void GetRGBRowSinkRow(RGBRowSink *pSink, int y, PIXEL *rgbRow[3])
+{
+	for (int plane = 0; plane < 3; plane++)
+	{
+		rgbRow[plane] = (pSink->pImage->colorSpace == RGB) ? pSink->pImage->pixArray[plane][y] :
+			pSink->rgbRows + ((y & 1) * 3 + plane) * pSink->pImage->width;
+	}
+}
+
+// Stores row y, previously filled in through GetRGBRowSinkRow()
+static void PutRGBRowSinkRow(RGBRowSink *pSink, int y)
+{
+	IMAGE *pImage = pSink->pImage;
+	int width = pImage->width;
+	PIXEL *rgbRow[3];
+
+	switch (pImage->colorSpace)
+	{
+	case YUV444:
+		GetRGBRowSinkRow(pSink, y, rgbRow);
+		pSink->convertRow(rgbRow[R_PLANE], rgbRow[G_PLANE], rgbRow[B_PLANE], pImage->pixArray[Y_PLANE][y],
+			pImage->pixArray[U_PLANE][y], pImage->pixArray[V_PLANE][y], width);
+		break;
+	case YUV422:
+		GetRGBRowSinkRow(pSink, y, rgbRow);
+		RGBRow2YUV422((const PIXEL **)rgbRow, pImage->pixArray[Y_PLANE][y], pImage->pixArray[U_PLANE][y],
+			pImage->pixArray[V_PLANE][y], width, pSink->convertRow, pSink->chromaRows);
+		break;
+	case YUV420:
+	{
+		// Convert once both rows of a pair have arrived. Repeat last line if height is odd
+		int yPartner = y ^ 1;
+		bool hasPartner = yPartner < pImage->height;
+		if (hasPartner && (pSink->bottomUp ? yPartner < y : yPartner > y))
+			break;
+		int y0 = y & ~1;
+		int y1 = hasPartner ? y0 + 1 : y0;
+		const PIXEL *rgbRow0[3], *rgbRow1[3];
+		for (int plane = 0; plane < 3; plane++)
+		{
+			rgbRow0[plane] = pSink->rgbRows + plane * width;
+			rgbRow1[plane] = hasPartner ? pSink->rgbRows + (3 + plane) * width : rgbRow0[plane];
+		}
+		RGBRowPair2YUV420(rgbRow0, rgbRow1, pImage->pixArray[Y_PLANE][y0], pImage->pixArray[Y_PLANE][y1],
+			pImage->pixArray[U_PLANE][y0 / 2], pImage->pixArray[V_PLANE][y0 / 2], width, pSink->convertRow,
+			pSink->chromaRows);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
 // Read image in Bitmap file format
-// pImage->colorSpace can be anything since file is read in in RGB 4:4:4 format, converted if necessary at end
+// Rows are deinterleaved straight into pImage's planes, converted in the same pass if pImage is YUV
 bool LoadBmpImage(const char *fileName, IMAGE *pImage)
 {
 	FILE *file = fopen(fileName, "rb");
@@ -1096,99 +2370,57 @@ bool LoadBmpImage(const char *fileName, IMAGE *pImage)
 		pImage->height = height;
 		pImage->width = width;
 		pImage->precision = BPP8;
+		pImage->bitDepth = 8;
 	}
 
-	// Calculate number of padding bytes if line not a multiple of 4
-	unsigned int padBytes = (4 - ((width * 3) & 0x0003)) & 0x0003;
-
-	// Allocate input pixel buffer
-	unsigned int bufSize = (width * 3 + padBytes) * height; //bmp data size
-
-	PIXEL *dataBuffer;
-	if ((dataBuffer = (PIXEL *)malloc(bufSize)) == NULL)
+	// Pixels normally stored "upside-down" with respect to normal image raster scan order
+	// Uncompressed Windows bitmaps can also be stored top to bottom when the Image Height value is negative
+	int vFlip = !(bmpHeader.bitmapHeight < 0);
+	RGBRowSink sink;
+	if (!OpenRGBRowSink(pImage, vFlip, &sink))
 	{
-		fprintf(stderr, "ERROR UTILS::LoadBmpImage(): Could not allocate input buffer!\n");
 		fclose(file);
 		return FALSE;
 	}
 
-	// Read pixel data from file
-	if (fread(dataBuffer, bufSize, 1, file) != 1)
+	// Pixel data normally follows the header directly, but the header says where it is
+	if (bmpHeader.dataOffset > sizeof(BitmapFileHeader))
+		fseek(file, bmpHeader.dataOffset, SEEK_SET);
+
+	// Calculate number of padding bytes if line not a multiple of 4
+	unsigned int padBytes = (4 - ((width * 3) & 0x0003)) & 0x0003;
+	unsigned int rowBytes = width * 3 + padBytes;
+
+	PIXEL *rowBuffer = (PIXEL *)malloc(rowBytes);
+	if (rowBuffer == NULL)
 	{
-		fprintf(stderr, "ERROR UTILS::LoadBmpImage(): Could not read BMP pixel data: file corrupted!\n");
+		fprintf(stderr, "ERROR UTILS::LoadBmpImage(): Could not allocate input buffer!\n");
+		CloseRGBRowSink(&sink);
 		fclose(file);
-		free(dataBuffer);
 		return FALSE;
 	}
-	fclose(file);
 
-
-	// Pixels normally stored "upside-down" with respect to normal image raster scan order
-	// Uncompressed Windows bitmaps can also be stored top to bottom when the Image Height value is negative
-	int vFlip = !(bmpHeader.bitmapHeight < 0);
-	PIXEL *bufPtr = dataBuffer;
-	PIXEL rgbPixel[3];
-
-
-	if (vFlip)
-	{
-		for (int y = height - 1; y >= 0; y--)
-		{
-			for (int x = 0; x < width; x++)
-			{
-				rgbPixel[B_PLANE] = (PIXEL)(*bufPtr++);
-				rgbPixel[G_PLANE] = (PIXEL)(*bufPtr++);
-				rgbPixel[R_PLANE] = (PIXEL)(*bufPtr++);
-				SetPixel(pImage, y, x, rgbPixel);
-			}
-			bufPtr += padBytes;
-		}
-	}
-	else
-	{
-		for (int y = 0; y < height; y++)
-		{
-			for (int x = 0; x < width; x++)
-			{
-				rgbPixel[B_PLANE] = (PIXEL)(*bufPtr++);
-				rgbPixel[G_PLANE] = (PIXEL)(*bufPtr++);
-				rgbPixel[R_PLANE] = (PIXEL)(*bufPtr++);
-				SetPixel(pImage, y, x, rgbPixel);
-			}
-			bufPtr += padBytes;
-		}
-	}
-	free(dataBuffer);
-	
-	// Do color space conversion if necessary to colorspace defined by given pImage
-	if (pImage->colorSpace != RGB)
+	for (int row = 0; row < height; row++)
 	{
-		IMAGE tempImage;
-
-		// Allocate temp image
-		// Colorspace is don't care since it will be overwritten by CopyImage
-		tempImage = CreateImage(pImage->colorSpace, width, height);
-
-		// Copy image to new temp image
-		if (!CopyImage(pImage, &tempImage))
-		{
-			DestroyImage(&tempImage);
-			fprintf(stderr, "UTILS::LoadBmpImage(): Unable to copy image for color space conversion!\n");
-			return FALSE;
-		}
-
-		// Convert color space
-		tempImage.colorSpace = RGB;
-		if (!ConvertImage(&tempImage, pImage))
+		if (fread(rowBuffer, rowBytes, 1, file) != 1)
 		{
-			DestroyImage(&tempImage);
-			fprintf(stderr, "UTILS::LoadBmpImage(): Unable to convert image color space!\n");
+			fprintf(stderr, "ERROR UTILS::LoadBmpImage(): Could not read BMP pixel data: file corrupted!\n");
+			CloseRGBRowSink(&sink);
+			fclose(file);
+			free(rowBuffer);
 			return FALSE;
 		}
 
-		// Deallocate temp image
-		DestroyImage(&tempImage);
+		// The flip is only a choice of destination row
+		int y = vFlip ? height - 1 - row : row;
+		PIXEL *rgbRow[3];
+		GetRGBRowSinkRow(&sink, y, rgbRow);
+		DeinterleaveTripletRow(rowBuffer, rgbRow[B_PLANE], rgbRow[G_PLANE], rgbRow[R_PLANE], width);
+		PutRGBRowSinkRow(&sink, y);
 	}
+	CloseRGBRowSink(&sink);
+	fclose(file);
+	free(rowBuffer);
 
 	return TRUE;
 }
@@ -1196,360 +2428,1507 @@ bool LoadBmpImage(const char *fileName, IMAGE *pImage)
 // Writes image in Bitmap file format
 bool SaveBmpImage(const char *fileName, IMAGE *pImage)
 {
-	IMAGE tempImage = CreateImage(RGB, pImage->width, pImage->height);
+	if (pImage->precision != BPP8)
+	{
+		fprintf(stderr, "ERROR UTILS::SaveBmpImage(): Only 8BPP precision supported!\n");
+		return FALSE;
+	}
+	if (pImage->colorSpace != RGB && pImage->colorSpace != YUV444 &&
+		pImage->colorSpace != YUV422 && pImage->colorSpace != YUV420)
+	{
+		fprintf(stderr, "ERROR UTILS::SaveBmpImage(): Unsupported color space!\n");
+		return FALSE;
+	}
 
-	// Color space conversion if necessary
-	if (pImage->colorSpace != RGB)
-		ConvertImage(pImage, &tempImage);
-	else
-		CopyImage(pImage, &tempImage);
+	int width = pImage->width;
+	int height = pImage->height;
+
+	// Calculate number of padding bytes if line not a multiple of 4
+	unsigned int padBytes = (4 - ((width * 3) & 0x0003)) & 0x0003;
+	unsigned int rowBytes = width * 3 + padBytes;
+
+	// Allocate zeroed output row buffer so padding bytes are written as 0's and,
+	// for YUV images, 1 row of RGB plus 2 rows of chroma scratch
+	PIXEL *rowBuffer = (PIXEL *)calloc(rowBytes + (pImage->colorSpace != RGB ? 5 * width : 0), 1);
+	if (rowBuffer == NULL)
+	{
+		fprintf(stderr, "ERROR UTILS::SaveBmpImage(): Could not allocate bitmap row buffer!\n");
+		return FALSE;
+	}
+	PIXEL *rgbRow[3] = { rowBuffer + rowBytes, rowBuffer + rowBytes + width, rowBuffer + rowBytes + 2 * width };
+	PIXEL *chromaRows = rowBuffer + rowBytes + 3 * width;
+	ConvertRowFunc convertRow = (pImage->colorSpace != RGB) ?
+		GetYUV2RGBRowFunc(pImage->yuvMatrix, pImage->yuvRange) : NULL;
 
 	FILE *file = fopen(fileName, "wb");
 	if (file == NULL)
 	{
 		fprintf(stderr, "ERROR UTILS::SaveBmpImage(): Could not create file %s!\n", fileName);
+		free(rowBuffer);
 		return FALSE;
 	}
 
-	// Calculate number of padding bytes if line not a multiple of 4
-	unsigned int padBytes = (4 - ((tempImage.width * 3) & 0x0003)) & 0x0003;
-
-	// Allocate input pixel buffer
-	unsigned int bufSize = (tempImage.width * 3 + padBytes) * tempImage.height; //bmp data size
-
 	// Clear bitmap header to 0's
 	BitmapFileHeader bmpHeader;
 	memset(&bmpHeader, 0, sizeof(BitmapFileHeader));
 
 	// Initialize bitmap header fields
+	unsigned int bufSize = rowBytes * height; //bmp data size
 	bmpHeader.fileType = 0x4D42;
 	bmpHeader.fileSize = bufSize + sizeof(BitmapFileHeader); // file size in bytes
 	bmpHeader.reserved1 = 0;
 	bmpHeader.dataOffset = sizeof(BitmapFileHeader); // offset to pixel data
 	bmpHeader.headerSize = 40;
-	bmpHeader.bitmapWidth = tempImage.width;
-	bmpHeader.bitmapHeight = tempImage.height;
+	bmpHeader.bitmapWidth = width;
+	bmpHeader.bitmapHeight = height;
 	bmpHeader.numPlanes = 1;
 	bmpHeader.colorDepth = 24;
 	bmpHeader.bitmapSize = bufSize;
 
-	// Allocate bitmap data buffer
-	bufSize += sizeof(BitmapFileHeader);
-	PIXEL *dataBuffer;
-	if ((dataBuffer = (PIXEL *)malloc(bufSize)) == NULL)
-	{
-		fprintf(stderr, "ERROR UTILS::SaveBmpImage(): Could not allocate bitmap data buffer!\n");
-		fclose(file);
-		return FALSE;
-	}
-
-	// Copy header into data buffer
-	memcpy(dataBuffer, &bmpHeader, sizeof(BitmapFileHeader));
-	PIXEL *bufPtr;
-	bufPtr = dataBuffer + sizeof(BitmapFileHeader);
+	bool success = (fwrite(&bmpHeader, sizeof(BitmapFileHeader), 1, file) == 1);
 
-	for (int y = tempImage.height - 1; y >= 0; y--)	// Output bot->top
+	// Interleave planar rows into BGR triplets, converting YUV rows on the fly
+	for (int y = height - 1; y >= 0 && success; y--)	// Output bot->top
 	{
-		for (int x = 0; x < tempImage.width; x++)
+		if (pImage->colorSpace == RGB)
 		{
-			PIXEL rgbPixel[3];
-			GetPixel(&tempImage, y, x, REPEAT, rgbPixel);
-
-			*bufPtr++ = (PIXEL)(rgbPixel[B_PLANE]);
-			*bufPtr++ = (PIXEL)(rgbPixel[G_PLANE]);
-			*bufPtr++ = (PIXEL)(rgbPixel[R_PLANE]);
+			InterleaveTripletRow(pImage->pixArray[B_PLANE][y], pImage->pixArray[G_PLANE][y],
+				pImage->pixArray[R_PLANE][y], rowBuffer, width);
+		}
+		else
+		{
+			YUVRow2RGB(pImage, y, rgbRow, convertRow, chromaRows);
+			InterleaveTripletRow(rgbRow[B_PLANE], rgbRow[G_PLANE], rgbRow[R_PLANE], rowBuffer, width);
 		}
-		bufPtr += padBytes;
+		success = (fwrite(rowBuffer, rowBytes, 1, file) == 1);
 	}
 
-	// Write data buffer to file
-	fwrite(dataBuffer, bufSize, 1, file);
+	if (!success)
+		fprintf(stderr, "ERROR UTILS::SaveBmpImage(): Could not write file %s!\n", fileName);
 
 	// Cleanup
 	fclose(file);
-	free(dataBuffer);
-	DestroyImage(&tempImage);
+	free(rowBuffer);
 
-	return TRUE;
+	return success;
 }
 
-// Reads image in raw YUV file format
-// Currently support YUV420 only, not YUV 422 or YUV444
-// Can also internally convert YUV420 to RGB if pImage->colorSpace == RGB
-bool LoadRawYUVImage(const char *fileName, IMAGE *pImage, int subFrame, YUVType fileSubtype)
+// QOI chunk tags, see qoiformat.org
+#define QOI_OP_INDEX	0x00	// 00xxxxxx
+#define QOI_OP_DIFF		0x40	// 01xxxxxx
+#define QOI_OP_LUMA		0x80	// 10xxxxxx
+#define QOI_OP_RUN		0xC0	// 11xxxxxx
+#define QOI_OP_RGB		0xFE	// 11111110
+#define QOI_OP_RGBA		0xFF	// 11111111
+#define QOI_MASK_2		0xC0	// 11000000
+#define QOI_RUN_MAX		62
+#define QOI_HASH(px) (((px).r * 3 + (px).g * 5 + (px).b * 7 + (px).a * 11) & 63)
+
+static const PIXEL QOI_END_MARKER[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+static const int QOI_IO_BUFFER_SIZE = 1 << 16;
+
+typedef struct
 {
-	ColorSpaces inputColorSpace = pImage->colorSpace;
-	switch (inputColorSpace)
-	{
-	case RGB:
-		// Must set image colorspace to YUV420 so that SetSubPixel() addresses correct locations
-		// This will be set back to RGB below during color space conversion
-		pImage->colorSpace = YUV420;
-		break;
-	case YUV420:
-		break;
-	default:
-		fprintf(stderr, "ERROR UTILS::LoadRawYUVImage(): Unsupported color space!\n");
+	PIXEL r, g, b, a;
+} QoiPixel;
+
+// Reads QOI header, leaving file positioned at first chunk
+static bool ReadQoiHeader(FILE *file, int *width, int *height, int *channels)
+{
+	PIXEL header[QOI_HEADER_SIZE];
+	if (fread(header, QOI_HEADER_SIZE, 1, file) != 1 || memcmp(header, QOI_MAGIC, 4) != 0)
 		return FALSE;
-	}
 
+	unsigned int qoiWidth = (header[4] << 24) | (header[5] << 16) | (header[6] << 8) | header[7];
+	unsigned int qoiHeight = (header[8] << 24) | (header[9] << 16) | (header[10] << 8) | header[11];
+	*channels = header[12];
+	if (qoiWidth == 0 || qoiHeight == 0 || qoiWidth > INT_MAX || qoiHeight > INT_MAX ||
+		(*channels != 3 && *channels != 4))
+		return FALSE;
+	*width = (int)qoiWidth;
+	*height = (int)qoiHeight;
+	return TRUE;
+}
+
+bool DetectQoiImageSize(const char *fileName, int *width, int *height)
+{
 	FILE *file = fopen(fileName, "rb");
 	if (file == NULL)
 	{
-		fprintf(stderr, "ERROR UTILS::LoadRawYUVImage(): Could not open file %s\n", fileName);
+		fprintf(stderr, "ERROR UTILS::DetectQoiImageSize(): File %s not found! \n", fileName);
 		return FALSE;
 	}
 
-	// Go to appropriate location for start of subframe data
-	long seekLocation = BPP_YUV420 * pImage->width * pImage->height * subFrame / 8;
-	fseek(file, seekLocation, SEEK_SET);
+	int channels;
+	bool success = ReadQoiHeader(file, width, height, &channels);
+	if (!success)
+		fprintf(stderr, "ERROR UTILS::DetectQoiImageSize(): Input QOI is corrupted! \n");
+	fclose(file);
+
+	return success;
+}
 
-	// Read YUV data in order depending on fileSubType
-	// Read Y plane
-	// Allocate input pixel buffer
-	unsigned int bufSize = pImage->width * pImage->height;	// Y plane size
-	PIXEL *dataBuffer;
-	if ((dataBuffer = (PIXEL *)malloc(bufSize)) == NULL)
+// Decodes QOI chunks row by row through a fixed size read buffer
+// Alpha is decoded to keep the chunk state correct, then dropped
+bool LoadQoiImage(const char *fileName, IMAGE *pImage)
+{
+	FILE *file = fopen(fileName, "rb");
+	if (file == NULL)
 	{
-		fprintf(stderr, "ERROR UTILS::LoadRawYUVImage(): Could not allocate Y buffer!\n");
-		fclose(file);
+		fprintf(stderr, "ERROR UTILS::LoadQoiImage(): Could not open file %s\n", fileName);
 		return FALSE;
 	}
 
-	// Read pixel data from file
-	if (fread(dataBuffer, bufSize, 1, file) != 1)
+	int width, height, channels;
+	if (!ReadQoiHeader(file, &width, &height, &channels))
 	{
-		fprintf(stderr, "ERROR UTILS::LoadRawYUVImage(): Could not read Y pixel data: file corrupted!\n");
+		fprintf(stderr, "ERROR UTILS::LoadQoiImage(): Could not read QOI header! \n");
 		fclose(file);
-		free(dataBuffer);
-		// Return instead of exit so we can try to read next frame
 		return FALSE;
 	}
 
-	// Write Y plane to image
-	PIXEL *bufPtr = dataBuffer;
-	for (int y = 0; y < pImage->height; y++) {
-		for (int x = 0; x < pImage->width; x++) {
-			SetSubPixel(pImage, y, x, Y_PLANE, (PIXEL)(*bufPtr++));
+	// Check that supplied image has correct allocated space
+	if ((pImage->height != height) || (pImage->width != width) ||
+		(pImage->precision != BPP8))
+	{
+		// Supplied image dimensions not correct. Deallocate image and re-allocate with correct dimensions.
+		DestroyImage(pImage);
+		pImage->pixArray = Create3DArray(PIXEL, 3, height, width);
+		if (pImage->pixArray == NULL)
+		{
+			fprintf(stderr, "ERROR UTILS::LoadQoiImage(): Error re-allocating image memory!\n");
+			fclose(file);
+			return FALSE;
 		}
+		pImage->height = height;
+		pImage->width = width;
+		pImage->precision = BPP8;
+		pImage->bitDepth = 8;
 	}
-	free(dataBuffer);
 
-	// Read UV planes
-	// Allocate input pixel buffer
-	bufSize /= 2;	// UV plane size = (w*h/4)*2
-	if ((dataBuffer = (PIXEL *)malloc(bufSize)) == NULL)
+	RGBRowSink sink;
+	if (!OpenRGBRowSink(pImage, FALSE, &sink))
 	{
-		fprintf(stderr, "ERROR UTILS::LoadRawYUVImage(): Could not allocate UV buffer!\n");
 		fclose(file);
 		return FALSE;
 	}
 
-	// Read UV pixel data from file
-	if (fread(dataBuffer, bufSize, 1, file) != 1)
+	PIXEL *buffer = (PIXEL *)malloc(QOI_IO_BUFFER_SIZE);
+	if (buffer == NULL)
 	{
-		fprintf(stderr, "ERROR UTILS::LoadRawYUVImage(): Could not read UV pixel data: file corrupted!\n");
+		fprintf(stderr, "ERROR UTILS::LoadQoiImage(): Could not allocate input buffer!\n");
+		CloseRGBRowSink(&sink);
 		fclose(file);
-		free(dataBuffer);
-		// Return instead of exit so we can try to read next frame
 		return FALSE;
 	}
-	fclose(file);
-	bufPtr = dataBuffer;
 
-	// Write UV planes to image
-	YUVPlanes plane1,plane2;
+	// Chunks never exceed 5 bytes: refill whenever fewer than that are left
+	size_t pos = 0;
+	size_t length = 0;
+	bool atEnd = FALSE;
+	bool success = TRUE;
 
-	// Setup order of U, V planes within specified file format
-	switch (fileSubtype)
+	QoiPixel index[64];
+	memset(index, 0, sizeof(index));
+	QoiPixel px = { 0, 0, 0, 255 };
+	int run = 0;
+	for (int y = 0; y < height && success; y++)
 	{
-	case YUV420_I420:
-	case YUV420_NV12:
-		plane1 = U_PLANE;
-		plane2 = V_PLANE;
-		break;
-	case YUV420_YV12:
-	case YUV420_NV21:
-		plane1 = V_PLANE;
-		plane2 = U_PLANE;
-		break;
-	default:
-		fprintf(stderr, "ERROR UTILS::LoadRawYUVImage(): Invalid YUV format type!\n");
-		free(dataBuffer);
-		return FALSE;
-	}
+		PIXEL *rgbRow[3];
+		GetRGBRowSinkRow(&sink, y, rgbRow);
+		for (int x = 0; x < width; x++)
+		{
+			if (run > 0)
+				run--;
+			else
+			{
+				if (length - pos < 5 && !atEnd)
+				{
+					memmove(buffer, buffer + pos, length - pos);
+					length -= pos;
+					pos = 0;
+					length += fread(buffer + length, 1, QOI_IO_BUFFER_SIZE - length, file);
+					atEnd = (length < (size_t)QOI_IO_BUFFER_SIZE);
+				}
+				// A truncated file may end inside a chunk: its payload must be in the buffer before it is read
+				size_t chunkSize = 1;
+				if (pos < length)
+				{
+					int op = buffer[pos];
+					chunkSize = (op == QOI_OP_RGBA) ? 5 : (op == QOI_OP_RGB) ? 4 : ((op & QOI_MASK_2) == QOI_OP_LUMA) ? 2 : 1;
+				}
+				if (length - pos < chunkSize)
+				{
+					success = FALSE;
+					break;
+				}
 
-	switch (fileSubtype)
-	{
-	case YUV420_I420:
-	case YUV420_YV12:
-		for (int y = 0; y < pImage->height; y += 2) {
-			for (int x = 0; x < pImage->width; x += 2) {
-				SetSubPixel(pImage, y, x, plane1, (PIXEL)(*bufPtr++));
-			}
-		}
-		for (int y = 0; y < pImage->height; y += 2) {
-			for (int x = 0; x < pImage->width; x += 2) {
-				SetSubPixel(pImage, y, x, plane2, (PIXEL)(*bufPtr++));
-			}
-		}
-		break;
-	case YUV420_NV12:
-	case YUV420_NV21:
-		for (int y = 0; y < pImage->height; y += 2) {
-			for (int x = 0; x < pImage->width; x += 2) {
-				SetSubPixel(pImage, y, x, plane1, (PIXEL)(*bufPtr++));
-				SetSubPixel(pImage, y, x, plane2, (PIXEL)(*bufPtr++));
+				int b1 = buffer[pos++];
+				if (b1 == QOI_OP_RGB)
+				{
+					px.r = buffer[pos];
+					px.g = buffer[pos + 1];
+					px.b = buffer[pos + 2];
+					pos += 3;
+				}
+				else if (b1 == QOI_OP_RGBA)
+				{
+					px.r = buffer[pos];
+					px.g = buffer[pos + 1];
+					px.b = buffer[pos + 2];
+					px.a = buffer[pos + 3];
+					pos += 4;
+				}
+				else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX)
+					px = index[b1];
+				else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF)
+				{
+					px.r += ((b1 >> 4) & 0x03) - 2;
+					px.g += ((b1 >> 2) & 0x03) - 2;
+					px.b += (b1 & 0x03) - 2;
+				}
+				else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA)
+				{
+					int b2 = buffer[pos++];
+					int vg = (b1 & 0x3F) - 32;
+					px.r += vg - 8 + ((b2 >> 4) & 0x0F);
+					px.g += vg;
+					px.b += vg - 8 + (b2 & 0x0F);
+				}
+				else
+					run = b1 & 0x3F;	// QOI_OP_RUN: this pixel plus run more
+				index[QOI_HASH(px)] = px;
 			}
+			rgbRow[R_PLANE][x] = px.r;
+			rgbRow[G_PLANE][x] = px.g;
+			rgbRow[B_PLANE][x] = px.b;
 		}
-		break;
-	default:
-		fprintf(stderr, "ERROR UTILS::LoadRawYUVImage(): Invalid YUV format type!\n");
-		free(dataBuffer);
-		return FALSE;
+		if (success)
+			PutRGBRowSinkRow(&sink, y);
 	}
-	free(dataBuffer);
 
-	// Do color space conversion if necessary to colorspace defined by given pImage
-	if (inputColorSpace == RGB)
+	if (!success)
 	{
-		IMAGE tempImage;
-
-		// Allocate temp image
-		// Colorspace is don't care since it will be overwritten by CopyImage
-		tempImage = CreateImage(inputColorSpace, pImage->width, pImage->height);
-
-		// Copy image to new temp image
-		if (!CopyImage(pImage, &tempImage))
-		{
-			DestroyImage(&tempImage);
-			fprintf(stderr, "UTILS::LoadRawYUVImage(): Unable to copy image for color space conversion!\n");
-			return FALSE;
-		}
-
-		// Convert color space
-		pImage->colorSpace = RGB;
-		if (!ConvertImage(&tempImage, pImage))
-		{
-			DestroyImage(&tempImage);
-			fprintf(stderr, "UTILS::LoadRawYUVImage(): Unable to convert image color space!\n");
-			return FALSE;
-		}
-
-		// Deallocate temp image
-		DestroyImage(&tempImage);
+		fprintf(stderr, "ERROR UTILS::LoadQoiImage(): Could not read QOI pixel data: file corrupted!\n");
+		success = FALSE;
 	}
 
-	return TRUE;
+	CloseRGBRowSink(&sink);
+	fclose(file);
+	free(buffer);
+
+	return success;
 }
 
-// Writes image in raw YUV file format
-bool SaveRawYUVImage(const char *fileName, IMAGE *pImage, YUVType fileSubtype)
+// Encodes QOI chunks row by row; YUV images are converted to RGB one row at a time
+bool SaveQoiImage(const char *fileName, IMAGE *pImage)
 {
-	FILE *file = fopen(fileName, "a+b");
-	if (file == NULL)
+	if (pImage->precision != BPP8)
 	{
-		fprintf(stderr, "ERROR UTILS::SaveRawYUVImage(): Could not open file %s\n", fileName);
+		fprintf(stderr, "ERROR UTILS::SaveQoiImage(): Only 8BPP precision supported!\n");
 		return FALSE;
 	}
-
-	// Write YUV data in order depending on fileSubType
-	// Write Y plane
-	// Allocate pixel buffer
-	unsigned int bufSize = pImage->width * pImage->height;	// Y plane size
-	PIXEL *dataBuffer;
-	if ((dataBuffer = (PIXEL *)malloc(bufSize)) == NULL)
+	if (pImage->colorSpace != RGB && pImage->colorSpace != YUV444 &&
+		pImage->colorSpace != YUV422 && pImage->colorSpace != YUV420)
 	{
-		fprintf(stderr, "ERROR UTILS::SaveRawYUVImage(): Could not allocate Y buffer!\n");
-		fclose(file);
+		fprintf(stderr, "ERROR UTILS::SaveQoiImage(): Unsupported color space!\n");
 		return FALSE;
 	}
 
-	// Write Y plane to buffer
-	PIXEL *bufPtr = dataBuffer;
-	for (int y = 0; y < pImage->height; y++) {
-		for (int x = 0; x < pImage->width; x++) {
-			*bufPtr++ = GetSubPixel(pImage, y, x, REPEAT, Y_PLANE);
-		}
-	}
-
-	// Write pixel data to file
-	fwrite(dataBuffer, bufSize, 1, file);
+	int width = pImage->width;
+	int height = pImage->height;
 
-	free(dataBuffer);
-
-	// Read UV planes
-	// Allocate input pixel buffer
-	bufSize = (pImage->width * pImage->height) / 2;	// UV plane size = (w*h/4)*2
-	if ((dataBuffer = (PIXEL *)malloc(bufSize)) == NULL)
+	// A row encodes to at most 4 bytes per pixel (QOI_OP_RGB) plus a pending run.
+	// YUV images also need 1 row of RGB plus 2 rows of chroma scratch
+	size_t maxRowBytes = 4 * (size_t)width + 1;
+	PIXEL *rowBuffer = (PIXEL *)malloc(maxRowBytes + (pImage->colorSpace != RGB ? 5 * width : 0));
+	if (rowBuffer == NULL)
 	{
-		fprintf(stderr, "ERROR UTILS::SaveRawYUVImage(): Could not allocate UV buffer!\n");
-		fclose(file);
+		fprintf(stderr, "ERROR UTILS::SaveQoiImage(): Could not allocate output row buffer!\n");
 		return FALSE;
 	}
-	bufPtr = dataBuffer;
-
-	// Write UV planes to buffer
-	int plane1, plane2;
+	PIXEL *rgbScratch[3] = { rowBuffer + maxRowBytes, rowBuffer + maxRowBytes + width,
+		rowBuffer + maxRowBytes + 2 * width };
+	PIXEL *chromaRows = rowBuffer + maxRowBytes + 3 * width;
+	ConvertRowFunc convertRow = (pImage->colorSpace != RGB) ?
+		GetYUV2RGBRowFunc(pImage->yuvMatrix, pImage->yuvRange) : NULL;
 
-	// Setup order of U, V planes within specified file format
-	switch (fileSubtype)
+	FILE *file = fopen(fileName, "wb");
+	if (file == NULL)
 	{
-	case YUV420_I420:
-	case YUV420_NV12:
-		plane1 = U_PLANE;
-		plane2 = V_PLANE;
-		break;
-	case YUV420_YV12:
-	case YUV420_NV21:
-		plane1 = V_PLANE;
-		plane2 = U_PLANE;
-		break;
-	default:
-		fprintf(stderr, "ERROR UTILS::SaveRawYUVImage(): Invalid YUV format type!\n");
-		fclose(file);
-		free(dataBuffer);
-		// Return instead of exit so we can try to read next frame
+		fprintf(stderr, "ERROR UTILS::SaveQoiImage(): Could not create file %s!\n", fileName);
+		free(rowBuffer);
 		return FALSE;
 	}
 
-	switch (fileSubtype)
+	// Header: magic, big endian width and height, 3 channels, sRGB
+	PIXEL header[QOI_HEADER_SIZE];
+	memcpy(header, QOI_MAGIC, 4);
+	for (int i = 0; i < 4; i++)
 	{
-	case YUV420_I420:
-	case YUV420_YV12:
-		for (int y = 0; y < pImage->height; y += 2) {
-			for (int x = 0; x < pImage->width; x += 2) {
-				*bufPtr++ = GetSubPixel(pImage, y, x, REPEAT, plane1);
-			}
+		header[4 + i] = (PIXEL)((unsigned int)width >> (24 - 8 * i));
+		header[8 + i] = (PIXEL)((unsigned int)height >> (24 - 8 * i));
+	}
+	header[12] = 3;
+	header[13] = 0;
+	bool success = (fwrite(header, QOI_HEADER_SIZE, 1, file) == 1);
+
+	QoiPixel index[64];
+	memset(index, 0, sizeof(index));
+	QoiPixel prev = { 0, 0, 0, 255 };
+	int run = 0;
+	for (int y = 0; y < height && success; y++)
+	{
+		const PIXEL *rgbRow[3];
+		if (pImage->colorSpace == RGB)
+		{
+			for (int plane = 0; plane < 3; plane++)
+				rgbRow[plane] = pImage->pixArray[plane][y];
 		}
-		for (int y = 0; y < pImage->height; y += 2) {
-			for (int x = 0; x < pImage->width; x += 2) {
-				*bufPtr++ = GetSubPixel(pImage, y, x, REPEAT, plane2);
+		else
+		{
+			YUVRow2RGB(pImage, y, rgbScratch, convertRow, chromaRows);
+			for (int plane = 0; plane < 3; plane++)
+				rgbRow[plane] = rgbScratch[plane];
+		}
+
+		// Runs carry over from row to row
+		PIXEL *out = rowBuffer;
+		for (int x = 0; x < width; x++)
+		{
+			QoiPixel px = { rgbRow[R_PLANE][x], rgbRow[G_PLANE][x], rgbRow[B_PLANE][x], 255 };
+			if (px.r == prev.r && px.g == prev.g && px.b == prev.b)
+			{
+				if (++run == QOI_RUN_MAX)
+				{
+					*out++ = (PIXEL)(QOI_OP_RUN | (run - 1));
+					run = 0;
+				}
+				continue;
+			}
+			if (run > 0)
+			{
+				*out++ = (PIXEL)(QOI_OP_RUN | (run - 1));
+				run = 0;
+			}
+
+			int indexPos = QOI_HASH(px);
+			if (index[indexPos].r == px.r && index[indexPos].g == px.g && index[indexPos].b == px.b &&
+				index[indexPos].a == px.a)
+				*out++ = (PIXEL)(QOI_OP_INDEX | indexPos);
+			else
+			{
+				index[indexPos] = px;
+
+				// Differences wrap around, as in the decoder
+				int vr = (signed char)(px.r - prev.r);
+				int vg = (signed char)(px.g - prev.g);
+				int vb = (signed char)(px.b - prev.b);
+				int vgr = vr - vg;
+				int vgb = vb - vg;
+				if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+					*out++ = (PIXEL)(QOI_OP_DIFF | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2));
+				else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8)
+				{
+					*out++ = (PIXEL)(QOI_OP_LUMA | (vg + 32));
+					*out++ = (PIXEL)(((vgr + 8) << 4) | (vgb + 8));
+				}
+				else
+				{
+					*out++ = QOI_OP_RGB;
+					*out++ = px.r;
+					*out++ = px.g;
+					*out++ = px.b;
+				}
 			}
+			prev = px;
 		}
-		break;
+
+		// Last run of the image ends with it
+		if (y == height - 1 && run > 0)
+			*out++ = (PIXEL)(QOI_OP_RUN | (run - 1));
+
+		success = (fwrite(rowBuffer, out - rowBuffer, 1, file) == 1 || out == rowBuffer);
+	}
+	success = success && (fwrite(QOI_END_MARKER, sizeof(QOI_END_MARKER), 1, file) == 1);
+
+	if (!success)
+		fprintf(stderr, "ERROR UTILS::SaveQoiImage(): Could not write file %s!\n", fileName);
+
+	// Cleanup
+	fclose(file);
+	free(rowBuffer);
+
+	return success;
+}
+
+// Bits per sample of raw YUV file format
+int GetYUVBitDepth(YUVType fileSubtype)
+{
+	switch (fileSubtype)
+	{
+	case YUV420_I420_10:
+	case YUV420_P010:
+		return 10;
+	case YUV420_I420_12:
+		return 12;
+	case YUV420_I420_16:
+		return 16;
+	default:
+		return 8;
+	}
+}
+
+// Chroma subsampling of raw YUV file format
+ColorSpaces GetYUVColorSpace(YUVType fileSubtype)
+{
+	switch (fileSubtype)
+	{
+	case YUV422_I422:
+	case YUV422_YUY2:
+	case YUV422_UYVY:
+		return YUV422;
+	case YUV444_I444:
+		return YUV444;
+	default:
+		return YUV420;
+	}
+}
+
+// Detects YUV formats held in memory with interleaved UV
+static bool IsSemiPlanarYUV(YUVType fileSubtype)
+{
+	return (fileSubtype == YUV420_NV12 || fileSubtype == YUV420_NV21 || fileSubtype == YUV420_P010);
+}
+
+// Detects YUV formats held in memory as Y, U, Y, V pixel pairs
+static bool IsPackedYUV(YUVType fileSubtype)
+{
+	return (fileSubtype == YUV422_YUY2 || fileSubtype == YUV422_UYVY);
+}
+
+// Size in bytes of one raw YUV frame
+// Frames use the usual odd-size layout: subsampled chroma planes are ceil(width/2) wide,
+// and ceil(height/2) high for YUV420; packed formats hold ceil(width/2) pixel pairs per row
+size_t GetYUVFrameSize(int width, int height, YUVType fileSubtype)
+{
+	int chromaWidth, chromaHeight;
+	GetPlaneDimensions(GetYUVColorSpace(fileSubtype), width, height, U_PLANE, &chromaWidth, &chromaHeight);
+	if (IsPackedYUV(fileSubtype))
+		return 4 * (size_t)chromaWidth * height;
+	size_t sampleSize = (GetYUVBitDepth(fileSubtype) > 8) ? sizeof(PIXEL16) : sizeof(PIXEL);
+	return ((size_t)width * height + 2 * (size_t)chromaWidth * chromaHeight) * sampleSize;
+}
+
+// Size in bytes of buffer for the planes unpacked from, or packed for, one frame of the file: see ViewRawYUVFrame()
+static size_t GetYUVPlaneBufferSize(int width, int height, YUVType fileSubtype)
+{
+	int chromaWidth, chromaHeight;
+	GetPlaneDimensions(GetYUVColorSpace(fileSubtype), width, height, U_PLANE, &chromaWidth, &chromaHeight);
+	// Packed frames of odd width hold one more luma sample per row than the unpacked planes
+	if (fileSubtype == YUV420_P010 || IsPackedYUV(fileSubtype))
+		return GetYUVFrameSize(width, height, fileSubtype);
+	return IsSemiPlanarYUV(fileSubtype) ? 2 * (size_t)chromaWidth * chromaHeight : 0;
+}
+
+// Reads image in raw YUV file format
+// Reads 8-bit formats only, into 8BPP images of any color space
+bool LoadRawYUVImage(const char *fileName, IMAGE *pImage, int subFrame, YUVType fileSubtype)
+{
+	if (GetYUVBitDepth(fileSubtype) > 8)
+	{
+		fprintf(stderr, "ERROR UTILS::LoadRawYUVImage(): Only 8-bit YUV formats supported!\n");
+		return FALSE;
+	}
+
+	YUVSequenceReader reader;
+	if (!OpenYUVSequenceReader(fileName, pImage->width, pImage->height, fileSubtype, &reader))
+		return FALSE;
+
+	IMAGE view = CreateImageView(GetYUVColorSpace(fileSubtype), pImage->width, pImage->height);
+	view.yuvMatrix = pImage->yuvMatrix;
+	view.yuvRange = pImage->yuvRange;
+	bool success = IsImageAllocated(&view) && ReadYUVSequenceFrame(&reader, subFrame, &view);
+	if (success && !ConvertImage(&view, pImage))
+	{
+		fprintf(stderr, "UTILS::LoadRawYUVImage(): Unable to convert image color space!\n");
+		success = FALSE;
+	}
+
+	DestroyImage(&view);
+	CloseYUVSequenceReader(&reader);
+	return success;
+}
+
+// Points rows of image view at raw YUV frame held in memory
+// Planar formats are viewed in place; NV12/NV21 chroma is deinterleaved once into planeBuffer,
+// and YUY2/UYVY pixel pairs are split into three planes there
+// Formats of more than 8 bits are viewed through pix16Array, assuming a little endian host,
+// except that P010 is shifted down to 10-bit samples into planeBuffer, luma included
+bool ViewRawYUVFrame(PIXEL *frame, int width, int height, YUVType fileSubtype,
+	PIXEL *planeBuffer, IMAGE *pImage)
+{
+	const int bitDepth = GetYUVBitDepth(fileSubtype);
+	const ColorSpaces colorSpace = GetYUVColorSpace(fileSubtype);
+	if (!pImage->isView || pImage->colorSpace != colorSpace ||
+		pImage->width != width || pImage->height != height ||
+		pImage->precision != ((bitDepth > 8) ? BPP16 : BPP8) || pImage->bitDepth != bitDepth)
+	{
+		fprintf(stderr, "ERROR UTILS::ViewRawYUVFrame(): Image must be a view of the file's color space, dimensions and bit depth!\n");
+		return FALSE;
+	}
+
+	int chromaWidth, chromaHeight;
+	GetPlaneDimensions(colorSpace, width, height, U_PLANE, &chromaWidth, &chromaHeight);
+	const size_t sampleSize = (bitDepth > 8) ? sizeof(PIXEL16) : sizeof(PIXEL);
+	const size_t lumaSize = (size_t)width * height * sampleSize;
+	const size_t chromaSize = (size_t)chromaWidth * chromaHeight * sampleSize;
+
+	// Setup order of U, V planes within specified file format
+	YUVPlanes plane1, plane2;
+	switch (fileSubtype)
+	{
+	case YUV420_I420:
 	case YUV420_NV12:
+	case YUV420_I420_10:
+	case YUV420_I420_12:
+	case YUV420_I420_16:
+	case YUV420_P010:
+	case YUV422_I422:
+	case YUV444_I444:
+	case YUV422_YUY2:
+	case YUV422_UYVY:
+		plane1 = U_PLANE;
+		plane2 = V_PLANE;
+		break;
+	case YUV420_YV12:
 	case YUV420_NV21:
-		for (int y = 0; y < pImage->height; y += 2) {
-			for (int x = 0; x < pImage->width; x += 2) {
-				*bufPtr++ = GetSubPixel(pImage, y, x, REPEAT, plane1);
-				*bufPtr++ = GetSubPixel(pImage, y, x, REPEAT, plane2);
+		plane1 = V_PLANE;
+		plane2 = U_PLANE;
+		break;
+	default:
+		fprintf(stderr, "ERROR UTILS::ViewRawYUVFrame(): Invalid YUV format type!\n");
+		return FALSE;
+	}
+
+	// Start of each plane, in bytes
+	PIXEL *planeData[3];
+	PIXEL *chroma = frame + lumaSize;
+	if (fileSubtype == YUV420_NV12 || fileSubtype == YUV420_NV21)
+	{
+		planeData[Y_PLANE] = frame;
+		planeData[plane1] = planeBuffer;
+		planeData[plane2] = planeBuffer + chromaSize;
+		for (int y = 0; y < chromaHeight; y++)
+		{
+			DeinterleaveRow(chroma + (size_t)y * 2 * chromaWidth,
+				planeData[plane1] + (size_t)y * chromaWidth, planeData[plane2] + (size_t)y * chromaWidth, chromaWidth);
+		}
+	}
+	else if (fileSubtype == YUV420_P010)
+	{
+		planeData[Y_PLANE] = planeBuffer;
+		planeData[plane1] = planeBuffer + lumaSize;
+		planeData[plane2] = planeBuffer + lumaSize + chromaSize;
+		ShiftRow16((const PIXEL16 *)frame, (PIXEL16 *)planeData[Y_PLANE], width * height, P010_SHIFT);
+		for (int y = 0; y < chromaHeight; y++)
+		{
+			DeinterleaveRow16((const PIXEL16 *)chroma + (size_t)y * 2 * chromaWidth,
+				(PIXEL16 *)planeData[plane1] + (size_t)y * chromaWidth,
+				(PIXEL16 *)planeData[plane2] + (size_t)y * chromaWidth, chromaWidth, P010_SHIFT);
+		}
+	}
+	else if (IsPackedYUV(fileSubtype))
+	{
+		planeData[Y_PLANE] = planeBuffer;
+		planeData[plane1] = planeBuffer + lumaSize;
+		planeData[plane2] = planeBuffer + lumaSize + chromaSize;
+		for (int y = 0; y < height; y++)
+		{
+			UnpackYUV422Row(frame + (size_t)y * 4 * chromaWidth, planeData[Y_PLANE] + (size_t)y * width,
+				planeData[plane1] + (size_t)y * chromaWidth, planeData[plane2] + (size_t)y * chromaWidth,
+				width, fileSubtype == YUV422_UYVY);
+		}
+	}
+	else
+	{
+		planeData[Y_PLANE] = frame;
+		planeData[plane1] = chroma;
+		planeData[plane2] = chroma + chromaSize;
+	}
+
+	// Rows past the chroma plane height are never addressed; point them at the last row regardless
+	for (int plane = Y_PLANE; plane <= V_PLANE; plane++)
+	{
+		int planeWidth = (plane == Y_PLANE) ? width : chromaWidth;
+		int planeHeight = (plane == Y_PLANE) ? height : chromaHeight;
+		for (int y = 0; y < height; y++)
+		{
+			PIXEL *row = planeData[plane] + (size_t)MIN(y, planeHeight - 1) * planeWidth * sampleSize;
+			if (bitDepth > 8)
+				pImage->pix16Array[plane][y] = (PIXEL16 *)row;
+			else
+				pImage->pixArray[plane][y] = row;
+		}
+	}
+
+	return TRUE;
+}
+
+// Maps raw YUV file into memory so that its frames can be viewed without copying
+// Frames use the usual odd-size layout: see GetYUVFrameSize()
+bool OpenYUVFileMap(const char *fileName, int width, int height, YUVType fileSubtype, YUVFileMap *pMap)
+{
+	memset(pMap, 0, sizeof(YUVFileMap));
+
+	if (fileSubtype < YUV420_I420 || fileSubtype > YUV422_UYVY)
+	{
+		fprintf(stderr, "ERROR UTILS::OpenYUVFileMap(): Invalid YUV format type!\n");
+		return FALSE;
+	}
+
+	size_t size = 0;
+	PIXEL *data = NULL;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		fprintf(stderr, "ERROR UTILS::OpenYUVFileMap(): Could not open file %s\n", fileName);
+		return FALSE;
+	}
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = NULL;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+	{
+		size = (size_t)fileSize.QuadPart;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL)
+			data = (PIXEL *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+	CloseHandle(file);		// The mapping keeps the file open
+	if (data == NULL)
+	{
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		fprintf(stderr, "ERROR UTILS::OpenYUVFileMap(): Could not map file %s\n", fileName);
+		return FALSE;
+	}
+	pMap->mappingHandle = mapping;
+#else
+	int fd = open(fileName, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "ERROR UTILS::OpenYUVFileMap(): Could not open file %s\n", fileName);
+		return FALSE;
+	}
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+	{
+		size = (size_t)fileStat.st_size;
+#ifdef POSIX_FADV_SEQUENTIAL
+		// Widens read-ahead of the open file, which page faults of the mapping go through after fd is closed
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+		void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped != MAP_FAILED)
+			data = (PIXEL *)mapped;
+	}
+	close(fd);				// The mapping keeps the file open
+	if (data == NULL)
+	{
+		fprintf(stderr, "ERROR UTILS::OpenYUVFileMap(): Could not map file %s\n", fileName);
+		return FALSE;
+	}
+	// Frames are visited in order
+	madvise(data, size, MADV_SEQUENTIAL);
+#endif
+
+	pMap->data = data;
+	pMap->size = size;
+	pMap->width = width;
+	pMap->height = height;
+	pMap->fileSubtype = fileSubtype;
+	pMap->frameSize = GetYUVFrameSize(width, height, fileSubtype);
+	pMap->numFrames = (int)(size / pMap->frameSize);
+
+	// Semi-planar chroma and packed pixels are split into this buffer, so that they can be viewed as planes
+	if (GetYUVPlaneBufferSize(width, height, fileSubtype))
+	{
+		if ((pMap->planeBuffer = (PIXEL *)malloc(GetYUVPlaneBufferSize(width, height, fileSubtype))) == NULL)
+		{
+			fprintf(stderr, "ERROR UTILS::OpenYUVFileMap(): Could not allocate plane buffer!\n");
+			CloseYUVFileMap(pMap);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+// Unmaps file previously mapped with OpenYUVFileMap()
+// Views returned by MapRawYUVImage() are no longer valid afterwards
+void CloseYUVFileMap(YUVFileMap *pMap)
+{
+	if (pMap->data)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(pMap->data);
+		CloseHandle((HANDLE)pMap->mappingHandle);
+#else
+		munmap(pMap->data, pMap->size);
+#endif
+	}
+	free(pMap->planeBuffer);
+	memset(pMap, 0, sizeof(YUVFileMap));
+}
+
+// Points rows of image view at given frame of mapped file
+// Planar formats are viewed in place; NV12/NV21/P010/YUY2/UYVY planes are unpacked once into the map's buffer
+bool MapRawYUVImage(YUVFileMap *pMap, int subFrame, IMAGE *pImage)
+{
+	if (subFrame < 0 || subFrame >= pMap->numFrames)
+	{
+		fprintf(stderr, "ERROR UTILS::MapRawYUVImage(): Could not read frame %d: file corrupted!\n", subFrame);
+		return FALSE;
+	}
+
+	return ViewRawYUVFrame(pMap->data + pMap->frameSize * subFrame, pMap->width, pMap->height,
+		pMap->fileSubtype, pMap->planeBuffer, pImage);
+}
+
+// Prepares stdin for binary, buffered reading. Must precede any read from stdin
+static void PrepareStdin()
+{
+	static bool prepared = FALSE;
+	if (prepared)
+		return;
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+#endif
+	setvbuf(stdin, NULL, _IOFBF, YUV_READ_BUFFER_SIZE);
+	prepared = TRUE;
+}
+
+// Opens file, or stdin, as a buffered stream for sequential reading
+static bool OpenReaderStream(const char *fileName, YUVSequenceReader *pReader)
+{
+	if (IsStdioFileName(fileName))
+	{
+		PrepareStdin();
+		pReader->file = stdin;
+	}
+	else if ((pReader->file = fopen(fileName, "rb")) != NULL)
+		setvbuf(pReader->file, NULL, _IOFBF, YUV_READ_BUFFER_SIZE);
+	else
+	{
+		fprintf(stderr, "ERROR UTILS::OpenYUVSequenceReader(): Could not open file %s\n", fileName);
+		return FALSE;
+	}
+#if !defined(_WIN32) && defined(POSIX_FADV_SEQUENTIAL)
+	// Takes effect for Y4M files and stdin redirected from a file; a pipe ignores it
+	posix_fadvise(fileno(pReader->file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	return TRUE;
+}
+
+// Allocates frame buffers of stream reader
+static bool AllocReaderBuffers(YUVSequenceReader *pReader, int width, int height, YUVType fileSubtype)
+{
+	pReader->map.width = width;
+	pReader->map.height = height;
+	pReader->map.fileSubtype = fileSubtype;
+	pReader->map.frameSize = GetYUVFrameSize(width, height, fileSubtype);
+	pReader->numFrames = -1;	// Unknown until end of stream
+
+	size_t planeBufferSize = GetYUVPlaneBufferSize(width, height, fileSubtype);
+	pReader->frameBuffer = (PIXEL *)malloc(pReader->map.frameSize);
+	pReader->map.planeBuffer = planeBufferSize ? (PIXEL *)malloc(planeBufferSize) : NULL;
+	if (pReader->frameBuffer == NULL || (planeBufferSize && pReader->map.planeBuffer == NULL))
+	{
+		fprintf(stderr, "ERROR UTILS::OpenYUVSequenceReader(): Could not allocate frame buffer!\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// Opens raw YUV file for reading frame by frame
+// Regular files are memory-mapped; anything else (pipes, devices) is read through one buffered stream
+bool OpenYUVSequenceReader(const char *fileName, int width, int height, YUVType fileSubtype,
+	YUVSequenceReader *pReader)
+{
+	memset(pReader, 0, sizeof(YUVSequenceReader));
+
+	struct stat fileStat;
+	if (IsStdioFileName(fileName))
+	{
+		// Treated as a stream even if redirected from a regular file
+		fileStat.st_mode = 0;
+	}
+	else if (stat(fileName, &fileStat) != 0)
+	{
+		fprintf(stderr, "ERROR UTILS::OpenYUVSequenceReader(): Could not open file %s\n", fileName);
+		return FALSE;
+	}
+	if ((fileStat.st_mode & S_IFMT) == S_IFREG)
+	{
+		if (!OpenYUVFileMap(fileName, width, height, fileSubtype, &pReader->map))
+			return FALSE;
+		pReader->numFrames = pReader->map.numFrames;
+		return TRUE;
+	}
+
+	if (fileSubtype < YUV420_I420 || fileSubtype > YUV422_UYVY)
+	{
+		fprintf(stderr, "ERROR UTILS::OpenYUVSequenceReader(): Invalid YUV format type!\n");
+		return FALSE;
+	}
+
+	if (!OpenReaderStream(fileName, pReader))
+		return FALSE;
+	if (!AllocReaderBuffers(pReader, width, height, fileSubtype))
+	{
+		CloseYUVSequenceReader(pReader);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+// Closes reader opened with OpenYUVSequenceReader()
+void CloseYUVSequenceReader(YUVSequenceReader *pReader)
+{
+	if (pReader->file)
+	{
+		if (pReader->file != stdin)
+			fclose(pReader->file);
+		free(pReader->frameBuffer);
+		free(pReader->map.planeBuffer);
+		memset(pReader, 0, sizeof(YUVSequenceReader));
+	}
+	else
+	{
+		CloseYUVFileMap(&pReader->map);
+		memset(pReader, 0, sizeof(YUVSequenceReader));
+	}
+}
+
+// Points rows of image view at given frame
+// Frames are cheapest read in order; other frames are sought to where the stream allows it
+bool ReadYUVSequenceFrame(YUVSequenceReader *pReader, int frame, IMAGE *pImage)
+{
+	if (pReader->file == NULL)
+		return MapRawYUVImage(&pReader->map, frame, pImage);
+	if (pReader->isY4M)
+		return ReadY4MSequenceFrame(pReader, frame, pImage);
+
+	if (frame != pReader->nextFrame)
+	{
+		if (FSEEK64(pReader->file, (long long)pReader->map.frameSize * frame, SEEK_SET) != 0)
+		{
+			fprintf(stderr, "ERROR UTILS::ReadYUVSequenceFrame(): Could not seek to frame %d!\n", frame);
+			return FALSE;
+		}
+		pReader->nextFrame = frame;
+	}
+
+	if (fread(pReader->frameBuffer, pReader->map.frameSize, 1, pReader->file) != 1)
+	{
+		if (feof(pReader->file))
+			pReader->numFrames = pReader->nextFrame;
+		else
+			fprintf(stderr, "ERROR UTILS::ReadYUVSequenceFrame(): Could not read frame %d: file corrupted!\n", frame);
+		return FALSE;
+	}
+	pReader->nextFrame++;
+
+	return ViewRawYUVFrame(pReader->frameBuffer, pReader->map.width, pReader->map.height,
+		pReader->map.fileSubtype, pReader->map.planeBuffer, pImage);
+}
+
+// Planar YUV format of Y4M stream of given chroma subsampling and bit depth
+static YUVType GetY4MFileSubtype(ColorSpaces colorSpace, int bitDepth)
+{
+	if (colorSpace == YUV422)
+		return YUV422_I422;
+	if (colorSpace == YUV444)
+		return YUV444_I444;
+	switch (bitDepth)
+	{
+	case 10:
+		return YUV420_I420_10;
+	case 12:
+		return YUV420_I420_12;
+	case 16:
+		return YUV420_I420_16;
+	default:
+		return YUV420_I420;
+	}
+}
+
+// Parses YUV4MPEG2 stream header line from file
+// Supports 4:2:0 streams of 8, 10, 12 or 16 bits, and 8-bit 4:2:2 and 4:4:4 streams
+static bool ReadY4MHeader(FILE *file, Y4MHeader *pHeader)
+{
+	char line[Y4M_MAX_HEADER_LENGTH];
+	if (fgets(line, sizeof(line), file) == NULL || strncmp(line, Y4M_SIGNATURE, strlen(Y4M_SIGNATURE)) != 0)
+	{
+		fprintf(stderr, "ERROR UTILS::ReadY4MHeader(): Not a YUV4MPEG2 stream!\n");
+		return FALSE;
+	}
+	if (strchr(line, '\n') == NULL)
+	{
+		fprintf(stderr, "ERROR UTILS::ReadY4MHeader(): Stream header too long!\n");
+		return FALSE;
+	}
+
+	memset(pHeader, 0, sizeof(Y4MHeader));
+	pHeader->interlace = 'p';
+	pHeader->yuvRange = LIMITED_RANGE;
+	pHeader->colorSpace = YUV420;
+	pHeader->bitDepth = 8;
+	for (char *token = strtok(line + strlen(Y4M_SIGNATURE), " \n"); token; token = strtok(NULL, " \n"))
+	{
+		switch (token[0])
+		{
+		case 'W':
+			pHeader->width = atoi(token + 1);
+			break;
+		case 'H':
+			pHeader->height = atoi(token + 1);
+			break;
+		case 'F':
+			sscanf(token + 1, "%d:%d", &pHeader->frameRateNum, &pHeader->frameRateDen);
+			break;
+		case 'A':
+			sscanf(token + 1, "%d:%d", &pHeader->aspectNum, &pHeader->aspectDen);
+			break;
+		case 'I':
+			pHeader->interlace = token[1];
+			break;
+		case 'C':
+			// 420jpeg, 420mpeg2 and 420paldv differ only in chroma siting; 420p10 and on give the bit depth
+			if (strcmp(token + 1, "422") == 0)
+				pHeader->colorSpace = YUV422;
+			else if (strcmp(token + 1, "444") == 0)
+				pHeader->colorSpace = YUV444;
+			else if (strncmp(token + 1, "420", 3) == 0 && token[4] == 'p' && isdigit(token[5]))
+				pHeader->bitDepth = atoi(token + 5);
+			if ((pHeader->colorSpace == YUV420 && strncmp(token + 1, "420", 3) != 0) ||
+				(pHeader->bitDepth != 8 && pHeader->bitDepth != 10 && pHeader->bitDepth != 12 && pHeader->bitDepth != 16))
+			{
+				fprintf(stderr, "ERROR UTILS::ReadY4MHeader(): Unsupported chroma format %s!\n", token + 1);
+				return FALSE;
 			}
+			break;
+		case 'X':
+			if (strcmp(token, "XCOLORRANGE=FULL") == 0)
+				pHeader->yuvRange = FULL_RANGE;
+			break;
+		default:
+			break;
 		}
+	}
+
+	if (pHeader->width <= 0 || pHeader->height <= 0)
+	{
+		fprintf(stderr, "ERROR UTILS::ReadY4MHeader(): Missing frame dimensions!\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// Reads stream header of Y4M file. The header of stdin is read once and remembered,
+// since a pipe can't be rewound for the reader to parse it again
+static bool GetY4MHeader(const char *fileName, FILE *file, Y4MHeader *pHeader)
+{
+	static Y4MHeader stdinHeader;
+	static bool stdinHeaderRead = FALSE;
+
+	if (file == stdin)
+	{
+		if (!stdinHeaderRead)
+		{
+			if (!ReadY4MHeader(stdin, &stdinHeader))
+				return FALSE;
+			stdinHeaderRead = TRUE;
+		}
+		*pHeader = stdinHeader;
+		return TRUE;
+	}
+
+	if (!ReadY4MHeader(file, pHeader))
+	{
+		fprintf(stderr, "ERROR UTILS::GetY4MHeader(): Could not read header of file %s\n", fileName);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// Reads Y4M stream header to get dimensions and stream parameters
+bool DetectY4MHeader(const char *fileName, Y4MHeader *pHeader)
+{
+	if (IsStdioFileName(fileName))
+	{
+		PrepareStdin();
+		return GetY4MHeader(fileName, stdin, pHeader);
+	}
+
+	FILE *file = fopen(fileName, "rb");
+	if (file == NULL)
+	{
+		fprintf(stderr, "ERROR UTILS::DetectY4MHeader(): Could not open file %s\n", fileName);
+		return FALSE;
+	}
+	bool success = GetY4MHeader(fileName, file, pHeader);
+	fclose(file);
+	return success;
+}
+
+// Opens Y4M file, or stdin, for reading frame by frame through a buffered stream
+// Frame boundaries come from the in-band FRAME markers, so the stream is never probed for its size
+bool OpenY4MSequenceReader(const char *fileName, Y4MHeader *pHeader, YUVSequenceReader *pReader)
+{
+	memset(pReader, 0, sizeof(YUVSequenceReader));
+
+	if (!OpenReaderStream(fileName, pReader))
+		return FALSE;
+	if (!GetY4MHeader(fileName, pReader->file, pHeader) ||
+		!AllocReaderBuffers(pReader, pHeader->width, pHeader->height, GetY4MFileSubtype(pHeader->colorSpace, pHeader->bitDepth)))
+	{
+		CloseYUVSequenceReader(pReader);
+		return FALSE;
+	}
+	pReader->isY4M = TRUE;
+	pReader->firstFrameOffset = (pReader->file == stdin) ? 0 : FTELL64(pReader->file);
+
+	return TRUE;
+}
+
+// Reads FRAME marker and data of the next frame in Y4M stream into frameBuffer
+// Returns FALSE at end of stream, with numFrames then known
+static bool ReadY4MFrameData(YUVSequenceReader *pReader)
+{
+	char line[Y4M_MAX_HEADER_LENGTH];
+	if (fgets(line, sizeof(line), pReader->file) == NULL)
+	{
+		if (feof(pReader->file))
+			pReader->numFrames = pReader->nextFrame;
+		return FALSE;
+	}
+	if (strncmp(line, Y4M_FRAME_MARKER, strlen(Y4M_FRAME_MARKER)) != 0 || strchr(line, '\n') == NULL)
+	{
+		fprintf(stderr, "ERROR UTILS::ReadYUVSequenceFrame(): Missing FRAME marker before frame %d: file corrupted!\n",
+			pReader->nextFrame);
+		return FALSE;
+	}
+	if (fread(pReader->frameBuffer, pReader->map.frameSize, 1, pReader->file) != 1)
+	{
+		fprintf(stderr, "ERROR UTILS::ReadYUVSequenceFrame(): Could not read frame %d: file corrupted!\n",
+			pReader->nextFrame);
+		return FALSE;
+	}
+	pReader->nextFrame++;
+	return TRUE;
+}
+
+// Points rows of image view at given frame of Y4M stream
+// Earlier frames need a seekable file; later frames are reached by reading past those in between
+static bool ReadY4MSequenceFrame(YUVSequenceReader *pReader, int frame, IMAGE *pImage)
+{
+	// frameBuffer still holds frame nextFrame - 1
+	if (frame < pReader->nextFrame - 1)
+	{
+		if (pReader->file == stdin || FSEEK64(pReader->file, pReader->firstFrameOffset, SEEK_SET) != 0)
+		{
+			fprintf(stderr, "ERROR UTILS::ReadYUVSequenceFrame(): Could not seek to frame %d!\n", frame);
+			return FALSE;
+		}
+		pReader->nextFrame = 0;
+	}
+	while (pReader->nextFrame <= frame)
+	{
+		if (!ReadY4MFrameData(pReader))
+			return FALSE;
+	}
+
+	return ViewRawYUVFrame(pReader->frameBuffer, pReader->map.width, pReader->map.height,
+		pReader->map.fileSubtype, pReader->map.planeBuffer, pImage);
+}
+
+// Adds a segment to a write list, extending the previous segment when the two are adjacent in memory
+static void AddWriteSegment(WRITE_SEGMENT *segments, int *numSegments, const PIXEL *data, size_t size)
+{
+	if (*numSegments > 0)
+	{
+		WRITE_SEGMENT *last = &segments[*numSegments - 1];
+		if ((const PIXEL *)last->iov_base + last->iov_len == data)
+		{
+			last->iov_len += size;
+			return;
+		}
+	}
+	segments[*numSegments].iov_base = (void *)data;
+	segments[*numSegments].iov_len = size;
+	(*numSegments)++;
+}
+
+// Writes list of segments to file descriptor, in as few system calls as allowed
+static bool WriteSegments(int fd, WRITE_SEGMENT *segments, int numSegments)
+{
+#ifdef _WIN32
+	for (int i = 0; i < numSegments; i++)
+	{
+		const char *data = (const char *)segments[i].iov_base;
+		size_t remaining = segments[i].iov_len;
+		while (remaining > 0)
+		{
+			int written = _write(fd, data, (unsigned int)MIN(remaining, (size_t)INT_MAX));
+			if (written <= 0)
+				return FALSE;
+			data += written;
+			remaining -= written;
+		}
+	}
+#else
+	while (numSegments > 0)
+	{
+		ssize_t written = writev(fd, segments, MIN(numSegments, IOV_MAX));
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+
+		// Skip fully written segments and advance into a partially written one
+		while (numSegments > 0 && (size_t)written >= segments->iov_len)
+		{
+			written -= segments->iov_len;
+			segments++;
+			numSegments--;
+		}
+		if (numSegments > 0)
+		{
+			segments->iov_base = (char *)segments->iov_base + written;
+			segments->iov_len -= written;
+		}
+	}
+#endif
+	return TRUE;
+}
+
+// Opens raw YUV file for writing frames, truncating it or appending to it
+static bool OpenYUVWriter(const char *fileName, int width, int height, YUVType fileSubtype, bool append,
+	YUVSequenceWriter *pWriter)
+{
+	memset(pWriter, 0, sizeof(YUVSequenceWriter));
+
+	if (fileSubtype < YUV420_I420 || fileSubtype > YUV422_UYVY)
+	{
+		fprintf(stderr, "ERROR UTILS::OpenYUVSequenceWriter(): Invalid YUV format type!\n");
+		return FALSE;
+	}
+
+	int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+	pWriter->isStdout = IsStdioFileName(fileName);
+#ifdef _WIN32
+	if (pWriter->isStdout)
+	{
+		pWriter->fd = _fileno(stdout);
+		_setmode(pWriter->fd, _O_BINARY);
+	}
+	else
+		pWriter->fd = _open(fileName, flags | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	pWriter->fd = pWriter->isStdout ? STDOUT_FILENO : open(fileName, flags, 0666);
+#endif
+	if (pWriter->fd < 0)
+	{
+		fprintf(stderr, "ERROR UTILS::OpenYUVSequenceWriter(): Could not open file %s\n", fileName);
+		return FALSE;
+	}
+
+	int chromaWidth, chromaHeight;
+	GetPlaneDimensions(GetYUVColorSpace(fileSubtype), width, height, U_PLANE, &chromaWidth, &chromaHeight);
+	pWriter->width = width;
+	pWriter->height = height;
+	pWriter->fileSubtype = fileSubtype;
+	pWriter->frameSize = GetYUVFrameSize(width, height, fileSubtype);
+
+	// Segments for a frame marker and every row of every plane, merged where rows are contiguous
+	size_t packBufferSize = GetYUVPlaneBufferSize(width, height, fileSubtype);
+	pWriter->segments = (WRITE_SEGMENT *)malloc((1 + height + 2 * chromaHeight) * sizeof(WRITE_SEGMENT));
+	if (packBufferSize)
+		pWriter->packBuffer = (PIXEL *)malloc(packBufferSize);
+	if (pWriter->segments == NULL || (packBufferSize && pWriter->packBuffer == NULL))
+	{
+		fprintf(stderr, "ERROR UTILS::OpenYUVSequenceWriter(): Could not allocate write buffers!\n");
+		// Not open yet, so CloseYUVSequenceWriter() would leave the file descriptor open
+		if (!pWriter->isStdout)
+		{
+#ifdef _WIN32
+			_close(pWriter->fd);
+#else
+			close(pWriter->fd);
+#endif
+		}
+		CloseYUVSequenceWriter(pWriter);
+		return FALSE;
+	}
+
+	pWriter->isOpen = TRUE;
+	return TRUE;
+}
+
+// Opens raw YUV file for writing a sequence of frames through one file handle
+// If numFrames > 0, disk space for that many frames is reserved up front where the file system allows it
+bool OpenYUVSequenceWriter(const char *fileName, int width, int height, YUVType fileSubtype, int numFrames,
+	YUVSequenceWriter *pWriter)
+{
+	if (!OpenYUVWriter(fileName, width, height, fileSubtype, FALSE, pWriter))
+		return FALSE;
+
+#ifdef __linux__
+	// Reserve blocks without changing file size, so a short sequence leaves no trailing garbage
+	// Failure only means the file system does not support it
+	if (numFrames > 0)
+		fallocate(pWriter->fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)pWriter->frameSize * numFrames);
+#else
+	(void)numFrames;
+#endif
+
+	return TRUE;
+}
+
+// Opens Y4M file, or stdout, for writing a sequence of frames and writes its stream header
+// Frame rate, aspect ratio and interlacing are written if given in pHeader
+bool OpenY4MSequenceWriter(const char *fileName, const Y4MHeader *pHeader, int numFrames,
+	YUVSequenceWriter *pWriter)
+{
+	if (!OpenYUVSequenceWriter(fileName, pHeader->width, pHeader->height, GetY4MFileSubtype(pHeader->colorSpace, pHeader->bitDepth), 0,
+		pWriter))
+		return FALSE;
+	pWriter->isY4M = TRUE;
+
+	char header[Y4M_MAX_HEADER_LENGTH];
+	int length = sprintf(header, "%s W%d H%d", Y4M_SIGNATURE, pHeader->width, pHeader->height);
+	if (pHeader->frameRateNum > 0 && pHeader->frameRateDen > 0)
+		length += sprintf(header + length, " F%d:%d", pHeader->frameRateNum, pHeader->frameRateDen);
+	if (pHeader->interlace)
+		length += sprintf(header + length, " I%c", pHeader->interlace);
+	if (pHeader->aspectNum > 0 && pHeader->aspectDen > 0)
+		length += sprintf(header + length, " A%d:%d", pHeader->aspectNum, pHeader->aspectDen);
+	// 2x2 averaged chroma is sited between the luma samples, as in JPEG
+	// Higher bit depths have no siting variants; XYSCSS is the tag written alongside by other tools
+	if (pHeader->colorSpace == YUV422)
+		length += sprintf(header + length, " C422 XYSCSS=422");
+	else if (pHeader->colorSpace == YUV444)
+		length += sprintf(header + length, " C444 XYSCSS=444");
+	else if (pHeader->bitDepth > 8)
+		length += sprintf(header + length, " C420p%d XYSCSS=420P%d", pHeader->bitDepth, pHeader->bitDepth);
+	else
+		length += sprintf(header + length, " C420jpeg");
+	length += sprintf(header + length, " XCOLORRANGE=%s\n", (pHeader->yuvRange == FULL_RANGE) ? "FULL" : "LIMITED");
+
+	WRITE_SEGMENT segment;
+	segment.iov_base = header;
+	segment.iov_len = length;
+	if (!WriteSegments(pWriter->fd, &segment, 1))
+	{
+		fprintf(stderr, "ERROR UTILS::OpenY4MSequenceWriter(): Could not write header to file %s\n", fileName);
+		CloseYUVSequenceWriter(pWriter);
+		return FALSE;
+	}
+
+#ifdef __linux__
+	if (numFrames > 0)
+	{
+		fallocate(pWriter->fd, FALLOC_FL_KEEP_SIZE, 0,
+			length + (off_t)(pWriter->frameSize + strlen(Y4M_FRAME_MARKER) + 1) * numFrames);
+	}
+#else
+	(void)numFrames;
+#endif
+
+	return TRUE;
+}
+
+// Closes writer opened with OpenYUVSequenceWriter()
+void CloseYUVSequenceWriter(YUVSequenceWriter *pWriter)
+{
+	if (pWriter->isOpen && !pWriter->isStdout)
+	{
+#ifdef _WIN32
+		_close(pWriter->fd);
+#else
+		close(pWriter->fd);
+#endif
+	}
+	free(pWriter->segments);
+	free(pWriter->packBuffer);
+	if (pWriter->tempImage.pixArray)
+		DestroyImage(&pWriter->tempImage);
+	memset(pWriter, 0, sizeof(YUVSequenceWriter));
+}
+
+// Row y of plane of 8BPP or BPP16 image, as bytes
+static const PIXEL *GetPlaneRowBytes(const IMAGE *pImage, int plane, int y)
+{
+	return (pImage->precision == BPP16) ? (const PIXEL *)pImage->pix16Array[plane][y] : pImage->pixArray[plane][y];
+}
+
+// Appends image to sequence as one frame, written straight from the image's planes
+// Images not in the file's color space are converted first, using the image's yuvMatrix and yuvRange
+// Formats of more than 8 bits take YUV420 images of the same bit depth, which are written assuming
+// a little endian host; P010 samples are shifted up, and YUY2/UYVY pixels packed, into the packing buffer
+bool WriteYUVSequenceFrame(YUVSequenceWriter *pWriter, const IMAGE *pImage)
+{
+	const int bitDepth = GetYUVBitDepth(pWriter->fileSubtype);
+	const ColorSpaces colorSpace = GetYUVColorSpace(pWriter->fileSubtype);
+	if (!pWriter->isOpen || pImage->width != pWriter->width || pImage->height != pWriter->height ||
+		pImage->precision != ((bitDepth > 8) ? BPP16 : BPP8) || pImage->bitDepth != bitDepth ||
+		(bitDepth > 8 && pImage->colorSpace != colorSpace))
+	{
+		fprintf(stderr, "ERROR UTILS::WriteYUVSequenceFrame(): Image does not match sequence!\n");
+		return FALSE;
+	}
+
+	// Do color space conversion if necessary
+	// Conversion image is kept for the rest of the sequence
+	if (pImage->colorSpace != colorSpace)
+	{
+		if (pWriter->tempImage.pixArray == NULL)
+			pWriter->tempImage = CreateImage(colorSpace, pImage->width, pImage->height);
+		if (!IsImageAllocated(&pWriter->tempImage))
+			return FALSE;
+		pWriter->tempImage.yuvMatrix = pImage->yuvMatrix;
+		pWriter->tempImage.yuvRange = pImage->yuvRange;
+		if (!ConvertImage(pImage, &pWriter->tempImage))
+		{
+			fprintf(stderr, "UTILS::WriteYUVSequenceFrame(): Unable to convert image color space!\n");
+			return FALSE;
+		}
+		pImage = &pWriter->tempImage;
+	}
+
+	// Setup order of U, V planes within specified file format
+	int plane1, plane2;
+	switch (pWriter->fileSubtype)
+	{
+	case YUV420_I420:
+	case YUV420_NV12:
+	case YUV420_I420_10:
+	case YUV420_I420_12:
+	case YUV420_I420_16:
+	case YUV420_P010:
+	case YUV422_I422:
+	case YUV444_I444:
+	case YUV422_YUY2:
+	case YUV422_UYVY:
+		plane1 = U_PLANE;
+		plane2 = V_PLANE;
+		break;
+	case YUV420_YV12:
+	case YUV420_NV21:
+		plane1 = V_PLANE;
+		plane2 = U_PLANE;
 		break;
 	default:
-		fprintf(stderr, "ERROR UTILS::SaveRawYUVImage(): Invalid YUV format type!\n");
-		fclose(file);
-		free(dataBuffer);
-		// Return instead of exit so we can try to read next frame
+		fprintf(stderr, "ERROR UTILS::WriteYUVSequenceFrame(): Invalid YUV format type!\n");
 		return FALSE;
 	}
 
-	// Write pixel data to file
-	fwrite(dataBuffer, bufSize, 1, file);
+	int chromaWidth, chromaHeight;
+	GetPlaneDimensions(colorSpace, pImage->width, pImage->height, U_PLANE, &chromaWidth, &chromaHeight);
+	const size_t sampleSize = (bitDepth > 8) ? sizeof(PIXEL16) : sizeof(PIXEL);
 
-	free(dataBuffer);
+	int numSegments = 0;
+	if (pWriter->isY4M)
+		AddWriteSegment(pWriter->segments, &numSegments, (const PIXEL *)Y4M_FRAME_MARKER "\n", strlen(Y4M_FRAME_MARKER) + 1);
+
+	switch (pWriter->fileSubtype)
+	{
+	case YUV420_I420:
+	case YUV420_YV12:
+	case YUV420_I420_10:
+	case YUV420_I420_12:
+	case YUV420_I420_16:
+	case YUV422_I422:
+	case YUV444_I444:
+		for (int y = 0; y < pImage->height; y++)
+		{
+			AddWriteSegment(pWriter->segments, &numSegments, GetPlaneRowBytes(pImage, Y_PLANE, y),
+				pImage->width * sampleSize);
+		}
+		for (int y = 0; y < chromaHeight; y++)
+		{
+			AddWriteSegment(pWriter->segments, &numSegments, GetPlaneRowBytes(pImage, plane1, y),
+				chromaWidth * sampleSize);
+		}
+		for (int y = 0; y < chromaHeight; y++)
+		{
+			AddWriteSegment(pWriter->segments, &numSegments, GetPlaneRowBytes(pImage, plane2, y),
+				chromaWidth * sampleSize);
+		}
+		break;
+	case YUV420_NV12:
+	case YUV420_NV21:
+		for (int y = 0; y < pImage->height; y++)
+			AddWriteSegment(pWriter->segments, &numSegments, pImage->pixArray[Y_PLANE][y], pImage->width);
+		for (int y = 0; y < chromaHeight; y++)
+		{
+			InterleaveRow(pImage->pixArray[plane1][y], pImage->pixArray[plane2][y],
+				pWriter->packBuffer + (size_t)y * 2 * chromaWidth, chromaWidth);
+		}
+		AddWriteSegment(pWriter->segments, &numSegments, pWriter->packBuffer, 2 * (size_t)chromaWidth * chromaHeight);
+		break;
+	case YUV420_P010:
+	{
+		PIXEL16 *luma = (PIXEL16 *)pWriter->packBuffer;
+		PIXEL16 *chroma = luma + (size_t)pImage->width * pImage->height;
+		for (int y = 0; y < pImage->height; y++)
+			ShiftRow16(pImage->pix16Array[Y_PLANE][y], luma + (size_t)y * pImage->width, pImage->width, -P010_SHIFT);
+		for (int y = 0; y < chromaHeight; y++)
+		{
+			InterleaveRow16(pImage->pix16Array[plane1][y], pImage->pix16Array[plane2][y],
+				chroma + (size_t)y * 2 * chromaWidth, chromaWidth, P010_SHIFT);
+		}
+		AddWriteSegment(pWriter->segments, &numSegments, pWriter->packBuffer, pWriter->frameSize);
+		break;
+	}
+	case YUV422_YUY2:
+	case YUV422_UYVY:
+		for (int y = 0; y < pImage->height; y++)
+		{
+			PackYUV422Row(pImage->pixArray[Y_PLANE][y], pImage->pixArray[plane1][y], pImage->pixArray[plane2][y],
+				pWriter->packBuffer + (size_t)y * 4 * chromaWidth, pImage->width, pWriter->fileSubtype == YUV422_UYVY);
+		}
+		AddWriteSegment(pWriter->segments, &numSegments, pWriter->packBuffer, pWriter->frameSize);
+		break;
+	default:
+		break;
+	}
+
+	if (!WriteSegments(pWriter->fd, pWriter->segments, numSegments))
+	{
+		fprintf(stderr, "ERROR UTILS::WriteYUVSequenceFrame(): Could not write frame %d!\n", pWriter->numFrames);
+		return FALSE;
+	}
+	pWriter->numFrames++;
 
-	fclose(file);
 	return TRUE;
 }
+
+// Writes image in raw YUV file format
+// Appends to the file, so that repeated calls build up a multi-frame file
+bool SaveRawYUVImage(const char *fileName, IMAGE *pImage, YUVType fileSubtype)
+{
+	YUVSequenceWriter writer;
+	if (!OpenYUVWriter(fileName, pImage->width, pImage->height, fileSubtype, TRUE, &writer))
+		return FALSE;
+
+	bool success = WriteYUVSequenceFrame(&writer, pImage);
+	CloseYUVSequenceWriter(&writer);
+	return success;
+}
@@ -15,12 +15,23 @@
 #define MIN(a,b) ((a)< (b) ? (a) : (b))
 #define MAX(a,b) ((a)>=(b) ? (a) : (b))
 
+// SSE2 kernels are used where the target guarantees SSE2: always on x64, /arch:SSE2 or later on Win32
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
 #ifdef _WIN32
 #define PATH_SEPARATOR '\\'
 #define FCLOSEALL()             _fcloseall()
+#define FSEEK64(f, o, w)        _fseeki64(f, o, w)
+#define FTELL64(f)              _ftelli64(f)
 #else	// Unix, linux, MACOS
+#include <sys/uio.h>
 #define PATH_SEPARATOR '/'
 #define FCLOSEALL()              fcloseall()  
+#define FSEEK64(f, o, w)         fseeko(f, (off_t)(o), w)
+#define FTELL64(f)               ((long long)ftello(f))
 #endif
 
 
@@ -28,20 +39,31 @@
 * DEFINES
 *****************************************************************************/
 typedef unsigned char PIXEL;
+typedef unsigned short PIXEL16;
 
 #define MAX_STRING_LENGTH		256
 
+#define STDIO_FILENAME			"-"		// File name standing for stdin (input) or stdout (output)
+
 #define TRUE					1
 #define FALSE					0
 
 #define FWD_GAMMA_LUTSIZE			256		// =2^8. Only 8 bpp input file supported
 #define BWD_GAMMA_LUTSIZE			4096	// =2^12. bpp after input gamma correction is removed. 12=BPPIN + 4
 // to account for greater resolution needed
+#define BWD_GAMMA16_LUTSIZE			65536	// =2^16. Indexed directly by 16-bit linear light pixels
 
 
 // Max value of 8-bit pixel value
 const int PIXMAX = 255;
 
+// Max value of 16-bit linear light pixel value
+const int PIX16MAX = 65535;
+
+// Nominal white of display pixels of given bit depth, 8 to 16
+// Codes of higher bit depths are 8-bit codes shifted up, e.g. 10-bit 940 is 8-bit 235
+#define DISPLAY_WHITE(bitDepth)		(PIXMAX << ((bitDepth) - 8))
+
 // Max value of pixel in floating piont
 const double DBLPIXMAX = 1.0;
 
@@ -50,21 +72,38 @@ enum FileType
 {
 	YUV_FILE,	// YUV files (.yuv).
 	BMP_FILE,	// Bitmap files (.bmp).
+	Y4M_FILE,	// YUV4MPEG2 files (.y4m).
+	QOI_FILE,	// Quite OK Image files (.qoi).
 	UNSUPPORTED_FILE
 };
 
-// Supported YUV420 file formats
-// TODO: Add YUV422 support
+// Supported YUV file formats
 enum YUVType
 {
 	NO_SUBTYPE,
 	YUV420_I420,	// I420 Y*8*n bits, U*2*n bits, V*2*n bits for n-pixel frame
 	YUV420_YV12,	// I420 Y*8*n bits, V*2*n bits, U*2*n bits for n-pixel frame
 	YUV420_NV12,	// I420 Y*8*n bits, (UV)*2*n bits for n-pixel frame
-	YUV420_NV21		// I420 Y*8*n bits, (VU)*2*n bits for n-pixel frame
+	YUV420_NV21,	// I420 Y*8*n bits, (VU)*2*n bits for n-pixel frame
+	YUV420_I420_10,	// I420 with 10-bit samples in 16-bit little endian words (yuv420p10le)
+	YUV420_I420_12,	// I420 with 12-bit samples in 16-bit little endian words (yuv420p12le)
+	YUV420_I420_16,	// I420 with 16-bit little endian samples (yuv420p16le)
+	YUV420_P010,	// NV12 with 10-bit samples in the high bits of 16-bit little endian words
+	YUV422_I422,	// Planar Y, U, V with U and V half width (yuv422p)
+	YUV444_I444,	// Planar Y, U, V at full resolution (yuv444p)
+	YUV422_YUY2,	// Packed (Y0 U Y1 V) for each pair of pixels (yuyv422)
+	YUV422_UYVY		// Packed (U Y0 V Y1) for each pair of pixels (uyvy422)
 };
 
 #define BPP_YUV420				12 // Bits per pixel for YUV420
+#define P010_SHIFT				6	// P010 samples are held in the top 10 bits of each word
+
+#define Y4M_SIGNATURE			"YUV4MPEG2"	// Start of Y4M stream header
+#define Y4M_FRAME_MARKER		"FRAME"		// Start of each Y4M frame header
+#define Y4M_MAX_HEADER_LENGTH	1024
+
+#define QOI_MAGIC				"qoif"		// Start of QOI file header
+#define QOI_HEADER_SIZE			14
 
 // Color spaces. Included for future expandability.
 enum ColorSpaces
@@ -75,6 +114,21 @@ enum ColorSpaces
 	YUV420		// YUV 4:2:0.
 };
 
+// YUV<->RGB conversion matrices
+enum YUVMatrix
+{
+	BT601,		// ITU-R BT.601, SD video.
+	BT709,		// ITU-R BT.709, HD video.
+	BT2020		// ITU-R BT.2020 non-constant luminance, UHD video.
+};
+
+// YUV sample ranges
+enum YUVRange
+{
+	LIMITED_RANGE,	// Y in YUV_YMIN..YUV_YMAX, UV in YUV_UVMIN..YUV_UVMAX (video levels).
+	FULL_RANGE		// Y, UV in 0..PIXMAX (JPEG levels).
+};
+
 // Color planes
 enum RGBPlanes
 {
@@ -97,24 +151,102 @@ enum EdgeMethod
 	NOCONTRIB		// Shorten filter kernal to zero out weights out of image
 };
 
-// Pixel Precision, 8bpp or double
+// Pixel Precision, 8bpp, 16bpp or double
 enum PixelPrecision
 {
 	BPP8,			// The usual default pixel type for gamma-corrected display pixels
-	DOUBLE			// Used for de-gamma'ed pixels
+	DOUBLE,			// Used for de-gamma'ed pixels
+	BPP16			// Compact alternative to DOUBLE for de-gamma'ed pixels, 0..PIX16MAX,
+					// or gamma-corrected display pixels of more than 8 bits, 0..(1 << bitDepth) - 1
 };
 
 // Structure used to hold a still image.
 typedef struct
 {
+	bool isView;				// pixArray rows point into storage owned elsewhere, see CreateImageView()
 	ColorSpaces colorSpace;		// The color space, per enum ColorSpaces
+	YUVMatrix yuvMatrix;		// Matrix used to convert the image to/from YUV
+	YUVRange yuvRange;			// Sample range of the image when it is YUV
 	int height;					// Height of the image in lines
 	int width;					// Width of the image in pixels
-	PixelPrecision precision;	// Pixel Precision, 8bpp or double
+	PixelPrecision precision;	// Pixel Precision, 8bpp, 16bpp or double
+	int bitDepth;				// Significant bits of BPP8 or BPP16 pixels, 8 to 16
 	PIXEL ***pixArray;			// 3 plane pixel buffer, allocated if precision==BPP8
 	double ***dblPixArray;		// 3 plane double precision pixel buffer, allocated only if precision==DOUBLE
+	PIXEL16 ***pix16Array;		// 3 plane 16-bit pixel buffer, allocated only if precision==BPP16
 } IMAGE;
 
+// Raw YUV file mapped into memory, see OpenYUVFileMap()
+typedef struct
+{
+	PIXEL *data;				// Start of mapped file
+	size_t size;				// Size of mapped file in bytes
+	size_t frameSize;			// Size of one frame in bytes
+	int width;
+	int height;
+	int numFrames;				// Number of whole frames in file
+	YUVType fileSubtype;		// YUV FOURCC type
+	PIXEL *planeBuffer;			// Planes of current frame unpacked from the file: U, V of NV12/NV21;
+								// Y, U, V of P010, YUY2 and UYVY
+	void *mappingHandle;		// File mapping object, Windows only
+} YUVFileMap;
+
+// Y4M stream parameters, from the stream header
+typedef struct
+{
+	int width;
+	int height;
+	int frameRateNum;			// Frame rate numerator, 0 if not given
+	int frameRateDen;			// Frame rate denominator, 0 if not given
+	int aspectNum;				// Pixel aspect ratio numerator, 0 if unknown
+	int aspectDen;				// Pixel aspect ratio denominator, 0 if unknown
+	char interlace;				// 'p' progressive, 't'/'b' top/bottom field first, 'm' mixed
+	YUVRange yuvRange;			// From XCOLORRANGE, limited if not given
+	int bitDepth;				// 8, or 10, 12 or 16 from C420p10, C420p12 or C420p16
+	ColorSpaces colorSpace;		// YUV420, or YUV422 or YUV444 from C422 or C444
+} Y4MHeader;
+
+// Raw YUV or Y4M file opened for reading frame by frame, see OpenYUVSequenceReader()
+typedef struct
+{
+	YUVFileMap map;				// Mapped file, or dimensions and format only if file is NULL
+	FILE *file;					// Buffered stream used when file cannot be mapped, else NULL
+	PIXEL *frameBuffer;			// Current frame read from stream
+	int nextFrame;				// Frame the stream is positioned at
+	int numFrames;				// Number of frames in file, -1 if not yet known
+	bool isY4M;					// Frames are preceded by FRAME markers
+	long long firstFrameOffset;	// File position of first FRAME marker, Y4M only
+} YUVSequenceReader;
+
+// Segment of a vectored write
+#ifdef _WIN32
+typedef struct
+{
+	void *iov_base;
+	size_t iov_len;
+} WRITE_SEGMENT;
+#else
+typedef struct iovec WRITE_SEGMENT;
+#endif
+
+// Raw YUV or Y4M file opened for writing a sequence of frames, see OpenYUVSequenceWriter()
+typedef struct
+{
+	bool isOpen;
+	bool isStdout;				// Writing to stdout, which is left open on close
+	bool isY4M;					// Frames are preceded by FRAME markers
+	int fd;						// File descriptor, kept open for the whole sequence
+	int width;
+	int height;
+	YUVType fileSubtype;		// YUV FOURCC type
+	size_t frameSize;			// Size of one frame in bytes
+	int numFrames;				// Number of frames written so far
+	WRITE_SEGMENT *segments;	// Plane rows gathered for one vectored write per frame
+	PIXEL *packBuffer;			// Planes of current frame packed for the file: UV of NV12/NV21;
+								// Y, UV of P010; YUV of YUY2 and UYVY
+	IMAGE tempImage;			// Conversion to the file's color space of frames supplied in others
+} YUVSequenceWriter;
+
 typedef struct
 {
 	FileType fileType;				// BMP or YUV
@@ -124,8 +256,14 @@ typedef struct
 	int numFrames;
 	int numSubFrames;
 	int startFrame;
+	int bitDepth;					// Bits per sample of frames, 8 for BMP and QOI
+	ColorSpaces colorSpace;			// Color space of frames as stored, RGB for BMP and QOI
+	int frameDigits;				// Digits in sequence numbers of file names, zero-padded to this width
+	bool singleFile;				// Read file alone even if its name is numbered, not as start of a sequence
+	int *frameNumbers;				// Sorted sequence numbers of files found, NULL for a single file
 	const char *filename;
 	char baseFileName[MAX_STRING_LENGTH];
+	Y4MHeader y4mHeader;			// Stream parameters, Y4M files only
 } ImageFileInfo;
 
 /******************************************************************************
@@ -160,26 +298,49 @@ void Free3DArray(void *** array3D);
 // ---------------------------
 
 // Allocates storage for and initializes image structure and returns pointer to new image
+// Check the result with IsImageAllocated(): these do not exit on allocation failure
 IMAGE CreateImage(ColorSpaces colorSpace, int width, int height);
 IMAGE CreateImage(ColorSpaces colorSpace, int width, int height, PixelPrecision precision);
 
-// Deallocates image previously created with CreateImage();
+// Allocates row pointers only for 8BPP image whose rows are pointed at external storage by the caller
+IMAGE CreateImageView(ColorSpaces colorSpace, int width, int height);
+IMAGE CreateImageView(ColorSpaces colorSpace, int width, int height, PixelPrecision precision);
+
+// FALSE if image has no pixel storage, or row pointers for a view: its creation failed or it was destroyed
+bool IsImageAllocated(const IMAGE *pImage);
+
+// Deallocates image previously created with CreateImage() or CreateImageView();
 void DestroyImage(IMAGE *pImage);
 
 // Copies entire image from first image to second
 bool CopyImage(const IMAGE *pImageIn, IMAGE * pImageOut);
 
 // Converts pixels of first image into color space of second image
+// Uses the yuvMatrix and yuvRange of whichever image is YUV
 bool ConvertImage(const IMAGE *pImageIn, IMAGE *pImageOut);
 
 // Takes gamma-corrected pImageIn, applies supplied fwdGamma table to convert to linear light pImageOut
 // Y'UV in YUV out, or R'G'B' in RGB out
+// fwdGamma holds 1 << pImageIn->bitDepth entries, one per display code
 bool DegammaImage(const IMAGE *pImageIn, IMAGE *pImageOut, double fwdGamma[]);
 
+// As above, but to a 16-bit linear light pImageOut (precision==BPP16)
+// fwdGamma entries are scaled to 0..PIX16MAX
+bool DegammaImage(const IMAGE *pImageIn, IMAGE *pImageOut, PIXEL16 fwdGamma[]);
+
 // Takes gamma-corrected pImageIn, applies supplied fwdGamma table to convert to linear light pImageOut
 // YUV in Y'UV out, or RGB in R'G'B' out
+// bwdGamma holds GetBwdGammaLutSize() entries: BWD_GAMMA_LUTSIZE for a DOUBLE pImageIn and 8-bit pImageOut,
+// or BWD_GAMMA16_LUTSIZE for a BPP16 pImageIn, which index it directly
 bool GammaImage(const IMAGE *pImageIn, IMAGE *pImageOut, PIXEL bwdGamma[]);
 
+// As above, but to a pImageOut of more than 8 bits (precision==BPP16)
+bool GammaImage(const IMAGE *pImageIn, IMAGE *pImageOut, PIXEL16 bwdGamma[]);
+
+// Number of entries in bwdGamma table of GammaImage(), for linear light pixels of given precision
+// and display pixels of given bit depth
+int GetBwdGammaLutSize(PixelPrecision linearPrecision, int displayBitDepth);
+
 // Gets YUV or RGB pixel from image
 // x, y co-ordinates are internally divided down for YUV422/YUV420 UV planes
 bool GetPixel(const IMAGE *pImage, int y, int x, const EdgeMethod edgeMethod, PIXEL pixel[]);
@@ -210,10 +371,16 @@ int HandleEdgeCase(int i, int imageDimMax, EdgeMethod edgeMethod);
 // Divide down x,y addresses for plane[1] and plane [2]
 void HandleColorspaceAddress(int *x, int *y, ColorSpaces colorSpace);
 
+// Get dimensions of given plane for image of given color space and dimensions
+void GetPlaneDimensions(ColorSpaces colorSpace, int width, int height, int plane, int *planeWidth, int *planeHeight);
+
 // ---------------------------
 // General image file I/O
 // ---------------------------
 
+// Detects if file name is STDIO_FILENAME, standing for stdin/stdout
+bool IsStdioFileName(const char *fileName);
+
 // Detects if file exists
 bool FileExists(const char *fileName);
 
@@ -221,8 +388,23 @@ bool FileExists(const char *fileName);
 bool DetectFileType(const char *fileName, FileType* fileType);
 
 // Determine how many frames in YUV file or BMP sequence
+// Sequences are found with one scan of the file's directory; numbering may have gaps
 bool DetectNumberOfFrames(ImageFileInfo *imageFileInfo);
 
+// Builds name of file i of sequence found by DetectNumberOfFrames()
+// Returns FALSE if the name does not fit MAX_STRING_LENGTH
+bool GetSequenceFileName(const ImageFileInfo *imageFileInfo, int i, char *fileName);
+
+// Deallocates sequence numbers found by DetectNumberOfFrames()
+void FreeImageFileInfo(ImageFileInfo *imageFileInfo);
+
+// Finds regular files matching pattern: all files of a directory, or names with * and ? wildcards in the last
+// path component. Returns number found, in name order in *pFileNames, or -1 if the directory cannot be read
+int ListMatchingFiles(const char *pattern, char ***pFileNames);
+
+// Deallocates file names found by ListMatchingFiles()
+void FreeFileList(char **fileNames, int numFiles);
+
 // ---------------------------------------
 // Image format-specific file i/o routines
 // ---------------------------------------
@@ -236,12 +418,78 @@ bool LoadBmpImage(const char *fileName, IMAGE *pImage);
 // Writes image in Bitmap file format
 bool SaveBmpImage(const char *fileName, IMAGE *pImage);
 
-// Reads image in raw YUV420 file format
-// TODO: Add YUV422 support
+// Detect QOI image size
+bool DetectQoiImageSize(const char *fileName, int *width, int *height);
+
+// Reads image in QOI file format
+bool LoadQoiImage(const char *fileName, IMAGE *pImage);
+
+// Writes image in QOI file format, 3 channels
+bool SaveQoiImage(const char *fileName, IMAGE *pImage);
+
+// Bits per sample of raw YUV file format
+int GetYUVBitDepth(YUVType fileSubtype);
+
+// Color space of frames of raw YUV file format: YUV420, YUV422 or YUV444
+ColorSpaces GetYUVColorSpace(YUVType fileSubtype);
+
+// Size in bytes of one frame of raw YUV file format
+size_t GetYUVFrameSize(int width, int height, YUVType fileSubtype);
+
+// Reads frame subFrame of raw YUV file into pImage, converting it to pImage's color space
 bool LoadRawYUVImage(const char *fileName, IMAGE *pImage, int subFrame, YUVType fileSubtype);
 
-// Writes image in raw YUV420 file format
-// TODO: Add YUV422 support
+// Maps raw YUV file into memory for zero-copy reading
+bool OpenYUVFileMap(const char *fileName, int width, int height, YUVType fileSubtype, YUVFileMap *pMap);
+
+// Unmaps file mapped with OpenYUVFileMap()
+void CloseYUVFileMap(YUVFileMap *pMap);
+
+// Points rows of pImage, created with CreateImageView(GetYUVColorSpace(fileSubtype),...), at subFrame of the mapped file
+// pImage is BPP16 with bitDepth of the file format for formats of more than 8 bits
+// Valid until the next call or until the file is unmapped
+bool MapRawYUVImage(YUVFileMap *pMap, int subFrame, IMAGE *pImage);
+
+// Points rows of pImage, a view as for MapRawYUVImage(), at raw YUV frame held in memory
+// Planar formats are viewed in place, so that writes to pImage go to frame; planeBuffer may be NULL for those only
+bool ViewRawYUVFrame(PIXEL *frame, int width, int height, YUVType fileSubtype, PIXEL *planeBuffer, IMAGE *pImage);
+
+// Opens raw YUV file once for reading a sequence of frames, in order or at random
+bool OpenYUVSequenceReader(const char *fileName, int width, int height, YUVType fileSubtype,
+	YUVSequenceReader *pReader);
+
+// Closes reader opened with OpenYUVSequenceReader()
+void CloseYUVSequenceReader(YUVSequenceReader *pReader);
+
+// Points rows of pImage, created with CreateImageView(GetYUVColorSpace(fileSubtype),...), at given frame
+// Valid until the next call or until the reader is closed
+bool ReadYUVSequenceFrame(YUVSequenceReader *pReader, int frame, IMAGE *pImage);
+
+// Opens raw YUV file once for writing a sequence of frames
+// numFrames, if known, is used to reserve disk space; pass 0 otherwise
+bool OpenYUVSequenceWriter(const char *fileName, int width, int height, YUVType fileSubtype, int numFrames,
+	YUVSequenceWriter *pWriter);
+
+// Closes writer opened with OpenYUVSequenceWriter()
+void CloseYUVSequenceWriter(YUVSequenceWriter *pWriter);
+
+// Appends pImage to the sequence as the next frame
+bool WriteYUVSequenceFrame(YUVSequenceWriter *pWriter, const IMAGE *pImage);
+
+// Reads stream header of Y4M file, or of stdin, to get its dimensions and stream parameters
+bool DetectY4MHeader(const char *fileName, Y4MHeader *pHeader);
+
+// Opens YUV4MPEG2 file once for reading a sequence of 4:2:0 frames, of 8, 10, 12 or 16 bits,
+// or of 8-bit 4:2:2 or 4:4:4 frames
+// Frames are read with ReadYUVSequenceFrame() and the reader closed with CloseYUVSequenceReader()
+bool OpenY4MSequenceReader(const char *fileName, Y4MHeader *pHeader, YUVSequenceReader *pReader);
+
+// Opens YUV4MPEG2 file once for writing a sequence of frames with given stream parameters
+// Frames are written with WriteYUVSequenceFrame() and the writer closed with CloseYUVSequenceWriter()
+bool OpenY4MSequenceWriter(const char *fileName, const Y4MHeader *pHeader, int numFrames,
+	YUVSequenceWriter *pWriter);
+
+// Appends image to file in raw YUV file format
 bool SaveRawYUVImage(const char *fileName, IMAGE *pImage, YUVType fileSubtype);
 
 